@@ -14,6 +14,14 @@ using uint = unsigned int;
 
 #define TEXEL_SAMPLES 8
 
+// Storage of the cluster projection and receiver reconstruction matrices. The elements are
+// packed into 32 bit words from the low bits up and multiplied by a scale per projection
+// matrix row and per reconstruction matrix, the scales of the float formats are 1.
+#define MATRIX_FORMAT_FP32 0
+#define MATRIX_FORMAT_FP16 1
+#define MATRIX_FORMAT_SNORM16 2
+#define MATRIX_FORMAT_SNORM8 3
+
 struct GPUShadowMapData 
 {
 	mat4 depthMVP;
@@ -116,6 +124,13 @@ struct GPUReceiverRaycastResult {
 	float visibility;
 };
 
+// Nonzero weight of a probe of the cluster for one receiver. The weights of a receiver are
+// sorted by clusterProbe, an index into the probes of its cluster.
+struct GPUReceiverProbeWeight {
+	int clusterProbe;
+	float weight;
+};
+
 struct GIConfig {
 	vec2 lightmapInputSize;
 	int probeCount;
@@ -124,6 +139,10 @@ struct GIConfig {
 	int clusterCount;
 	int pcaCoefficient;
 	int maxReceiversInCluster;
+	int matrixFormat;
+	int pad0_;
+	int pad1_;
+	int pad2_;
 };
 
 struct ClusterReceiverInfo {
@@ -156,6 +175,34 @@ struct ReflectionPayload {
 
 #ifndef __cplusplus
 
+uint matrix_word_index(uint element, int format)
+{
+	if (format == MATRIX_FORMAT_FP32)
+	{
+		return element;
+	}
+	return format == MATRIX_FORMAT_SNORM8 ? element / 4 : element / 2;
+}
+
+// Value of a packed matrix element before its scale is applied
+float unpack_matrix_element(uint word, uint element, int format)
+{
+	if (format == MATRIX_FORMAT_FP32)
+	{
+		return uintBitsToFloat(word);
+	}
+	else if (format == MATRIX_FORMAT_FP16)
+	{
+		vec2 halves = unpackHalf2x16(word);
+		return (element & 1) == 0 ? halves.x : halves.y;
+	}
+	else if (format == MATRIX_FORMAT_SNORM16)
+	{
+		return float(bitfieldExtract(int(word), int(element & 1) * 16, 16));
+	}
+	return float(bitfieldExtract(int(word), int(element & 3) * 8, 8));
+}
+
 const float PHI = 1.61803398874989484820459;
 
 float goldNoise(in vec2 xy, in float seed)
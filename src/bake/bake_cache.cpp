@@ -0,0 +1,73 @@
+#include "bake_cache.h"
+#include "bake_container.h"
+
+#include <filesystem>
+#include <inttypes.h>
+#include <stdio.h>
+
+template <typename T> static uint64_t hash_value(uint64_t hash, const T& value)
+{
+    return bake_checksum(&value, sizeof(T), hash);
+}
+
+template <typename T> static uint64_t hash_vector(uint64_t hash, const std::vector<T>& values)
+{
+    hash = hash_value(hash, (uint64_t)values.size());
+    return bake_checksum(values.data(), values.size() * sizeof(T), hash);
+}
+
+uint64_t bake_scene_key(const GltfScene& scene)
+{
+    uint64_t hash = hash_vector(BAKE_CHECKSUM_SEED, scene.positions);
+    hash = hash_vector(hash, scene.normals);
+    hash = hash_vector(hash, scene.indices);
+    hash = hash_vector(hash, scene.texcoords0);
+    hash = hash_vector(hash, scene.lightmapUVs);
+    hash = hash_value(hash, scene.lightmap_width);
+    hash = hash_value(hash, scene.lightmap_height);
+    for (const GltfNode& node : scene.nodes)
+    {
+        hash = hash_value(hash, node.world_matrix);
+        hash = hash_value(hash, node.prim_mesh);
+    }
+    for (const GltfPrimMesh& mesh : scene.prim_meshes)
+    {
+        hash = hash_value(hash, mesh.first_idx);
+        hash = hash_value(hash, mesh.idx_count);
+        hash = hash_value(hash, mesh.vtx_offset);
+        hash = hash_value(hash, mesh.vtx_count);
+    }
+    return hash;
+}
+
+uint64_t bake_content_key(const GltfScene& scene, const PrecalculationInfo& precalculationInfo)
+{
+    uint64_t hash = hash_value(BAKE_CHECKSUM_SEED, (uint32_t)BAKE_ALGORITHM_VERSION);
+    hash = hash_value(hash, bake_scene_key(scene));
+
+    // Field by field, so that padding never ends up in the key
+    hash = hash_value(hash, precalculationInfo.voxelSize);
+    hash = hash_value(hash, precalculationInfo.voxelPadding);
+    hash = hash_value(hash, precalculationInfo.probeOverlaps);
+    hash = hash_value(hash, precalculationInfo.raysPerProbe);
+    hash = hash_value(hash, precalculationInfo.raysPerReceiver);
+    hash = hash_value(hash, precalculationInfo.sphericalHarmonicsOrder);
+    hash = hash_value(hash, precalculationInfo.clusterCoefficientCount);
+    hash = hash_value(hash, precalculationInfo.maxReceiversInCluster);
+    hash = hash_value(hash, precalculationInfo.lightmapResolution);
+    hash = hash_value(hash, precalculationInfo.texelSize);
+    hash = hash_value(hash, precalculationInfo.desiredSpacing);
+    hash = hash_value(hash, precalculationInfo.matrixFormat);
+
+    return hash != 0 ? hash : 1;
+}
+
+std::string bake_cache_path(const std::string& directory, uint64_t key)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".bake", key);
+    return (std::filesystem::path(directory) / name).string();
+}
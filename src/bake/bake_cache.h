@@ -0,0 +1,21 @@
+#pragma once
+
+#include <gltf_scene.hpp>
+#include <precalculation_types.h>
+#include <stdint.h>
+#include <string>
+
+// Bump when a change to the bake makes the results of older builds wrong, their cache entries
+// stop matching then
+#define BAKE_ALGORITHM_VERSION 1
+
+// Hash of the geometry, texture and lightmap UVs of the scene
+uint64_t bake_scene_key(const GltfScene& scene);
+
+// Hash of everything a bake depends on: the geometry, texture and lightmap UVs of the scene,
+// every PrecalculationInfo setting and BAKE_ALGORITHM_VERSION. Materials and lights are only
+// used when relighting, so they are not part of it. Never 0.
+uint64_t bake_content_key(const GltfScene& scene, const PrecalculationInfo& precalculationInfo);
+
+// directory/<key as 16 hex digits>.bake, the directory is created if needed
+std::string bake_cache_path(const std::string& directory, uint64_t key);
@@ -0,0 +1,273 @@
+#include "bake_checkpoint.h"
+
+#include <chrono>
+#include <filesystem>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+// Cluster of a checkpoint without its receiver and probe lists
+struct CheckpointCluster
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    int receiverCount;
+    int probeCount;
+    int svdCoeffCount;
+    int projectionMatrixOffset;
+    int reconstructionMatrixOffset;
+    int pad0_;
+};
+
+const char* bake_stage_name(BakeStage stage)
+{
+    switch (stage)
+    {
+    case BAKE_STAGE_RECEIVERS:
+        return "receivers";
+    case BAKE_STAGE_PROBES:
+        return "probes";
+    case BAKE_STAGE_PROBE_RAYCAST:
+        return "probe_raycast";
+    case BAKE_STAGE_CLUSTERS:
+        return "clusters";
+    case BAKE_STAGE_RECEIVER_TRANSFER:
+        return "receiver_transfer";
+    case BAKE_STAGE_PCA:
+        return "pca";
+    }
+    return "unknown";
+}
+
+void BakeCheckpoints::init(const std::string& directory, uint64_t sceneKey)
+{
+    _directory = directory;
+    _sceneKey = sceneKey;
+    if (!_directory.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(_directory, error);
+    }
+}
+
+std::string BakeCheckpoints::prefix(BakeStage stage) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s-%016" PRIx64 "-", bake_stage_name(stage), _sceneKey);
+    return name;
+}
+
+std::string BakeCheckpoints::path(BakeStage stage, uint64_t key) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".bake", key);
+    return (std::filesystem::path(_directory) / (prefix(stage) + name)).string();
+}
+
+bool BakeCheckpoints::resume(BakeStage stage, uint64_t key, BakeContainer& outCheckpoint) const
+{
+    if (!enabled())
+    {
+        return false;
+    }
+
+    std::string filename = path(stage, key);
+    std::error_code error;
+    if (!std::filesystem::exists(filename, error) || !outCheckpoint.open(filename) ||
+        outCheckpoint.content_key() != key)
+    {
+        outCheckpoint.close();
+        return false;
+    }
+    printf("Resuming the %s stage from %s\n", bake_stage_name(stage), filename.c_str());
+    return true;
+}
+
+bool BakeCheckpoints::begin(BakeStage stage, uint64_t key,
+                            BakeContainerWriter& outWriter) const
+{
+    if (!enabled() || !outWriter.open(path(stage, key) + ".tmp"))
+    {
+        return false;
+    }
+    outWriter.set_content_key(key);
+    return true;
+}
+
+bool BakeCheckpoints::commit(BakeStage stage, uint64_t key, BakeContainerWriter& writer) const
+{
+    std::string filename = path(stage, key);
+    std::error_code error;
+    if (!writer.finish())
+    {
+        std::filesystem::remove(filename + ".tmp", error);
+        return false;
+    }
+
+    // Checkpoints of the stage of this scene with other inputs are stale now. Unfinished
+    // ones may belong to a bake that is still running, they are only removed when they are
+    // old enough to come from a bake that stopped.
+    std::string stagePrefix = prefix(stage);
+    std::filesystem::path written = filename + ".tmp";
+    auto staleTime = std::filesystem::file_time_type::clock::now() -
+                     std::chrono::hours(BAKE_CHECKPOINT_STALE_TMP_HOURS);
+    for (const auto& entry : std::filesystem::directory_iterator(_directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, stagePrefix.size(), stagePrefix) != 0 || entry.path() == written)
+        {
+            continue;
+        }
+        std::error_code entryError;
+        if (entry.path().extension() == ".tmp")
+        {
+            auto writeTime = entry.last_write_time(entryError);
+            if (entryError || writeTime > staleTime)
+            {
+                continue;
+            }
+        }
+        std::filesystem::remove(entry.path(), entryError);
+    }
+
+    std::filesystem::rename(filename + ".tmp", filename, error);
+    if (error)
+    {
+        printf("Could not write the %s checkpoint %s\n", bake_stage_name(stage),
+               filename.c_str());
+        return false;
+    }
+    printf("Saved the %s checkpoint to %s\n", bake_stage_name(stage), filename.c_str());
+    return true;
+}
+
+bool read_checkpoint_section(const BakeContainer& checkpoint, BakeSectionId id, void* out,
+                             size_t size)
+{
+    size_t sectionSize;
+    const void* data = checkpoint.section(id, &sectionSize);
+    if (!data || sectionSize != size)
+    {
+        return false;
+    }
+    memcpy(out, data, size);
+    return true;
+}
+
+template <typename T>
+static void write_vector(BakeContainerWriter& writer, BakeSectionId id,
+                         const std::vector<T>& values)
+{
+    writer.add_section(id, values.data(), values.size() * sizeof(T));
+}
+
+void write_receivers(BakeContainerWriter& writer, const ReceiverStore& receivers)
+{
+    write_vector(writer, BAKE_SECTION_RECEIVER_POSITIONS, receivers.positions);
+    write_vector(writer, BAKE_SECTION_RECEIVER_NORMALS, receivers.normals);
+    write_vector(writer, BAKE_SECTION_RECEIVER_UVS, receivers.uvs);
+    write_vector(writer, BAKE_SECTION_RECEIVER_OBJECT_IDS, receivers.objectIds);
+    write_vector(writer, BAKE_SECTION_RECEIVER_SAMPLE_START, receivers.sampleStart);
+    write_vector(writer, BAKE_SECTION_RECEIVER_SAMPLES, receivers.samples);
+    write_vector(writer, BAKE_SECTION_RECEIVER_TRIANGLES, receivers.triangles);
+}
+
+bool read_receivers(const BakeContainer& checkpoint, ReceiverStore& outReceivers)
+{
+    ReceiverStore receivers;
+    if (!read_checkpoint_section(checkpoint, BAKE_SECTION_RECEIVER_POSITIONS,
+                                 receivers.positions) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_RECEIVER_NORMALS,
+                                 receivers.normals) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_RECEIVER_UVS, receivers.uvs) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_RECEIVER_OBJECT_IDS,
+                                 receivers.objectIds) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_RECEIVER_SAMPLE_START,
+                                 receivers.sampleStart) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_RECEIVER_SAMPLES,
+                                 receivers.samples) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_RECEIVER_TRIANGLES,
+                                 receivers.triangles))
+    {
+        return false;
+    }
+
+    size_t count = receivers.positions.size();
+    if (receivers.normals.size() != count || receivers.uvs.size() != count ||
+        receivers.objectIds.size() != count || receivers.sampleStart.size() != count + 1 ||
+        receivers.sampleStart.back() != receivers.samples.size())
+    {
+        return false;
+    }
+    outReceivers = std::move(receivers);
+    return true;
+}
+
+void write_clusters(BakeContainerWriter& writer, const std::vector<AABB>& clusters)
+{
+    std::vector<CheckpointCluster> infos(clusters.size());
+    std::vector<int> receiverLists;
+    std::vector<int> probeLists;
+    for (size_t i = 0; i < clusters.size(); i++)
+    {
+        const AABB& cluster = clusters[i];
+        infos[i] = {cluster.min,
+                    cluster.max,
+                    (int)cluster.receivers.size(),
+                    (int)cluster.probes.size(),
+                    cluster.svdCoeffCount,
+                    cluster.projectionMatrixOffset,
+                    cluster.reconstructionMatrixOffset,
+                    0};
+        receiverLists.insert(receiverLists.end(), cluster.receivers.begin(),
+                             cluster.receivers.end());
+        probeLists.insert(probeLists.end(), cluster.probes.begin(), cluster.probes.end());
+    }
+
+    write_vector(writer, BAKE_SECTION_CLUSTERS, infos);
+    write_vector(writer, BAKE_SECTION_CLUSTER_RECEIVER_LISTS, receiverLists);
+    write_vector(writer, BAKE_SECTION_CLUSTER_PROBE_LISTS, probeLists);
+}
+
+bool read_clusters(const BakeContainer& checkpoint, std::vector<AABB>& outClusters)
+{
+    std::vector<CheckpointCluster> infos;
+    std::vector<int> receiverLists;
+    std::vector<int> probeLists;
+    if (!read_checkpoint_section(checkpoint, BAKE_SECTION_CLUSTERS, infos) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_CLUSTER_RECEIVER_LISTS,
+                                 receiverLists) ||
+        !read_checkpoint_section(checkpoint, BAKE_SECTION_CLUSTER_PROBE_LISTS, probeLists))
+    {
+        return false;
+    }
+
+    std::vector<AABB> clusters(infos.size());
+    size_t receiverOffset = 0;
+    size_t probeOffset = 0;
+    for (size_t i = 0; i < infos.size(); i++)
+    {
+        const CheckpointCluster& info = infos[i];
+        if (info.receiverCount < 0 || info.probeCount < 0 ||
+            receiverOffset + info.receiverCount > receiverLists.size() ||
+            probeOffset + info.probeCount > probeLists.size())
+        {
+            return false;
+        }
+
+        AABB& cluster = clusters[i];
+        cluster.min = info.min;
+        cluster.max = info.max;
+        cluster.receivers.assign(receiverLists.begin() + receiverOffset,
+                                 receiverLists.begin() + receiverOffset + info.receiverCount);
+        cluster.probes.assign(probeLists.begin() + probeOffset,
+                              probeLists.begin() + probeOffset + info.probeCount);
+        cluster.svdCoeffCount = info.svdCoeffCount;
+        cluster.projectionMatrixOffset = info.projectionMatrixOffset;
+        cluster.reconstructionMatrixOffset = info.reconstructionMatrixOffset;
+        receiverOffset += info.receiverCount;
+        probeOffset += info.probeCount;
+    }
+    outClusters = std::move(clusters);
+    return true;
+}
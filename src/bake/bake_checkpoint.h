@@ -0,0 +1,102 @@
+#pragma once
+
+#include "bake_cache.h"
+#include "bake_container.h"
+#include "receiver_store.h"
+
+#include <precalculation_types.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Stages of Precalculation::prepare, in order
+enum BakeStage : uint32_t
+{
+    BAKE_STAGE_RECEIVERS,
+    BAKE_STAGE_PROBES,
+    BAKE_STAGE_PROBE_RAYCAST,
+    BAKE_STAGE_CLUSTERS,
+    BAKE_STAGE_RECEIVER_TRANSFER,
+    BAKE_STAGE_PCA,
+};
+
+const char* bake_stage_name(BakeStage stage);
+
+// Key of a stage output: the stage, BAKE_ALGORITHM_VERSION, the keys of the stages it reads
+// and the settings it uses. Stages chain the keys of their inputs, so a changed setting only
+// changes the keys of the stages that depend on it. Never 0.
+template <typename... Inputs> uint64_t bake_stage_key(BakeStage stage, const Inputs&... inputs)
+{
+    uint32_t header[2] = {stage, BAKE_ALGORITHM_VERSION};
+    uint64_t hash = bake_checksum(header, sizeof(header));
+    ((hash = bake_checksum(&inputs, sizeof(Inputs), hash)), ...);
+    return hash != 0 ? hash : 1;
+}
+
+// Scalar outputs of BAKE_STAGE_CLUSTERS
+struct ClusterStageValues
+{
+    float radius;
+    int maxProbesPerCluster;
+    int totalReceiverCount;
+    int pad0_;
+};
+
+// Unfinished checkpoints of other bakes are only removed once they are this old, a younger
+// one may still be written
+#define BAKE_CHECKPOINT_STALE_TMP_HOURS 24
+
+// Checkpoints of the stages of a bake, stored as bake containers named after the stage, the
+// scene and the key of its output in one directory, which bakes of several scenes can share.
+// A stage resumes from its checkpoint when one with the same key exists, only the latest
+// checkpoint of every stage of a scene is kept.
+class BakeCheckpoints
+{
+public:
+    // An empty directory disables the checkpoints, every stage runs then
+    void init(const std::string& directory, uint64_t sceneKey);
+    bool enabled() const
+    {
+        return !_directory.empty();
+    }
+
+    // Opens the checkpoint of the stage if one with this key exists and is valid
+    bool resume(BakeStage stage, uint64_t key, BakeContainer& outCheckpoint) const;
+    // The checkpoint is written next to its final name and only replaces the older
+    // checkpoints of the stage in commit, a bake that stops halfway leaves none behind
+    bool begin(BakeStage stage, uint64_t key, BakeContainerWriter& outWriter) const;
+    bool commit(BakeStage stage, uint64_t key, BakeContainerWriter& writer) const;
+
+private:
+    // <stage>-<scene key>-, the start of the names of the checkpoints of the stage
+    std::string prefix(BakeStage stage) const;
+    std::string path(BakeStage stage, uint64_t key) const;
+
+    std::string _directory;
+    uint64_t _sceneKey = 0;
+};
+
+// Copies a section that has exactly size bytes
+bool read_checkpoint_section(const BakeContainer& checkpoint, BakeSectionId id, void* out,
+                             size_t size);
+
+template <typename T>
+bool read_checkpoint_section(const BakeContainer& checkpoint, BakeSectionId id,
+                             std::vector<T>& out)
+{
+    size_t size;
+    const T* data = (const T*)checkpoint.section(id, &size);
+    if (!data || size % sizeof(T) != 0)
+    {
+        return false;
+    }
+    out.assign(data, data + size / sizeof(T));
+    return true;
+}
+
+// The readers leave the output untouched if the checkpoint is incomplete
+void write_receivers(BakeContainerWriter& writer, const ReceiverStore& receivers);
+bool read_receivers(const BakeContainer& checkpoint, ReceiverStore& outReceivers);
+// Bounds, receivers, probes and PCA offsets of the clusters
+void write_clusters(BakeContainerWriter& writer, const std::vector<AABB>& clusters);
+bool read_clusters(const BakeContainer& checkpoint, std::vector<AABB>& outClusters);
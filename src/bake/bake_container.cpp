@@ -0,0 +1,332 @@
+#include "bake_container.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char BAKE_MAGIC[8] = {'P', 'A', 'N', 'K', 'O', 'B', 'A', 'K'};
+
+uint64_t bake_checksum(const void* data, size_t size, uint64_t seed)
+{
+    const uint64_t prime = 0x100000001B3ull;
+    uint64_t hash = seed;
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t words = size / sizeof(uint64_t);
+    for (size_t i = 0; i < words; i++)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+        hash = (hash ^ word) * prime;
+    }
+    for (size_t i = words * sizeof(uint64_t); i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    return hash;
+}
+
+BakeContainerWriter::~BakeContainerWriter()
+{
+    if (_file)
+    {
+        fclose(_file);
+    }
+}
+
+bool BakeContainerWriter::open(const std::string& filename)
+{
+    _file = fopen(filename.c_str(), "wb");
+    if (!_file)
+    {
+        printf("Could not open %s for writing\n", filename.c_str());
+        return false;
+    }
+
+    // Placeholder until finish knows the section table
+    BakeFileHeader header = {};
+    write(&header, sizeof(header));
+    return true;
+}
+
+void BakeContainerWriter::write(const void* data, size_t size)
+{
+    if (size > 0 && fwrite(data, 1, size, _file) != size)
+    {
+        _failed = true;
+    }
+    _offset += size;
+}
+
+void BakeContainerWriter::add_section(BakeSectionId id, const void* data, size_t size)
+{
+    static const uint8_t padding[BAKE_CONTAINER_ALIGNMENT] = {};
+    write(padding, (BAKE_CONTAINER_ALIGNMENT - _offset % BAKE_CONTAINER_ALIGNMENT) %
+                       BAKE_CONTAINER_ALIGNMENT);
+
+    BakeSectionEntry entry = {};
+    entry.id = id;
+    entry.offset = _offset;
+    entry.size = size;
+    entry.checksum = bake_checksum(data, size);
+    _sections.push_back(entry);
+
+    write(data, size);
+}
+
+bool BakeContainerWriter::finish()
+{
+    // The section table is aligned like the sections
+    static const uint8_t padding[BAKE_CONTAINER_ALIGNMENT] = {};
+    write(padding, (BAKE_CONTAINER_ALIGNMENT - _offset % BAKE_CONTAINER_ALIGNMENT) %
+                       BAKE_CONTAINER_ALIGNMENT);
+
+    size_t tableSize = _sections.size() * sizeof(BakeSectionEntry);
+    BakeFileHeader header = {};
+    memcpy(header.magic, BAKE_MAGIC, sizeof(BAKE_MAGIC));
+    header.version = BAKE_CONTAINER_VERSION;
+    header.sectionCount = _sections.size();
+    header.sectionTableOffset = _offset;
+    header.sectionTableChecksum = bake_checksum(_sections.data(), tableSize);
+    header.contentKey = _contentKey;
+    write(_sections.data(), tableSize);
+
+    if (fseek(_file, 0, SEEK_SET) != 0)
+    {
+        _failed = true;
+    }
+    else if (fwrite(&header, sizeof(header), 1, _file) != 1)
+    {
+        _failed = true;
+    }
+
+    if (fclose(_file) != 0)
+    {
+        _failed = true;
+    }
+    _file = nullptr;
+
+    if (_failed)
+    {
+        printf("Writing the bake failed\n");
+    }
+    return !_failed;
+}
+
+BakeContainer::~BakeContainer()
+{
+    close();
+}
+
+bool BakeContainer::open(const std::string& filename, bool verifyChecksums)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        printf("Could not open %s\n", filename.c_str());
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    _size = fileSize.QuadPart;
+    if (_size > 0)
+    {
+        _mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if (_mapping)
+        {
+            _data = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0);
+        }
+    }
+    CloseHandle(file);
+#else
+    int file = ::open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        printf("Could not open %s\n", filename.c_str());
+        return false;
+    }
+    struct stat fileStat;
+    _size = fstat(file, &fileStat) == 0 ? fileStat.st_size : 0;
+    if (_size > 0)
+    {
+        void* data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+        _data = data == MAP_FAILED ? nullptr : (uint8_t*)data;
+    }
+    ::close(file);
+#endif
+
+    if (!_data)
+    {
+        printf("Could not map %s\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    const BakeFileHeader* header = (const BakeFileHeader*)_data;
+    if (_size < sizeof(BakeFileHeader) || memcmp(header->magic, BAKE_MAGIC, 8) != 0)
+    {
+        printf("%s is not a bake file\n", filename.c_str());
+        close();
+        return false;
+    }
+    if (header->version != BAKE_CONTAINER_VERSION)
+    {
+        printf("%s has version %u, expected %u\n", filename.c_str(), header->version,
+               BAKE_CONTAINER_VERSION);
+        close();
+        return false;
+    }
+
+    uint64_t tableSize = (uint64_t)header->sectionCount * sizeof(BakeSectionEntry);
+    if (header->sectionTableOffset > _size || tableSize > _size - header->sectionTableOffset ||
+        bake_checksum(_data + header->sectionTableOffset, tableSize) !=
+            header->sectionTableChecksum)
+    {
+        printf("%s has a damaged section table\n", filename.c_str());
+        close();
+        return false;
+    }
+    _sections = (const BakeSectionEntry*)(_data + header->sectionTableOffset);
+    _sectionCount = header->sectionCount;
+    _contentKey = header->contentKey;
+
+    for (uint32_t i = 0; i < _sectionCount; i++)
+    {
+        const BakeSectionEntry& entry = _sections[i];
+        bool valid = entry.offset % BAKE_CONTAINER_ALIGNMENT == 0 && entry.offset <= _size &&
+                     entry.size <= _size - entry.offset;
+        if (valid && verifyChecksums)
+        {
+            valid = bake_checksum(_data + entry.offset, entry.size) == entry.checksum;
+            // Reading the section again later only hits the page cache, this way verifying
+            // does not keep the whole file resident
+            release_pages(entry);
+        }
+        if (!valid)
+        {
+            printf("Section %u of %s is damaged\n", entry.id, filename.c_str());
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void BakeContainer::close()
+{
+#ifdef _WIN32
+    if (_data)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping)
+    {
+        CloseHandle(_mapping);
+    }
+    _mapping = nullptr;
+#else
+    if (_data)
+    {
+        munmap(_data, _size);
+    }
+#endif
+    _data = nullptr;
+    _size = 0;
+    _sections = nullptr;
+    _sectionCount = 0;
+    _contentKey = 0;
+}
+
+const BakeSectionEntry* BakeContainer::find_section(BakeSectionId id) const
+{
+    for (uint32_t i = 0; i < _sectionCount; i++)
+    {
+        if (_sections[i].id == id)
+        {
+            return &_sections[i];
+        }
+    }
+    return nullptr;
+}
+
+void* BakeContainer::section(BakeSectionId id, size_t* outSize) const
+{
+    const BakeSectionEntry* entry = find_section(id);
+    if (outSize)
+    {
+        *outSize = entry ? entry->size : 0;
+    }
+    return entry ? _data + entry->offset : nullptr;
+}
+
+uint8_t* BakeContainer::section_pages(const BakeSectionEntry& entry, size_t* outSize) const
+{
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    size_t pageSize = systemInfo.dwPageSize;
+#else
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+#endif
+
+    // The mapping starts at a page boundary, so file offsets line up with pages
+    size_t begin = (entry.offset + pageSize - 1) / pageSize * pageSize;
+    size_t end = (entry.offset + entry.size) / pageSize * pageSize;
+    *outSize = end > begin ? end - begin : 0;
+    return end > begin ? _data + begin : nullptr;
+}
+
+void BakeContainer::prefetch(BakeSectionId id) const
+{
+    const BakeSectionEntry* entry = find_section(id);
+    size_t size;
+    uint8_t* pages = entry ? section_pages(*entry, &size) : nullptr;
+    if (!pages)
+    {
+        return;
+    }
+#ifdef _WIN32
+    WIN32_MEMORY_RANGE_ENTRY range = {pages, size};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    madvise(pages, size, MADV_WILLNEED);
+#endif
+}
+
+void BakeContainer::release(BakeSectionId id) const
+{
+    const BakeSectionEntry* entry = find_section(id);
+    if (entry)
+    {
+        release_pages(*entry);
+    }
+}
+
+void BakeContainer::release_pages(const BakeSectionEntry& entry) const
+{
+    size_t size;
+    uint8_t* pages = section_pages(entry, &size);
+    if (!pages)
+    {
+        return;
+    }
+#ifdef _WIN32
+    // Unlocking pages that are not locked removes them from the working set
+    VirtualUnlock(pages, size);
+#else
+    madvise(pages, size, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Single file bake output. A 64 byte header is followed by the sections, each starting at a
+// 64 byte aligned offset, and the section table at the end of the file. Every section and the
+// table carry a checksum. The file is little endian and read through a memory mapping, so the
+// sections can be handed to the upload path without copying them first.
+#define BAKE_CONTAINER_VERSION 3
+#define BAKE_CONTAINER_ALIGNMENT 64
+
+enum BakeSectionId : uint32_t
+{
+    BAKE_SECTION_CONFIG = 1, // JSON with the PrecalculationInfo and PrecalculationLoadData
+    BAKE_SECTION_PROBES,
+    BAKE_SECTION_PROBE_RAYCAST_RESULT,
+    BAKE_SECTION_PROBE_RAYCAST_BASIS_FUNCTIONS,
+    BAKE_SECTION_AABB_RECEIVERS,
+    BAKE_SECTION_CLUSTER_PROJECTION_MATRICES,   // packed in the matrixFormat of the config
+    BAKE_SECTION_RECEIVER_COEFFICIENT_MATRICES, // packed in the matrixFormat of the config
+    BAKE_SECTION_CLUSTER_RECEIVER_INFOS,
+    BAKE_SECTION_CLUSTER_RECEIVER_UVS,
+    BAKE_SECTION_RECEIVER_PROBE_WEIGHT_OFFSETS,
+    BAKE_SECTION_CLUSTER_PROBES,
+    BAKE_SECTION_CLUSTER_PROJECTION_SCALES,
+    BAKE_SECTION_RECEIVER_COEFFICIENT_SCALES,
+    BAKE_SECTION_RECEIVER_PROBE_WEIGHTS,
+
+    // Stage checkpoints (bake_checkpoint.h)
+    BAKE_SECTION_STAGE_VALUES = 64, // scalar outputs of the stage
+    BAKE_SECTION_RECEIVER_POSITIONS,
+    BAKE_SECTION_RECEIVER_NORMALS,
+    BAKE_SECTION_RECEIVER_UVS,
+    BAKE_SECTION_RECEIVER_OBJECT_IDS,
+    BAKE_SECTION_RECEIVER_SAMPLE_START,
+    BAKE_SECTION_RECEIVER_SAMPLES,
+    BAKE_SECTION_RECEIVER_TRIANGLES,
+    BAKE_SECTION_CLUSTERS,
+    BAKE_SECTION_CLUSTER_RECEIVER_LISTS,
+    BAKE_SECTION_CLUSTER_PROBE_LISTS,
+    BAKE_SECTION_PCA_PROJECTION_MATRICES,     // fp32
+    BAKE_SECTION_PCA_RECONSTRUCTION_MATRICES, // fp32
+    BAKE_SECTION_TRANSFER_MATRICES = 0x10000, // one section per cluster, id + cluster index
+};
+
+struct BakeFileHeader
+{
+    char magic[8]; // "PANKOBAK"
+    uint32_t version;
+    uint32_t sectionCount;
+    uint64_t sectionTableOffset;
+    uint64_t sectionTableChecksum;
+    uint64_t contentKey; // bake_content_key of the inputs, 0 if unknown
+    uint8_t reserved[24];
+};
+static_assert(sizeof(BakeFileHeader) == BAKE_CONTAINER_ALIGNMENT, "bake header size changed");
+
+struct BakeSectionEntry
+{
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+#define BAKE_CHECKSUM_SEED 0xCBF29CE484222325ull
+
+// FNV-1a over 64 bit words, the bytes after the last full word are hashed one at a time.
+// Passing the previous result as the seed hashes several blocks as one.
+uint64_t bake_checksum(const void* data, size_t size, uint64_t seed = BAKE_CHECKSUM_SEED);
+
+// Writes the sections one after another as they are added, the header and the section table
+// are written by finish
+class BakeContainerWriter
+{
+public:
+    ~BakeContainerWriter();
+
+    bool open(const std::string& filename);
+    void set_content_key(uint64_t key)
+    {
+        _contentKey = key;
+    }
+    void add_section(BakeSectionId id, const void* data, size_t size);
+    bool finish();
+
+private:
+    void write(const void* data, size_t size);
+
+    FILE* _file = nullptr;
+    uint64_t _offset = 0;
+    uint64_t _contentKey = 0;
+    bool _failed = false;
+    std::vector<BakeSectionEntry> _sections;
+};
+
+class BakeContainer
+{
+public:
+    BakeContainer() = default;
+    BakeContainer(const BakeContainer&) = delete;
+    BakeContainer& operator=(const BakeContainer&) = delete;
+    ~BakeContainer();
+
+    // Maps the file and validates the header, the section table and, if asked for, the
+    // checksums of every section. Prints the reason and returns false for invalid files.
+    bool open(const std::string& filename, bool verifyChecksums = true);
+    void close();
+
+    // Null if the file has no such section. The mapping is private and writable, writes
+    // through the pointer never reach the file.
+    void* section(BakeSectionId id, size_t* outSize = nullptr) const;
+    uint64_t content_key() const
+    {
+        return _contentKey;
+    }
+
+    // Starts reading the section from disk in the background
+    void prefetch(BakeSectionId id) const;
+    // Drops the pages of the section from the process once it is uploaded, they are read
+    // from the file again if the section is touched later. Writes to the section are lost.
+    void release(BakeSectionId id) const;
+
+private:
+    const BakeSectionEntry* find_section(BakeSectionId id) const;
+    // Whole pages inside the section, null if it does not span one
+    uint8_t* section_pages(const BakeSectionEntry& entry, size_t* outSize) const;
+    void release_pages(const BakeSectionEntry& entry) const;
+
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+    const BakeSectionEntry* _sections = nullptr;
+    uint32_t _sectionCount = 0;
+    uint64_t _contentKey = 0;
+#ifdef _WIN32
+    void* _mapping = nullptr;
+#endif
+};
@@ -0,0 +1,276 @@
+#include "bake_profiler.h"
+
+#include "json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdio.h>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+struct ProfileEvent
+{
+    const char* name;
+    int thread;
+    double start;
+    double duration;
+    double threadCpu;
+    double processCpu;
+    size_t peakMemory;
+    int64_t items;
+};
+
+struct ProfileTotals
+{
+    int64_t count = 0;
+    double wall = 0;
+    double maxWall = 0;
+    double threadCpu = 0;
+    double processCpu = 0;
+    int64_t items = 0;
+};
+
+static std::mutex profileMutex;
+static std::vector<ProfileEvent> profileEvents;
+// Ordered by name, so the reports of two bakes can be compared line by line
+static std::map<std::string, ProfileTotals> profileTotals;
+static std::chrono::steady_clock::time_point profileStart = std::chrono::steady_clock::now();
+static std::atomic<int> profileThreadCount{0};
+
+// Times are in seconds since begin
+static double wall_time()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - profileStart)
+        .count();
+}
+
+#ifdef _WIN32
+static double filetime_seconds(FILETIME time)
+{
+    return (((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) * 1e-7;
+}
+#endif
+
+static double thread_cpu_time()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    return filetime_seconds(kernel) + filetime_seconds(user);
+#else
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+static double process_cpu_time()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    return filetime_seconds(kernel) + filetime_seconds(user);
+#else
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+// Peak resident memory of the process in bytes
+static size_t peak_memory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Small ids in the order the threads first enter a zone, the trace viewers draw a row each
+static int thread_index()
+{
+    thread_local int index = profileThreadCount++;
+    return index;
+}
+
+BakeProfileZone::BakeProfileZone(const char* name, bool traced) : _name(name), _traced(traced)
+{
+#if BAKE_PROFILER
+    _wallStart = wall_time();
+    _threadCpuStart = thread_cpu_time();
+    _processCpuStart = process_cpu_time();
+#endif
+}
+
+BakeProfileZone::~BakeProfileZone()
+{
+    end();
+}
+
+void BakeProfileZone::end()
+{
+#if BAKE_PROFILER
+    if (_ended)
+    {
+        return;
+    }
+    _ended = true;
+
+    ProfileEvent event = {_name,
+                          thread_index(),
+                          _wallStart,
+                          wall_time() - _wallStart,
+                          thread_cpu_time() - _threadCpuStart,
+                          process_cpu_time() - _processCpuStart,
+                          _traced ? peak_memory() : 0,
+                          _items};
+
+    std::lock_guard<std::mutex> lock(profileMutex);
+    ProfileTotals& totals = profileTotals[_name];
+    totals.count++;
+    totals.wall += event.duration;
+    totals.maxWall = std::max(totals.maxWall, event.duration);
+    totals.threadCpu += event.threadCpu;
+    totals.processCpu += event.processCpu;
+    totals.items += event.items;
+    if (_traced)
+    {
+        profileEvents.push_back(event);
+    }
+#endif
+}
+
+static int max_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// CPU time of the process over the wall time of all threads. Only meaningful for zones that
+// are not entered by several threads at once, like the stages.
+static double utilization(double processCpu, double wall)
+{
+    return wall > 0 ? processCpu / (wall * max_threads()) : 0;
+}
+
+namespace bake_profiler
+{
+void begin()
+{
+    std::lock_guard<std::mutex> lock(profileMutex);
+    profileEvents.clear();
+    profileTotals.clear();
+    profileStart = std::chrono::steady_clock::now();
+}
+
+bool write_report(const std::string& filename, const std::string& metadataJson)
+{
+#if BAKE_PROFILER
+    std::lock_guard<std::mutex> lock(profileMutex);
+
+    // Complete events in microseconds
+    nlohmann::json events = nlohmann::json::array();
+    for (const ProfileEvent& event : profileEvents)
+    {
+        nlohmann::json args;
+        args["cpu_ms"] = event.threadCpu * 1000;
+        args["process_cpu_ms"] = event.processCpu * 1000;
+        args["utilization"] = utilization(event.processCpu, event.duration);
+        args["peak_memory_mb"] = event.peakMemory / (1024.0 * 1024.0);
+        args["items"] = event.items;
+
+        nlohmann::json entry;
+        entry["name"] = event.name;
+        entry["ph"] = "X";
+        entry["pid"] = 0;
+        entry["tid"] = event.thread;
+        entry["ts"] = event.start * 1e6;
+        entry["dur"] = event.duration * 1e6;
+        entry["args"] = args;
+        events.push_back(entry);
+    }
+
+    nlohmann::json zones = nlohmann::json::array();
+    for (const auto& [name, totals] : profileTotals)
+    {
+        nlohmann::json zone;
+        zone["name"] = name;
+        zone["count"] = totals.count;
+        zone["wall_s"] = totals.wall;
+        zone["max_wall_s"] = totals.maxWall;
+        zone["cpu_s"] = totals.threadCpu;
+        zone["process_cpu_s"] = totals.processCpu;
+        zone["utilization"] = utilization(totals.processCpu, totals.wall);
+        zone["items"] = totals.items;
+        zone["items_per_s"] = totals.wall > 0 ? totals.items / totals.wall : 0;
+        zones.push_back(zone);
+    }
+
+    nlohmann::json report;
+    report["traceEvents"] = events;
+    report["displayTimeUnit"] = "ms";
+    report["zones"] = zones;
+    report["threads"] = max_threads();
+    report["peak_memory_mb"] = peak_memory() / (1024.0 * 1024.0);
+    report["bake"] = nlohmann::json::parse(metadataJson, nullptr, false);
+
+    std::ofstream file(filename, std::ios::binary);
+    file << report.dump(1);
+    if (!file)
+    {
+        printf("Could not write the bake profile %s\n", filename.c_str());
+        return false;
+    }
+    printf("Saved the bake profile to %s\n", filename.c_str());
+    return true;
+#else
+    return false;
+#endif
+}
+
+void print_summary()
+{
+#if BAKE_PROFILER
+    std::lock_guard<std::mutex> lock(profileMutex);
+    printf("%-28s %8s %10s %10s %6s %12s\n", "Zone", "Count", "Wall s", "CPU s", "Util",
+           "Items/s");
+    for (const auto& [name, totals] : profileTotals)
+    {
+        printf("%-28s %8lld %10.3f %10.3f %5.0f%% %12.0f\n", name.c_str(),
+               (long long)totals.count, totals.wall, totals.threadCpu,
+               utilization(totals.processCpu, totals.wall) * 100,
+               totals.wall > 0 ? totals.items / totals.wall : 0);
+    }
+    printf("Peak memory: %.1f MB\n", peak_memory() / (1024.0 * 1024.0));
+#endif
+}
+} // namespace bake_profiler
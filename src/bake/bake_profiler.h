@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+// Zones of the bake are timed and written to a report next to the bake. Setting it to 0 turns
+// every zone into a no-op.
+#define BAKE_PROFILER 1
+
+// Times a scope of the bake: wall time, CPU time of the thread and of the whole process, peak
+// memory at its end and the number of items it processed. Zones can be entered from any
+// thread. Traced zones show up as events in the report, the others are only summed up per
+// name, which keeps zones around inner loops cheap.
+class BakeProfileZone
+{
+public:
+    explicit BakeProfileZone(const char* name, bool traced = true);
+    BakeProfileZone(const BakeProfileZone&) = delete;
+    BakeProfileZone& operator=(const BakeProfileZone&) = delete;
+    ~BakeProfileZone();
+
+    void add_items(int64_t count)
+    {
+        _items += count;
+    }
+    // Ends the zone before the end of its scope, later calls do nothing
+    void end();
+
+private:
+    const char* _name;
+    bool _traced;
+    bool _ended = false;
+    int64_t _items = 0;
+    double _wallStart = 0;
+    double _threadCpuStart = 0;
+    double _processCpuStart = 0;
+};
+
+// Zones recorded by all threads since the last begin
+namespace bake_profiler
+{
+// Drops the zones of the previous bake
+void begin();
+// Chrome trace (chrome://tracing, Perfetto) of the traced zones, with a summary of every zone
+// name and the metadata JSON object of the bake added as extra keys
+bool write_report(const std::string& filename, const std::string& metadataJson);
+// Wall time, CPU time, utilization and item rate of every zone name
+void print_summary();
+} // namespace bake_profiler
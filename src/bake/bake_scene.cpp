@@ -0,0 +1,127 @@
+#include "bake_scene.h"
+
+#include <xatlas.h>
+
+bool load_gltf_scene(const std::string& fileName, GltfScene& scene)
+{
+    tinygltf::Model tmodel;
+    tinygltf::TinyGLTF tcontext;
+
+    std::string warn, error;
+    if (!tcontext.LoadASCIIFromFile(&tmodel, &error, &warn, fileName))
+    {
+        printf("ERROR: SCENE LOADING: %s\n", error.c_str());
+        return false;
+    }
+    if (!warn.empty())
+    {
+        printf("WARNING: SCENE LOADING: %s\n", warn.c_str());
+    }
+    if (!error.empty())
+    {
+        printf("WARNING: SCENE LOADING: %s\n", error.c_str());
+    }
+
+    scene.import_materials(tmodel);
+    scene.import_drawable_nodes(
+        tmodel, GltfAttributes::Normal | GltfAttributes::Texcoord_0 | GltfAttributes::Tangent);
+
+    printf("dimensions: %f %f %f\n", scene.m_dimensions.size.x, scene.m_dimensions.size.y,
+           scene.m_dimensions.size.z);
+
+    return true;
+}
+
+void generate_lightmap_uvs(GltfScene& scene, int texelSize)
+{
+    printf("Generating lightmap uvs\n");
+    xatlas::Atlas* atlas = xatlas::Create();
+    for (int i = 0; i < scene.nodes.size(); i++)
+    {
+        auto& mesh = scene.prim_meshes[scene.nodes[i].prim_mesh];
+        xatlas::MeshDecl meshDecleration = {};
+        meshDecleration.vertexPositionData = &scene.positions[mesh.vtx_offset];
+        meshDecleration.vertexPositionStride = sizeof(glm::vec3);
+        meshDecleration.vertexCount = mesh.vtx_count;
+
+        if (scene.texcoords0.size() > 0)
+        {
+            meshDecleration.vertexUvData = &scene.texcoords0[mesh.vtx_offset];
+            meshDecleration.vertexUvStride = sizeof(glm::vec2);
+        }
+
+        meshDecleration.indexData = &scene.indices[mesh.first_idx];
+        meshDecleration.indexCount = mesh.idx_count;
+        meshDecleration.indexFormat = xatlas::IndexFormat::UInt32;
+        xatlas::AddMesh(atlas, meshDecleration);
+    }
+
+    xatlas::ChartOptions chartOptions = xatlas::ChartOptions();
+    // chartOptions.fixWinding = true;
+    xatlas::PackOptions packOptions = xatlas::PackOptions();
+    packOptions.texelsPerUnit = texelSize;
+    packOptions.bilinear = true;
+    packOptions.padding = 1;
+    xatlas::Generate(atlas, chartOptions, packOptions);
+
+    scene.lightmap_width = atlas->width;
+    scene.lightmap_height = atlas->height;
+
+    std::vector<GltfPrimMesh> prim_meshes;
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> texcoords0;
+    std::vector<glm::vec4> tangents;
+
+    for (int i = 0; i < scene.nodes.size(); i++)
+    {
+        GltfPrimMesh mesh = scene.prim_meshes[scene.nodes[i].prim_mesh];
+        uint32_t orihinal_vtx_offset = mesh.vtx_offset;
+        mesh.first_idx = indices.size();
+        mesh.vtx_offset = positions.size();
+
+        mesh.idx_count = atlas->meshes[i].indexCount;
+        mesh.vtx_count = atlas->meshes[i].vertexCount;
+
+        scene.nodes[i].prim_mesh = prim_meshes.size();
+        prim_meshes.push_back(mesh);
+
+        for (int j = 0; j < atlas->meshes[i].vertexCount; j++)
+        {
+            scene.lightmapUVs.push_back({atlas->meshes[i].vertexArray[j].uv[0],
+                                              atlas->meshes[i].vertexArray[j].uv[1]});
+
+            positions.push_back(scene.positions[atlas->meshes[i].vertexArray[j].xref +
+                                                     orihinal_vtx_offset]);
+            normals.push_back(scene.normals[atlas->meshes[i].vertexArray[j].xref +
+                                                 orihinal_vtx_offset]);
+            texcoords0.push_back(scene.texcoords0[atlas->meshes[i].vertexArray[j].xref +
+                                                       orihinal_vtx_offset]);
+            tangents.push_back(scene.tangents[atlas->meshes[i].vertexArray[j].xref +
+                                                   orihinal_vtx_offset]);
+        }
+
+        for (int j = 0; j < atlas->meshes[i].indexCount; j++)
+        {
+            indices.push_back(atlas->meshes[i].indexArray[j]);
+        }
+    }
+
+    scene.prim_meshes.clear();
+    scene.positions.clear();
+    scene.indices.clear();
+    scene.normals.clear();
+    scene.texcoords0.clear();
+    scene.tangents.clear();
+
+    scene.prim_meshes = prim_meshes;
+    scene.positions = positions;
+    scene.indices = indices;
+    scene.normals = normals;
+    scene.texcoords0 = texcoords0;
+    scene.tangents = tangents;
+
+    printf("Generated lightmap uvs, %d x %d\n", atlas->width, atlas->height);
+    xatlas::Destroy(atlas);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <gltf_scene.hpp>
+#include <string>
+
+// Loads the drawable nodes and materials of an ASCII glTF file
+bool load_gltf_scene(const std::string& fileName, GltfScene& scene);
+
+// Packs every node into a single lightmap atlas with xatlas and rebuilds the vertex data
+// (positions, normals, texcoords, tangents, lightmapUVs) around the atlas vertices
+void generate_lightmap_uvs(GltfScene& scene, int texelSize);
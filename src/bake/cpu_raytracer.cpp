@@ -0,0 +1,889 @@
+#include "cpu_raytracer.h"
+
+#include <algorithm>
+#include <gltf_scene.hpp>
+#include <immintrin.h>
+#include <limits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define BVH_MAX_LEAF_SIZE (BVH_WIDTH * 2)
+#define BVH_STACK_SIZE 512
+#define SAH_BIN_COUNT 16
+#define SAH_TRAVERSAL_COST 1.0f
+#define SAH_INTERSECTION_COST 1.0f
+
+#if BVH_WIDTH == 8
+typedef __m256 vfloat;
+static inline vfloat vload(const float* p)
+{
+    return _mm256_load_ps(p);
+}
+static inline vfloat vset(float f)
+{
+    return _mm256_set1_ps(f);
+}
+static inline vfloat vadd(vfloat a, vfloat b)
+{
+    return _mm256_add_ps(a, b);
+}
+static inline vfloat vsub(vfloat a, vfloat b)
+{
+    return _mm256_sub_ps(a, b);
+}
+static inline vfloat vmul(vfloat a, vfloat b)
+{
+    return _mm256_mul_ps(a, b);
+}
+static inline vfloat vdiv(vfloat a, vfloat b)
+{
+    return _mm256_div_ps(a, b);
+}
+static inline vfloat vmin(vfloat a, vfloat b)
+{
+    return _mm256_min_ps(a, b);
+}
+static inline vfloat vmax(vfloat a, vfloat b)
+{
+    return _mm256_max_ps(a, b);
+}
+static inline vfloat vand(vfloat a, vfloat b)
+{
+    return _mm256_and_ps(a, b);
+}
+static inline vfloat vabs(vfloat a)
+{
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a);
+}
+static inline vfloat vle(vfloat a, vfloat b)
+{
+    return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+static inline vfloat vlt(vfloat a, vfloat b)
+{
+    return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+static inline vfloat vge(vfloat a, vfloat b)
+{
+    return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+}
+static inline vfloat vgt(vfloat a, vfloat b)
+{
+    return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+static inline uint32_t vmask(vfloat a)
+{
+    return _mm256_movemask_ps(a);
+}
+static inline void vstore(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+static inline vfloat vblend(vfloat a, vfloat b, vfloat mask)
+{
+    return _mm256_blendv_ps(a, b, mask);
+}
+#else
+typedef __m128 vfloat;
+static inline vfloat vload(const float* p)
+{
+    return _mm_load_ps(p);
+}
+static inline vfloat vset(float f)
+{
+    return _mm_set1_ps(f);
+}
+static inline vfloat vadd(vfloat a, vfloat b)
+{
+    return _mm_add_ps(a, b);
+}
+static inline vfloat vsub(vfloat a, vfloat b)
+{
+    return _mm_sub_ps(a, b);
+}
+static inline vfloat vmul(vfloat a, vfloat b)
+{
+    return _mm_mul_ps(a, b);
+}
+static inline vfloat vdiv(vfloat a, vfloat b)
+{
+    return _mm_div_ps(a, b);
+}
+static inline vfloat vmin(vfloat a, vfloat b)
+{
+    return _mm_min_ps(a, b);
+}
+static inline vfloat vmax(vfloat a, vfloat b)
+{
+    return _mm_max_ps(a, b);
+}
+static inline vfloat vand(vfloat a, vfloat b)
+{
+    return _mm_and_ps(a, b);
+}
+static inline vfloat vabs(vfloat a)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.f), a);
+}
+static inline vfloat vle(vfloat a, vfloat b)
+{
+    return _mm_cmple_ps(a, b);
+}
+static inline vfloat vlt(vfloat a, vfloat b)
+{
+    return _mm_cmplt_ps(a, b);
+}
+static inline vfloat vge(vfloat a, vfloat b)
+{
+    return _mm_cmpge_ps(a, b);
+}
+static inline vfloat vgt(vfloat a, vfloat b)
+{
+    return _mm_cmpgt_ps(a, b);
+}
+static inline uint32_t vmask(vfloat a)
+{
+    return _mm_movemask_ps(a);
+}
+static inline void vstore(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+static inline vfloat vblend(vfloat a, vfloat b, vfloat mask)
+{
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+#endif
+
+static inline int bit_scan(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static float surface_area(const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 extent = glm::max(max - min, glm::vec3(0.f));
+    return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static uint32_t block_count(uint32_t triangleCount)
+{
+    return (triangleCount + BVH_WIDTH - 1) / BVH_WIDTH;
+}
+
+void CpuRaytracer::build(GltfScene& scene)
+{
+    _scene = &scene;
+    _triangles.clear();
+    _blocks.clear();
+    _nodes.clear();
+    _normalMatrices.resize(scene.nodes.size());
+
+    for (int nodeIndex = 0; nodeIndex < scene.nodes.size(); nodeIndex++)
+    {
+        auto& node = scene.nodes[nodeIndex];
+        auto& mesh = scene.prim_meshes[node.prim_mesh];
+        _normalMatrices[nodeIndex] =
+            glm::mat3(glm::transpose(glm::inverse(node.world_matrix)));
+
+        for (uint32_t triangle = 0; triangle < mesh.idx_count; triangle += 3)
+        {
+            glm::vec3 worldVertices[3];
+            for (int i = 0; i < 3; i++)
+            {
+                int vertexIndex =
+                    mesh.vtx_offset + scene.indices[mesh.first_idx + triangle + i];
+                glm::vec4 vertex =
+                    node.world_matrix * glm::vec4(scene.positions[vertexIndex], 1.0);
+                worldVertices[i] = glm::vec3(vertex / vertex.w);
+            }
+
+            Triangle tri = {};
+            tri.v0 = worldVertices[0];
+            tri.edge1 = worldVertices[1] - worldVertices[0];
+            tri.edge2 = worldVertices[2] - worldVertices[0];
+            tri.nodeIndex = nodeIndex;
+            tri.indexOffset = mesh.first_idx + triangle;
+            tri.vertexOffset = mesh.vtx_offset;
+            _triangles.push_back(tri);
+        }
+    }
+
+    if (_triangles.empty())
+    {
+        return;
+    }
+
+    std::vector<glm::vec3> centroids(_triangles.size());
+    std::vector<glm::vec3> triangleMin(_triangles.size());
+    std::vector<glm::vec3> triangleMax(_triangles.size());
+    std::vector<uint32_t> order(_triangles.size());
+    for (uint32_t i = 0; i < _triangles.size(); i++)
+    {
+        const Triangle& tri = _triangles[i];
+        glm::vec3 v1 = tri.v0 + tri.edge1;
+        glm::vec3 v2 = tri.v0 + tri.edge2;
+        triangleMin[i] = glm::min(tri.v0, glm::min(v1, v2));
+        triangleMax[i] = glm::max(tri.v0, glm::max(v1, v2));
+        centroids[i] = (triangleMin[i] + triangleMax[i]) * 0.5f;
+        order[i] = i;
+    }
+
+    // Binary SAH tree first, it is collapsed into the wide nodes afterwards
+    std::vector<BuildNode> buildNodes;
+    buildNodes.reserve(_triangles.size() * 2);
+    buildNodes.push_back({});
+    build_sah(buildNodes, 0, 0, _triangles.size(), order, centroids, triangleMin, triangleMax);
+
+    std::vector<Triangle> orderedTriangles(_triangles.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        orderedTriangles[i] = _triangles[order[i]];
+    }
+    _triangles = std::move(orderedTriangles);
+
+    _nodes.reserve(buildNodes.size() / 2 + 1);
+    _blocks.reserve(_triangles.size() / BVH_WIDTH + buildNodes.size() / 2 + 1);
+    collapse(buildNodes, 0);
+
+    printf("CPU BVH built: %d triangles, %d binary nodes, %d %d-wide nodes, %d triangle "
+           "blocks\n",
+           (int)_triangles.size(), (int)buildNodes.size(), (int)_nodes.size(), BVH_WIDTH,
+           (int)_blocks.size());
+}
+
+void CpuRaytracer::build_sah(std::vector<BuildNode>& buildNodes, uint32_t nodeIndex,
+                             uint32_t first, uint32_t count, std::vector<uint32_t>& order,
+                             const std::vector<glm::vec3>& centroids,
+                             const std::vector<glm::vec3>& triangleMin,
+                             const std::vector<glm::vec3>& triangleMax)
+{
+    glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+    glm::vec3 centroidMin = boundsMin;
+    glm::vec3 centroidMax = boundsMax;
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        boundsMin = glm::min(boundsMin, triangleMin[order[i]]);
+        boundsMax = glm::max(boundsMax, triangleMax[order[i]]);
+        centroidMin = glm::min(centroidMin, centroids[order[i]]);
+        centroidMax = glm::max(centroidMax, centroids[order[i]]);
+    }
+
+    buildNodes[nodeIndex].min = boundsMin;
+    buildNodes[nodeIndex].max = boundsMax;
+    buildNodes[nodeIndex].first = first;
+    buildNodes[nodeIndex].count = count;
+
+    if (count <= 1)
+    {
+        return;
+    }
+
+    // Binned SAH over all three axes, the cost of a leaf is counted in triangle blocks since a
+    // block is intersected at once
+    glm::vec3 extent = centroidMax - centroidMin;
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    int bestSplit = 0;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] <= 0.f)
+        {
+            continue;
+        }
+
+        uint32_t binCounts[SAH_BIN_COUNT] = {};
+        glm::vec3 binMin[SAH_BIN_COUNT];
+        glm::vec3 binMax[SAH_BIN_COUNT];
+        for (int b = 0; b < SAH_BIN_COUNT; b++)
+        {
+            binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+            binMax[b] = glm::vec3(-std::numeric_limits<float>::max());
+        }
+
+        float scale = SAH_BIN_COUNT / extent[axis];
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            int bin = std::min(SAH_BIN_COUNT - 1,
+                               (int)((centroids[order[i]][axis] - centroidMin[axis]) * scale));
+            binCounts[bin]++;
+            binMin[bin] = glm::min(binMin[bin], triangleMin[order[i]]);
+            binMax[bin] = glm::max(binMax[bin], triangleMax[order[i]]);
+        }
+
+        // Sweep from the right to get the cost of every right side, then from the left
+        float rightCost[SAH_BIN_COUNT];
+        glm::vec3 sweepMin = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 sweepMax = glm::vec3(-std::numeric_limits<float>::max());
+        uint32_t sweepCount = 0;
+        for (int b = SAH_BIN_COUNT - 1; b > 0; b--)
+        {
+            sweepMin = glm::min(sweepMin, binMin[b]);
+            sweepMax = glm::max(sweepMax, binMax[b]);
+            sweepCount += binCounts[b];
+            rightCost[b] = sweepCount > 0
+                               ? surface_area(sweepMin, sweepMax) * block_count(sweepCount)
+                               : 0.f;
+        }
+
+        sweepMin = glm::vec3(std::numeric_limits<float>::max());
+        sweepMax = glm::vec3(-std::numeric_limits<float>::max());
+        sweepCount = 0;
+        for (int b = 0; b < SAH_BIN_COUNT - 1; b++)
+        {
+            sweepMin = glm::min(sweepMin, binMin[b]);
+            sweepMax = glm::max(sweepMax, binMax[b]);
+            sweepCount += binCounts[b];
+            if (sweepCount == 0 || sweepCount == count)
+            {
+                continue;
+            }
+
+            float cost =
+                surface_area(sweepMin, sweepMax) * block_count(sweepCount) + rightCost[b + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b + 1;
+            }
+        }
+    }
+
+    float nodeArea = surface_area(boundsMin, boundsMax);
+    float leafCost = SAH_INTERSECTION_COST * block_count(count);
+    float splitCost = SAH_TRAVERSAL_COST +
+                      SAH_INTERSECTION_COST * bestCost / std::max(nodeArea, 1e-12f);
+
+    if (bestAxis == -1 || (count <= BVH_MAX_LEAF_SIZE && leafCost <= splitCost))
+    {
+        return;
+    }
+
+    float scale = SAH_BIN_COUNT / extent[bestAxis];
+    auto middle = std::partition(
+        order.begin() + first, order.begin() + first + count, [&](uint32_t triangle) {
+            int bin = std::min(
+                SAH_BIN_COUNT - 1,
+                (int)((centroids[triangle][bestAxis] - centroidMin[bestAxis]) * scale));
+            return bin < bestSplit;
+        });
+    uint32_t leftCount = middle - (order.begin() + first);
+
+    uint32_t left = buildNodes.size();
+    buildNodes.push_back({});
+    buildNodes.push_back({});
+    buildNodes[nodeIndex].left = left;
+    buildNodes[nodeIndex].count = 0;
+
+    build_sah(buildNodes, left, first, leftCount, order, centroids, triangleMin, triangleMax);
+    build_sah(buildNodes, left + 1, first + leftCount, count - leftCount, order, centroids,
+              triangleMin, triangleMax);
+}
+
+uint32_t CpuRaytracer::collapse(const std::vector<BuildNode>& buildNodes,
+                                uint32_t buildNodeIndex)
+{
+    // Pull grandchildren up until the node is full, always opening the largest inner child
+    uint32_t children[BVH_WIDTH];
+    int childCount = 0;
+    const BuildNode& buildNode = buildNodes[buildNodeIndex];
+    if (buildNode.count > 0)
+    {
+        children[childCount++] = buildNodeIndex;
+    }
+    else
+    {
+        children[childCount++] = buildNode.left;
+        children[childCount++] = buildNode.left + 1;
+    }
+
+    while (childCount < BVH_WIDTH)
+    {
+        int largest = -1;
+        float largestArea = -1.f;
+        for (int i = 0; i < childCount; i++)
+        {
+            const BuildNode& child = buildNodes[children[i]];
+            float area = surface_area(child.min, child.max);
+            if (child.count == 0 && area > largestArea)
+            {
+                largest = i;
+                largestArea = area;
+            }
+        }
+
+        if (largest == -1)
+        {
+            break;
+        }
+
+        uint32_t opened = children[largest];
+        children[largest] = buildNodes[opened].left;
+        children[childCount++] = buildNodes[opened].left + 1;
+    }
+
+    uint32_t nodeIndex = _nodes.size();
+    _nodes.push_back({});
+    for (int i = 0; i < BVH_WIDTH; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // Empty lanes can never be entered
+            _nodes[nodeIndex].boundsMin[axis][i] = std::numeric_limits<float>::infinity();
+            _nodes[nodeIndex].boundsMax[axis][i] = -std::numeric_limits<float>::infinity();
+        }
+    }
+
+    for (int i = 0; i < childCount; i++)
+    {
+        const BuildNode& child = buildNodes[children[i]];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            _nodes[nodeIndex].boundsMin[axis][i] = child.min[axis];
+            _nodes[nodeIndex].boundsMax[axis][i] = child.max[axis];
+        }
+
+        if (child.count > 0)
+        {
+            uint32_t firstBlock = _blocks.size();
+            uint32_t blocks = block_count(child.count);
+            for (uint32_t b = 0; b < blocks; b++)
+            {
+                TriangleBlock block = {};
+                for (int lane = 0; lane < BVH_WIDTH; lane++)
+                {
+                    uint32_t triangle = child.first + b * BVH_WIDTH + lane;
+                    if (triangle >= child.first + child.count)
+                    {
+                        // Zero edges give a zero determinant, the lane never reports a hit
+                        block.triangle[lane] = 0xFFFFFFFF;
+                        continue;
+                    }
+
+                    const Triangle& tri = _triangles[triangle];
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        block.v0[axis][lane] = tri.v0[axis];
+                        block.edge1[axis][lane] = tri.edge1[axis];
+                        block.edge2[axis][lane] = tri.edge2[axis];
+                    }
+                    block.triangle[lane] = triangle;
+                }
+                _blocks.push_back(block);
+            }
+            _nodes[nodeIndex].child[i] = firstBlock;
+            _nodes[nodeIndex].blockCount[i] = blocks;
+        }
+        else
+        {
+            uint32_t childNode = collapse(buildNodes, children[i]);
+            _nodes[nodeIndex].child[i] = childNode;
+            _nodes[nodeIndex].blockCount[i] = 0;
+        }
+    }
+
+    return nodeIndex;
+}
+
+CpuRaytracer::TraversalRay CpuRaytracer::make_traversal_ray(const glm::vec3& origin,
+                                                            const glm::vec3& direction,
+                                                            float tMin)
+{
+    TraversalRay ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.tMin = tMin;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // Keeps the slab test free of 0 * inf
+        float d = direction[axis];
+        if (std::abs(d) < 1e-20f)
+        {
+            d = d < 0.f ? -1e-20f : 1e-20f;
+        }
+        ray.invDirection[axis] = 1.f / d;
+    }
+    return ray;
+}
+
+uint32_t CpuRaytracer::intersect_node(const WideNode& node, const TraversalRay& ray,
+                                      float tMax, float* outTNear) const
+{
+    vfloat tNear = vset(ray.tMin);
+    vfloat tFar = vset(tMax);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        bool negative = ray.invDirection[axis] < 0.f;
+        vfloat nearPlane = vload(negative ? node.boundsMax[axis] : node.boundsMin[axis]);
+        vfloat farPlane = vload(negative ? node.boundsMin[axis] : node.boundsMax[axis]);
+        vfloat origin = vset(ray.origin[axis]);
+        vfloat invDirection = vset(ray.invDirection[axis]);
+        tNear = vmax(tNear, vmul(vsub(nearPlane, origin), invDirection));
+        tFar = vmin(tFar, vmul(vsub(farPlane, origin), invDirection));
+    }
+
+    vstore(outTNear, tNear);
+    return vmask(vle(tNear, tFar));
+}
+
+void CpuRaytracer::intersect_leaf(uint32_t firstBlock, uint32_t blockCount,
+                                  const TraversalRay& ray, HitRecord& hit) const
+{
+    // Moller-Trumbore against a whole block, both faces are hit like the GPU pipeline
+    // (culling disabled)
+    vfloat dx = vset(ray.direction.x);
+    vfloat dy = vset(ray.direction.y);
+    vfloat dz = vset(ray.direction.z);
+    vfloat ox = vset(ray.origin.x);
+    vfloat oy = vset(ray.origin.y);
+    vfloat oz = vset(ray.origin.z);
+    vfloat zero = vset(0.f);
+    vfloat one = vset(1.f);
+    vfloat epsilon = vset(1e-12f);
+    vfloat tMin = vset(ray.tMin);
+
+    for (uint32_t b = firstBlock; b < firstBlock + blockCount; b++)
+    {
+        const TriangleBlock& block = _blocks[b];
+        vfloat e1x = vload(block.edge1[0]);
+        vfloat e1y = vload(block.edge1[1]);
+        vfloat e1z = vload(block.edge1[2]);
+        vfloat e2x = vload(block.edge2[0]);
+        vfloat e2y = vload(block.edge2[1]);
+        vfloat e2z = vload(block.edge2[2]);
+
+        // pvec = cross(direction, edge2)
+        vfloat px = vsub(vmul(dy, e2z), vmul(dz, e2y));
+        vfloat py = vsub(vmul(dz, e2x), vmul(dx, e2z));
+        vfloat pz = vsub(vmul(dx, e2y), vmul(dy, e2x));
+        vfloat det = vadd(vadd(vmul(e1x, px), vmul(e1y, py)), vmul(e1z, pz));
+        vfloat valid = vgt(vabs(det), epsilon);
+        if (vmask(valid) == 0)
+        {
+            continue;
+        }
+        vfloat invDet = vdiv(one, det);
+
+        vfloat tx = vsub(ox, vload(block.v0[0]));
+        vfloat ty = vsub(oy, vload(block.v0[1]));
+        vfloat tz = vsub(oz, vload(block.v0[2]));
+        vfloat u = vmul(vadd(vadd(vmul(tx, px), vmul(ty, py)), vmul(tz, pz)), invDet);
+        valid = vand(valid, vand(vge(u, zero), vle(u, one)));
+
+        // qvec = cross(tvec, edge1)
+        vfloat qx = vsub(vmul(ty, e1z), vmul(tz, e1y));
+        vfloat qy = vsub(vmul(tz, e1x), vmul(tx, e1z));
+        vfloat qz = vsub(vmul(tx, e1y), vmul(ty, e1x));
+        vfloat v = vmul(vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz)), invDet);
+        valid = vand(valid, vand(vge(v, zero), vle(vadd(u, v), one)));
+
+        vfloat t = vmul(vadd(vadd(vmul(e2x, qx), vmul(e2y, qy)), vmul(e2z, qz)), invDet);
+        valid = vand(valid, vand(vgt(t, tMin), vlt(t, vset(hit.t))));
+
+        uint32_t mask = vmask(valid);
+        if (mask == 0)
+        {
+            continue;
+        }
+
+        float ts[BVH_WIDTH], us[BVH_WIDTH], vs[BVH_WIDTH];
+        vstore(ts, t);
+        vstore(us, u);
+        vstore(vs, v);
+        while (mask != 0)
+        {
+            int lane = bit_scan(mask);
+            mask &= mask - 1;
+            if (ts[lane] < hit.t)
+            {
+                hit.t = ts[lane];
+                hit.u = us[lane];
+                hit.v = vs[lane];
+                hit.triangle = block.triangle[lane];
+            }
+        }
+    }
+}
+
+GPUHitPayload CpuRaytracer::trace(glm::vec3 origin, glm::vec3 direction, float tMin,
+                                  float tMax) const
+{
+    HitRecord hit = {tMax, 0.f, 0.f, -1};
+
+    if (!_nodes.empty())
+    {
+        TraversalRay ray = make_traversal_ray(origin, direction, tMin);
+        StackEntry stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = {0, 0, tMin};
+
+        while (stackSize > 0)
+        {
+            StackEntry entry = stack[--stackSize];
+            if (entry.tNear > hit.t)
+            {
+                continue;
+            }
+
+            if (entry.blockCount > 0)
+            {
+                intersect_leaf(entry.child, entry.blockCount, ray, hit);
+                continue;
+            }
+
+            const WideNode& node = _nodes[entry.child];
+            float tNear[BVH_WIDTH];
+            uint32_t mask = intersect_node(node, ray, hit.t, tNear);
+
+            // Push the far children first so the nearest one is visited next
+            int first = stackSize;
+            while (mask != 0)
+            {
+                int lane = bit_scan(mask);
+                mask &= mask - 1;
+
+                StackEntry child = {node.child[lane], node.blockCount[lane], tNear[lane]};
+                int slot = stackSize++;
+                while (slot > first && stack[slot - 1].tNear < child.tNear)
+                {
+                    stack[slot] = stack[slot - 1];
+                    slot--;
+                }
+                stack[slot] = child;
+            }
+        }
+    }
+
+    GPUHitPayload payload = {};
+    fill_payload(hit, payload);
+    return payload;
+}
+
+void CpuRaytracer::trace_packet(const CpuRay* rays, int rayCount,
+                                GPUHitPayload* outPayloads) const
+{
+    for (int packetStart = 0; packetStart < rayCount; packetStart += CPU_RAY_PACKET_SIZE)
+    {
+        int packetSize = std::min(CPU_RAY_PACKET_SIZE, rayCount - packetStart);
+
+        // Structure of arrays, one SIMD lane per ray. Unused lanes start with an empty
+        // interval so they never enter a node.
+        alignas(32) float packet[10][CPU_RAY_PACKET_SIZE];
+        alignas(32) float hitT[CPU_RAY_PACKET_SIZE];
+        alignas(32) float hitU[CPU_RAY_PACKET_SIZE];
+        alignas(32) float hitV[CPU_RAY_PACKET_SIZE];
+        int hitTriangle[CPU_RAY_PACKET_SIZE];
+        for (int r = 0; r < CPU_RAY_PACKET_SIZE; r++)
+        {
+            const CpuRay& ray = rays[packetStart + std::min(r, packetSize - 1)];
+            TraversalRay traversalRay =
+                make_traversal_ray(ray.origin, ray.direction, ray.tMin);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                packet[axis][r] = traversalRay.origin[axis];
+                packet[3 + axis][r] = traversalRay.direction[axis];
+                packet[6 + axis][r] = traversalRay.invDirection[axis];
+            }
+            packet[9][r] = r < packetSize ? ray.tMin : std::numeric_limits<float>::max();
+            hitT[r] = r < packetSize ? ray.tMax : -std::numeric_limits<float>::max();
+            hitU[r] = 0.f;
+            hitV[r] = 0.f;
+            hitTriangle[r] = -1;
+        }
+
+        vfloat ox = vload(packet[0]), oy = vload(packet[1]), oz = vload(packet[2]);
+        vfloat dx = vload(packet[3]), dy = vload(packet[4]), dz = vload(packet[5]);
+        vfloat ix = vload(packet[6]), iy = vload(packet[7]), iz = vload(packet[8]);
+        vfloat tMin = vload(packet[9]);
+        vfloat zero = vset(0.f);
+        vfloat one = vset(1.f);
+        vfloat epsilon = vset(1e-12f);
+
+        StackEntry stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        if (!_nodes.empty())
+        {
+            stack[stackSize++] = {0, 0, -std::numeric_limits<float>::max()};
+        }
+
+        while (stackSize > 0)
+        {
+            StackEntry entry = stack[--stackSize];
+            vfloat tHit = vload(hitT);
+
+            if (entry.blockCount > 0)
+            {
+                for (uint32_t b = entry.child; b < entry.child + entry.blockCount; b++)
+                {
+                    const TriangleBlock& block = _blocks[b];
+                    for (int lane = 0; lane < BVH_WIDTH; lane++)
+                    {
+                        if (block.triangle[lane] == 0xFFFFFFFF)
+                        {
+                            break;
+                        }
+
+                        // Moller-Trumbore of one triangle against every ray of the packet
+                        vfloat e1x = vset(block.edge1[0][lane]);
+                        vfloat e1y = vset(block.edge1[1][lane]);
+                        vfloat e1z = vset(block.edge1[2][lane]);
+                        vfloat e2x = vset(block.edge2[0][lane]);
+                        vfloat e2y = vset(block.edge2[1][lane]);
+                        vfloat e2z = vset(block.edge2[2][lane]);
+
+                        vfloat px = vsub(vmul(dy, e2z), vmul(dz, e2y));
+                        vfloat py = vsub(vmul(dz, e2x), vmul(dx, e2z));
+                        vfloat pz = vsub(vmul(dx, e2y), vmul(dy, e2x));
+                        vfloat det = vadd(vadd(vmul(e1x, px), vmul(e1y, py)), vmul(e1z, pz));
+                        vfloat valid = vgt(vabs(det), epsilon);
+                        vfloat invDet = vdiv(one, det);
+
+                        vfloat tx = vsub(ox, vset(block.v0[0][lane]));
+                        vfloat ty = vsub(oy, vset(block.v0[1][lane]));
+                        vfloat tz = vsub(oz, vset(block.v0[2][lane]));
+                        vfloat u =
+                            vmul(vadd(vadd(vmul(tx, px), vmul(ty, py)), vmul(tz, pz)), invDet);
+                        valid = vand(valid, vand(vge(u, zero), vle(u, one)));
+
+                        vfloat qx = vsub(vmul(ty, e1z), vmul(tz, e1y));
+                        vfloat qy = vsub(vmul(tz, e1x), vmul(tx, e1z));
+                        vfloat qz = vsub(vmul(tx, e1y), vmul(ty, e1x));
+                        vfloat v =
+                            vmul(vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz)), invDet);
+                        valid = vand(valid, vand(vge(v, zero), vle(vadd(u, v), one)));
+
+                        vfloat t = vmul(
+                            vadd(vadd(vmul(e2x, qx), vmul(e2y, qy)), vmul(e2z, qz)), invDet);
+                        valid = vand(valid, vand(vgt(t, tMin), vlt(t, tHit)));
+
+                        uint32_t mask = vmask(valid);
+                        if (mask == 0)
+                        {
+                            continue;
+                        }
+
+                        tHit = vblend(tHit, t, valid);
+                        vstore(hitT, tHit);
+                        vstore(hitU, vblend(vload(hitU), u, valid));
+                        vstore(hitV, vblend(vload(hitV), v, valid));
+                        while (mask != 0)
+                        {
+                            int r = bit_scan(mask);
+                            mask &= mask - 1;
+                            hitTriangle[r] = block.triangle[lane];
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // Every child is tested against the whole packet, children are visited in the
+            // order of the closest ray entering them
+            const WideNode& node = _nodes[entry.child];
+            int first = stackSize;
+            for (int lane = 0; lane < BVH_WIDTH; lane++)
+            {
+                if (node.boundsMin[0][lane] > node.boundsMax[0][lane])
+                {
+                    break;
+                }
+
+                vfloat t0x = vmul(vsub(vset(node.boundsMin[0][lane]), ox), ix);
+                vfloat t1x = vmul(vsub(vset(node.boundsMax[0][lane]), ox), ix);
+                vfloat t0y = vmul(vsub(vset(node.boundsMin[1][lane]), oy), iy);
+                vfloat t1y = vmul(vsub(vset(node.boundsMax[1][lane]), oy), iy);
+                vfloat t0z = vmul(vsub(vset(node.boundsMin[2][lane]), oz), iz);
+                vfloat t1z = vmul(vsub(vset(node.boundsMax[2][lane]), oz), iz);
+                vfloat tNear = vmax(vmax(vmin(t0x, t1x), vmin(t0y, t1y)),
+                                    vmax(vmin(t0z, t1z), tMin));
+                vfloat tFar = vmin(vmin(vmax(t0x, t1x), vmax(t0y, t1y)),
+                                   vmin(vmax(t0z, t1z), tHit));
+
+                vfloat entered = vle(tNear, tFar);
+                uint32_t mask = vmask(entered);
+                if (mask == 0)
+                {
+                    continue;
+                }
+
+                alignas(32) float tNears[CPU_RAY_PACKET_SIZE];
+                vstore(tNears, tNear);
+                float closest = std::numeric_limits<float>::max();
+                while (mask != 0)
+                {
+                    int r = bit_scan(mask);
+                    mask &= mask - 1;
+                    closest = std::min(closest, tNears[r]);
+                }
+
+                StackEntry child = {node.child[lane], node.blockCount[lane], closest};
+                int slot = stackSize++;
+                while (slot > first && stack[slot - 1].tNear < child.tNear)
+                {
+                    stack[slot] = stack[slot - 1];
+                    slot--;
+                }
+                stack[slot] = child;
+            }
+        }
+
+        for (int r = 0; r < packetSize; r++)
+        {
+            HitRecord hit = {hitT[r], hitU[r], hitV[r], hitTriangle[r]};
+            outPayloads[packetStart + r] = {};
+            fill_payload(hit, outPayloads[packetStart + r]);
+        }
+    }
+}
+
+void CpuRaytracer::fill_payload(const HitRecord& hit, GPUHitPayload& payload) const
+{
+    // Same values as precalculate_probe_rt.rmiss
+    if (hit.triangle == -1)
+    {
+        payload.objectId = -1;
+        payload.pos = glm::vec3(-999, -999, -999);
+        payload.normal = glm::vec3(0);
+        return;
+    }
+
+    const GltfScene& scene = *_scene;
+    const Triangle& triangle = _triangles[hit.triangle];
+    float u = hit.u;
+    float v = hit.v;
+    glm::vec3 barycentrics = {1.f - u - v, u, v};
+
+    uint32_t ind[3];
+    for (int i = 0; i < 3; i++)
+    {
+        ind[i] = scene.indices[triangle.indexOffset + i] + triangle.vertexOffset;
+    }
+
+    payload.pos = triangle.v0 + u * triangle.edge1 + v * triangle.edge2;
+
+    glm::vec3 nrm = scene.normals[ind[0]] * barycentrics.x +
+                    scene.normals[ind[1]] * barycentrics.y +
+                    scene.normals[ind[2]] * barycentrics.z;
+    payload.normal = glm::normalize(_normalMatrices[triangle.nodeIndex] * nrm);
+
+    if (!scene.texcoords0.empty())
+    {
+        payload.texUv = scene.texcoords0[ind[0]] * barycentrics.x +
+                        scene.texcoords0[ind[1]] * barycentrics.y +
+                        scene.texcoords0[ind[2]] * barycentrics.z;
+    }
+
+    if (!scene.lightmapUVs.empty())
+    {
+        payload.lightmapUv = scene.lightmapUVs[ind[0]] * barycentrics.x +
+                             scene.lightmapUVs[ind[1]] * barycentrics.y +
+                             scene.lightmapUVs[ind[2]] * barycentrics.z;
+    }
+
+    payload.objectId = triangle.nodeIndex;
+}
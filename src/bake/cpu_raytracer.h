@@ -0,0 +1,119 @@
+#pragma once
+
+#include "../../shaders/common.glsl"
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Nodes and triangle blocks are as wide as the vector unit the bake is compiled for
+#if defined(__AVX__)
+#define BVH_WIDTH 8
+#else
+#define BVH_WIDTH 4
+#endif
+
+// Rays traced together by trace_packet, one SIMD lane per ray
+#define CPU_RAY_PACKET_SIZE BVH_WIDTH
+
+struct GltfScene;
+
+struct CpuRay
+{
+    glm::vec3 origin;
+    float tMin;
+    glm::vec3 direction;
+    float tMax;
+};
+
+// CPU counterpart of the precalculation ray tracing pipeline (precalculate_probe_rt.*).
+// Hits are reported the same way precalculate_probe_rt.rchit/.rmiss fill GPUHitPayload.
+// The acceleration structure is a binned SAH BVH collapsed into BVH_WIDTH wide nodes, leaves
+// hold blocks of BVH_WIDTH triangles which are intersected with one SIMD test.
+class CpuRaytracer
+{
+public:
+    void build(GltfScene& scene);
+    GPUHitPayload trace(glm::vec3 origin, glm::vec3 direction, float tMin, float tMax) const;
+    // Traces rays in packets of CPU_RAY_PACKET_SIZE, works best when the rays of a packet are
+    // coherent (same origin, nearby directions)
+    void trace_packet(const CpuRay* rays, int rayCount, GPUHitPayload* outPayloads) const;
+
+private:
+    struct alignas(32) WideNode
+    {
+        float boundsMin[3][BVH_WIDTH];
+        float boundsMax[3][BVH_WIDTH];
+        uint32_t child[BVH_WIDTH];      // inner node index, or first block of a leaf
+        uint32_t blockCount[BVH_WIDTH]; // 0 for inner children
+    };
+
+    struct alignas(32) TriangleBlock
+    {
+        float v0[3][BVH_WIDTH];
+        float edge1[3][BVH_WIDTH];
+        float edge2[3][BVH_WIDTH];
+        uint32_t triangle[BVH_WIDTH]; // index into _triangles, padding lanes have zero edges
+    };
+
+    struct Triangle
+    {
+        glm::vec3 v0;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+        int nodeIndex;
+        uint32_t indexOffset;
+        uint32_t vertexOffset;
+    };
+
+    struct BuildNode
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        uint32_t left; // right child is left + 1
+        uint32_t first;
+        uint32_t count; // 0 for inner nodes
+    };
+
+    struct HitRecord
+    {
+        float t;
+        float u;
+        float v;
+        int triangle;
+    };
+
+    struct TraversalRay
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        glm::vec3 invDirection;
+        float tMin;
+    };
+
+    struct StackEntry
+    {
+        uint32_t child;
+        uint32_t blockCount; // 0 for inner nodes
+        float tNear;
+    };
+
+    void build_sah(std::vector<BuildNode>& buildNodes, uint32_t nodeIndex, uint32_t first,
+                   uint32_t count, std::vector<uint32_t>& order,
+                   const std::vector<glm::vec3>& centroids,
+                   const std::vector<glm::vec3>& triangleMin,
+                   const std::vector<glm::vec3>& triangleMax);
+    uint32_t collapse(const std::vector<BuildNode>& buildNodes, uint32_t buildNodeIndex);
+    static TraversalRay make_traversal_ray(const glm::vec3& origin, const glm::vec3& direction,
+                                           float tMin);
+    uint32_t intersect_node(const WideNode& node, const TraversalRay& ray, float tMax,
+                            float* outTNear) const;
+    void intersect_leaf(uint32_t firstBlock, uint32_t blockCount, const TraversalRay& ray,
+                        HitRecord& hit) const;
+    void fill_payload(const HitRecord& hit, GPUHitPayload& payload) const;
+
+    GltfScene* _scene = nullptr;
+    std::vector<Triangle> _triangles;
+    std::vector<TriangleBlock> _blocks;
+    std::vector<WideNode> _nodes;
+    std::vector<glm::mat3> _normalMatrices;
+};
@@ -0,0 +1,300 @@
+#include "gi_reference.h"
+
+#include "bake_profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+#include <immintrin.h>
+#include <string.h>
+#include <vector>
+
+#define GI_REFERENCE_PI 3.14159265358979323846264f
+
+// baked_window of gi_cluster_projection.comp, indexed by the degree of the basis function
+static const float bakedWindow[] = {1,        0.983632f, 0.935489f, 0.858394f,
+                                    0.756827f, 0.63662f,  0.504551f, 0.367883f};
+
+static inline __m128 load_color(const glm::vec4& color)
+{
+    return _mm_loadu_ps(&color.x);
+}
+
+static inline void store_color(glm::vec4& color, __m128 value)
+{
+    _mm_storeu_ps(&color.x, value);
+}
+
+// texture() with the LINEAR sampler of the render graph: texel centers at half texels and
+// the coordinates clamped to the edge texels
+static glm::vec4 sample_bilinear(const glm::vec4* image, int width, int height, glm::vec2 uv)
+{
+    float x = uv.x * width - 0.5f;
+    float y = uv.y * height - 0.5f;
+    float x0 = std::floor(x);
+    float y0 = std::floor(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    int left = std::clamp((int)x0, 0, width - 1);
+    int right = std::clamp((int)x0 + 1, 0, width - 1);
+    int top = std::clamp((int)y0, 0, height - 1);
+    int bottom = std::clamp((int)y0 + 1, 0, height - 1);
+
+    glm::vec4 upper = glm::mix(image[top * width + left], image[top * width + right], fx);
+    glm::vec4 lower =
+        glm::mix(image[bottom * width + left], image[bottom * width + right], fx);
+    return glm::mix(upper, lower, fy);
+}
+
+// Elements first to first + count of a packed matrix with their scale applied, the same
+// values as dequantize_matrix_element without deciding the format for every element
+static void unpack_row(int format, const uint32_t* words, size_t first, int count, float scale,
+                       float* out)
+{
+    switch (format)
+    {
+    case MATRIX_FORMAT_FP32:
+        for (int i = 0; i < count; i++)
+        {
+            float value;
+            memcpy(&value, &words[first + i], sizeof(float));
+            out[i] = value * scale;
+        }
+        break;
+    case MATRIX_FORMAT_FP16:
+        for (int i = 0; i < count; i++)
+        {
+            size_t element = first + i;
+            out[i] = glm::unpackHalf1x16(words[element / 2] >> (element % 2 * 16) & 0xFFFF) *
+                     scale;
+        }
+        break;
+    case MATRIX_FORMAT_SNORM16:
+        for (int i = 0; i < count; i++)
+        {
+            size_t element = first + i;
+            out[i] = (int16_t)(words[element / 2] >> (element % 2 * 16)) * scale;
+        }
+        break;
+    default:
+        for (int i = 0; i < count; i++)
+        {
+            size_t element = first + i;
+            out[i] = (int8_t)(words[element / 4] >> (element % 4 * 8)) * scale;
+        }
+        break;
+    }
+}
+
+namespace gi_reference
+{
+GIConfig make_config(const PrecalculationInfo& precalculationInfo,
+                     const PrecalculationLoadData& precalculationLoadData,
+                     glm::vec2 lightmapInputSize)
+{
+    GIConfig config = {};
+    config.lightmapInputSize = lightmapInputSize;
+    config.probeCount = precalculationLoadData.probesCount;
+    config.rayCount = precalculationInfo.raysPerProbe;
+    config.basisFunctionCount =
+        SPHERICAL_HARMONICS_NUM_COEFF(precalculationInfo.sphericalHarmonicsOrder);
+    config.clusterCount = precalculationLoadData.aabbClusterCount;
+    config.pcaCoefficient = precalculationInfo.clusterCoefficientCount;
+    config.maxReceiversInCluster = precalculationInfo.maxReceiversInCluster;
+    config.matrixFormat = precalculationInfo.matrixFormat;
+    return config;
+}
+
+void probe_projection(const GIConfig& config, const GPUProbeRaycastResult* probeRaycasts,
+                      const float* probeBasis, const glm::vec4* lightmap, int lightmapWidth,
+                      int lightmapHeight, glm::vec4* outProbeColors)
+{
+    int basisCount = config.basisFunctionCount;
+
+#pragma omp parallel
+    {
+        // Every ray samples the lightmap once and adds to all basis functions of its probe,
+        // each sum still runs over the rays in order like one shader invocation does
+        std::vector<glm::vec4> sums(basisCount);
+
+#pragma omp for schedule(dynamic, 16)
+        for (int probe = 0; probe < config.probeCount; probe++)
+        {
+            std::fill(sums.begin(), sums.end(), glm::vec4(0));
+
+            for (int j = 0; j < config.rayCount; j++)
+            {
+                // Misses add black, which leaves the sums as they are
+                const GPUProbeRaycastResult& ray = probeRaycasts[probe * config.rayCount + j];
+                if (ray.objectId == -1)
+                {
+                    continue;
+                }
+                glm::vec4 sample = sample_bilinear(lightmap, lightmapWidth, lightmapHeight,
+                                                   ray.lightmapUv / config.lightmapInputSize);
+                __m128 color = _mm_setr_ps(sample.r, sample.g, sample.b, 1);
+
+                const float* basis = &probeBasis[(size_t)j * basisCount];
+                for (int b = 0; b < basisCount; b++)
+                {
+                    __m128 weighted = _mm_mul_ps(_mm_set1_ps(basis[b]), color);
+                    store_color(sums[b], _mm_add_ps(load_color(sums[b]), weighted));
+                }
+            }
+
+            std::copy(sums.begin(), sums.end(), &outProbeColors[(size_t)probe * basisCount]);
+        }
+    }
+}
+
+void cluster_projection(const GIConfig& config, int basisSize,
+                        const ClusterReceiverInfo* clusters, const int* clusterProbes,
+                        const uint32_t* projectionMatrices, const float* projectionScales,
+                        const glm::vec4* probeColors, glm::vec4* outClusterColors)
+{
+    basisSize = std::min({basisSize, config.basisFunctionCount, GI_REFERENCE_MAX_BASIS_SIZE});
+
+    // The degree of basis function k is floor(sqrt(k))
+    float window[GI_REFERENCE_MAX_BASIS_SIZE];
+    for (int degree = 0; degree * degree < GI_REFERENCE_MAX_BASIS_SIZE; degree++)
+    {
+        for (int k = degree * degree; k < (degree + 1) * (degree + 1); k++)
+        {
+            window[k] = bakedWindow[degree];
+        }
+    }
+
+#pragma omp parallel
+    {
+        float row[GI_REFERENCE_MAX_BASIS_SIZE];
+
+#pragma omp for schedule(dynamic, 4)
+        for (int cluster = 0; cluster < config.clusterCount; cluster++)
+        {
+            const ClusterReceiverInfo& info = clusters[cluster];
+            int coeffCount = std::min(info.svdCoeffCount, config.pcaCoefficient);
+
+            for (int coeff = 0; coeff < coeffCount; coeff++)
+            {
+                float scale = projectionScales[info.svdCoeffOffset + coeff];
+                __m128 sum = _mm_setzero_ps();
+
+                for (int i = 0; i < info.probeCount; i++)
+                {
+                    size_t first =
+                        info.projectionMatrixOffset +
+                        ((size_t)coeff * info.probeCount + i) * config.basisFunctionCount;
+                    unpack_row(config.matrixFormat, projectionMatrices, first, basisSize,
+                               scale, row);
+
+                    const glm::vec4* colors =
+                        &probeColors[(size_t)clusterProbes[info.probeOffset + i] *
+                                     config.basisFunctionCount];
+                    for (int k = 0; k < basisSize; k++)
+                    {
+                        __m128 weighted =
+                            _mm_mul_ps(_mm_set1_ps(window[k]), load_color(colors[k]));
+                        sum = _mm_add_ps(sum, _mm_mul_ps(weighted, _mm_set1_ps(row[k])));
+                    }
+                }
+
+                store_color(outClusterColors[info.svdCoeffOffset + coeff], sum);
+            }
+        }
+    }
+}
+
+void receiver_reconstruction(const GIConfig& config, const ClusterReceiverInfo* clusters,
+                             const glm::ivec4* clusterReceiverUvs,
+                             const uint32_t* reconstructionMatrices,
+                             const float* reconstructionScales, const glm::vec4* clusterColors,
+                             float historyWeight, glm::vec4* indirectLightmap,
+                             int indirectLightmapWidth)
+{
+    __m128 history = _mm_set1_ps(historyWeight);
+    __m128 current = _mm_set1_ps(1.0f - historyWeight);
+    __m128 pi = _mm_set1_ps(GI_REFERENCE_PI);
+
+#pragma omp parallel
+    {
+        std::vector<float> row;
+
+#pragma omp for schedule(dynamic, 4)
+        for (int cluster = 0; cluster < config.clusterCount; cluster++)
+        {
+            const ClusterReceiverInfo& info = clusters[cluster];
+            int receiverCount = std::min(info.receiverCount, config.maxReceiversInCluster);
+            int coeffCount = info.svdCoeffCount;
+            float scale = reconstructionScales[cluster];
+            row.resize(std::max(coeffCount, 1));
+
+            for (int j = 0; j < receiverCount; j++)
+            {
+                unpack_row(config.matrixFormat, reconstructionMatrices,
+                           info.reconstructionMatrixOffset + (size_t)j * coeffCount,
+                           coeffCount, scale, row.data());
+
+                __m128 sum = _mm_setzero_ps();
+                const glm::vec4* colors = &clusterColors[info.svdCoeffOffset];
+                for (int i = 0; i < coeffCount; i++)
+                {
+                    __m128 weighted = _mm_mul_ps(_mm_set1_ps(row[i]), load_color(colors[i]));
+                    sum = _mm_add_ps(sum, weighted);
+                }
+
+                // Clamped to black, alpha set to pi so it comes out as 1 after the division
+                glm::vec4 result;
+                store_color(result, _mm_max_ps(sum, _mm_setzero_ps()));
+                result.a = GI_REFERENCE_PI;
+
+                glm::ivec4 uv = clusterReceiverUvs[info.receiverOffset + j];
+                glm::vec4& texel =
+                    indirectLightmap[(size_t)uv.y * indirectLightmapWidth + uv.x];
+                __m128 blended =
+                    _mm_add_ps(_mm_mul_ps(load_color(texel), history),
+                               _mm_mul_ps(_mm_div_ps(load_color(result), pi), current));
+                store_color(texel, blended);
+            }
+        }
+    }
+}
+
+void relight(const PrecalculationInfo& precalculationInfo,
+             const PrecalculationLoadData& precalculationLoadData,
+             const PrecalculationResult& precalculationResult, glm::vec2 lightmapInputSize,
+             int basisSize, const glm::vec4* lightmap, int lightmapWidth, int lightmapHeight,
+             float historyWeight, glm::vec4* indirectLightmap)
+{
+    GIConfig config = make_config(precalculationInfo, precalculationLoadData,
+                                  lightmapInputSize);
+    std::vector<glm::vec4> probeColors((size_t)config.probeCount * config.basisFunctionCount);
+    std::vector<glm::vec4> clusterColors(precalculationLoadData.totalSvdCoeffCount);
+
+    {
+        BakeProfileZone zone("gi_probe_projection");
+        probe_projection(config, precalculationResult.probeRaycastResult,
+                         precalculationResult.probeRaycastBasisFunctions, lightmap,
+                         lightmapWidth, lightmapHeight, probeColors.data());
+        zone.add_items((int64_t)config.probeCount * config.rayCount);
+    }
+    {
+        BakeProfileZone zone("gi_cluster_projection");
+        cluster_projection(config, basisSize, precalculationResult.clusterReceiverInfos,
+                           precalculationResult.clusterProbes,
+                           precalculationResult.clusterProjectionMatrices,
+                           precalculationResult.clusterProjectionScales, probeColors.data(),
+                           clusterColors.data());
+        zone.add_items(precalculationLoadData.projectionMatricesSize);
+    }
+    {
+        BakeProfileZone zone("gi_receiver_reconstruction");
+        receiver_reconstruction(config, precalculationResult.clusterReceiverInfos,
+                                precalculationResult.clusterReceiverUvs,
+                                precalculationResult.receiverCoefficientMatrices,
+                                precalculationResult.receiverCoefficientScales,
+                                clusterColors.data(), historyWeight, indirectLightmap,
+                                precalculationInfo.lightmapResolution);
+        zone.add_items(precalculationLoadData.reconstructionMatricesSize);
+    }
+}
+} // namespace gi_reference
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../../shaders/common.glsl"
+#include <glm/glm.hpp>
+#include <precalculation_types.h>
+
+// Share of the previous frame kept by gi_receiver_reconstruction.comp (its ALPHA). Passing 0
+// as the history weight gives the value the indirect lightmap converges to instead.
+#define GI_REFERENCE_HISTORY_WEIGHT 0.7f
+// Basis functions the cluster projection window is baked for (degree 7)
+#define GI_REFERENCE_MAX_BASIS_SIZE 64
+
+// CPU implementation of the runtime diffuse GI of DiffuseIllumination::render, for relighting
+// without a GPU and for checking the shaders against. Every stage computes the same sums in
+// the same order as its shader, one color per SIMD register, and runs its outer loop on all
+// OpenMP threads. Only the bilinear lightmap lookup differs from the texture unit in its
+// rounding. The matrices are read in the format of the bake, so timing the stages compares
+// the matrix layouts too.
+namespace gi_reference
+{
+// What DiffuseIllumination::init uploads, lightmapInputSize is the size of the lightmap UVs
+GIConfig make_config(const PrecalculationInfo& precalculationInfo,
+                     const PrecalculationLoadData& precalculationLoadData,
+                     glm::vec2 lightmapInputSize);
+
+// gi_probe_projection.comp: the lit lightmap seen by the rays of every probe projected onto
+// the basis functions, probeCount * basisFunctionCount colors. The lightmap is sampled like
+// the LINEAR sampler of the render graph (bilinear, clamped to the edges).
+void probe_projection(const GIConfig& config, const GPUProbeRaycastResult* probeRaycasts,
+                      const float* probeBasis, const glm::vec4* lightmap, int lightmapWidth,
+                      int lightmapHeight, glm::vec4* outProbeColors);
+
+// gi_cluster_projection.comp: one color per PCA coefficient of every cluster, indexed by
+// svdCoeffOffset. basisSize is the BASIS_SIZE the shader is compiled with, at most
+// GI_REFERENCE_MAX_BASIS_SIZE.
+void cluster_projection(const GIConfig& config, int basisSize,
+                        const ClusterReceiverInfo* clusters, const int* clusterProbes,
+                        const uint32_t* projectionMatrices, const float* projectionScales,
+                        const glm::vec4* probeColors, glm::vec4* outClusterColors);
+
+// gi_receiver_reconstruction.comp: blends the color of every cluster receiver into its texel
+// of the indirect lightmap, which is indirectLightmapWidth texels wide
+void receiver_reconstruction(const GIConfig& config, const ClusterReceiverInfo* clusters,
+                             const glm::ivec4* clusterReceiverUvs,
+                             const uint32_t* reconstructionMatrices,
+                             const float* reconstructionScales, const glm::vec4* clusterColors,
+                             float historyWeight, glm::vec4* indirectLightmap,
+                             int indirectLightmapWidth);
+
+// All three stages for a loaded bake, indirectLightmap has lightmapResolution^2 texels
+void relight(const PrecalculationInfo& precalculationInfo,
+             const PrecalculationLoadData& precalculationLoadData,
+             const PrecalculationResult& precalculationResult, glm::vec2 lightmapInputSize,
+             int basisSize, const glm::vec4* lightmap, int lightmapWidth, int lightmapHeight,
+             float historyWeight, glm::vec4* indirectLightmap);
+} // namespace gi_reference
@@ -0,0 +1,71 @@
+#include "incremental_svd.h"
+
+#include <algorithm>
+
+void IncrementalSvd::reset(int cols, int maxRank)
+{
+    _cols = cols;
+    _maxRank = std::min(maxRank, cols);
+    _energy = 0;
+    _singularValues.resize(0);
+    _v.resize(cols, 0);
+}
+
+void IncrementalSvd::add_row(const float* row)
+{
+    Eigen::VectorXd a = Eigen::Map<const Eigen::VectorXf>(row, _cols).cast<double>();
+    double squaredNorm = a.squaredNorm();
+    _energy += squaredNorm;
+    if (squaredNorm == 0)
+    {
+        return;
+    }
+
+    // Split the row into its part in the span of V and the orthogonal rest, twice so that V
+    // stays orthonormal after many updates
+    int rank = this->rank();
+    Eigen::VectorXd p = _v.transpose() * a;
+    _residual = a - _v * p;
+    Eigen::VectorXd correction = _v.transpose() * _residual;
+    _residual -= _v * correction;
+    p += correction;
+
+    double rho = _residual.norm();
+    bool grow = rho > 1e-9 * std::sqrt(squaredNorm);
+    int n = grow ? rank + 1 : rank;
+
+    // The new row appended to diag(S) V^T is [diag(S) 0; p^T rho] [V r/rho]^T, its right
+    // singular vectors are the eigenvectors of diag(S^2, 0) + z z^T with z = (p, rho)
+    Eigen::VectorXd z(n);
+    z.head(rank) = p;
+    if (grow)
+    {
+        z[rank] = rho;
+    }
+    Eigen::MatrixXd gram = z * z.transpose();
+    gram.diagonal().head(rank) += _singularValues.cwiseAbs2();
+
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(gram);
+    int newRank = std::min(n, _maxRank);
+    // Eigenvalues are ascending, keep the largest ones in descending order
+    Eigen::MatrixXd rotation = eigen.eigenvectors().rightCols(newRank).rowwise().reverse();
+    Eigen::VectorXd values = eigen.eigenvalues().tail(newRank).reverse();
+
+    Eigen::MatrixXd v = _v * rotation.topRows(rank);
+    if (grow)
+    {
+        v += (_residual / rho) * rotation.row(rank);
+    }
+    _v = std::move(v);
+    _singularValues = values.cwiseMax(0.0).cwiseSqrt();
+}
+
+double IncrementalSvd::residual(int k) const
+{
+    double result = _energy;
+    for (int j = 0; j < std::min(k, rank()); j++)
+    {
+        result -= _singularValues[j] * _singularValues[j];
+    }
+    return result;
+}
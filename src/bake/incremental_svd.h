@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+// Truncated SVD of a matrix that grows one row at a time, updated with Brand's rank one
+// modification of the thin SVD. Only the singular values and right singular vectors are
+// kept, so adding a row costs O(cols * rank^2 + rank^3) no matter how many rows were added.
+// Directions beyond maxRank are dropped, which can only make residual() larger than the
+// residual of an exact SVD.
+class IncrementalSvd
+{
+public:
+    void reset(int cols, int maxRank);
+    void add_row(const float* row);
+
+    int rank() const
+    {
+        return (int)_singularValues.size();
+    }
+    const Eigen::VectorXd& singular_values() const
+    {
+        return _singularValues;
+    }
+    // Squared norm of the rows that is not captured by the first k singular values
+    double residual(int k) const;
+
+private:
+    int _cols = 0;
+    int _maxRank = 0;
+    double _energy = 0; // squared Frobenius norm of the added rows
+    Eigen::VectorXd _singularValues; // descending
+    Eigen::MatrixXd _v;              // cols x rank
+    Eigen::VectorXd _residual;
+};
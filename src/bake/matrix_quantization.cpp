@@ -0,0 +1,247 @@
+#include "matrix_quantization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+#include <random>
+#include <string.h>
+#include <vector>
+
+static int snorm_max(int format)
+{
+    return format == MATRIX_FORMAT_SNORM8 ? 127 : 32767;
+}
+
+static bool is_snorm(int format)
+{
+    return format == MATRIX_FORMAT_SNORM16 || format == MATRIX_FORMAT_SNORM8;
+}
+
+int matrix_format_word_count(int format, int elementCount)
+{
+    int elementsPerWord = 1;
+    if (format == MATRIX_FORMAT_FP16 || format == MATRIX_FORMAT_SNORM16)
+    {
+        elementsPerWord = 2;
+    }
+    else if (format == MATRIX_FORMAT_SNORM8)
+    {
+        elementsPerWord = 4;
+    }
+    return std::max(1, (elementCount + elementsPerWord - 1) / elementsPerWord);
+}
+
+const char* matrix_format_name(int format)
+{
+    switch (format)
+    {
+    case MATRIX_FORMAT_FP32:
+        return "fp32";
+    case MATRIX_FORMAT_FP16:
+        return "fp16";
+    case MATRIX_FORMAT_SNORM16:
+        return "snorm16";
+    case MATRIX_FORMAT_SNORM8:
+        return "snorm8";
+    }
+    return "unknown";
+}
+
+int matrix_format_from_name(const char* name)
+{
+    for (int format = MATRIX_FORMAT_FP32; format <= MATRIX_FORMAT_SNORM8; format++)
+    {
+        if (strcmp(name, matrix_format_name(format)) == 0)
+        {
+            return format;
+        }
+    }
+    return -1;
+}
+
+// Value is already divided by the scale of its matrix
+static void pack_element(int format, uint32_t* words, int element, float value)
+{
+    if (format == MATRIX_FORMAT_FP32)
+    {
+        memcpy(&words[element], &value, sizeof(float));
+    }
+    else if (format == MATRIX_FORMAT_FP16)
+    {
+        words[element / 2] |= (uint32_t)glm::packHalf1x16(value) << (element % 2 * 16);
+    }
+    else
+    {
+        int limit = snorm_max(format);
+        int quantized = std::clamp((int)std::lround(value), -limit, limit);
+        if (format == MATRIX_FORMAT_SNORM16)
+        {
+            words[element / 2] |= ((uint32_t)quantized & 0xFFFF) << (element % 2 * 16);
+        }
+        else
+        {
+            words[element / 4] |= ((uint32_t)quantized & 0xFF) << (element % 4 * 8);
+        }
+    }
+}
+
+float dequantize_matrix_element(int format, const uint32_t* words, int element, float scale)
+{
+    if (format == MATRIX_FORMAT_FP32)
+    {
+        float value;
+        memcpy(&value, &words[element], sizeof(float));
+        return value * scale;
+    }
+    else if (format == MATRIX_FORMAT_FP16)
+    {
+        return glm::unpackHalf1x16(words[element / 2] >> (element % 2 * 16) & 0xFFFF) *
+               scale;
+    }
+    else if (format == MATRIX_FORMAT_SNORM16)
+    {
+        return (int16_t)(words[element / 2] >> (element % 2 * 16)) * scale;
+    }
+    return (int8_t)(words[element / 4] >> (element % 4 * 8)) * scale;
+}
+
+static float quantization_scale(int format, const float* values, int count)
+{
+    if (!is_snorm(format))
+    {
+        return 1;
+    }
+    float maxValue = 0;
+    for (int i = 0; i < count; i++)
+    {
+        maxValue = std::max(maxValue, std::abs(values[i]));
+    }
+    return maxValue / snorm_max(format);
+}
+
+static void pack_matrix(int format, const float* values, int offset, int count, float scale,
+                        uint32_t* outWords)
+{
+    float invScale = scale > 0 ? 1.0f / scale : 0.0f;
+    for (int i = 0; i < count; i++)
+    {
+        pack_element(format, outWords, offset + i, values[offset + i] * invScale);
+    }
+}
+
+void quantize_matrices(int format, const ClusterReceiverInfo* clusters, int clusterCount,
+                       int basisFunctionCount, int projectionMatricesSize,
+                       int reconstructionMatricesSize, const float* projectionMatrices,
+                       const float* reconstructionMatrices, uint32_t* outProjectionMatrices,
+                       float* outProjectionScales, uint32_t* outReconstructionMatrices,
+                       float* outReconstructionScales)
+{
+    // Neighbouring matrices can share a word, so the words are only ever or-ed into
+    memset(outProjectionMatrices, 0,
+           matrix_format_word_count(format, projectionMatricesSize) * sizeof(uint32_t));
+    memset(outReconstructionMatrices, 0,
+           matrix_format_word_count(format, reconstructionMatricesSize) * sizeof(uint32_t));
+
+    for (int c = 0; c < clusterCount; c++)
+    {
+        const ClusterReceiverInfo& cluster = clusters[c];
+        int rowSize = cluster.probeCount * basisFunctionCount;
+        for (int k = 0; k < cluster.svdCoeffCount; k++)
+        {
+            int offset = cluster.projectionMatrixOffset + k * rowSize;
+            float scale = quantization_scale(format, projectionMatrices + offset, rowSize);
+            outProjectionScales[cluster.svdCoeffOffset + k] = scale;
+            pack_matrix(format, projectionMatrices, offset, rowSize, scale,
+                        outProjectionMatrices);
+        }
+
+        int offset = cluster.reconstructionMatrixOffset;
+        int size = cluster.receiverCount * cluster.svdCoeffCount;
+        float scale = quantization_scale(format, reconstructionMatrices + offset, size);
+        outReconstructionScales[c] = scale;
+        pack_matrix(format, reconstructionMatrices, offset, size, scale,
+                    outReconstructionMatrices);
+    }
+}
+
+MatrixQuantizationError measure_quantization_error(
+    int format, const ClusterReceiverInfo* clusters, int clusterCount, int basisFunctionCount,
+    const float* projectionMatrices, const float* reconstructionMatrices,
+    const uint32_t* quantizedProjectionMatrices, const float* projectionScales,
+    const uint32_t* quantizedReconstructionMatrices, const float* reconstructionScales)
+{
+    double projectionError = 0, projectionNorm = 0;
+    double reconstructionError = 0, reconstructionNorm = 0;
+    double transferError = 0, transferNorm = 0;
+    double transferMax = 0;
+
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> distribution(0, 1);
+    std::vector<float> probeColors;
+    std::vector<double> reference, quantized;
+
+    for (int c = 0; c < clusterCount; c++)
+    {
+        const ClusterReceiverInfo& cluster = clusters[c];
+        int rowSize = cluster.probeCount * basisFunctionCount;
+        probeColors.resize(rowSize);
+        for (float& color : probeColors)
+        {
+            color = distribution(generator);
+        }
+
+        reference.assign(cluster.svdCoeffCount, 0);
+        quantized.assign(cluster.svdCoeffCount, 0);
+        for (int k = 0; k < cluster.svdCoeffCount; k++)
+        {
+            int offset = cluster.projectionMatrixOffset + k * rowSize;
+            float scale = projectionScales[cluster.svdCoeffOffset + k];
+            for (int i = 0; i < rowSize; i++)
+            {
+                float value = projectionMatrices[offset + i];
+                float dequantized = dequantize_matrix_element(
+                    format, quantizedProjectionMatrices, offset + i, scale);
+                projectionError += (double)(dequantized - value) * (dequantized - value);
+                projectionNorm += (double)value * value;
+                reference[k] += (double)value * probeColors[i];
+                quantized[k] += (double)dequantized * probeColors[i];
+            }
+        }
+
+        double clusterError = 0, clusterNorm = 0;
+        float scale = reconstructionScales[c];
+        for (int r = 0; r < cluster.receiverCount; r++)
+        {
+            double referenceColor = 0, quantizedColor = 0;
+            for (int k = 0; k < cluster.svdCoeffCount; k++)
+            {
+                int index =
+                    cluster.reconstructionMatrixOffset + r * cluster.svdCoeffCount + k;
+                float value = reconstructionMatrices[index];
+                float dequantized = dequantize_matrix_element(
+                    format, quantizedReconstructionMatrices, index, scale);
+                reconstructionError += (double)(dequantized - value) * (dequantized - value);
+                reconstructionNorm += (double)value * value;
+                referenceColor += value * reference[k];
+                quantizedColor += dequantized * quantized[k];
+            }
+            clusterError += (quantizedColor - referenceColor) * (quantizedColor - referenceColor);
+            clusterNorm += referenceColor * referenceColor;
+        }
+
+        transferError += clusterError;
+        transferNorm += clusterNorm;
+        if (clusterNorm > 0)
+        {
+            transferMax = std::max(transferMax, std::sqrt(clusterError / clusterNorm));
+        }
+    }
+
+    MatrixQuantizationError result = {};
+    result.projectionRms = projectionNorm > 0 ? std::sqrt(projectionError / projectionNorm) : 0;
+    result.reconstructionRms =
+        reconstructionNorm > 0 ? std::sqrt(reconstructionError / reconstructionNorm) : 0;
+    result.transferRms = transferNorm > 0 ? std::sqrt(transferError / transferNorm) : 0;
+    result.transferMax = transferMax;
+    return result;
+}
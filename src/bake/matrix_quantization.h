@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../../shaders/common.glsl"
+#include <stdint.h>
+
+// Packs the PCA matrices of the bake into one of the MATRIX_FORMAT_* layouts of common.glsl.
+// Projection matrices get a scale per row (indexed like the cluster projection output, by
+// svdCoeffOffset + coefficient), reconstruction matrices a scale per cluster. The snorm
+// scales are the largest magnitude they cover divided by the largest snorm value.
+
+// Words needed to store elementCount elements, at least one so the buffer is never empty
+int matrix_format_word_count(int format, int elementCount);
+const char* matrix_format_name(int format);
+// -1 for unknown names
+int matrix_format_from_name(const char* name);
+
+// The packed arrays have matrix_format_word_count words, the projection scales one entry per
+// cluster coefficient and the reconstruction scales one per cluster
+void quantize_matrices(int format, const ClusterReceiverInfo* clusters, int clusterCount,
+                       int basisFunctionCount, int projectionMatricesSize,
+                       int reconstructionMatricesSize, const float* projectionMatrices,
+                       const float* reconstructionMatrices, uint32_t* outProjectionMatrices,
+                       float* outProjectionScales, uint32_t* outReconstructionMatrices,
+                       float* outReconstructionScales);
+
+// Same as the dequantization in the GI shaders
+float dequantize_matrix_element(int format, const uint32_t* words, int element, float scale);
+
+struct MatrixQuantizationError
+{
+    // Relative to the norm of the fp32 matrices
+    float projectionRms;
+    float reconstructionRms;
+    // Receiver colors of the fp32 and the quantized matrices for random probe colors,
+    // relative to the norm of the fp32 colors, over the whole bake and of the worst cluster
+    float transferRms;
+    float transferMax;
+};
+
+MatrixQuantizationError measure_quantization_error(
+    int format, const ClusterReceiverInfo* clusters, int clusterCount, int basisFunctionCount,
+    const float* projectionMatrices, const float* reconstructionMatrices,
+    const uint32_t* quantizedProjectionMatrices, const float* projectionScales,
+    const uint32_t* quantizedReconstructionMatrices, const float* reconstructionScales);
@@ -0,0 +1,185 @@
+#include "probe_grid.h"
+
+#include <algorithm>
+#include <limits>
+#include <queue>
+
+#define PROBE_GRID_POINTS_PER_CELL 4
+#define PROBE_GRID_MAX_CELLS (1 << 24)
+
+void ProbeGrid::build(const std::vector<glm::vec4>& positions, float cellSize)
+{
+    _points.clear();
+    _indices.clear();
+    _cellStart.clear();
+    _dims = glm::ivec3(0);
+
+    if (positions.empty())
+    {
+        return;
+    }
+
+    glm::vec3 boundsMin = glm::vec3(positions[0]);
+    glm::vec3 boundsMax = boundsMin;
+    for (const glm::vec4& position : positions)
+    {
+        boundsMin = glm::min(boundsMin, glm::vec3(position));
+        boundsMax = glm::max(boundsMax, glm::vec3(position));
+    }
+
+    glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(1e-4f));
+    if (cellSize <= 0)
+    {
+        float volume = extent.x * extent.y * extent.z;
+        cellSize = std::cbrt(volume * PROBE_GRID_POINTS_PER_CELL / positions.size());
+    }
+
+    // Keep the cell count proportional to the probes for flat or very sparse sets
+    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    cellSize = std::max(cellSize, maxExtent / 1024.f);
+    while ((double)(extent.x / cellSize + 1) * (extent.y / cellSize + 1) *
+               (extent.z / cellSize + 1) >
+           std::max<double>(PROBE_GRID_MAX_CELLS / 8, positions.size() * 8.0))
+    {
+        cellSize *= 2;
+    }
+
+    _min = boundsMin;
+    _cellSize = cellSize;
+    _dims = glm::ivec3(extent / cellSize) + 1;
+
+    // Counting sort of the positions by cell
+    int cellCount = _dims.x * _dims.y * _dims.z;
+    std::vector<int> cells(positions.size());
+    _cellStart.assign(cellCount + 1, 0);
+    for (int i = 0; i < positions.size(); i++)
+    {
+        glm::ivec3 cell = cell_of(glm::vec3(positions[i]));
+        cells[i] = cell_index(cell.x, cell.y, cell.z);
+        _cellStart[cells[i] + 1]++;
+    }
+
+    for (int i = 0; i < cellCount; i++)
+    {
+        _cellStart[i + 1] += _cellStart[i];
+    }
+
+    std::vector<uint32_t> cursor(_cellStart.begin(), _cellStart.end() - 1);
+    _points.resize(positions.size());
+    _indices.resize(positions.size());
+    for (int i = 0; i < positions.size(); i++)
+    {
+        uint32_t slot = cursor[cells[i]]++;
+        _points[slot] = glm::vec3(positions[i]);
+        _indices[slot] = i;
+    }
+}
+
+glm::ivec3 ProbeGrid::cell_of(glm::vec3 point) const
+{
+    glm::vec3 cell = glm::floor((point - _min) / _cellSize);
+    cell = glm::clamp(cell, glm::vec3(0), glm::vec3(_dims - 1));
+    return glm::ivec3(cell);
+}
+
+void ProbeGrid::query_nearest(glm::vec3 point, int k, std::vector<int>& outIndices,
+                              std::vector<float>& outDistances) const
+{
+    outIndices.clear();
+    outDistances.clear();
+    if (_points.empty() || k <= 0)
+    {
+        return;
+    }
+
+    // Max heap of the k closest points found so far
+    std::priority_queue<std::pair<float, int>> closest;
+    glm::ivec3 center = cell_of(point);
+    int maxRing = std::max(std::max(center.x, _dims.x - 1 - center.x),
+                           std::max(std::max(center.y, _dims.y - 1 - center.y),
+                                    std::max(center.z, _dims.z - 1 - center.z)));
+
+    // Visit shells of cells around the center until nothing outside the searched block can
+    // be closer than the k-th point
+    for (int ring = 0; ring <= maxRing; ring++)
+    {
+        glm::ivec3 minCell = glm::max(center - ring, glm::ivec3(0));
+        glm::ivec3 maxCell = glm::min(center + ring, _dims - 1);
+
+        for (int z = minCell.z; z <= maxCell.z; z++)
+        {
+            for (int y = minCell.y; y <= maxCell.y; y++)
+            {
+                bool onFace = std::abs(z - center.z) == ring || std::abs(y - center.y) == ring;
+                int step = onFace ? 1 : 2 * ring;
+                for (int x = center.x - ring; x <= center.x + ring; x += std::max(step, 1))
+                {
+                    if (x < 0 || x >= _dims.x)
+                    {
+                        continue;
+                    }
+
+                    int cell = cell_index(x, y, z);
+                    for (uint32_t i = _cellStart[cell]; i < _cellStart[cell + 1]; i++)
+                    {
+                        glm::vec3 d = _points[i] - point;
+                        float distanceSquared = glm::dot(d, d);
+                        if (closest.size() < k)
+                        {
+                            closest.push({distanceSquared, _indices[i]});
+                        }
+                        else if (distanceSquared < closest.top().first)
+                        {
+                            closest.pop();
+                            closest.push({distanceSquared, _indices[i]});
+                        }
+                    }
+                }
+            }
+        }
+
+        if (closest.size() < k)
+        {
+            continue;
+        }
+
+        // Closest distance to the cells that have not been visited yet
+        float unvisited = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (center[axis] - ring > 0)
+            {
+                float lower = _min[axis] + (center[axis] - ring) * _cellSize;
+                unvisited = std::min(unvisited, point[axis] - lower);
+            }
+            if (center[axis] + ring < _dims[axis] - 1)
+            {
+                float upper = _min[axis] + (center[axis] + ring + 1) * _cellSize;
+                unvisited = std::min(unvisited, upper - point[axis]);
+            }
+        }
+
+        unvisited = std::max(unvisited, 0.f);
+        if (closest.top().first <= unvisited * unvisited)
+        {
+            break;
+        }
+    }
+
+    outIndices.resize(closest.size());
+    outDistances.resize(closest.size());
+    for (int i = (int)closest.size() - 1; i >= 0; i--)
+    {
+        outIndices[i] = closest.top().second;
+        outDistances[i] = std::sqrt(closest.top().first);
+        closest.pop();
+    }
+}
+
+float ProbeGrid::kth_nearest_distance(glm::vec3 point, int k) const
+{
+    std::vector<int> indices;
+    std::vector<float> distances;
+    query_nearest(point, k, indices, distances);
+    return distances.empty() ? 0.f : distances.back();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Uniform grid over probe positions for the neighbour queries of the bake (receiver radius,
+// supporting probes of a cluster). Positions are stored sorted by cell, so a query only
+// touches the cells overlapping it.
+class ProbeGrid
+{
+public:
+    // A cellSize <= 0 picks a size that puts a few probes in every cell
+    void build(const std::vector<glm::vec4>& positions, float cellSize = 0);
+
+    // Calls visitor(index, distance) for every position closer than radius to point
+    template <typename Visitor>
+    void query_radius(glm::vec3 point, float radius, Visitor&& visitor) const;
+
+    // The k closest positions to point, closest first. Returns fewer when there are less than
+    // k positions.
+    void query_nearest(glm::vec3 point, int k, std::vector<int>& outIndices,
+                       std::vector<float>& outDistances) const;
+    // Distance to the k-th closest position (the farthest one when there are less than k)
+    float kth_nearest_distance(glm::vec3 point, int k) const;
+
+    int size() const
+    {
+        return (int)_points.size();
+    }
+
+private:
+    glm::ivec3 cell_of(glm::vec3 point) const;
+    int cell_index(int x, int y, int z) const
+    {
+        return x + _dims.x * (y + _dims.y * z);
+    }
+
+    glm::vec3 _min = glm::vec3(0);
+    float _cellSize = 1;
+    glm::ivec3 _dims = glm::ivec3(0);
+    std::vector<uint32_t> _cellStart; // first point of every cell, one extra entry at the end
+    std::vector<glm::vec3> _points;   // sorted by cell
+    std::vector<int> _indices;        // original index of every sorted point
+};
+
+template <typename Visitor>
+void ProbeGrid::query_radius(glm::vec3 point, float radius, Visitor&& visitor) const
+{
+    if (_points.empty())
+    {
+        return;
+    }
+
+    glm::ivec3 minCell = cell_of(point - glm::vec3(radius));
+    glm::ivec3 maxCell = cell_of(point + glm::vec3(radius));
+    float radiusSquared = radius * radius;
+
+    for (int z = minCell.z; z <= maxCell.z; z++)
+    {
+        for (int y = minCell.y; y <= maxCell.y; y++)
+        {
+            // Cells of a row are contiguous
+            uint32_t begin = _cellStart[cell_index(minCell.x, y, z)];
+            uint32_t end = _cellStart[cell_index(maxCell.x, y, z) + 1];
+            for (uint32_t i = begin; i < end; i++)
+            {
+                glm::vec3 d = _points[i] - point;
+                float distanceSquared = glm::dot(d, d);
+                if (distanceSquared < radiusSquared)
+                {
+                    visitor(_indices[i], std::sqrt(distanceSquared));
+                }
+            }
+        }
+    }
+}
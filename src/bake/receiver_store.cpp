@@ -0,0 +1,46 @@
+#include "receiver_store.h"
+
+glm::vec3 calculate_barycentric(glm::vec2 p, glm::vec2 a, glm::vec2 b, glm::vec2 c);
+glm::vec3 apply_barycentric(glm::vec3 barycentricCoordinates, glm::vec3 a, glm::vec3 b,
+                            glm::vec3 c);
+
+void ReceiverStore::get_sample(int receiver, int index, glm::vec3& outPosition,
+                               glm::vec3& outNormal) const
+{
+    uint32_t sample = samples[sampleStart[receiver] + index];
+    const ReceiverTriangle& triangle = triangles[sample >> RECEIVER_SAMPLE_BITS];
+    glm::vec3 barycentric = sample_barycentric(
+        triangle, uvs[receiver], sample & ((1 << RECEIVER_SAMPLE_BITS) - 1));
+
+    outPosition = apply_barycentric(barycentric, triangle.worldVertices[0],
+                                    triangle.worldVertices[1], triangle.worldVertices[2]);
+    outNormal = apply_barycentric(barycentric, triangle.worldNormals[0],
+                                  triangle.worldNormals[1], triangle.worldNormals[2]);
+}
+
+size_t ReceiverStore::memory_size() const
+{
+    return positions.size() * sizeof(glm::vec3) + normals.size() * sizeof(glm::vec3) +
+           uvs.size() * sizeof(glm::ivec2) + objectIds.size() * sizeof(int) +
+           sampleStart.size() * sizeof(uint32_t) + samples.size() * sizeof(uint32_t) +
+           triangles.size() * sizeof(ReceiverTriangle);
+}
+
+glm::vec3 ReceiverStore::sample_barycentric(const ReceiverTriangle& triangle,
+                                            glm::ivec2 texel, int sample)
+{
+    int maxSample = TEXEL_SAMPLES;
+    glm::vec2 pixelMiddle;
+    if (maxSample > 1)
+    {
+        pixelMiddle = {texel.x + (sample / maxSample) / ((float)(maxSample - 1)),
+                       texel.y + (sample % maxSample) / ((float)(maxSample - 1))};
+    }
+    else
+    {
+        pixelMiddle = {texel.x + 0.5, texel.y + 0.5};
+    }
+
+    return calculate_barycentric(pixelMiddle, triangle.texVertices[0],
+                                 triangle.texVertices[1], triangle.texVertices[2]);
+}
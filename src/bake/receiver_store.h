@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../../shaders/common.glsl"
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Samples are packed as triangle << RECEIVER_SAMPLE_BITS | sample of the texel grid
+#define RECEIVER_SAMPLE_BITS 6
+static_assert(TEXEL_SAMPLES * TEXEL_SAMPLES <= (1 << RECEIVER_SAMPLE_BITS),
+              "texel samples do not fit in RECEIVER_SAMPLE_BITS");
+
+struct ReceiverTriangle
+{
+    glm::vec3 worldVertices[3];
+    glm::vec3 worldNormals[3];
+    glm::vec2 texVertices[3]; // in texels
+    int nodeIndex;
+};
+
+// Lightmap receivers of the bake as a structure of arrays, only texels covered by geometry are
+// stored. The samples of receiver r are [sampleStart[r], sampleStart[r + 1]). A sample only
+// keeps the triangle and the texel grid position it was taken from, its position and normal
+// are recomputed by get_sample with the same arithmetic that generated them.
+struct ReceiverStore
+{
+    std::vector<glm::vec3> positions; // average of the samples
+    std::vector<glm::vec3> normals;
+    std::vector<glm::ivec2> uvs;
+    std::vector<int> objectIds;
+    std::vector<uint32_t> sampleStart = {0};
+    std::vector<uint32_t> samples;
+    std::vector<ReceiverTriangle> triangles;
+
+    int size() const
+    {
+        return (int)positions.size();
+    }
+    int sample_count(int receiver) const
+    {
+        return sampleStart[receiver + 1] - sampleStart[receiver];
+    }
+
+    void get_sample(int receiver, int index, glm::vec3& outPosition,
+                    glm::vec3& outNormal) const;
+    size_t memory_size() const;
+
+    // Barycentric coordinates of a point of the sample grid of a texel, the coordinates are
+    // negative or NaN outside of the triangle
+    static glm::vec3 sample_barycentric(const ReceiverTriangle& triangle, glm::ivec2 texel,
+                                        int sample);
+};
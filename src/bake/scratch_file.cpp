@@ -0,0 +1,207 @@
+#include "scratch_file.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static size_t page_size()
+{
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    return systemInfo.dwAllocationGranularity;
+#else
+    return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+ScratchFile::~ScratchFile()
+{
+    close();
+}
+
+bool ScratchFile::open(const std::string& directory)
+{
+    close();
+
+#ifdef _WIN32
+    char filename[MAX_PATH];
+    if (GetTempFileNameA(directory.c_str(), "pnk", 0, filename) == 0)
+    {
+        printf("Could not create a scratch file in %s\n", directory.c_str());
+        return false;
+    }
+    HANDLE file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        printf("Could not create a scratch file in %s\n", directory.c_str());
+        return false;
+    }
+    _file = file;
+#else
+    std::string pattern = (std::filesystem::path(directory) / "scratch-XXXXXX").string();
+    _file = mkstemp(pattern.data());
+    if (_file < 0)
+    {
+        printf("Could not create a scratch file in %s\n", directory.c_str());
+        return false;
+    }
+    // The file is gone as soon as it is closed, even if the bake crashes
+    unlink(pattern.c_str());
+#endif
+    return true;
+}
+
+bool ScratchFile::is_open() const
+{
+#ifdef _WIN32
+    return _file != nullptr;
+#else
+    return _file >= 0;
+#endif
+}
+
+void ScratchFile::unmap()
+{
+#ifdef _WIN32
+    if (_data)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping)
+    {
+        CloseHandle(_mapping);
+    }
+    _mapping = nullptr;
+#else
+    if (_data)
+    {
+        munmap(_data, _size);
+    }
+#endif
+    _data = nullptr;
+}
+
+void ScratchFile::close()
+{
+    unmap();
+#ifdef _WIN32
+    if (_file)
+    {
+        CloseHandle(_file);
+    }
+    _file = nullptr;
+#else
+    if (_file >= 0)
+    {
+        ::close(_file);
+    }
+    _file = -1;
+#endif
+    _size = 0;
+}
+
+void* ScratchFile::map(size_t size)
+{
+    if (!is_open())
+    {
+        return nullptr;
+    }
+    if (_data && size <= _size)
+    {
+        return _data;
+    }
+
+    unmap();
+    size_t pageSize = page_size();
+    _size = std::max<size_t>(1, (size + pageSize - 1) / pageSize) * pageSize;
+
+#ifdef _WIN32
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, (DWORD)(_size >> 32),
+                                  (DWORD)_size, nullptr);
+    if (_mapping)
+    {
+        _data = MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size);
+    }
+#else
+    if (ftruncate(_file, _size) == 0)
+    {
+        void* data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+        _data = data == MAP_FAILED ? nullptr : data;
+    }
+#endif
+
+    if (!_data)
+    {
+        printf("Could not map %zu bytes of scratch memory\n", _size);
+        _size = 0;
+    }
+    return _data;
+}
+
+void ScratchFile::evict(size_t offset, size_t size)
+{
+    if (!_data || offset >= _size)
+    {
+        return;
+    }
+
+    // The pages at both ends may hold data around the range, evicting them loses nothing
+    size_t pageSize = page_size();
+    size_t begin = offset / pageSize * pageSize;
+    size_t end = std::min(_size, (offset + size + pageSize - 1) / pageSize * pageSize);
+    char* pages = (char*)_data + begin;
+
+#ifdef _WIN32
+    FlushViewOfFile(pages, end - begin);
+    // Unlocking pages that are not locked removes them from the working set
+    VirtualUnlock(pages, end - begin);
+#else
+#ifdef __linux__
+    sync_file_range(_file, begin, end - begin, SYNC_FILE_RANGE_WRITE);
+#else
+    msync(pages, end - begin, MS_ASYNC);
+#endif
+    madvise(pages, end - begin, MADV_DONTNEED);
+#endif
+}
+
+float* ScratchBuffer::allocate(size_t count)
+{
+    _mapped = nullptr;
+    if (count * sizeof(float) > _threshold)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(_directory, error);
+        if (_file.is_open() || _file.open(_directory))
+        {
+            _mapped = (float*)_file.map(count * sizeof(float));
+        }
+        if (_mapped)
+        {
+            return _mapped;
+        }
+    }
+    _memory.resize(count);
+    return _memory.data();
+}
+
+void ScratchBuffer::evict(size_t first, size_t count)
+{
+    if (_mapped)
+    {
+        _file.evict(first * sizeof(float), count * sizeof(float));
+    }
+}
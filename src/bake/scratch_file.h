@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Temporary file mapped into memory, deleted when it is closed. Pages written through the
+// mapping go back to the file instead of staying in memory, so data larger than the memory
+// budget can be written and read back in blocks.
+class ScratchFile
+{
+public:
+    ScratchFile() = default;
+    ScratchFile(const ScratchFile&) = delete;
+    ScratchFile& operator=(const ScratchFile&) = delete;
+    ~ScratchFile();
+
+    // Creates the file in the directory, the directory has to exist
+    bool open(const std::string& directory);
+    void close();
+    bool is_open() const;
+
+    // Grows the file to at least size bytes. The mapping stays valid until the next map or
+    // close, it is only zeroed where the file grew.
+    void* map(size_t size);
+    // Starts writing [offset, offset + size) back to the file and drops its pages from the
+    // process, they are read from the file again when they are touched
+    void evict(size_t offset, size_t size);
+
+private:
+    void unmap();
+
+    void* _data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void* _file = nullptr;
+    void* _mapping = nullptr;
+#else
+    int _file = -1;
+#endif
+};
+
+// Floats kept in memory up to threshold bytes and in a scratch file in the directory above
+// that. Falls back to memory if the scratch file cannot be created.
+class ScratchBuffer
+{
+public:
+    ScratchBuffer(const std::string& directory, size_t threshold)
+        : _directory(directory), _threshold(threshold)
+    {
+    }
+
+    // The contents are undefined, the buffer is reused by every allocate
+    float* allocate(size_t count);
+    // Drops [first, first + count) from memory if the buffer lives in the scratch file
+    void evict(size_t first, size_t count);
+
+private:
+    std::string _directory;
+    size_t _threshold;
+    std::vector<float> _memory;
+    ScratchFile _file;
+    float* _mapped = nullptr;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Voxels are stored in bricks of VOXEL_BRICK_SIZE^3
+#define VOXEL_BRICK_SIZE 8
+#define VOXEL_BRICK_VOXELS (VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE)
+
+enum VoxelState
+{
+    VOXEL_UNREACHED, // border voxels the flood fill did not reach
+    VOXEL_SOLID,     // touched by a triangle or enclosed by the surface
+    VOXEL_OUTSIDE,
+    VOXEL_BOUNDARY // outside, next to a voxel touched by a triangle
+};
+
+// 2 bits per voxel, grouped in bricks. A brick whose voxels all have the same state only
+// stores the state, so empty space and the inside of thick walls cost 4 bytes per brick.
+class VoxelGrid
+{
+public:
+    glm::ivec3 dimensions() const
+    {
+        return _dims;
+    }
+
+    VoxelState get(glm::ivec3 voxel) const;
+
+    // Calls visitor(voxel) for every voxel with the given state, brick by brick. Uniform
+    // bricks of another state are skipped without looking at their voxels.
+    template <typename Visitor>
+    void for_each(VoxelState state, Visitor&& visitor) const;
+
+    // Bytes used by the brick table and the stored bricks
+    size_t memory_size() const
+    {
+        return _bricks.size() * sizeof(uint32_t) + _states.size() * sizeof(BrickStates);
+    }
+    int stored_brick_count() const
+    {
+        return (int)_states.size();
+    }
+
+private:
+    friend class Voxelizer;
+
+    struct BrickStates
+    {
+        uint64_t words[VOXEL_BRICK_VOXELS * 2 / 64]; // voxel v uses bits 2 * (v % 32)
+    };
+
+    // Brick table entries with this bit set hold a uniform state instead of an index
+    static constexpr uint32_t UNIFORM_BRICK = 0x80000000u;
+
+    static VoxelState brick_state(const BrickStates& states, int voxel)
+    {
+        return (VoxelState)((states.words[voxel >> 5] >> ((voxel & 31) * 2)) & 3);
+    }
+
+    glm::ivec3 _dims = glm::ivec3(0);
+    glm::ivec3 _brickDims = glm::ivec3(0);
+    std::vector<uint32_t> _bricks; // x fastest
+    std::vector<BrickStates> _states;
+};
+
+inline VoxelState VoxelGrid::get(glm::ivec3 voxel) const
+{
+    glm::ivec3 brick = voxel / VOXEL_BRICK_SIZE;
+    uint32_t entry = _bricks[brick.x + _brickDims.x * (brick.y + _brickDims.y * brick.z)];
+    if (entry & UNIFORM_BRICK)
+    {
+        return (VoxelState)(entry & 3);
+    }
+
+    glm::ivec3 local = voxel - brick * VOXEL_BRICK_SIZE;
+    return brick_state(_states[entry], local.x + VOXEL_BRICK_SIZE *
+                                                     (local.y + VOXEL_BRICK_SIZE * local.z));
+}
+
+template <typename Visitor>
+void VoxelGrid::for_each(VoxelState state, Visitor&& visitor) const
+{
+    for (int bz = 0; bz < _brickDims.z; bz++)
+    {
+        for (int by = 0; by < _brickDims.y; by++)
+        {
+            for (int bx = 0; bx < _brickDims.x; bx++)
+            {
+                uint32_t entry = _bricks[bx + _brickDims.x * (by + _brickDims.y * bz)];
+                if ((entry & UNIFORM_BRICK) && (entry & 3) != state)
+                {
+                    continue;
+                }
+
+                glm::ivec3 brickMin = glm::ivec3(bx, by, bz) * VOXEL_BRICK_SIZE;
+                glm::ivec3 size = glm::min(brickMin + VOXEL_BRICK_SIZE, _dims) - brickMin;
+                for (int z = 0; z < size.z; z++)
+                {
+                    for (int y = 0; y < size.y; y++)
+                    {
+                        for (int x = 0; x < size.x; x++)
+                        {
+                            int voxel = x + VOXEL_BRICK_SIZE * (y + VOXEL_BRICK_SIZE * z);
+                            if ((entry & UNIFORM_BRICK) ||
+                                brick_state(_states[entry], voxel) == state)
+                            {
+                                visitor(brickMin + glm::ivec3(x, y, z));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
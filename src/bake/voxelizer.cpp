@@ -0,0 +1,648 @@
+#include "voxelizer.h"
+
+#include <gltf_scene.hpp>
+#include <triangle_box_intersection.h>
+
+#include <algorithm>
+#include <bit>
+#include <stdio.h>
+
+#define VOXEL_BRICK_SHIFT 3
+#define VOXEL_BRICK_COLUMN_0 0x0101010101010101ull // bits with x == 0
+#define VOXEL_BRICK_COLUMN_7 0x8080808080808080ull // bits with x == 7
+
+static bool is_empty(const VoxelBrickMask& mask)
+{
+    uint64_t bits = 0;
+    for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+    {
+        bits |= mask.slices[z];
+    }
+    return bits == 0;
+}
+
+static bool is_equal(const VoxelBrickMask& a, const VoxelBrickMask& b)
+{
+    uint64_t difference = 0;
+    for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+    {
+        difference |= a.slices[z] ^ b.slices[z];
+    }
+    return difference == 0;
+}
+
+// Voxels one step away from a set voxel inside the same brick
+static VoxelBrickMask dilate(const VoxelBrickMask& mask)
+{
+    VoxelBrickMask result;
+    for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+    {
+        uint64_t slice = mask.slices[z];
+        uint64_t bits = ((slice << 1) & ~VOXEL_BRICK_COLUMN_0) |
+                        ((slice >> 1) & ~VOXEL_BRICK_COLUMN_7) | (slice << 8) | (slice >> 8);
+        if (z > 0)
+        {
+            bits |= mask.slices[z - 1];
+        }
+        if (z < VOXEL_BRICK_SIZE - 1)
+        {
+            bits |= mask.slices[z + 1];
+        }
+        result.slices[z] = bits;
+    }
+    return result;
+}
+
+// Voxels of a brick that are one step away from a set voxel of a neighbouring brick.
+// get_mask(brick, outMask) returns false for bricks outside the grid or without set voxels.
+template <typename GetMask>
+static VoxelBrickMask dilate_from_neighbours(glm::ivec3 brick, GetMask&& get_mask)
+{
+    VoxelBrickMask result = {};
+    VoxelBrickMask mask;
+    if (get_mask(brick - glm::ivec3(1, 0, 0), mask))
+    {
+        for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+        {
+            result.slices[z] |= (mask.slices[z] & VOXEL_BRICK_COLUMN_7) >> 7;
+        }
+    }
+    if (get_mask(brick + glm::ivec3(1, 0, 0), mask))
+    {
+        for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+        {
+            result.slices[z] |= (mask.slices[z] & VOXEL_BRICK_COLUMN_0) << 7;
+        }
+    }
+    if (get_mask(brick - glm::ivec3(0, 1, 0), mask))
+    {
+        for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+        {
+            result.slices[z] |= mask.slices[z] >> 56;
+        }
+    }
+    if (get_mask(brick + glm::ivec3(0, 1, 0), mask))
+    {
+        for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+        {
+            result.slices[z] |= mask.slices[z] << 56;
+        }
+    }
+    if (get_mask(brick - glm::ivec3(0, 0, 1), mask))
+    {
+        result.slices[0] |= mask.slices[VOXEL_BRICK_SIZE - 1];
+    }
+    if (get_mask(brick + glm::ivec3(0, 0, 1), mask))
+    {
+        result.slices[VOXEL_BRICK_SIZE - 1] |= mask.slices[0];
+    }
+    return result;
+}
+
+void Voxelizer::voxelize(GltfScene& scene, float voxelSize, int padding, VoxelGrid& outGrid)
+{
+    _min = scene.m_dimensions.min;
+    _voxelSize = voxelSize;
+    _padding = padding;
+    _dims.x = (scene.m_dimensions.max.x - scene.m_dimensions.min.x) / voxelSize + padding * 2;
+    _dims.y = (scene.m_dimensions.max.y - scene.m_dimensions.min.y) / voxelSize + padding * 2;
+    _dims.z = (scene.m_dimensions.max.z - scene.m_dimensions.min.z) / voxelSize + padding * 2;
+    _brickDims = (_dims + VOXEL_BRICK_SIZE - 1) >> VOXEL_BRICK_SHIFT;
+
+    printf("Creating a voxel scene with: %d x %d x %d\n", _dims.x, _dims.y, _dims.z);
+
+    std::vector<Triangle> triangles;
+    std::vector<uint32_t> brickStart;
+    std::vector<uint32_t> brickTriangles;
+    bin_triangles(scene, triangles, brickStart, brickTriangles);
+    rasterize(triangles, brickStart, brickTriangles);
+
+    printf("A total of voxels marked: %d\n", _surfaceVoxelCount);
+
+    flood_fill();
+    build_grid(outGrid);
+
+    printf("Voxel grid uses %.2f MB, %d of %d bricks are not uniform\n",
+           outGrid.memory_size() / (1024.0 * 1024.0), outGrid.stored_brick_count(),
+           (int)outGrid._bricks.size());
+}
+
+void Voxelizer::bin_triangles(GltfScene& scene, std::vector<Triangle>& triangles,
+                              std::vector<uint32_t>& brickStart,
+                              std::vector<uint32_t>& brickTriangles) const
+{
+    std::vector<uint32_t> nodeStart(scene.nodes.size() + 1, 0);
+    for (int nodeIndex = 0; nodeIndex < scene.nodes.size(); nodeIndex++)
+    {
+        auto& mesh = scene.prim_meshes[scene.nodes[nodeIndex].prim_mesh];
+        nodeStart[nodeIndex + 1] = nodeStart[nodeIndex] + mesh.idx_count / 3;
+    }
+    triangles.resize(nodeStart.back());
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int nodeIndex = 0; nodeIndex < scene.nodes.size(); nodeIndex++)
+    {
+        auto& mesh = scene.prim_meshes[scene.nodes[nodeIndex].prim_mesh];
+        for (uint32_t triangle = 0; triangle < mesh.idx_count / 3; triangle++)
+        {
+            Triangle& tri = triangles[nodeStart[nodeIndex] + triangle];
+            tri.min = _dims;
+            tri.max = glm::ivec3(0);
+            for (int i = 0; i < 3; i++)
+            {
+                uint32_t index = scene.indices[mesh.first_idx + triangle * 3 + i];
+                glm::vec4 vertex = scene.nodes[nodeIndex].world_matrix *
+                                   glm::vec4(scene.positions[mesh.vtx_offset + index], 1.0);
+                tri.vertices[i] = glm::vec3(vertex) / vertex.w;
+
+                glm::ivec3 voxel =
+                    glm::ivec3((tri.vertices[i] - _min) / _voxelSize) + _padding;
+                tri.min = glm::min(tri.min, voxel);
+                tri.max = glm::max(tri.max, voxel);
+            }
+            tri.min = glm::max(tri.min, glm::ivec3(0));
+            tri.max = glm::min(tri.max, _dims - 1);
+        }
+    }
+
+    // Bricks overlapped by every triangle. Big triangles are tested against the bricks of
+    // their bounds, the test box is slightly larger so no overlapped voxel is lost.
+    glm::vec3 brickHalfSize = glm::vec3(_voxelSize * VOXEL_BRICK_SIZE * 0.5f * 1.001f);
+    auto for_each_brick = [&](const Triangle& tri, auto&& visitor) {
+        glm::ivec3 minBrick = tri.min >> VOXEL_BRICK_SHIFT;
+        glm::ivec3 maxBrick = tri.max >> VOXEL_BRICK_SHIFT;
+        bool singleBrick = minBrick == maxBrick;
+        for (int z = minBrick.z; z <= maxBrick.z; z++)
+        {
+            for (int y = minBrick.y; y <= maxBrick.y; y++)
+            {
+                for (int x = minBrick.x; x <= maxBrick.x; x++)
+                {
+                    glm::vec3 brickCenter =
+                        _min + (glm::vec3(glm::ivec3(x, y, z) * VOXEL_BRICK_SIZE - _padding) +
+                                VOXEL_BRICK_SIZE * 0.5f) *
+                                   _voxelSize;
+                    if (singleBrick || tri_box_overlap(brickCenter, brickHalfSize,
+                                                       tri.vertices[0], tri.vertices[1],
+                                                       tri.vertices[2]))
+                    {
+                        visitor(brick_index(glm::ivec3(x, y, z)));
+                    }
+                }
+            }
+        }
+    };
+
+    std::vector<uint32_t> triangleStart(triangles.size() + 1, 0);
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < triangles.size(); i++)
+    {
+        uint32_t count = 0;
+        for_each_brick(triangles[i], [&](int) { count++; });
+        triangleStart[i + 1] = count;
+    }
+    for (int i = 0; i < triangles.size(); i++)
+    {
+        triangleStart[i + 1] += triangleStart[i];
+    }
+
+    std::vector<uint32_t> pairBricks(triangleStart.back());
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < triangles.size(); i++)
+    {
+        uint32_t slot = triangleStart[i];
+        for_each_brick(triangles[i], [&](int brick) { pairBricks[slot++] = brick; });
+    }
+
+    // Counting sort of the pairs by brick, triangles of a brick stay in scene order
+    int brickCount = _brickDims.x * _brickDims.y * _brickDims.z;
+    brickStart.assign(brickCount + 1, 0);
+    for (uint32_t brick : pairBricks)
+    {
+        brickStart[brick + 1]++;
+    }
+    for (int i = 0; i < brickCount; i++)
+    {
+        brickStart[i + 1] += brickStart[i];
+    }
+
+    std::vector<uint32_t> cursor(brickStart.begin(), brickStart.end() - 1);
+    brickTriangles.resize(pairBricks.size());
+    for (int i = 0; i < triangles.size(); i++)
+    {
+        for (uint32_t pair = triangleStart[i]; pair < triangleStart[i + 1]; pair++)
+        {
+            brickTriangles[cursor[pairBricks[pair]]++] = i;
+        }
+    }
+}
+
+void Voxelizer::rasterize(const std::vector<Triangle>& triangles,
+                          const std::vector<uint32_t>& brickStart,
+                          const std::vector<uint32_t>& brickTriangles)
+{
+    int brickCount = _brickDims.x * _brickDims.y * _brickDims.z;
+    std::vector<int> touchedBricks;
+    for (int brick = 0; brick < brickCount; brick++)
+    {
+        if (brickStart[brick + 1] > brickStart[brick])
+        {
+            touchedBricks.push_back(brick);
+        }
+    }
+
+    glm::vec3 halfSize = {_voxelSize / 2.f, _voxelSize / 2.f, _voxelSize / 2.f};
+    std::vector<VoxelBrickMask> masks(touchedBricks.size());
+#pragma omp parallel for schedule(dynamic, 4)
+    for (int touched = 0; touched < touchedBricks.size(); touched++)
+    {
+        int brick = touchedBricks[touched];
+        glm::ivec3 brickMin = brick_coordinates(brick) * VOXEL_BRICK_SIZE;
+        glm::ivec3 brickMax = glm::min(brickMin + VOXEL_BRICK_SIZE - 1, _dims - 1);
+        VoxelBrickMask mask = {};
+
+        for (uint32_t pair = brickStart[brick]; pair < brickStart[brick + 1]; pair++)
+        {
+            const Triangle& tri = triangles[brickTriangles[pair]];
+            glm::ivec3 minVoxel = glm::max(tri.min, brickMin);
+            glm::ivec3 maxVoxel = glm::min(tri.max, brickMax);
+
+            for (int k = minVoxel.z; k <= maxVoxel.z; k++)
+            {
+                for (int j = minVoxel.y; j <= maxVoxel.y; j++)
+                {
+                    for (int i = minVoxel.x; i <= maxVoxel.x; i++)
+                    {
+                        int bit = (i - brickMin.x) + (j - brickMin.y) * VOXEL_BRICK_SIZE;
+                        uint64_t& slice = mask.slices[k - brickMin.z];
+                        if (slice & (1ull << bit))
+                        {
+                            continue;
+                        }
+
+                        glm::vec3 center = {
+                            _min.x + (i - _padding) * _voxelSize + _voxelSize / 2.f,
+                            _min.y + (j - _padding) * _voxelSize + _voxelSize / 2.f,
+                            _min.z + (k - _padding) * _voxelSize + _voxelSize / 2.f};
+                        if (tri_box_overlap(center, halfSize, tri.vertices[0], tri.vertices[1],
+                                            tri.vertices[2]))
+                        {
+                            slice |= 1ull << bit;
+                        }
+                    }
+                }
+            }
+        }
+
+        masks[touched] = mask;
+    }
+
+    _surfaceBrick.assign(brickCount, BRICK_EMPTY);
+    _surfaceMasks.clear();
+    _surfaceVoxelCount = 0;
+    for (int touched = 0; touched < touchedBricks.size(); touched++)
+    {
+        if (is_empty(masks[touched]))
+        {
+            continue;
+        }
+
+        _surfaceBrick[touchedBricks[touched]] = (int)_surfaceMasks.size();
+        _surfaceMasks.push_back(masks[touched]);
+        for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+        {
+            _surfaceVoxelCount += std::popcount(masks[touched].slices[z]);
+        }
+    }
+}
+
+void Voxelizer::flood_fill()
+{
+    int brickCount = _brickDims.x * _brickDims.y * _brickDims.z;
+    _outsideBrick.assign(brickCount, BRICK_EMPTY);
+    _outsideMasks.clear();
+    if (brickCount == 0)
+    {
+        return;
+    }
+
+    // The fill starts at voxel (0, 0, 0), which is outside even if a triangle touches it
+    if (_surfaceBrick[0] != BRICK_EMPTY)
+    {
+        _surfaceMasks[_surfaceBrick[0]].slices[0] &= ~1ull;
+    }
+
+    auto get_outside_mask = [&](glm::ivec3 brick, VoxelBrickMask& outMask) {
+        return get_outside(brick, outMask);
+    };
+
+    // Grows mask inside the free voxels of a brick until it stops changing
+    auto fill_brick = [](VoxelBrickMask mask, const VoxelBrickMask& freeMask) {
+        while (true)
+        {
+            VoxelBrickMask grown = dilate(mask);
+            bool changed = false;
+            for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+            {
+                uint64_t slice = (mask.slices[z] | grown.slices[z]) & freeMask.slices[z];
+                changed |= slice != mask.slices[z];
+                mask.slices[z] = slice;
+            }
+            if (!changed)
+            {
+                return mask;
+            }
+        }
+    };
+
+    // Bricks that are outside everywhere, which is most of the empty space, keep no mask
+    auto store_outside = [&](int brick, const VoxelBrickMask& mask) {
+        if (is_equal(mask, free_mask(brick)))
+        {
+            _outsideBrick[brick] = BRICK_FULL;
+        }
+        else if (_outsideBrick[brick] == BRICK_EMPTY)
+        {
+            _outsideBrick[brick] = (int)_outsideMasks.size();
+            _outsideMasks.push_back(mask);
+        }
+        else
+        {
+            _outsideMasks[_outsideBrick[brick]] = mask;
+        }
+    };
+
+    VoxelBrickMask seed = {};
+    seed.slices[0] = 1;
+    store_outside(0, fill_brick(seed, free_mask(0)));
+
+    std::vector<int> changedBricks = {0};
+    std::vector<int> candidates;
+    std::vector<int> candidateWave(brickCount, -1);
+    std::vector<VoxelBrickMask> results;
+    std::vector<uint8_t> resultChanged;
+    const glm::ivec3 offsets[6] = {{-1, 0, 0}, {1, 0, 0},  {0, -1, 0},
+                                   {0, 1, 0},  {0, 0, -1}, {0, 0, 1}};
+
+    for (int wave = 0; !changedBricks.empty(); wave++)
+    {
+        // Neighbours of the bricks that grew in the previous wave
+        candidates.clear();
+        for (int brick : changedBricks)
+        {
+            glm::ivec3 coordinates = brick_coordinates(brick);
+            for (const glm::ivec3& offset : offsets)
+            {
+                glm::ivec3 neighbour = coordinates + offset;
+                if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) ||
+                    glm::any(glm::greaterThanEqual(neighbour, _brickDims)))
+                {
+                    continue;
+                }
+
+                int neighbourIndex = brick_index(neighbour);
+                if (_outsideBrick[neighbourIndex] != BRICK_FULL &&
+                    candidateWave[neighbourIndex] != wave)
+                {
+                    candidateWave[neighbourIndex] = wave;
+                    candidates.push_back(neighbourIndex);
+                }
+            }
+        }
+
+        // Every candidate only writes its own result, the masks are updated after the wave
+        results.resize(candidates.size());
+        resultChanged.assign(candidates.size(), 0);
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int candidate = 0; candidate < candidates.size(); candidate++)
+        {
+            int brick = candidates[candidate];
+            glm::ivec3 coordinates = brick_coordinates(brick);
+            VoxelBrickMask outside = {};
+            get_outside(coordinates, outside);
+            VoxelBrickMask freeMask = free_mask(brick);
+            VoxelBrickMask seeds = dilate_from_neighbours(coordinates, get_outside_mask);
+
+            VoxelBrickMask mask;
+            for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+            {
+                mask.slices[z] = (outside.slices[z] | seeds.slices[z]) & freeMask.slices[z];
+            }
+            if (is_equal(mask, outside))
+            {
+                continue;
+            }
+
+            results[candidate] = fill_brick(mask, freeMask);
+            resultChanged[candidate] = 1;
+        }
+
+        changedBricks.clear();
+        for (int candidate = 0; candidate < candidates.size(); candidate++)
+        {
+            if (resultChanged[candidate])
+            {
+                store_outside(candidates[candidate], results[candidate]);
+                changedBricks.push_back(candidates[candidate]);
+            }
+        }
+    }
+}
+
+void Voxelizer::build_grid(VoxelGrid& outGrid) const
+{
+    int brickCount = _brickDims.x * _brickDims.y * _brickDims.z;
+    outGrid._dims = _dims;
+    outGrid._brickDims = _brickDims;
+    outGrid._bricks.assign(brickCount, 0);
+    outGrid._states.clear();
+
+    auto get_surface_mask = [&](glm::ivec3 brick, VoxelBrickMask& outMask) {
+        return get_surface(brick, outMask);
+    };
+
+    // Outside voxels next to a surface voxel
+    auto boundary_mask = [&](glm::ivec3 coordinates) {
+        VoxelBrickMask boundary = dilate_from_neighbours(coordinates, get_surface_mask);
+        VoxelBrickMask surface;
+        if (get_surface(coordinates, surface))
+        {
+            VoxelBrickMask grown = dilate(surface);
+            for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+            {
+                boundary.slices[z] |= grown.slices[z];
+            }
+        }
+        return boundary;
+    };
+
+    // Bricks without surface voxels are uniform when they are fully outside away from the
+    // surface, or fully enclosed away from the border of the grid
+    std::vector<int> uniformState(brickCount, -1);
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int brick = 0; brick < brickCount; brick++)
+    {
+        if (_surfaceBrick[brick] != BRICK_EMPTY)
+        {
+            continue;
+        }
+
+        glm::ivec3 coordinates = brick_coordinates(brick);
+        glm::ivec3 brickMin = coordinates * VOXEL_BRICK_SIZE;
+        if (_outsideBrick[brick] == BRICK_FULL)
+        {
+            VoxelBrickMask boundary = boundary_mask(coordinates);
+            VoxelBrickMask inGrid = in_grid_mask(coordinates);
+            for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+            {
+                boundary.slices[z] &= inGrid.slices[z];
+            }
+            if (is_empty(boundary))
+            {
+                uniformState[brick] = VOXEL_OUTSIDE;
+            }
+        }
+        else if (_outsideBrick[brick] == BRICK_EMPTY &&
+                 glm::all(glm::greaterThan(brickMin, glm::ivec3(0))) &&
+                 glm::all(glm::lessThan(brickMin + VOXEL_BRICK_SIZE, _dims)))
+        {
+            uniformState[brick] = VOXEL_SOLID;
+        }
+    }
+
+    std::vector<int> storedBricks;
+    for (int brick = 0; brick < brickCount; brick++)
+    {
+        if (uniformState[brick] >= 0)
+        {
+            outGrid._bricks[brick] = VoxelGrid::UNIFORM_BRICK | uniformState[brick];
+        }
+        else
+        {
+            outGrid._bricks[brick] = (uint32_t)storedBricks.size();
+            storedBricks.push_back(brick);
+        }
+    }
+
+    outGrid._states.resize(storedBricks.size());
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int stored = 0; stored < storedBricks.size(); stored++)
+    {
+        int brick = storedBricks[stored];
+        glm::ivec3 coordinates = brick_coordinates(brick);
+        glm::ivec3 brickMin = coordinates * VOXEL_BRICK_SIZE;
+        glm::ivec3 brickMax = glm::min(brickMin + VOXEL_BRICK_SIZE, _dims);
+        VoxelBrickMask surface = {};
+        VoxelBrickMask outside = {};
+        get_surface(coordinates, surface);
+        get_outside(coordinates, outside);
+        VoxelBrickMask boundary = boundary_mask(coordinates);
+
+        VoxelGrid::BrickStates& states = outGrid._states[stored];
+        states = {};
+        for (int k = brickMin.z; k < brickMax.z; k++)
+        {
+            int z = k - brickMin.z;
+            for (int j = brickMin.y; j < brickMax.y; j++)
+            {
+                for (int i = brickMin.x; i < brickMax.x; i++)
+                {
+                    int bitIndex = (i - brickMin.x) + (j - brickMin.y) * VOXEL_BRICK_SIZE;
+                    uint64_t bit = 1ull << bitIndex;
+                    uint64_t state = VOXEL_UNREACHED;
+                    if (surface.slices[z] & bit)
+                    {
+                        state = VOXEL_SOLID;
+                    }
+                    else if (outside.slices[z] & bit)
+                    {
+                        state = (boundary.slices[z] & bit) ? VOXEL_BOUNDARY : VOXEL_OUTSIDE;
+                    }
+                    else if (i > 0 && j > 0 && k > 0 && i < _dims.x - 1 && j < _dims.y - 1 &&
+                             k < _dims.z - 1)
+                    {
+                        // Enclosed by the surface
+                        state = VOXEL_SOLID;
+                    }
+
+                    int voxel = bitIndex + z * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
+                    states.words[voxel >> 5] |= state << ((voxel & 31) * 2);
+                }
+            }
+        }
+    }
+}
+
+bool Voxelizer::get_surface(glm::ivec3 brick, VoxelBrickMask& outMask) const
+{
+    if (glm::any(glm::lessThan(brick, glm::ivec3(0))) ||
+        glm::any(glm::greaterThanEqual(brick, _brickDims)))
+    {
+        return false;
+    }
+
+    int surface = _surfaceBrick[brick_index(brick)];
+    if (surface == BRICK_EMPTY)
+    {
+        return false;
+    }
+    outMask = _surfaceMasks[surface];
+    return true;
+}
+
+bool Voxelizer::get_outside(glm::ivec3 brick, VoxelBrickMask& outMask) const
+{
+    if (glm::any(glm::lessThan(brick, glm::ivec3(0))) ||
+        glm::any(glm::greaterThanEqual(brick, _brickDims)))
+    {
+        return false;
+    }
+
+    int index = brick_index(brick);
+    int outside = _outsideBrick[index];
+    if (outside == BRICK_EMPTY)
+    {
+        return false;
+    }
+    outMask = outside == BRICK_FULL ? free_mask(index) : _outsideMasks[outside];
+    return true;
+}
+
+VoxelBrickMask Voxelizer::free_mask(int brick) const
+{
+    VoxelBrickMask mask = in_grid_mask(brick_coordinates(brick));
+    int surface = _surfaceBrick[brick];
+    if (surface != BRICK_EMPTY)
+    {
+        for (int z = 0; z < VOXEL_BRICK_SIZE; z++)
+        {
+            mask.slices[z] &= ~_surfaceMasks[surface].slices[z];
+        }
+    }
+    return mask;
+}
+
+VoxelBrickMask Voxelizer::in_grid_mask(glm::ivec3 brick) const
+{
+    glm::ivec3 count =
+        glm::min(_dims - brick * VOXEL_BRICK_SIZE, glm::ivec3(VOXEL_BRICK_SIZE));
+    uint64_t row = (1ull << count.x) - 1;
+    uint64_t slice = 0;
+    for (int y = 0; y < count.y; y++)
+    {
+        slice |= row << (y * VOXEL_BRICK_SIZE);
+    }
+
+    VoxelBrickMask mask = {};
+    for (int z = 0; z < count.z; z++)
+    {
+        mask.slices[z] = slice;
+    }
+    return mask;
+}
+
+glm::ivec3 Voxelizer::brick_coordinates(int brick) const
+{
+    return glm::ivec3(brick % _brickDims.x, (brick / _brickDims.x) % _brickDims.y,
+                      brick / (_brickDims.x * _brickDims.y));
+}
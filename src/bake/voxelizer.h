@@ -0,0 +1,79 @@
+#pragma once
+
+#include "voxel_grid.h"
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+
+struct GltfScene;
+
+// 8x8x8 bits, one word per z slice with bit x + 8 * y
+struct VoxelBrickMask
+{
+    uint64_t slices[VOXEL_BRICK_SIZE];
+};
+
+// Voxelizes the triangles of a scene and flood fills the outside. Triangles are binned into
+// the bricks they overlap and every brick is rasterized by a single thread, so no voxel is
+// shared between threads. The flood fill runs brick by brick in waves; every wave only reads
+// the previous one, so the result does not depend on the thread count. Surface and outside
+// masks are only kept for the bricks that need them and the result is a sparse VoxelGrid.
+class Voxelizer
+{
+public:
+    // Covers the scene bounds plus padding voxels on every side
+    void voxelize(GltfScene& scene, float voxelSize, int padding, VoxelGrid& outGrid);
+
+    glm::ivec3 dimensions() const
+    {
+        return _dims;
+    }
+    int surface_voxel_count() const
+    {
+        return _surfaceVoxelCount;
+    }
+
+private:
+    struct Triangle
+    {
+        glm::vec3 vertices[3];
+        glm::ivec3 min; // voxel bounds
+        glm::ivec3 max;
+    };
+
+    void bin_triangles(GltfScene& scene, std::vector<Triangle>& triangles,
+                       std::vector<uint32_t>& brickStart,
+                       std::vector<uint32_t>& brickTriangles) const;
+    void rasterize(const std::vector<Triangle>& triangles,
+                   const std::vector<uint32_t>& brickStart,
+                   const std::vector<uint32_t>& brickTriangles);
+    void flood_fill();
+    void build_grid(VoxelGrid& outGrid) const;
+
+    bool get_surface(glm::ivec3 brick, VoxelBrickMask& outMask) const;
+    bool get_outside(glm::ivec3 brick, VoxelBrickMask& outMask) const;
+    VoxelBrickMask free_mask(int brick) const;
+    VoxelBrickMask in_grid_mask(glm::ivec3 brick) const;
+    glm::ivec3 brick_coordinates(int brick) const;
+    int brick_index(glm::ivec3 brick) const
+    {
+        return brick.x + _brickDims.x * (brick.y + _brickDims.y * brick.z);
+    }
+
+    glm::vec3 _min = glm::vec3(0); // scene minimum, the corner of the first unpadded voxel
+    float _voxelSize = 1;
+    int _padding = 0;
+    glm::ivec3 _dims = glm::ivec3(0);
+    glm::ivec3 _brickDims = glm::ivec3(0);
+    int _surfaceVoxelCount = 0;
+
+    // Masks are only stored for the bricks that need one. The brick tables hold an index into
+    // the masks, BRICK_EMPTY, or BRICK_FULL for outside bricks where every free voxel is set.
+    static constexpr int BRICK_EMPTY = -1;
+    static constexpr int BRICK_FULL = -2;
+    std::vector<int> _surfaceBrick;
+    std::vector<VoxelBrickMask> _surfaceMasks;
+    std::vector<int> _outsideBrick;
+    std::vector<VoxelBrickMask> _outsideMasks;
+};
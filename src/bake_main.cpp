@@ -0,0 +1,337 @@
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <bake/bake_cache.h>
+#include <bake/bake_container.h>
+#include <bake/bake_profiler.h>
+#include <bake/bake_scene.h>
+#include <bake/gi_reference.h>
+#include <bake/matrix_quantization.h>
+#include <precalculation.h>
+
+#define FILE_HELPER_IMPL
+#include <file_helper.h>
+
+#include <filesystem>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+// Headless precalculation. Produces the same bake file as the renderer does, so it can be
+// consumed by Precalculation::load. Without --output the bake goes into the cache entry the
+// renderer looks up, and nothing is baked if that entry already matches the inputs.
+
+// Suffix of the indirect lightmap written by --relight, next to the bake
+#define RELIGHT_OUTPUT_SUFFIX ".indirect.hdr"
+
+static void print_usage()
+{
+    printf("Usage: panko_bake [scene.gltf] [options]\n");
+    printf("  --output <file>                   bake file (default: cache entry of the "
+           "inputs)\n");
+    printf("  --cache-dir <dir>                 (default " PRECALCULATION_CACHE_DIRECTORY
+           ")\n");
+    printf("  --checkpoint-dir <dir>            stage checkpoints to resume from (default "
+           PRECALCULATION_CHECKPOINT_DIRECTORY ")\n");
+    printf("  --no-checkpoints                  run every stage, write no checkpoints\n");
+    // The transfer matrices are as large as the traced data, ~307 MB for the cornell box
+    // with the defaults and without a bound on larger scenes or denser probe sets
+    printf("  --checkpoint-transfer-matrices    also checkpoint the transfer matrices, so a "
+           "changed\n"
+           "                                    PCA does not trace again (large on disk)\n");
+    printf("  --probes <file>                   use the probes of an earlier bake file\n");
+    printf("  --threads <n>                     number of CPU threads\n");
+    printf("  --debug-dumps <dir>               write the voxels, probes and receiver mask "
+           "there\n");
+    printf("  --voxel-size <f>                  (default 0.25)\n");
+    printf("  --voxel-padding <n>               (default 2)\n");
+    printf("  --probe-overlaps <n>              (default 10)\n");
+    printf("  --rays-per-probe <n>              (default 1000)\n");
+    printf("  --rays-per-receiver <n>           (default 40000)\n");
+    printf("  --sh-order <n>                    (default 7)\n");
+    printf("  --cluster-coefficients <n>        (default 32)\n");
+    printf("  --max-receivers-in-cluster <n>    (default 1024)\n");
+    printf("  --lightmap-resolution <n>         (default 261)\n");
+    printf("  --texel-size <n>                  (default 6)\n");
+    printf("  --desired-spacing <f>             (default 2)\n");
+    printf("  --matrix-format <name>            fp32, fp16, snorm16 or snorm8 "
+           "(default snorm16)\n");
+    printf("  --relight <image>                 relight the bake with a lit lightmap on the "
+           "CPU\n");
+    printf("  --relight-frames <n>              frames to relight and time (default 1)\n");
+    printf("  --basis-functions <n>             basis functions used by --relight "
+           "(default 64)\n");
+}
+
+// Runs the diffuse GI of the renderer on the CPU for the bake, with the image standing in for
+// the lit lightmap, and saves the indirect lightmap. The first frame gives the converged
+// result, the others blend into it like the renderer does every frame.
+static bool relight_bake(const char* bakeFile, const GltfScene& scene,
+                         const char* lightmapFile, int frames, int basisSize)
+{
+    Precalculation precalculation;
+    PrecalculationInfo precalculationInfo = {};
+    PrecalculationLoadData precalculationLoadData = {};
+    PrecalculationResult precalculationResult = {};
+    if (!precalculation.load(bakeFile, precalculationInfo, precalculationLoadData,
+                             precalculationResult))
+    {
+        return false;
+    }
+
+    int width, height, channels;
+    float* pixels = stbi_loadf(lightmapFile, &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        printf("Could not load the lightmap %s\n", lightmapFile);
+        return false;
+    }
+    std::vector<glm::vec4> lightmap((glm::vec4*)pixels, (glm::vec4*)pixels + width * height);
+    stbi_image_free(pixels);
+
+    int resolution = precalculationInfo.lightmapResolution;
+    std::vector<glm::vec4> indirectLightmap(resolution * resolution, glm::vec4(0));
+    glm::vec2 lightmapInputSize(scene.lightmap_width, scene.lightmap_height);
+
+    bake_profiler::begin();
+    for (int frame = 0; frame < std::max(frames, 1); frame++)
+    {
+        BakeProfileZone zone("relight_frame");
+        gi_reference::relight(precalculationInfo, precalculationLoadData, precalculationResult,
+                              lightmapInputSize, basisSize, lightmap.data(), width, height,
+                              frame == 0 ? 0 : GI_REFERENCE_HISTORY_WEIGHT,
+                              indirectLightmap.data());
+    }
+    bake_profiler::print_summary();
+
+    std::string outputFile = std::string(bakeFile) + RELIGHT_OUTPUT_SUFFIX;
+    if (!stbi_write_hdr(outputFile.c_str(), resolution, resolution, 4,
+                        &indirectLightmap[0].x))
+    {
+        printf("Could not write %s\n", outputFile.c_str());
+        return false;
+    }
+    printf("Saved the indirect lightmap to %s\n", outputFile.c_str());
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    // Same defaults as VulkanEngine::init
+    PrecalculationInfo precalculationInfo = {};
+    precalculationInfo.voxelSize = 0.25;
+    precalculationInfo.voxelPadding = 2;
+    precalculationInfo.probeOverlaps = 10;
+    precalculationInfo.raysPerProbe = 1000;
+    precalculationInfo.raysPerReceiver = 40000;
+    precalculationInfo.sphericalHarmonicsOrder = 7;
+    precalculationInfo.clusterCoefficientCount = 32;
+    precalculationInfo.maxReceiversInCluster = 1024;
+    precalculationInfo.lightmapResolution = 261;
+    precalculationInfo.texelSize = 6;
+    precalculationInfo.desiredSpacing = 2;
+    precalculationInfo.matrixFormat = MATRIX_FORMAT_SNORM16;
+
+    const char* sceneFile = "../assets/cornellFixed.gltf";
+    const char* outputFile = nullptr;
+    const char* cacheDirectory = PRECALCULATION_CACHE_DIRECTORY;
+    const char* checkpointDirectory = PRECALCULATION_CHECKPOINT_DIRECTORY;
+    const char* loadProbes = nullptr;
+    bool checkpointTransferMatrices = false;
+    const char* relightLightmap = nullptr;
+    int relightFrames = 1;
+    int relightBasisFunctions = 64;
+    const char* debugDumpDirectory = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)
+        {
+            print_usage();
+            return 0;
+        }
+        else if (strncmp(arg, "--", 2) != 0)
+        {
+            sceneFile = arg;
+            continue;
+        }
+        else if (strcmp(arg, "--no-checkpoints") == 0)
+        {
+            checkpointDirectory = nullptr;
+            continue;
+        }
+        else if (strcmp(arg, "--checkpoint-transfer-matrices") == 0)
+        {
+            checkpointTransferMatrices = true;
+            continue;
+        }
+        else if (value == nullptr)
+        {
+            printf("Missing value for %s\n", arg);
+            print_usage();
+            return 1;
+        }
+
+        if (strcmp(arg, "--output") == 0)
+        {
+            outputFile = value;
+        }
+        else if (strcmp(arg, "--cache-dir") == 0)
+        {
+            cacheDirectory = value;
+        }
+        else if (strcmp(arg, "--checkpoint-dir") == 0)
+        {
+            checkpointDirectory = value;
+        }
+        else if (strcmp(arg, "--probes") == 0)
+        {
+            loadProbes = value;
+        }
+        else if (strcmp(arg, "--threads") == 0)
+        {
+#ifdef _OPENMP
+            omp_set_num_threads(atoi(value));
+#else
+            printf("Built without OpenMP, baking on a single thread\n");
+#endif
+        }
+        else if (strcmp(arg, "--debug-dumps") == 0)
+        {
+            debugDumpDirectory = value;
+        }
+        else if (strcmp(arg, "--voxel-size") == 0)
+        {
+            precalculationInfo.voxelSize = atof(value);
+        }
+        else if (strcmp(arg, "--voxel-padding") == 0)
+        {
+            precalculationInfo.voxelPadding = atoi(value);
+        }
+        else if (strcmp(arg, "--probe-overlaps") == 0)
+        {
+            precalculationInfo.probeOverlaps = atoi(value);
+        }
+        else if (strcmp(arg, "--rays-per-probe") == 0)
+        {
+            precalculationInfo.raysPerProbe = atoi(value);
+        }
+        else if (strcmp(arg, "--rays-per-receiver") == 0)
+        {
+            precalculationInfo.raysPerReceiver = atoi(value);
+        }
+        else if (strcmp(arg, "--sh-order") == 0)
+        {
+            precalculationInfo.sphericalHarmonicsOrder = atoi(value);
+        }
+        else if (strcmp(arg, "--cluster-coefficients") == 0)
+        {
+            precalculationInfo.clusterCoefficientCount = atoi(value);
+        }
+        else if (strcmp(arg, "--max-receivers-in-cluster") == 0)
+        {
+            precalculationInfo.maxReceiversInCluster = atoi(value);
+        }
+        else if (strcmp(arg, "--lightmap-resolution") == 0)
+        {
+            precalculationInfo.lightmapResolution = atoi(value);
+        }
+        else if (strcmp(arg, "--texel-size") == 0)
+        {
+            precalculationInfo.texelSize = atoi(value);
+        }
+        else if (strcmp(arg, "--desired-spacing") == 0)
+        {
+            precalculationInfo.desiredSpacing = atof(value);
+        }
+        else if (strcmp(arg, "--matrix-format") == 0)
+        {
+            precalculationInfo.matrixFormat = matrix_format_from_name(value);
+            if (precalculationInfo.matrixFormat < 0)
+            {
+                printf("Unknown matrix format %s\n", value);
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--relight") == 0)
+        {
+            relightLightmap = value;
+        }
+        else if (strcmp(arg, "--relight-frames") == 0)
+        {
+            relightFrames = atoi(value);
+        }
+        else if (strcmp(arg, "--basis-functions") == 0)
+        {
+            relightBasisFunctions = atoi(value);
+        }
+        else
+        {
+            printf("Unknown option %s\n", arg);
+            print_usage();
+            return 1;
+        }
+        i++;
+    }
+
+    GltfScene scene;
+    if (!load_gltf_scene(sceneFile, scene))
+    {
+        return 1;
+    }
+    generate_lightmap_uvs(scene, precalculationInfo.texelSize);
+
+    // Bakes that reuse probes are never cached, their key depends on the probes
+    std::string cacheFile;
+    bool upToDate = false;
+    if (!outputFile && loadProbes)
+    {
+        outputFile = PRECALCULATION_DEFAULT_FILE;
+    }
+    else if (!outputFile)
+    {
+        uint64_t contentKey = bake_content_key(scene, precalculationInfo);
+        cacheFile = bake_cache_path(cacheDirectory, contentKey);
+        BakeContainer cached;
+        if (std::filesystem::exists(cacheFile) && cached.open(cacheFile) &&
+            cached.content_key() == contentKey)
+        {
+            printf("%s is up to date\n", cacheFile.c_str());
+            upToDate = true;
+        }
+        outputFile = cacheFile.c_str();
+    }
+
+    if (!upToDate)
+    {
+        Precalculation precalculation;
+        PrecalculationLoadData precalculationLoadData = {};
+        PrecalculationResult precalculationResult = {};
+        if (debugDumpDirectory)
+        {
+            std::filesystem::create_directories(debugDumpDirectory);
+            precalculation.debugDumpDirectory = debugDumpDirectory;
+        }
+        if (!precalculation.prepare(nullptr, scene, precalculationInfo,
+                                    precalculationLoadData, precalculationResult, loadProbes,
+                                    outputFile, checkpointDirectory,
+                                    checkpointTransferMatrices))
+        {
+            return 1;
+        }
+    }
+
+    if (relightLightmap)
+    {
+        return relight_bake(outputFile, scene, relightLightmap, relightFrames,
+                            relightBasisFunctions)
+                   ? 0
+                   : 1;
+    }
+    return 0;
+}
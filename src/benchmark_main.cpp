@@ -0,0 +1,350 @@
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <bake/bake_cache.h>
+#include <bake/bake_scene.h>
+#include <frame_passes.h>
+#include <gi_brdf.h>
+#include <gi_deferred.h>
+#include <gi_diffuse.h>
+#include <gi_gbuffer.h>
+#include <gi_glossy.h>
+#include <gi_glossy_svgf.h>
+#include <gi_shadow.h>
+#include <precalculation.h>
+#include <vk_debug_renderer.h>
+#include <vk_initializers.h>
+#include <vk_null_render_device.h>
+#include <vk_rendergraph.h>
+
+#define FILE_HELPER_IMPL
+#include <file_helper.h>
+
+#include <chrono>
+#include <filesystem>
+#include <stdlib.h>
+#include <string.h>
+
+// Records the frame of the renderer into memory, without a window or a GPU. Everything the
+// render graph and the modules create goes to a NullRenderDevice, so the time is the CPU time
+// of building and recording the frame: adding the passes, compiling the graph, planning the
+// barriers and the transient memory and recording the commands. FSR2 and ImGui need a device,
+// their passes are recorded as the external commands they are in the renderer.
+
+static void print_usage()
+{
+    printf("Usage: panko_benchmark_recording [scene.gltf] [options]\n");
+    printf("  --bake <file>     bake of the scene (default: cache entry of the renderer's "
+           "inputs)\n");
+    printf("  --frames <n>      frames to record and time (default 1000)\n");
+}
+
+// The scene buffers and their bindings, like VulkanEngine::init_descriptors and init_scene
+static void init_scene_data(EngineData& engineData, SceneData& sceneData, GltfScene& scene)
+{
+    const int MAX_OBJECTS = 10000;
+    Vrg::RenderDevice* device = engineData.renderDevice;
+    Vrg::RenderGraph* renderGraph = engineData.renderGraph;
+
+    sceneData.objectBuffer =
+        device->create_buffer(sizeof(GPUObjectData) * MAX_OBJECTS,
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    sceneData.cameraBuffer =
+        device->create_buffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                              VMA_MEMORY_USAGE_CPU_TO_GPU);
+    sceneData.objectBufferBinding =
+        renderGraph->register_storage_buffer(&sceneData.objectBuffer, "ObjectBuffer");
+    sceneData.cameraBufferBinding =
+        renderGraph->register_uniform_buffer(&sceneData.cameraBuffer, "CameraBuffer");
+
+    VkBufferUsageFlags vertexUsage =
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    sceneData.vertexBuffer = device->create_upload_buffer(
+        scene.positions.data(), scene.positions.size() * sizeof(glm::vec3), vertexUsage,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    sceneData.indexBuffer = device->create_upload_buffer(
+        scene.indices.data(), scene.indices.size() * sizeof(uint32_t),
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    sceneData.normalBuffer = device->create_upload_buffer(
+        scene.normals.data(), scene.normals.size() * sizeof(glm::vec3), vertexUsage,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    sceneData.tangentBuffer = device->create_upload_buffer(
+        scene.tangents.data(), scene.tangents.size() * sizeof(glm::vec4), vertexUsage,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    sceneData.texBuffer = device->create_upload_buffer(
+        scene.texcoords0.data(), scene.texcoords0.size() * sizeof(glm::vec2), vertexUsage,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    sceneData.lightmapTexBuffer = device->create_upload_buffer(
+        scene.lightmapUVs.data(), scene.lightmapUVs.size() * sizeof(glm::vec2), vertexUsage,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    sceneData.materialBuffer =
+        device->create_buffer(scene.materials.size() * sizeof(GPUBasicMaterialData),
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    device->flush_uploads();
+
+    sceneData.vertexBufferBinding = renderGraph->register_vertex_buffer(
+        &sceneData.vertexBuffer, VK_FORMAT_R32G32B32_SFLOAT, "VertexBuffer");
+    sceneData.indexBufferBinding = renderGraph->register_index_buffer(
+        &sceneData.indexBuffer, VK_FORMAT_R32_UINT, "IndexBuffer");
+    sceneData.normalBufferBinding = renderGraph->register_vertex_buffer(
+        &sceneData.normalBuffer, VK_FORMAT_R32G32B32_SFLOAT, "NormalBuffer");
+    sceneData.tangentBufferBinding = renderGraph->register_vertex_buffer(
+        &sceneData.tangentBuffer, VK_FORMAT_R32G32B32A32_SFLOAT, "TangentBuffer");
+    sceneData.texBufferBinding = renderGraph->register_vertex_buffer(
+        &sceneData.texBuffer, VK_FORMAT_R32G32_SFLOAT, "TexBuffer");
+    sceneData.lightmapTexBufferBinding = renderGraph->register_vertex_buffer(
+        &sceneData.lightmapTexBuffer, VK_FORMAT_R32G32_SFLOAT, "LightmapTexBuffer");
+    sceneData.materialBufferBinding =
+        renderGraph->register_storage_buffer(&sceneData.materialBuffer, "MaterialBuffer");
+
+    // The texture and raytracing sets are made by the engine, the passes only bind them
+    sceneData.textureSetLayout = device->create_descriptor_set_layout(
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER}, "TextureSetLayout");
+    sceneData.textureDescriptor =
+        device->create_descriptor_set(sceneData.textureSetLayout, {}, "TextureSet");
+    sceneData.raytracingSetLayout = device->create_descriptor_set_layout(
+        {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+        "RaytracingSetLayout");
+    sceneData.raytracingDescriptor =
+        device->create_descriptor_set(sceneData.raytracingSetLayout, {}, "RaytracingSet");
+}
+
+int main(int argc, char* argv[])
+{
+    // Same defaults as VulkanEngine::init
+    PrecalculationInfo precalculationInfo = {};
+    precalculationInfo.voxelSize = 0.25;
+    precalculationInfo.voxelPadding = 2;
+    precalculationInfo.probeOverlaps = 10;
+    precalculationInfo.raysPerProbe = 1000;
+    precalculationInfo.raysPerReceiver = 40000;
+    precalculationInfo.sphericalHarmonicsOrder = 7;
+    precalculationInfo.clusterCoefficientCount = 32;
+    precalculationInfo.maxReceiversInCluster = 1024;
+    precalculationInfo.lightmapResolution = 261;
+    precalculationInfo.texelSize = 6;
+    precalculationInfo.desiredSpacing = 2;
+    precalculationInfo.matrixFormat = MATRIX_FORMAT_SNORM16;
+
+    const char* sceneFile = "../assets/cornellFixed.gltf";
+    const char* bakeFile = nullptr;
+    int frameCount = 1000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)
+        {
+            print_usage();
+            return 0;
+        }
+        else if (strncmp(arg, "--", 2) != 0)
+        {
+            sceneFile = arg;
+            continue;
+        }
+        else if (value == nullptr)
+        {
+            printf("Missing value for %s\n", arg);
+            print_usage();
+            return 1;
+        }
+
+        if (strcmp(arg, "--bake") == 0)
+        {
+            bakeFile = value;
+        }
+        else if (strcmp(arg, "--frames") == 0)
+        {
+            frameCount = atoi(value);
+        }
+        else
+        {
+            printf("Unknown option %s\n", arg);
+            print_usage();
+            return 1;
+        }
+        i++;
+    }
+
+    GltfScene scene;
+    if (!load_gltf_scene(sceneFile, scene))
+    {
+        return 1;
+    }
+
+    // A given bake brings its own settings, the lightmap UVs have to match them
+    Precalculation precalculation;
+    PrecalculationLoadData precalculationLoadData = {};
+    PrecalculationResult precalculationResult = {};
+    if (bakeFile)
+    {
+        if (!precalculation.load(bakeFile, precalculationInfo, precalculationLoadData,
+                                 precalculationResult))
+        {
+            return 1;
+        }
+        generate_lightmap_uvs(scene, precalculationInfo.texelSize);
+    }
+    else
+    {
+        generate_lightmap_uvs(scene, precalculationInfo.texelSize);
+        uint64_t bakeKey = bake_content_key(scene, precalculationInfo);
+        std::string cacheFile = bake_cache_path(PRECALCULATION_CACHE_DIRECTORY, bakeKey);
+        if (!std::filesystem::exists(cacheFile))
+        {
+            printf("%s does not exist, bake the scene with panko_bake or pass --bake\n",
+                   cacheFile.c_str());
+            return 1;
+        }
+        if (!precalculation.load(cacheFile.c_str(), precalculationInfo, precalculationLoadData,
+                                 precalculationResult, bakeKey))
+        {
+            return 1;
+        }
+    }
+
+    Vrg::NullRenderDevice device;
+    Vrg::RenderGraph renderGraph(&device);
+    EngineData engineData = {};
+    engineData.renderDevice = &device;
+    engineData.renderGraph = &renderGraph;
+
+    SceneData sceneData = {};
+    init_scene_data(engineData, sceneData, scene);
+
+    // Same modules and resolutions as VulkanEngine::init
+    VkExtent2D renderResolution = {1920, 1080};
+    VkExtent2D displayResolution = {1920, 1080};
+
+    BRDF brdf;
+    Shadow shadow;
+    GBuffer gbuffer;
+    DiffuseIllumination diffuse;
+    GlossyIllumination glossy;
+    GlossyDenoise glossyDenoise;
+    Deferred deferred;
+    VulkanDebugRenderer debugRenderer;
+
+    brdf.init_images(engineData);
+    shadow.init_buffers(engineData);
+    shadow.init_images(engineData);
+    gbuffer.init_images(engineData, renderResolution);
+    diffuse.init(engineData, &precalculationInfo, &precalculationLoadData,
+                 &precalculationResult, scene);
+    glossy.init_images(engineData, renderResolution);
+    glossyDenoise.init_images(engineData, renderResolution);
+    deferred.init_images(engineData, renderResolution);
+    debugRenderer.init(engineData);
+
+    // Stand-ins for the images of FSR2 (SuperResolution) and of the swapchain
+    AllocatedImage upscaledImage = device.create_image(
+        COLOR_32_FORMAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        {displayResolution.width, displayResolution.height, 1});
+    Handle<Vrg::Bindable> upscaledBinding = renderGraph.register_image_view(
+        &upscaledImage,
+        {.sampler = Vrg::Sampler::LINEAR, .baseMipLevel = 0, .mipLevelCount = 1},
+        "SuperResolutionOutputImage");
+    AllocatedImage swapchainImage = device.create_image(
+        COLOR_8_FORMAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        {displayResolution.width, displayResolution.height, 1});
+    Handle<Vrg::Bindable> swapchainBinding = renderGraph.register_image_view(
+        &swapchainImage,
+        {.sampler = Vrg::Sampler::LINEAR, .baseMipLevel = 0, .mipLevelCount = 1},
+        "SwapchainImage");
+
+    // Same settings as the editor defaults
+    FrameModules modules = {brdf,   shadow,        gbuffer, diffuse,
+                            glossy, glossyDenoise, deferred};
+    FrameSettings settings = {.groundTruthDiffuse = false,
+                              .realtimeRaycast = true,
+                              .basisFunctionCount = 64,
+                              .stochasticSpecular = true,
+                              .denoise = true};
+
+    auto drawObjects = [&](VkCommandBuffer cmd) {
+        for (int i = 0; i < scene.nodes.size(); i++)
+        {
+            auto& mesh = scene.prim_meshes[scene.nodes[i].prim_mesh];
+            renderGraph.get_recorder()->draw_indexed(cmd, mesh.idx_count, 1, mesh.first_idx,
+                                                     mesh.vtx_offset, i);
+        }
+    };
+
+    // The passes of VulkanEngine::add_frame_passes
+    auto addFrame = [&]() {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        shadow.prepare_rendering(engineData);
+        add_lighting_passes(cmd, engineData, sceneData, modules, settings, drawObjects);
+
+        auto gbufferData = gbuffer.get_current_frame_data();
+        renderGraph.add_render_pass(
+            {.name = "SuperResolutionPass",
+             .pipelineType = Vrg::PipelineType::CUSTOM,
+             .writes = {{0, upscaledBinding}},
+             .reads = {{0, deferred._deferredColorImageBinding},
+                       {0, gbufferData->depthBinding},
+                       {0, gbufferData->motionBinding}},
+             .execute = [](VkCommandBuffer cmd) {}});
+
+        debugRenderer.render(engineData, sceneData, displayResolution, swapchainBinding);
+
+        VkClearValue clearValue;
+        clearValue.color = {{1.0f, 1.0f, 1.0f, 1.0f}};
+
+        renderGraph.add_render_pass(
+            {.name = "PresentPass",
+             .pipelineType = Vrg::PipelineType::RASTER_TYPE,
+             .rasterPipeline =
+                 {
+                     .vertexShader = "../shaders/fullscreen.vert",
+                     .fragmentShader = "../shaders/gamma.frag",
+                     .size = displayResolution,
+                     .depthState = {false, false, VK_COMPARE_OP_NEVER},
+                     .cullMode = Vrg::CullMode::NONE,
+                     .blendAttachmentStates =
+                         {
+                             vkinit::color_blend_attachment_state(),
+                         },
+                     .colorOutputs =
+                         {
+                             {swapchainBinding, clearValue, true},
+                         },
+
+                 },
+             .reads = {{0, upscaledBinding}},
+             .execute = [&](VkCommandBuffer cmd) {
+                 auto recorder = renderGraph.get_recorder();
+                 recorder->draw(cmd, 3, 1, 0, 0);
+                 debugRenderer.custom_execute(cmd, engineData);
+                 recorder->external(cmd, "ImGui", [](VkCommandBuffer cmd) {});
+             }});
+
+        renderGraph.execute(cmd);
+    };
+
+    // The first frame creates the pipelines, descriptor sets and transient memory, it is not
+    // timed
+    addFrame();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frameCount; i++)
+    {
+        device.recorder.clear();
+        addFrame();
+    }
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Recorded %d frames in %.3f s, %.2f us per frame\n", frameCount, seconds,
+           frameCount > 0 ? seconds * 1e6 / frameCount : 0);
+    device.recorder.print_summary();
+
+    renderGraph.destroy();
+    device.destroy();
+    return 0;
+}
@@ -134,23 +134,20 @@ void Editor::prepare_debug_settings(EngineData& engineData)
     }
 }
 
-void Editor::prepare_performance_settings(EngineData& engineData)
+void Editor::prepare_performance_settings(const VulkanTimer& timer)
 {
     ImGuiIO& io = ImGui::GetIO();
 
     ImGui::Begin("Performance");
     {
-        if (engineData.renderGraph->vkTimer.result)
+        if (timer.result)
         {
             float totalTime = 0;
-            for (int i = 0; i < engineData.renderGraph->vkTimer.count; i++)
+            for (int i = 0; i < timer.count; i++)
             {
-                float time = (engineData.renderGraph->vkTimer.times[i * 2 + 1] -
-                              engineData.renderGraph->vkTimer.times[i * 2]) /
-                             1000000.0;
+                float time = (timer.times[i * 2 + 1] - timer.times[i * 2]) / 1000000.0;
                 totalTime += time;
-                sprintf_s(buffer, "%s: %.2f ms",
-                          engineData.renderGraph->vkTimer.names[i].c_str(), time);
+                sprintf_s(buffer, "%s: %.2f ms", timer.names[i].c_str(), time);
                 ImGui::Text(buffer);
             }
             ImGui::Separator();
@@ -322,15 +319,14 @@ void Editor::prepare_renderer_settings(EngineData& engineData, GPUCameraData& ca
         probeCount = precalculationResult.clusterReceiverInfos[specificCluster].probeCount; int
         probeOffset = precalculationResult.clusterReceiverInfos[specificCluster].probeOffset;
 
-                for (int i = 0; i < probeCount; i++) {
-                    if (precalculationResult.receiverProbeWeightData[(receiverOffset +
-        specificReceiver) * precalculationLoadData.maxProbesPerCluster + i] > 0) { int
-        realProbeIndex = precalculationResult.clusterProbes[probeOffset + i]; sprintf_s(buffer,
-        "Probe %d: %f", realProbeIndex,
-        precalculationResult.receiverProbeWeightData[(receiverOffset + specificReceiver) *
-        precalculationLoadData.maxProbesPerCluster + i]); ImGui::Checkbox(buffer,
-        &probesEnabled[realProbeIndex]);
-                    }
+                int receiver = receiverOffset + specificReceiver;
+                for (int w = precalculationResult.receiverProbeWeightOffsets[receiver];
+                     w < precalculationResult.receiverProbeWeightOffsets[receiver + 1]; w++) {
+                    const GPUReceiverProbeWeight& weight =
+        precalculationResult.receiverProbeWeights[w]; int realProbeIndex =
+        precalculationResult.clusterProbes[probeOffset + weight.clusterProbe];
+                    sprintf_s(buffer, "Probe %d: %f", realProbeIndex, weight.weight);
+                    ImGui::Checkbox(buffer, &probesEnabled[realProbeIndex]);
                 }
             }
         }
@@ -1,4 +1,5 @@
 #pragma once
+#include "vk_timer.h"
 #include "vk_types.h"
 #include <glm/glm.hpp>
 #include <string>
@@ -77,7 +78,7 @@ public:
     void prepare_camera_settings(EngineData& engineData, GPUCameraData& camData,
                                  CameraConfig& camConfig, bool sceneCameraAvailable);
     void prepare_debug_settings(EngineData& engineData);
-    void prepare_performance_settings(EngineData& engineData);
+    void prepare_performance_settings(const VulkanTimer& timer);
     void prepare_material_settings(EngineData& engineData, SceneData& sceneData,
                                    GPUBasicMaterialData* materials, int count);
     void prepare_object_settings(EngineData& engineData, GltfNode* node, int count);
@@ -2,6 +2,8 @@
 #define FILE_HELPER_H_
 
 #include <fstream>
+#include <string>
+#include <sys/stat.h>
 
 void save_binary(std::string filename, void* data, size_t size);
 size_t seek_file(std::string filename);
@@ -11,10 +13,8 @@ void load_binary(std::string filename, void* destination, size_t size);
 
 void save_binary(std::string filename, void* data, size_t size)
 {
-    FILE* ptr;
-    fopen_s(&ptr, filename.c_str(), "wb");
-    fwrite(data, size, 1, ptr);
-    fclose(ptr);
+    std::ofstream file(filename, std::ios::binary);
+    file.write((const char*)data, size);
 }
 
 size_t seek_file(std::string filename)
@@ -26,10 +26,8 @@ size_t seek_file(std::string filename)
 
 void load_binary(std::string filename, void* destination, size_t size)
 {
-    FILE* ptr;
-    fopen_s(&ptr, filename.c_str(), "rb");
-    fread_s(destination, size, size, 1, ptr);
-    fclose(ptr);
+    std::ifstream file(filename, std::ios::binary);
+    file.read((char*)destination, size);
 }
 
 #endif // FILE_HELPER_IMPL
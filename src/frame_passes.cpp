@@ -0,0 +1,45 @@
+#include "frame_passes.h"
+#include <gi_brdf.h>
+#include <gi_deferred.h>
+#include <gi_diffuse.h>
+#include <gi_gbuffer.h>
+#include <gi_glossy.h>
+#include <gi_glossy_svgf.h>
+#include <gi_shadow.h>
+
+void add_lighting_passes(VkCommandBuffer cmd, EngineData& engineData, SceneData& sceneData,
+                         FrameModules& modules, const FrameSettings& settings,
+                         std::function<void(VkCommandBuffer cmd)> drawObjects)
+{
+    // The passes keep their own copy, they run after this returns
+    auto draw = [drawObjects](VkCommandBuffer cmd) { drawObjects(cmd); };
+
+    modules.shadow.render(engineData, sceneData, draw);
+    modules.gbuffer.render(engineData, sceneData, draw);
+    if (settings.groundTruthDiffuse)
+    {
+        modules.diffuse.render_ground_truth(cmd, engineData, sceneData, modules.shadow,
+                                            modules.brdf);
+    }
+    else
+    {
+        modules.diffuse.render(cmd, engineData, sceneData, modules.shadow, modules.brdf, draw,
+                               settings.realtimeRaycast, settings.basisFunctionCount);
+    }
+    modules.glossy.render(engineData, sceneData, modules.gbuffer, modules.shadow,
+                          modules.diffuse, modules.brdf);
+
+    Handle<Vrg::Bindable> glossyBinding = modules.glossy._glossyReflectionsColorImageBinding;
+    if (settings.stochasticSpecular)
+    {
+        modules.glossyDenoise.render(engineData, sceneData, modules.gbuffer, modules.glossy);
+
+        if (settings.denoise)
+        {
+            glossyBinding = modules.glossyDenoise.get_denoised_binding();
+        }
+    }
+
+    modules.deferred.render(engineData, sceneData, modules.gbuffer, modules.shadow,
+                            modules.diffuse, modules.glossy, modules.brdf, glossyBinding);
+}
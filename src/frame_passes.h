@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <vk_types.h>
+
+class BRDF;
+class Shadow;
+class GBuffer;
+class DiffuseIllumination;
+class GlossyIllumination;
+class GlossyDenoise;
+class Deferred;
+
+// The modules whose passes light a frame
+struct FrameModules
+{
+    BRDF& brdf;
+    Shadow& shadow;
+    GBuffer& gbuffer;
+    DiffuseIllumination& diffuse;
+    GlossyIllumination& glossy;
+    GlossyDenoise& glossyDenoise;
+    Deferred& deferred;
+};
+
+struct FrameSettings
+{
+    bool groundTruthDiffuse;
+    bool realtimeRaycast;
+    int basisFunctionCount;
+    bool stochasticSpecular;
+    bool denoise;
+};
+
+// Adds the passes from the shadow map to the deferred image (Deferred::_deferredColorImage)
+// to the render graph. Upscaling and presenting are left to the caller, so the engine and
+// panko_benchmark_recording record the same frame. drawObjects is called by the raster
+// passes when the graph is executed.
+void add_lighting_passes(VkCommandBuffer cmd, EngineData& engineData, SceneData& sceneData,
+                         FrameModules& modules, const FrameSettings& settings,
+                         std::function<void(VkCommandBuffer cmd)> drawObjects);
@@ -16,8 +16,8 @@ void Deferred::init_images(EngineData& engineData, VkExtent2D imageSize)
 
     VkExtent3D extent3D = {_imageSize.width, _imageSize.height, 1};
 
-    _deferredColorImage = vkutils::create_image(
-        &engineData, COLOR_32_FORMAT,
+    engineData.renderGraph->create_transient_image(
+        &_deferredColorImage, COLOR_32_FORMAT,
         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
 
     _deferredColorImageBinding = engineData.renderGraph->register_image_view(
@@ -74,5 +74,7 @@ void Deferred::render(EngineData& engineData, SceneData& sceneData, GBuffer& gbu
                  {8, glossyIllumination._glossyReflectionsGbufferImageBinding},
              },
          .extraDescriptorSets = {{2, sceneData.textureDescriptor, sceneData.textureSetLayout}},
-         .execute = [&](VkCommandBuffer cmd) { vkCmdDraw(cmd, 3, 1, 0, 0); }});
+         .execute = [&](VkCommandBuffer cmd) {
+             engineData.renderGraph->get_recorder()->draw(cmd, 3, 1, 0, 0);
+         }});
 }
@@ -1,5 +1,7 @@
 #include "gi_diffuse.h"
 #include "gltf_scene.hpp"
+#include <bake/bake_container.h>
+#include <bake/matrix_quantization.h>
 #include <gi_brdf.h>
 #include <gi_shadow.h>
 #include <random>
@@ -7,7 +9,6 @@
 #include <vk_initializers.h>
 #include <vk_pipeline.h>
 #include <vk_rendergraph.h>
-#include <vk_utils.h>
 
 glm::vec3 calculate_barycentric(glm::vec2 p, glm::vec2 a, glm::vec2 b, glm::vec2 c);
 glm::vec3 apply_barycentric(glm::vec3 barycentricCoordinates, glm::vec3 a, glm::vec3 b,
@@ -58,6 +59,7 @@ void DiffuseIllumination::init(EngineData& engineData, PrecalculationInfo* preca
     _config.lightmapInputSize = glm::vec2(scene.lightmap_width, scene.lightmap_height);
     _config.pcaCoefficient = _precalculationInfo->clusterCoefficientCount;
     _config.maxReceiversInCluster = _precalculationInfo->maxReceiversInCluster;
+    _config.matrixFormat = _precalculationInfo->matrixFormat;
 
     _giLightmapExtent.width = precalculationInfo->lightmapResolution;
     _giLightmapExtent.height = precalculationInfo->lightmapResolution;
@@ -68,62 +70,79 @@ void DiffuseIllumination::init(EngineData& engineData, PrecalculationInfo* preca
                                           1};
 
     // IMAGES
-    _lightmapColorImage =
-        vkutils::create_image(&engineData, COLOR_32_FORMAT,
-                              VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                              lightmapImageExtent3D);
+    _lightmapColorImage = engineData.renderDevice->create_image(
+        COLOR_32_FORMAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        lightmapImageExtent3D);
     _lightmapColorImageBinding = engineData.renderGraph->register_image_view(
         &_lightmapColorImage,
         {.sampler = Vrg::Sampler::LINEAR, .baseMipLevel = 0, .mipLevelCount = 1},
         "DiffuseLightmapImage");
 
-    _giIndirectLightImage = vkutils::create_image(
-        &engineData, COLOR_32_FORMAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        giLightmapImageExtent3D);
+    // The receiver reconstruction blends every frame into the last one
+    engineData.renderGraph->create_transient_image(
+        &_giIndirectLightImage, COLOR_32_FORMAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, giLightmapImageExtent3D, 1,
+        true);
     _giIndirectLightImageBinding = engineData.renderGraph->register_image_view(
         &_giIndirectLightImage,
         {.sampler = Vrg::Sampler::LINEAR, .baseMipLevel = 0, .mipLevelCount = 1},
         "DiffuseIndirectImage");
 
-    _dilatedGiIndirectLightImage =
-        vkutils::create_image(&engineData, COLOR_32_FORMAT,
-                              VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                              giLightmapImageExtent3D);
+    // The probe relight passes bounce the light of the last frame
+    engineData.renderGraph->create_transient_image(
+        &_dilatedGiIndirectLightImage, COLOR_32_FORMAT,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        giLightmapImageExtent3D, 1, true);
     _dilatedGiIndirectLightImageBinding = engineData.renderGraph->register_image_view(
         &_dilatedGiIndirectLightImage,
         {.sampler = Vrg::Sampler::LINEAR, .baseMipLevel = 0, .mipLevelCount = 1},
         "DiffuseDilatedIndirectImage");
 
     // COMMON
-    _configBuffer = vkutils::create_upload_buffer(&engineData, &_config, sizeof(GIConfig),
-                                                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                                  VMA_MEMORY_USAGE_CPU_TO_GPU);
+    _configBuffer = engineData.renderDevice->create_upload_buffer(
+        &_config, sizeof(GIConfig), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
     _configBufferBinding =
         engineData.renderGraph->register_uniform_buffer(&_configBuffer, "DiffuseConfigBuffer");
 
+    // The baked arrays are streamed to the GPU in small chunks. Arrays that live in the mapped
+    // bake file and are not read on the CPU are dropped from memory right after their upload.
+    Vrg::RenderDevice* device = engineData.renderDevice;
+    BakeContainer* bakeFile = _precalculationResult->bakeFile.get();
+    auto release = [bakeFile](BakeSectionId id) {
+        if (bakeFile)
+        {
+            bakeFile->release(id);
+        }
+    };
+
     // Probe relighting buffers
-    _probeRaycastResultOfflineBuffer = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->probeRaycastResult,
+    _probeRaycastResultOfflineBuffer = device->create_upload_buffer(
+        _precalculationResult->probeRaycastResult,
         sizeof(GPUProbeRaycastResult) * _config.probeCount * _config.rayCount,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    release(BAKE_SECTION_PROBE_RAYCAST_RESULT);
     _probeRaycastResultOfflineBufferBinding = engineData.renderGraph->register_storage_buffer(
         &_probeRaycastResultOfflineBuffer, "DiffuseProbeRaycatResultOfflineBuffer");
 
-    _probeRaycastResultOnlineBuffer = vkutils::create_buffer(
-        engineData.allocator, sizeof(glm::vec4) * _config.probeCount * _config.rayCount,
+    _probeRaycastResultOnlineBuffer = device->create_buffer(
+        sizeof(glm::vec4) * _config.probeCount * _config.rayCount,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
     _probeRaycastResultOnlineBufferBinding = engineData.renderGraph->register_storage_buffer(
         &_probeRaycastResultOnlineBuffer, "DiffuseProbeRaycastResultOnlineBuffer");
 
-    _probeBasisBuffer = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->probeRaycastBasisFunctions,
+    _probeBasisBuffer = device->create_buffer(
         sizeof(glm::vec4) * (_config.rayCount * _config.basisFunctionCount / 4 + 1),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    device->upload_buffer(_probeBasisBuffer, 0,
+                          _precalculationResult->probeRaycastBasisFunctions,
+                          sizeof(float) * _config.rayCount * _config.basisFunctionCount);
+    release(BAKE_SECTION_PROBE_RAYCAST_BASIS_FUNCTIONS);
     _probeBasisBufferBinding = engineData.renderGraph->register_storage_buffer(
         &_probeBasisBuffer, "DiffuseProbeBasisBuffer");
 
-    _probeRelightOutputBuffer = vkutils::create_buffer(
-        engineData.allocator,
+    _probeRelightOutputBuffer = device->create_buffer(
         sizeof(glm::vec4) * _config.probeCount * _config.basisFunctionCount,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
         VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
@@ -131,56 +150,80 @@ void DiffuseIllumination::init(EngineData& engineData, PrecalculationInfo* preca
         &_probeRelightOutputBuffer, "DiffuseProbeRelightOutputBuffer");
 
     // cluster projetion
-    _clusterProjectionMatricesBuffer = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->clusterProjectionMatrices,
-        _precalculationLoadData->projectionMatricesSize * sizeof(float),
+    _clusterProjectionMatricesBuffer = device->create_upload_buffer(
+        _precalculationResult->clusterProjectionMatrices,
+        matrix_format_word_count(_config.matrixFormat,
+                                 _precalculationLoadData->projectionMatricesSize) *
+            sizeof(uint32_t),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
         VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
+    release(BAKE_SECTION_CLUSTER_PROJECTION_MATRICES);
     _clusterProjectionMatricesBufferBinding = engineData.renderGraph->register_storage_buffer(
         &_clusterProjectionMatricesBuffer, "DiffuseClusterProjectionMatricesBuffer");
 
-    _clusterProjectionOutputBuffer = vkutils::create_buffer(
-        engineData.allocator, _precalculationLoadData->totalSvdCoeffCount * sizeof(glm::vec4),
+    _clusterProjectionScalesBuffer = device->create_upload_buffer(
+        _precalculationResult->clusterProjectionScales,
+        _precalculationLoadData->totalSvdCoeffCount * sizeof(float),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    release(BAKE_SECTION_CLUSTER_PROJECTION_SCALES);
+    _clusterProjectionScalesBufferBinding = engineData.renderGraph->register_storage_buffer(
+        &_clusterProjectionScalesBuffer, "DiffuseClusterProjectionScalesBuffer");
+
+    _clusterProjectionOutputBuffer = device->create_buffer(
+        _precalculationLoadData->totalSvdCoeffCount * sizeof(glm::vec4),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
     _clusterProjectionOutputBufferBinding = engineData.renderGraph->register_storage_buffer(
         &_clusterProjectionOutputBuffer, "DiffuseClusterProjectionOutputBuffer");
 
-    _clusterReceiverInfos = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->clusterReceiverInfos,
+    _clusterReceiverInfos = device->create_upload_buffer(
+        _precalculationResult->clusterReceiverInfos,
         _config.clusterCount * sizeof(ClusterReceiverInfo), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         VMA_MEMORY_USAGE_GPU_ONLY);
     _clusterReceiverInfosBinding = engineData.renderGraph->register_storage_buffer(
         &_clusterReceiverInfos, "DiffuseClusterReceiverInfos");
 
-    _clusterProbes = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->clusterProbes,
+    _clusterProbes = device->create_buffer(
         (_precalculationLoadData->totalProbesPerCluster / 4 + 1) * sizeof(glm::ivec4),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    device->upload_buffer(_clusterProbes, 0, _precalculationResult->clusterProbes,
+                          _precalculationLoadData->totalProbesPerCluster * sizeof(int));
     _clusterProbesBinding = engineData.renderGraph->register_storage_buffer(
         &_clusterProbes, "DiffuseClusterProbes");
 
     // receiver reconstruction
-    _receiverReconstructionMatricesBuffer = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->receiverCoefficientMatrices,
-        (_precalculationLoadData->reconstructionMatricesSize / 4 + 1) * sizeof(glm::vec4),
+    _receiverReconstructionMatricesBuffer = device->create_upload_buffer(
+        _precalculationResult->receiverCoefficientMatrices,
+        matrix_format_word_count(_config.matrixFormat,
+                                 _precalculationLoadData->reconstructionMatricesSize) *
+            sizeof(uint32_t),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
         VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
+    release(BAKE_SECTION_RECEIVER_COEFFICIENT_MATRICES);
     _receiverReconstructionMatricesBufferBinding =
         engineData.renderGraph->register_storage_buffer(
             &_receiverReconstructionMatricesBuffer,
             "DiffuseReceiverReconstructionMatricesBuffer");
 
-    _clusterReceiverUvs = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->clusterReceiverUvs,
+    _receiverReconstructionScalesBuffer = device->create_upload_buffer(
+        _precalculationResult->receiverCoefficientScales, _config.clusterCount * sizeof(float),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    release(BAKE_SECTION_RECEIVER_COEFFICIENT_SCALES);
+    _receiverReconstructionScalesBufferBinding =
+        engineData.renderGraph->register_storage_buffer(
+            &_receiverReconstructionScalesBuffer, "DiffuseReceiverReconstructionScalesBuffer");
+
+    _clusterReceiverUvs = device->create_upload_buffer(
+        _precalculationResult->clusterReceiverUvs,
         _precalculationLoadData->totalClusterReceiverCount * sizeof(glm::ivec4),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    release(BAKE_SECTION_CLUSTER_RECEIVER_UVS);
     _clusterReceiverUvsBinding = engineData.renderGraph->register_storage_buffer(
         &_clusterReceiverUvs, "DiffuseClusterReceiverUvs");
 
-    _probeLocationsBuffer = vkutils::create_upload_buffer(
-        &engineData, _precalculationResult->probes.data(),
-        sizeof(glm::vec4) * _config.probeCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY);
+    _probeLocationsBuffer = device->create_upload_buffer(
+        _precalculationResult->probes.data(), sizeof(glm::vec4) * _config.probeCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
     _probeLocationsBufferBinding = engineData.renderGraph->register_storage_buffer(
         &_probeLocationsBuffer, "DiffuseProbeLocationsBuffer");
 
@@ -320,13 +363,14 @@ void DiffuseIllumination::init(EngineData& engineData, PrecalculationInfo* preca
 
         delete[] lm;
         _gpuReceiverCount = receiverCount;
-        _receiverBuffer = vkutils::create_upload_buffer(
-            &engineData, receiverDataVector.data(),
-            sizeof(GPUReceiverDataUV) * receiverDataVector.size(),
+        _receiverBuffer = device->create_upload_buffer(
+            receiverDataVector.data(), sizeof(GPUReceiverDataUV) * receiverDataVector.size(),
             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
         _receiverBufferBinding = engineData.renderGraph->register_storage_buffer(
             &_receiverBuffer, "ReceiverBuffer");
     }
+
+    device->flush_uploads();
 }
 
 VkSpecializationMapEntry specializationMapEntry = {0, 0, sizeof(uint32_t)};
@@ -479,7 +523,8 @@ void DiffuseIllumination::render(VkCommandBuffer cmd, EngineData& engineData,
                        {0, _probeRelightOutputBufferBinding},
                        {0, _clusterProjectionMatricesBufferBinding},
                        {0, _clusterReceiverInfosBinding},
-                       {0, _clusterProbesBinding}},
+                       {0, _clusterProbesBinding},
+                       {0, _clusterProjectionScalesBufferBinding}},
              .defines = {{"BASIS_SIZE", numBasisFunctions}}});
     }
 
@@ -502,7 +547,10 @@ void DiffuseIllumination::render(VkCommandBuffer cmd, EngineData& engineData,
                        {0, _clusterProjectionOutputBufferBinding},
                        {0, _receiverReconstructionMatricesBufferBinding},
                        {0, _clusterReceiverInfosBinding},
-                       {0, _clusterReceiverUvsBinding}}});
+                       {0, _clusterReceiverUvsBinding},
+                       {0, _receiverReconstructionScalesBufferBinding},
+                       // blended into
+                       {0, _giIndirectLightImageBinding}}});
     }
 
     // GI LIGHTMAP DILATION RENDERING
@@ -534,7 +582,9 @@ void DiffuseIllumination::render(VkCommandBuffer cmd, EngineData& engineData,
                  {
                      {0, _giIndirectLightImageBinding} // gi image
                  },
-             .execute = [&](VkCommandBuffer cmd) { vkCmdDraw(cmd, 3, 1, 0, 0); }});
+             .execute = [&](VkCommandBuffer cmd) {
+                 engineData.renderGraph->get_recorder()->draw(cmd, 3, 1, 0, 0);
+             }});
     }
 }
 
@@ -598,7 +648,9 @@ void DiffuseIllumination::render_ground_truth(VkCommandBuffer cmd, EngineData& e
              {
                  {0, _giIndirectLightImageBinding} // gi image
              },
-         .execute = [&](VkCommandBuffer cmd) { vkCmdDraw(cmd, 3, 1, 0, 0); }});
+         .execute = [&](VkCommandBuffer cmd) {
+             engineData.renderGraph->get_recorder()->draw(cmd, 3, 1, 0, 0);
+         }});
 }
 
 void DiffuseIllumination::debug_draw_probes(VulkanDebugRenderer& debugRenderer,
@@ -697,13 +749,13 @@ void DiffuseIllumination::debug_draw_specific_receiver(
         debugRenderer.draw_line(receiverPos, receiverPos + direction * 100.0f, {0, 1, 1});
     }
 
-    for (int probe = 0; probe < probeCount; probe++)
+    int receiver = receiverOffset + specificReceiver;
+    for (int w = _precalculationResult->receiverProbeWeightOffsets[receiver];
+         w < _precalculationResult->receiverProbeWeightOffsets[receiver + 1]; w++)
     {
-        int i = _precalculationResult->clusterProbes[probeOffset + probe];
-        if (_precalculationResult
-                ->receiverProbeWeightData[(receiverOffset + specificReceiver) *
-                                              _precalculationLoadData->maxProbesPerCluster +
-                                          probe] > 0.000001)
+        const GPUReceiverProbeWeight& weight = _precalculationResult->receiverProbeWeights[w];
+        int i = _precalculationResult->clusterProbes[probeOffset + weight.clusterProbe];
+        if (weight.weight > 0.000001)
         {
             if (enabledProbes[i])
             {
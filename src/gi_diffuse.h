@@ -43,6 +43,8 @@ public:
 
     AllocatedBuffer _clusterProjectionMatricesBuffer;
     Handle<Vrg::Bindable> _clusterProjectionMatricesBufferBinding;
+    AllocatedBuffer _clusterProjectionScalesBuffer;
+    Handle<Vrg::Bindable> _clusterProjectionScalesBufferBinding;
     AllocatedBuffer _clusterProjectionOutputBuffer;
     Handle<Vrg::Bindable> _clusterProjectionOutputBufferBinding;
     AllocatedBuffer _clusterReceiverInfos;
@@ -52,6 +54,8 @@ public:
 
     AllocatedBuffer _receiverReconstructionMatricesBuffer;
     Handle<Vrg::Bindable> _receiverReconstructionMatricesBufferBinding;
+    AllocatedBuffer _receiverReconstructionScalesBuffer;
+    Handle<Vrg::Bindable> _receiverReconstructionScalesBufferBinding;
     AllocatedBuffer _clusterReceiverUvs;
     Handle<Vrg::Bindable> _clusterReceiverUvsBinding;
 
@@ -9,32 +9,38 @@ void GBuffer::init_images(EngineData& engineData, VkExtent2D imageSize)
     _imageSize = imageSize;
     VkExtent3D extent3D = {_imageSize.width, _imageSize.height, 1};
 
+    // The denoiser reads the gbuffer of the last frame
     for (int i = 0; i < 2; i++)
     {
-        _gbufferdata[i].gbufferAlbedoMetallicImage = vkutils::create_image(
-            &engineData, COLOR_8_FORMAT,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
+        engineData.renderGraph->create_transient_image(
+            &_gbufferdata[i].gbufferAlbedoMetallicImage, COLOR_8_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D, 1,
+            true);
 
-        _gbufferdata[i].gbufferNormalImage = vkutils::create_image(
-            &engineData, VK_FORMAT_R16G16_SFLOAT,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
+        engineData.renderGraph->create_transient_image(
+            &_gbufferdata[i].gbufferNormalImage, VK_FORMAT_R16G16_SFLOAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D, 1,
+            true);
 
-        _gbufferdata[i].gbufferMotionImage = vkutils::create_image(
-            &engineData, VK_FORMAT_R16G16_SFLOAT,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
+        engineData.renderGraph->create_transient_image(
+            &_gbufferdata[i].gbufferMotionImage, VK_FORMAT_R16G16_SFLOAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D, 1,
+            true);
 
-        _gbufferdata[i].gbufferRoughnessDepthCurvatureMaterialImage = vkutils::create_image(
-            &engineData, COLOR_16_FORMAT,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
+        engineData.renderGraph->create_transient_image(
+            &_gbufferdata[i].gbufferRoughnessDepthCurvatureMaterialImage, COLOR_16_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D, 1,
+            true);
 
-        _gbufferdata[i].gbufferUVImage = vkutils::create_image(
-            &engineData, COLOR_16_FORMAT,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
+        engineData.renderGraph->create_transient_image(
+            &_gbufferdata[i].gbufferUVImage, COLOR_16_FORMAT,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D, 1,
+            true);
 
-        _gbufferdata[i].gbufferDepthImage = vkutils::create_image(
-            &engineData, DEPTH_32_FORMAT,
+        engineData.renderGraph->create_transient_image(
+            &_gbufferdata[i].gbufferDepthImage, DEPTH_32_FORMAT,
             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            extent3D);
+            extent3D, 1, true);
 
         auto index = std::to_string(i);
 
@@ -21,17 +21,18 @@ void GlossyIllumination::init_images(EngineData& engineData, VkExtent2D imageSiz
                        std::floor(std::log2(std::max(_imageSize.width, _imageSize.height)))) +
                    1;
 
-    _glossyReflectionsColorImage =
-        vkutils::create_image(&engineData, COLOR_16_FORMAT,
-                              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
-                                  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                              extent3D, mipmapLevels);
+    // Without the denoiser the path tracer accumulates into the color of the last frames
+    engineData.renderGraph->create_transient_image(
+        &_glossyReflectionsColorImage, COLOR_16_FORMAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        extent3D, mipmapLevels, true);
 
-    _glossyReflectionsGbufferImage =
-        vkutils::create_image(&engineData, COLOR_16_FORMAT,
-                              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
-                                  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-                              extent3D, mipmapLevels);
+    engineData.renderGraph->create_transient_image(
+        &_glossyReflectionsGbufferImage, COLOR_16_FORMAT,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        extent3D, mipmapLevels);
 
     _glossyReflectionsColorImageBinding = engineData.renderGraph->register_image_view(
         &_glossyReflectionsColorImage,
@@ -99,6 +100,8 @@ void GlossyIllumination::render(EngineData& engineData, SceneData& sceneData, GB
                  {6, shadow._shadowMapColorImageBinding},
                  {7, diffuseIllumination._dilatedGiIndirectLightImageBinding},
                  {8, brdfUtils.brdfLutImageBinding},
+                 // accumulated into without the denoiser
+                 {1, _glossyReflectionsColorImageBinding},
              },
          .extraDescriptorSets = {
              {0, sceneData.raytracingDescriptor, sceneData.raytracingSetLayout},
@@ -138,7 +141,7 @@ void GlossyIllumination::render(EngineData& engineData, SceneData& sceneData, GB
                     {&pushData, sizeof(glm::vec3)}
                 },
                 .execute = [&](VkCommandBuffer cmd) {
-                    vkCmdDraw(cmd, 3, 1, 0, 0);
+                    engineData.renderGraph->get_recorder()->draw(cmd, 3, 1, 0, 0);
                 }
             });
         }
@@ -176,7 +179,7 @@ void GlossyIllumination::render(EngineData& engineData, SceneData& sceneData, GB
                     {&pushData, sizeof(glm::vec3)}
                 },
                 .execute = [&](VkCommandBuffer cmd) {
-                    vkCmdDraw(cmd, 3, 1, 0, 0);
+                    engineData.renderGraph->get_recorder()->draw(cmd, 3, 1, 0, 0);
                 }
             });
         }
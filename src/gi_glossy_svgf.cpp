@@ -1,4 +1,5 @@
 #include "gi_glossy_svgf.h"
+#include <math.h>
 #include <vk_initializers.h>
 #include <vk_rendergraph.h>
 #include <vk_utils.h>
@@ -9,15 +10,16 @@ void GlossyDenoise::init_images(EngineData& engineData, VkExtent2D imageSize)
 
     VkExtent3D extent3D = {_imageSize.width, _imageSize.height, 1};
 
+    // The temporal pass reads the color and moments of the last frame
     for (int i = 0; i < 2; i++)
     {
-        _temporalData[i].colorImage = vkutils::create_image(
-            &engineData, COLOR_16_FORMAT,
-            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
+        engineData.renderGraph->create_transient_image(
+            &_temporalData[i].colorImage, COLOR_16_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D, 1, true);
 
-        _temporalData[i].momentsImage = vkutils::create_image(
-            &engineData, COLOR_16_FORMAT,
-            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
+        engineData.renderGraph->create_transient_image(
+            &_temporalData[i].momentsImage, COLOR_16_FORMAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D, 1, true);
 
         _temporalData[i].colorImageBinding = engineData.renderGraph->register_image_view(
             &_temporalData[i].colorImage,
@@ -33,8 +35,8 @@ void GlossyDenoise::init_images(EngineData& engineData, VkExtent2D imageSize)
     // atrous
     for (int i = 0; i < 2; i++)
     {
-        _atrousData[i].pingImage = vkutils::create_image(
-            &engineData, COLOR_16_FORMAT,
+        engineData.renderGraph->create_transient_image(
+            &_atrousData[i].pingImage, COLOR_16_FORMAT,
             VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent3D);
 
         _atrousData[i].pingImageBinding = engineData.renderGraph->register_image_view(
@@ -3,20 +3,19 @@
 #include <vk_initializers.h>
 #include <vk_pipeline.h>
 #include <vk_rendergraph.h>
-#include <vk_utils.h>
 
 void Shadow::init_images(EngineData& engineData)
 {
     VkExtent3D depthImageExtent3D = {_shadowMapExtent.width, _shadowMapExtent.height, 1};
 
-    _shadowMapColorImage = vkutils::create_image(
-        &engineData, COLOR_32_FORMAT,
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, depthImageExtent3D);
+    _shadowMapColorImage = engineData.renderDevice->create_image(
+        COLOR_32_FORMAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        depthImageExtent3D);
 
-    _shadowMapDepthImage = vkutils::create_image(&engineData, DEPTH_32_FORMAT,
-                                                 VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
-                                                     VK_IMAGE_USAGE_SAMPLED_BIT,
-                                                 depthImageExtent3D);
+    _shadowMapDepthImage = engineData.renderDevice->create_image(
+        DEPTH_32_FORMAT,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        depthImageExtent3D);
 
     _shadowMapColorImageBinding = engineData.renderGraph->register_image_view(
         &_shadowMapColorImage,
@@ -31,19 +30,19 @@ void Shadow::init_images(EngineData& engineData)
 
 void Shadow::init_buffers(EngineData& engineData)
 {
-    _shadowMapDataBuffer = vkutils::create_buffer(
-        engineData.allocator, sizeof(GPUShadowMapData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+    _shadowMapDataBuffer = engineData.renderDevice->create_buffer(
+        sizeof(GPUShadowMapData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
         VMA_MEMORY_USAGE_CPU_TO_GPU);
-    vkutils::cpu_to_gpu(engineData.allocator, _shadowMapDataBuffer, &_shadowMapData,
-                        sizeof(GPUShadowMapData));
+    engineData.renderDevice->write_buffer(_shadowMapDataBuffer, &_shadowMapData,
+                                          sizeof(GPUShadowMapData));
     _shadowMapDataBinding = engineData.renderGraph->register_uniform_buffer(
         &_shadowMapDataBuffer, "ShadowMapData");
 }
 
 void Shadow::prepare_rendering(EngineData& engineData)
 {
-    vkutils::cpu_to_gpu(engineData.allocator, _shadowMapDataBuffer, &_shadowMapData,
-                        sizeof(GPUShadowMapData));
+    engineData.renderDevice->write_buffer(_shadowMapDataBuffer, &_shadowMapData,
+                                          sizeof(GPUShadowMapData));
 }
 
 void Shadow::render(EngineData& engineData, SceneData& sceneData,
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <initializer_list>
+#include <stddef.h>
 #include <vector>
 
 // https://twitter.com/SebAaltonen/status/1535253315654762501
 template <typename T> struct Slice
 {
+    Slice();
     Slice(std::initializer_list<T> init);
     Slice(T* _data, size_t _size);
     Slice(std::vector<T>& list);
@@ -46,6 +48,12 @@ template <typename T> struct Slice
     }
 };
 
+template <typename T> inline Slice<T>::Slice()
+{
+    m_data = nullptr;
+    m_size = 0;
+}
+
 template <typename T> inline Slice<T>::Slice(std::initializer_list<T> init)
 {
     m_data = (T*)init.begin();
@@ -2,31 +2,75 @@
 #include "precalculation_types.h"
 #include "spherical_harmonics.h"
 #include <omp.h>
+#include <inttypes.h>
 #include <stdint.h>
-#include <triangle_box_intersection.h>
 
 #include <fstream>
 #include <queue>
 #include <vector>
-#include <vk_initializers.h>
-#include <vk_utils.h>
 
 #include "json.hpp"
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <bake/bake_cache.h>
+#include <bake/bake_checkpoint.h>
+#include <bake/bake_container.h>
+#include <bake/bake_profiler.h>
+#include <bake/cpu_raytracer.h>
+#include <bake/incremental_svd.h>
+#include <bake/matrix_quantization.h>
+#include <bake/probe_grid.h>
+#include <bake/receiver_store.h>
+#include <bake/scratch_file.h>
+#include <bake/voxelizer.h>
 #include <chrono>
+#include <immintrin.h>
+#include <iterator>
+#include <numeric>
 #include <set>
-#include <unordered_set>
-#include <vk_pipeline.h>
+#include <tuple>
 
 #include <file_helper.h>
 #include <redsvd.h>
 
+// Defined in triangle_box_intersection.h, which is compiled with the voxelizer
+glm::vec3 calculate_barycentric(glm::vec2 p, glm::vec2 a, glm::vec2 b, glm::vec2 c);
+glm::vec3 apply_barycentric(glm::vec3 barycentricCoordinates, glm::vec3 a, glm::vec3 b,
+                            glm::vec3 c);
+
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
-#define USE_COMPUTE_PROBE_DENSITY_CALCULATION 1
+// panko_bake is built without the Vulkan backend (precalculation_vulkan.cpp)
+#ifdef PANKO_HEADLESS_BAKE
+#define USE_VULKAN_PRECALCULATION 0
+#else
+#define USE_VULKAN_PRECALCULATION 1
+#endif
+
+// The compute path re-weights every probe on the GPU for each removal, the CPU path only
+// updates the neighbours of the removed probe
+#define USE_COMPUTE_PROBE_DENSITY_CALCULATION 0
 #define M_PI 3.14159265358979323846264338327950288
+#define PHI 1.61803398874989484820459f
+#define WINDOWING 10
+#define RAY_T_MIN 0.0001f
+#define RAY_T_MAX 10000.0f
+#define RECEIVER_TILE_SIZE 64
+
+// Receiver clusters are split at the middle of the longest axis of their box. The balanced
+// split divides them by receiver count instead so they all end up close to
+// maxReceiversInCluster; the iterative PCA grows faster than linearly with the rows of a
+// cluster, so it is off by default.
+#define BALANCED_RECEIVER_CLUSTERS 0
+// Smaller nodes are divided without spawning a task
+#define AABB_TASK_RECEIVERS 8192
+// Extra directions the SVDs of the iterative PCA keep beyond the cluster coefficient count.
+// The incremental SVD then barely overestimates the error of a growing sub cluster and the
+// randomized SVD of a finished one stays within about 1% of an exact decomposition.
+#define PCA_RANK_OVERSAMPLING 16
+#define PCA_POWER_ITERATIONS 2
 
 inline float dot_product(float* data1, float* data2, int size)
 {
@@ -250,274 +294,396 @@ static float calculate_density(float length, float radius)
     return 0;
 }
 
-static float calculate_spatial_weight(float radius, int probeIndex,
-                                      std::vector<glm::vec4>& probes)
+static float calculate_radius(const ReceiverStore& receivers, const ProbeGrid& probeGrid,
+                              int overlaps)
 {
     // OPTICK_EVENT();
 
-    float total_weight = 0.f;
-#pragma omp parallel for reduction(+ : total_weight)
-    for (int i = 0; i < probes.size(); i++)
+    // Average distance of the receivers to their overlaps-th closest probe
+    double radius = 0;
+#pragma omp parallel for schedule(dynamic, 256) reduction(+ : radius)
+    for (int r = 0; r < receivers.size(); r += 1)
     {
-        if (i != probeIndex)
-        {
-            total_weight +=
-                calculate_density(glm::distance(probes[i], probes[probeIndex]), radius);
-        }
+        radius += probeGrid.kth_nearest_distance(receivers.positions[r], overlaps);
     }
-    return total_weight;
+
+    return radius / receivers.size();
 }
 
-static float calculate_radius(Receiver* receivers, int receiverSize,
-                              std::vector<glm::vec4>& probes, int overlaps)
+// Weights of the probes of every cluster for each of its receivers in CSR form, the receivers
+// in cluster order. Probes outside the radius of a receiver have no weight and are left out.
+static void build_receiver_probe_weights(const ReceiverStore& receivers,
+                                         const std::vector<glm::vec4>& probes,
+                                         const std::vector<AABB>& aabbClusters, float radius,
+                                         std::vector<int>& outOffsets,
+                                         std::vector<GPUReceiverProbeWeight>& outWeights)
 {
-    // OPTICK_EVENT();
-
-    float radius = 0;
-    int receiverCount = 0;
-    Receiver* previousReceiver = nullptr;
-#pragma omp parallel for
-    for (int r = 0; r < receiverSize; r += 1)
+    outOffsets.assign(1, 0);
+    outWeights.clear();
+    for (const AABB& cluster : aabbClusters)
     {
-        if (!receivers[r].exists)
+        for (int receiver : cluster.receivers)
         {
-            continue;
+            for (int k = 0; k < cluster.probes.size(); k++)
+            {
+                float weight = calculate_density(
+                    glm::distance(receivers.positions[receiver],
+                                  glm::vec3(probes[cluster.probes[k]])),
+                    radius);
+                if (weight > 0)
+                {
+                    outWeights.push_back({k, weight});
+                }
+            }
+            outOffsets.push_back(outWeights.size());
         }
-        // if (previousReceiver != nullptr) {
-        //	printf("Distance between them is %f\n", glm::distance(receivers[r].position,
-        // previousReceiver->position));
-        // }
-        // if (previousReceiver != nullptr && glm::distance(receivers[r].position,
-        // previousReceiver->position) < 100) { 	continue;
-        // }
-
-        std::priority_queue<float, std::vector<float>, std::greater<float>> minheap;
+    }
+}
 
-        for (int p = 0; p < probes.size(); p++)
+// Partitions receiverIndices in place and appends the clusters of the node in the order of
+// the index array, so the result does not depend on how the tasks were scheduled
+static void divide_aabb(std::vector<AABB>& aabbClusters, AABB node,
+                        const ReceiverStore& receivers, int* receiverIndices,
+                        int receiverCount, int divideReceivers)
+{
+    if (receiverCount <= divideReceivers)
+    {
+        if (receiverCount > 0)
         {
-            minheap.push(glm::distance(glm::vec3(probes[p]), receivers[r].position));
+            // Receivers stay in texel order inside a cluster
+            node.receivers.assign(receiverIndices, receiverIndices + receiverCount);
+            std::sort(node.receivers.begin(), node.receivers.end());
+            aabbClusters.push_back(std::move(node));
         }
+        return;
+    }
 
-        for (int i = 0; i < overlaps - 1; i++)
-        {
-            minheap.pop();
-        }
+#if BALANCED_RECEIVER_CLUSTERS
+    node.min = node.max = receivers.positions[receiverIndices[0]];
+    for (int i = 1; i < receiverCount; i++)
+    {
+        node.min = glm::min(node.min, receivers.positions[receiverIndices[i]]);
+        node.max = glm::max(node.max, receivers.positions[receiverIndices[i]]);
+    }
+#endif
 
-#pragma omp critical
-        {
-            radius += minheap.top();
-            receiverCount++;
-        }
-        // previousReceiver = &receivers[r];
+    glm::vec3 size = node.max - node.min;
+    int axis = 2;
+    if (size.x >= size.y && size.x >= size.z)
+    {
+        axis = 0;
+    }
+    else if (size.y >= size.x && size.y >= size.z)
+    {
+        axis = 1;
     }
 
-    return radius / receiverCount;
+#if BALANCED_RECEIVER_CLUSTERS
+    // Give each side a share of the receivers that needs a whole number of full clusters
+    int clusterCount = (receiverCount + divideReceivers - 1) / divideReceivers;
+    int firstCount = (int)((int64_t)receiverCount * (clusterCount / 2) / clusterCount);
+    std::nth_element(receiverIndices, receiverIndices + firstCount,
+                     receiverIndices + receiverCount, [&](int a, int b) {
+                         return receivers.positions[a][axis] < receivers.positions[b][axis];
+                     });
+    float split = receivers.positions[receiverIndices[firstCount]][axis];
+#else
+    float split = node.min[axis] + size[axis] / 2.f;
+    int firstCount = std::partition(receiverIndices, receiverIndices + receiverCount,
+                                    [&](int receiver) {
+                                        return receivers.positions[receiver][axis] < split;
+                                    }) -
+                     receiverIndices;
+#endif
+
+    AABB first = {};
+    AABB second = {};
+    first.min = node.min;
+    first.max = node.max;
+    first.max[axis] = split;
+    second.min = node.min;
+    second.min[axis] = split;
+    second.max = node.max;
+
+    std::vector<AABB> firstClusters;
+    std::vector<AABB> secondClusters;
+#pragma omp task shared(firstClusters, receivers) if (receiverCount > AABB_TASK_RECEIVERS)
+    divide_aabb(firstClusters, first, receivers, receiverIndices, firstCount,
+                divideReceivers);
+    divide_aabb(secondClusters, second, receivers, receiverIndices + firstCount,
+                receiverCount - firstCount, divideReceivers);
+#pragma omp taskwait
+
+    std::move(firstClusters.begin(), firstClusters.end(), std::back_inserter(aabbClusters));
+    std::move(secondClusters.begin(), secondClusters.end(), std::back_inserter(aabbClusters));
 }
 
-static void divide_aabb(std::vector<AABB>& aabbClusters, AABB node, Receiver* receivers,
-                        int receiverCount, int divideReceivers)
+// CPU versions of the ray generation helpers in common.glsl and the precomputation shaders
+
+static glm::vec3 probe_ray_direction(int index, int rays)
 {
-    int receiversInIt = 0;
-    for (int i = 0; i < receiverCount; i++)
+    // Spherical fibonacci, same as precalculate_probe_rt.rgen
+    float dirY = 1 - (index / float(rays - 1)) * 2;
+    float radius = std::sqrt(1 - dirY * dirY);
+    float theta = PHI * (float)M_PI * index;
+    float dirX = std::cos(theta) * radius;
+    float dirZ = std::sin(theta) * radius;
+    return glm::normalize(glm::vec3(dirX, dirY, dirZ));
+}
+
+static uint32_t init_rand(uint32_t val0, uint32_t val1)
+{
+    uint32_t v0 = val0, v1 = val1, s0 = 0;
+
+    for (uint32_t n = 0; n < 16; n++)
     {
-        auto receiver = receivers[i];
-        if (!receiver.exists)
-        {
-            continue;
-        }
-        if (receiver.position.x >= node.min.x && receiver.position.x < node.max.x &&
-            receiver.position.y >= node.min.y && receiver.position.y < node.max.y &&
-            receiver.position.z >= node.min.z && receiver.position.z < node.max.z)
-        {
-            node.receivers.push_back(receiver);
-        }
+        s0 += 0x9e3779b9;
+        v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+        v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
     }
+    return v0;
+}
+
+static float next_rand(uint32_t& s)
+{
+    s = (1664525u * s + 1013904223u);
+    return float(s & 0x00FFFFFF) / float(0x01000000);
+}
 
-    if (node.receivers.size() > divideReceivers)
+static float halton(int index, int base)
+{
+    float result = 0;
+    float f = 1;
+    while (index > 0)
     {
-        // printf("There are %d receivers in this AABB, splitting\n", node.receivers.size());
+        f /= base;
+        result += f * (index % base);
+        index = int(std::floor(index / float(base)));
+    }
+    return result;
+}
 
-        auto size = node.max - node.min;
-        float dimX = size.x;
-        float dimY = size.y;
-        float dimZ = size.z;
+static glm::vec3 get_perpendicular_vector(glm::vec3 u)
+{
+    glm::vec3 a = glm::abs(u);
+    uint32_t xm = ((a.x - a.y) < 0 && (a.x - a.z) < 0) ? 1 : 0;
+    uint32_t ym = (a.y - a.z) < 0 ? (1 ^ xm) : 0;
+    uint32_t zm = 1 ^ (xm | ym);
+    return glm::cross(u, glm::vec3(xm, ym, zm));
+}
 
-        // printf("Sizes are: %f %f %f\n", dimX, dimY, dimZ);
+static glm::vec3 get_cos_hemisphere_sample(int index, glm::vec2 offset, glm::vec3 hitNorm)
+{
+    float u = glm::fract(halton(index, 3) + offset.x);
+    float v = glm::fract(halton(index, 5) + offset.y);
 
-        AABB first = {};
-        AABB second = {};
+    glm::vec3 bitangent = get_perpendicular_vector(hitNorm);
+    glm::vec3 tangent = glm::cross(bitangent, hitNorm);
+    float r = std::sqrt(u);
+    float phi = 2.0f * 3.14159265f * v;
 
-        if (dimX >= dimY && dimX >= dimZ)
-        {
-            first.min = node.min;
-            first.max = {node.min.x + dimX / 2.f, node.max.y, node.max.z};
-            second.min = {node.min.x + dimX / 2.f, node.min.y, node.min.z};
-            second.max = node.max;
-        }
-        else if (dimY >= dimX && dimY >= dimZ)
-        {
-            first.min = node.min;
-            first.max = {node.max.x, node.min.y + dimY / 2.f, node.max.z};
-            second.min = {node.min.x, node.min.y + dimY / 2.f, node.min.z};
-            second.max = node.max;
-        }
-        else
-        {
-            first.min = node.min;
-            first.max = {node.max.x, node.max.y, node.min.z + dimZ / 2.f};
-            second.min = {node.min.x, node.min.y, node.min.z + dimZ / 2.f};
-            second.max = node.max;
-        }
+    return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) +
+           hitNorm * std::sqrt(1 - u);
+}
+
+static glm::vec3 offset_ray(glm::vec3 p, glm::vec3 n)
+{
+    const float float_scale = 0.001;
+    return p + float_scale * n;
+}
 
-        divide_aabb(aabbClusters, first, node.receivers.data(), node.receivers.size(),
-                    divideReceivers);
-        divide_aabb(aabbClusters, second, node.receivers.data(), node.receivers.size(),
-                    divideReceivers);
+static float window(float l, float w)
+{
+    if (l == 0)
+    {
+        return 1;
     }
-    else if (node.receivers.size() > 0)
+    else if (l >= w)
     {
-        aabbClusters.push_back(node);
+        return 0;
     }
+
+    float x = (float)M_PI * l / w;
+    return std::sin(x) / x;
 }
 
-void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
+bool Precalculation::prepare(VulkanEngine* engine, GltfScene& scene,
                              PrecalculationInfo precalculationInfo,
                              PrecalculationLoadData& outPrecalculationLoadData,
                              PrecalculationResult& outPrecalculationResult,
-                             const char* loadProbes)
+                             const char* loadProbes, const char* outputFilename,
+                             const char* checkpointDirectory,
+                             bool checkpointTransferMatrices)
 {
+    // Every stage and the expensive loops in them are zones of the profile written next to
+    // the bake
+    bake_profiler::begin();
+    BakeProfileZone bakeZone("bake");
+
     printf("Scene center: %f x %f x %f\n", scene.m_dimensions.center.x,
            scene.m_dimensions.center.y, scene.m_dimensions.center.z);
     printf("Scene dimensions: %f x %f x %f\n", scene.m_dimensions.size.x,
            scene.m_dimensions.size.y, scene.m_dimensions.size.z);
-    std::vector<Receiver> receivers =
-        generate_receivers_cpu(engine, scene, precalculationInfo.lightmapResolution);
-    std::vector<glm::vec4> probes;
 
-    if (loadProbes == nullptr)
-    {
-        int voxelDimX, voxelDimY, voxelDimZ;
-        std::vector<uint8_t> voxelData =
-            voxelize(scene, precalculationInfo.voxelSize, precalculationInfo.voxelPadding,
-                     voxelDimX, voxelDimY, voxelDimZ);
+    // Every stage is keyed by the keys of the stages it reads and its own settings
+    uint64_t sceneKey = bake_scene_key(scene);
+    BakeCheckpoints checkpoints;
+    checkpoints.init(checkpointDirectory ? checkpointDirectory : "", sceneKey);
+    // The GPU stages do not give the exact same results as the CPU ones
+    int backend = USE_VULKAN_PRECALCULATION && engine != nullptr;
+
+    // The CPU stages trace against their own BVH instead of the engine's TLAS, it is only
+    // built once a stage has to trace
+    CpuRaytracer raytracer;
+    bool raytracerBuilt = false;
+    auto build_raytracer = [&]() {
+        if (engine == nullptr && !raytracerBuilt)
+        {
+            raytracer.build(scene);
+            raytracerBuilt = true;
+        }
+    };
 
-        // Place probes everywhere in the voxelized scene
-        for (int k = precalculationInfo.voxelPadding;
-             k < voxelDimZ - precalculationInfo.voxelPadding; k += 1)
+    ReceiverStore receivers;
+    uint64_t receiversKey =
+        bake_stage_key(BAKE_STAGE_RECEIVERS, sceneKey, precalculationInfo.lightmapResolution);
+    {
+        BakeProfileZone zone(bake_stage_name(BAKE_STAGE_RECEIVERS));
+        BakeContainer checkpoint;
+        if (!checkpoints.resume(BAKE_STAGE_RECEIVERS, receiversKey, checkpoint) ||
+            !read_receivers(checkpoint, receivers))
         {
-            for (int j = precalculationInfo.voxelPadding;
-                 j < voxelDimY - precalculationInfo.voxelPadding; j += 1)
+            generate_receivers_cpu(scene, precalculationInfo.lightmapResolution, receivers);
+
+            BakeContainerWriter writer;
+            if (checkpoints.begin(BAKE_STAGE_RECEIVERS, receiversKey, writer))
             {
-                for (int i = precalculationInfo.voxelPadding;
-                     i < voxelDimX - precalculationInfo.voxelPadding; i += 1)
-                {
-                    int index = i + j * voxelDimX + k * voxelDimX * voxelDimY;
-                    if (voxelData[index] == 3)
-                    {
-                        probes.push_back({scene.m_dimensions.min.x +
-                                              precalculationInfo.voxelSize *
-                                                  (i - precalculationInfo.voxelPadding) +
-                                              precalculationInfo.voxelSize / 2.f,
-                                          scene.m_dimensions.min.y +
-                                              precalculationInfo.voxelSize *
-                                                  (j - precalculationInfo.voxelPadding) +
-                                              precalculationInfo.voxelSize / 2.f,
-                                          scene.m_dimensions.min.z +
-                                              precalculationInfo.voxelSize *
-                                                  (k - precalculationInfo.voxelPadding) +
-                                              precalculationInfo.voxelSize / 2.f,
-                                          0.f});
-                    }
-                }
+                write_receivers(writer, receivers);
+                checkpoints.commit(BAKE_STAGE_RECEIVERS, receiversKey, writer);
+            }
+        }
+        zone.add_items(receivers.size());
+    }
+
+    std::vector<glm::vec4> probes;
+    uint64_t probesKey =
+        bake_stage_key(BAKE_STAGE_PROBES, sceneKey, precalculationInfo.voxelSize,
+                       precalculationInfo.voxelPadding, precalculationInfo.desiredSpacing);
+    BakeProfileZone probesZone(bake_stage_name(BAKE_STAGE_PROBES));
+    BakeContainer probeCheckpoint;
+    if (loadProbes == nullptr &&
+        checkpoints.resume(BAKE_STAGE_PROBES, probesKey, probeCheckpoint) &&
+        read_checkpoint_section(probeCheckpoint, BAKE_SECTION_PROBES, probes))
+    {
+        printf("Resumed %d probes.\n", (int)probes.size());
+    }
+    else if (loadProbes == nullptr)
+    {
+        VoxelGrid voxelGrid;
+        voxelize(scene, precalculationInfo.voxelSize, precalculationInfo.voxelPadding,
+                 voxelGrid);
+
+        // Place probes everywhere in the voxelized scene. Only the bricks that are not uniform
+        // are visited, the candidates are sorted back into scan order since the probe order
+        // decides the ties of the probe placement.
+        int padding = precalculationInfo.voxelPadding;
+        glm::ivec3 voxelDims = voxelGrid.dimensions();
+        std::vector<glm::ivec3> candidateVoxels;
+        voxelGrid.for_each(VOXEL_BOUNDARY, [&](glm::ivec3 voxel) {
+            if (glm::all(glm::greaterThanEqual(voxel, glm::ivec3(padding))) &&
+                glm::all(glm::lessThan(voxel, voxelDims - padding)))
+            {
+                candidateVoxels.push_back(voxel);
             }
+        });
+        std::sort(candidateVoxels.begin(), candidateVoxels.end(),
+                  [](const glm::ivec3& a, const glm::ivec3& b) {
+                      return std::tie(a.z, a.y, a.x) < std::tie(b.z, b.y, b.x);
+                  });
+
+        probes.reserve(candidateVoxels.size());
+        for (const glm::ivec3& voxel : candidateVoxels)
+        {
+            glm::vec3 position =
+                scene.m_dimensions.min +
+                precalculationInfo.voxelSize * glm::vec3(voxel - padding) +
+                precalculationInfo.voxelSize / 2.f;
+            probes.push_back(glm::vec4(position, 0.f));
         }
 
         float desiredSpacing = precalculationInfo.desiredSpacing;
         int targetProbeCount = (scene.m_dimensions.size.x / desiredSpacing) *
                                (scene.m_dimensions.size.y / desiredSpacing) *
                                (scene.m_dimensions.size.z / desiredSpacing);
-        printf("Desired spacing: %d. Targeted amount of probes is %d. Current probes: %d\n",
-               desiredSpacing, targetProbeCount, probes.size());
+        printf("Desired spacing: %f. Targeted amount of probes is %d. Current probes: %d\n",
+               desiredSpacing, targetProbeCount, (int)probes.size());
 
         // probes.erase(std::remove_if(probes.begin(), probes.end(),
         //	[](glm::vec4 i) { return i.y < 0; }), probes.end());
 
-        if (true)
+        if (!debugDumpDirectory.empty())
         {
-            std::ofstream file("mesh_voxelized.obj");
+            std::ofstream file(debugDumpDirectory + "/mesh_voxelized.obj");
             int counter = 0;
 
-            for (int k = 0; k < voxelDimZ; k++)
-            {
-                for (int j = 0; j < voxelDimY; j++)
-                {
-                    for (int i = 0; i < voxelDimX; i++)
-                    {
-                        int index = i + j * voxelDimX + k * voxelDimX * voxelDimY;
-
-                        if (voxelData[index] != 1)
-                        {
-                            continue;
-                        }
+            voxelGrid.for_each(VOXEL_SOLID, [&](glm::ivec3 voxel) {
+                float voxelX = scene.m_dimensions.min.x +
+                               precalculationInfo.voxelSize *
+                                   (voxel.x - precalculationInfo.voxelPadding);
+                float voxelY = scene.m_dimensions.min.y +
+                               precalculationInfo.voxelSize *
+                                   (voxel.y - precalculationInfo.voxelPadding);
+                float voxelZ = scene.m_dimensions.min.z +
+                               precalculationInfo.voxelSize *
+                                   (voxel.z - precalculationInfo.voxelPadding);
 
-                        float voxelX = scene.m_dimensions.min.x +
-                                       precalculationInfo.voxelSize *
-                                           (i - precalculationInfo.voxelPadding);
-                        float voxelY = scene.m_dimensions.min.y +
-                                       precalculationInfo.voxelSize *
-                                           (j - precalculationInfo.voxelPadding);
-                        float voxelZ = scene.m_dimensions.min.z +
-                                       precalculationInfo.voxelSize *
-                                           (k - precalculationInfo.voxelPadding);
-
-                        // Vertices
-                        file << "v " << voxelX << " " << voxelY << " " << voxelZ << "\n";
-                        file << "v " << voxelX << " " << voxelY << " "
-                             << voxelZ + precalculationInfo.voxelSize << "\n";
-                        file << "v " << voxelX + precalculationInfo.voxelSize << " " << voxelY
-                             << " " << voxelZ + precalculationInfo.voxelSize << "\n";
-                        file << "v " << voxelX + +precalculationInfo.voxelSize << " " << voxelY
-                             << " " << voxelZ << "\n";
-                        file << "v " << voxelX << " " << voxelY + precalculationInfo.voxelSize
-                             << " " << voxelZ << "\n";
-                        file << "v " << voxelX << " " << voxelY + precalculationInfo.voxelSize
-                             << " " << voxelZ + precalculationInfo.voxelSize << "\n";
-                        file << "v " << voxelX + precalculationInfo.voxelSize << " "
-                             << voxelY + precalculationInfo.voxelSize << " "
-                             << voxelZ + precalculationInfo.voxelSize << "\n";
-                        file << "v " << voxelX + +precalculationInfo.voxelSize << " "
-                             << voxelY + precalculationInfo.voxelSize << " " << voxelZ << "\n";
+                // Vertices
+                file << "v " << voxelX << " " << voxelY << " " << voxelZ << "\n";
+                file << "v " << voxelX << " " << voxelY << " "
+                     << voxelZ + precalculationInfo.voxelSize << "\n";
+                file << "v " << voxelX + precalculationInfo.voxelSize << " " << voxelY
+                     << " " << voxelZ + precalculationInfo.voxelSize << "\n";
+                file << "v " << voxelX + +precalculationInfo.voxelSize << " " << voxelY
+                     << " " << voxelZ << "\n";
+                file << "v " << voxelX << " " << voxelY + precalculationInfo.voxelSize
+                     << " " << voxelZ << "\n";
+                file << "v " << voxelX << " " << voxelY + precalculationInfo.voxelSize
+                     << " " << voxelZ + precalculationInfo.voxelSize << "\n";
+                file << "v " << voxelX + precalculationInfo.voxelSize << " "
+                     << voxelY + precalculationInfo.voxelSize << " "
+                     << voxelZ + precalculationInfo.voxelSize << "\n";
+                file << "v " << voxelX + +precalculationInfo.voxelSize << " "
+                     << voxelY + precalculationInfo.voxelSize << " " << voxelZ << "\n";
 
-                        int idx = counter * 8 + 1;
+                int idx = counter * 8 + 1;
 
-                        // Face 1
-                        file << "f " << idx << " " << idx + 1 << " " << idx + 2 << "\n";
-                        file << "f " << idx << " " << idx + 2 << " " << idx + 3 << "\n";
-                        // Face 2
-                        file << "f " << idx + 4 << " " << idx + 5 << " " << idx + 6 << "\n";
-                        file << "f " << idx + 4 << " " << idx + 6 << " " << idx + 7 << "\n";
-                        // Face 3
-                        file << "f " << idx << " " << idx + 4 << " " << idx + 5 << "\n";
-                        file << "f " << idx << " " << idx + 5 << " " << idx + 1 << "\n";
-                        // Face 4
-                        file << "f " << idx + 7 << " " << idx + 3 << " " << idx + 2 << "\n";
-                        file << "f " << idx + 7 << " " << idx + 2 << " " << idx + 6 << "\n";
-                        // Face 5
-                        file << "f " << idx << " " << idx + 4 << " " << idx + 7 << "\n";
-                        file << "f " << idx << " " << idx + 7 << " " << idx + 3 << "\n";
-                        // Face 6
-                        file << "f " << idx + 1 << " " << idx + 5 << " " << idx + 6 << "\n";
-                        file << "f " << idx + 1 << " " << idx + 6 << " " << idx + 2 << "\n";
+                // Face 1
+                file << "f " << idx << " " << idx + 1 << " " << idx + 2 << "\n";
+                file << "f " << idx << " " << idx + 2 << " " << idx + 3 << "\n";
+                // Face 2
+                file << "f " << idx + 4 << " " << idx + 5 << " " << idx + 6 << "\n";
+                file << "f " << idx + 4 << " " << idx + 6 << " " << idx + 7 << "\n";
+                // Face 3
+                file << "f " << idx << " " << idx + 4 << " " << idx + 5 << "\n";
+                file << "f " << idx << " " << idx + 5 << " " << idx + 1 << "\n";
+                // Face 4
+                file << "f " << idx + 7 << " " << idx + 3 << " " << idx + 2 << "\n";
+                file << "f " << idx + 7 << " " << idx + 2 << " " << idx + 6 << "\n";
+                // Face 5
+                file << "f " << idx << " " << idx + 4 << " " << idx + 7 << "\n";
+                file << "f " << idx << " " << idx + 7 << " " << idx + 3 << "\n";
+                // Face 6
+                file << "f " << idx + 1 << " " << idx + 5 << " " << idx + 6 << "\n";
+                file << "f " << idx + 1 << " " << idx + 6 << " " << idx + 2 << "\n";
 
-                        counter++;
-                    }
-                }
-            }
+                counter++;
+            });
             file.close();
         }
 
+        if (!debugDumpDirectory.empty())
         {
-            std::ofstream file("mesh_voxelized_probe.obj");
+            std::ofstream file(debugDumpDirectory + "/mesh_voxelized_probe.obj");
             int counter = 0;
 
             for (int i = 0; i < probes.size(); i++)
@@ -577,13 +743,22 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
             file.close();
         }
 
-        place_probes(engine, probes, targetProbeCount, desiredSpacing);
+#if USE_VULKAN_PRECALCULATION && USE_COMPUTE_PROBE_DENSITY_CALCULATION
+        if (engine != nullptr)
+        {
+            place_probes(*engine, probes, targetProbeCount, desiredSpacing);
+        }
+        else
+#endif
+        {
+            place_probes_cpu(probes, targetProbeCount, desiredSpacing);
+        }
 
         ////////
 
-        if (true)
+        if (!debugDumpDirectory.empty())
         {
-            std::ofstream file("mesh_voxelized_probe_selected.obj");
+            std::ofstream file(debugDumpDirectory + "/mesh_voxelized_probe_selected.obj");
             int counter = 0;
             /*
             for (int k = 0; k < voxelDimZ; k++) {
@@ -697,29 +872,111 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
             }
             file.close();
         }
+
+        BakeContainerWriter writer;
+        if (checkpoints.begin(BAKE_STAGE_PROBES, probesKey, writer))
+        {
+            writer.add_section(BAKE_SECTION_PROBES, probes.data(),
+                               probes.size() * sizeof(glm::vec4));
+            checkpoints.commit(BAKE_STAGE_PROBES, probesKey, writer);
+        }
     }
     else
     {
-        size_t size = seek_file(loadProbes);
-        printf("The size is %d\n", size);
-        probes.resize(size / sizeof(glm::vec4));
-        load_binary(loadProbes, probes.data(), size);
-        printf("Loaded %d probes.\n", probes.size());
+        // Probes of an earlier bake
+        BakeContainer bakeFile;
+        if (!bakeFile.open(loadProbes))
+        {
+            return false;
+        }
+        size_t size = 0;
+        const glm::vec4* loadedProbes =
+            (const glm::vec4*)bakeFile.section(BAKE_SECTION_PROBES, &size);
+        if (!loadedProbes || size < sizeof(glm::vec4))
+        {
+            printf("%s has no probes\n", loadProbes);
+            return false;
+        }
+        probes.assign(loadedProbes, loadedProbes + size / sizeof(glm::vec4));
+        printf("Loaded %d probes.\n", (int)probes.size());
+        probesKey = bake_stage_key(
+            BAKE_STAGE_PROBES,
+            bake_checksum(probes.data(), probes.size() * sizeof(glm::vec4)));
     }
+    probesZone.add_items(probes.size());
+    probesZone.end();
     ////////
 
     outPrecalculationLoadData.probesCount = probes.size();
     outPrecalculationResult.probes = probes;
-    outPrecalculationResult.probeRaycastResult = (GPUProbeRaycastResult*)malloc(
-        precalculationInfo.raysPerProbe * probes.size() * sizeof(GPUProbeRaycastResult));
-    outPrecalculationResult.probeRaycastBasisFunctions = (float*)malloc(
+    size_t probeRaycastSize =
+        precalculationInfo.raysPerProbe * probes.size() * sizeof(GPUProbeRaycastResult);
+    size_t basisFunctionsSize =
         precalculationInfo.raysPerProbe *
         SPHERICAL_HARMONICS_NUM_COEFF(precalculationInfo.sphericalHarmonicsOrder) *
-        sizeof(float));
-    probe_raycast(engine, probes, precalculationInfo.raysPerProbe,
-                  precalculationInfo.sphericalHarmonicsOrder,
-                  outPrecalculationResult.probeRaycastResult,
-                  outPrecalculationResult.probeRaycastBasisFunctions);
+        sizeof(float);
+    outPrecalculationResult.probeRaycastResult =
+        (GPUProbeRaycastResult*)malloc(probeRaycastSize);
+    outPrecalculationResult.probeRaycastBasisFunctions = (float*)malloc(basisFunctionsSize);
+
+    uint64_t probeRaycastKey = bake_stage_key(
+        BAKE_STAGE_PROBE_RAYCAST, sceneKey, probesKey, backend,
+        precalculationInfo.raysPerProbe, precalculationInfo.sphericalHarmonicsOrder);
+    BakeProfileZone probeRaycastZone(bake_stage_name(BAKE_STAGE_PROBE_RAYCAST));
+    BakeContainer probeRaycastCheckpoint;
+    if (!checkpoints.resume(BAKE_STAGE_PROBE_RAYCAST, probeRaycastKey,
+                            probeRaycastCheckpoint) ||
+        !read_checkpoint_section(probeRaycastCheckpoint, BAKE_SECTION_PROBE_RAYCAST_RESULT,
+                                 outPrecalculationResult.probeRaycastResult,
+                                 probeRaycastSize) ||
+        !read_checkpoint_section(probeRaycastCheckpoint,
+                                 BAKE_SECTION_PROBE_RAYCAST_BASIS_FUNCTIONS,
+                                 outPrecalculationResult.probeRaycastBasisFunctions,
+                                 basisFunctionsSize))
+    {
+#if USE_VULKAN_PRECALCULATION
+        if (engine != nullptr)
+        {
+            probe_raycast(*engine, probes, precalculationInfo.raysPerProbe,
+                          outPrecalculationResult.probeRaycastResult);
+        }
+        else
+#endif
+        {
+            build_raytracer();
+            probe_raycast_cpu(raytracer, probes, precalculationInfo.raysPerProbe,
+                              outPrecalculationResult.probeRaycastResult);
+        }
+
+        int shCoeff =
+            SPHERICAL_HARMONICS_NUM_COEFF(precalculationInfo.sphericalHarmonicsOrder);
+        float* basisFunctions = outPrecalculationResult.probeRaycastBasisFunctions;
+        for (int i = 0; i < precalculationInfo.raysPerProbe; i++)
+        {
+            glm::vec3 direction = outPrecalculationResult.probeRaycastResult[i].direction;
+            calcY(&basisFunctions[i * shCoeff], normalize(direction),
+                  precalculationInfo.sphericalHarmonicsOrder);
+
+            for (int l = 0; l < shCoeff; l++)
+            {
+                basisFunctions[i * shCoeff + l] *= 4 * M_PI / precalculationInfo.raysPerProbe;
+            }
+        }
+
+        BakeContainerWriter writer;
+        if (checkpoints.begin(BAKE_STAGE_PROBE_RAYCAST, probeRaycastKey, writer))
+        {
+            writer.add_section(BAKE_SECTION_PROBE_RAYCAST_RESULT,
+                               outPrecalculationResult.probeRaycastResult, probeRaycastSize);
+            writer.add_section(BAKE_SECTION_PROBE_RAYCAST_BASIS_FUNCTIONS,
+                               outPrecalculationResult.probeRaycastBasisFunctions,
+                               basisFunctionsSize);
+            checkpoints.commit(BAKE_STAGE_PROBE_RAYCAST, probeRaycastKey, writer);
+        }
+    }
+    probeRaycastCheckpoint.close();
+    probeRaycastZone.add_items((int64_t)probes.size() * precalculationInfo.raysPerProbe);
+    probeRaycastZone.end();
 
     //{
     //	std::string filename = "../precomputation/precalculation";
@@ -732,82 +989,132 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
     // sizeof(float));
     //}
 
-    // Receiver radius
-    float newRadius = calculate_radius(receivers.data(),
-                                       precalculationInfo.lightmapResolution *
-                                           precalculationInfo.lightmapResolution,
-                                       probes, precalculationInfo.probeOverlaps);
-    printf("Radius for receivers: %f\n", newRadius);
-
-    // AABB clustering
+    // Receiver radius, AABB clustering and the weights of the probes supporting the clusters
+    float newRadius = 0;
     std::vector<AABB> aabbClusters;
-    AABB initial_node = {};
-    initial_node.min = scene.m_dimensions.min - glm::vec3(1.0); // adding some padding
-    initial_node.max = scene.m_dimensions.max + glm::vec3(1.0); // adding some padding
-    divide_aabb(aabbClusters, initial_node, receivers.data(),
-                precalculationInfo.lightmapResolution * precalculationInfo.lightmapResolution,
-                precalculationInfo.maxReceiversInCluster);
-
     int maxProbesPerCluster = 0;
     int totalReceiverCount = 0;
+    uint64_t clustersKey = bake_stage_key(BAKE_STAGE_CLUSTERS, receiversKey, probesKey,
+                                          precalculationInfo.probeOverlaps,
+                                          precalculationInfo.maxReceiversInCluster);
+    ClusterStageValues clusterValues;
+    BakeProfileZone clustersZone(bake_stage_name(BAKE_STAGE_CLUSTERS));
+    BakeContainer clusterCheckpoint;
+    if (checkpoints.resume(BAKE_STAGE_CLUSTERS, clustersKey, clusterCheckpoint) &&
+        read_checkpoint_section(clusterCheckpoint, BAKE_SECTION_STAGE_VALUES, &clusterValues,
+                                sizeof(clusterValues)) &&
+        read_clusters(clusterCheckpoint, aabbClusters))
+    {
+        newRadius = clusterValues.radius;
+        maxProbesPerCluster = clusterValues.maxProbesPerCluster;
+        totalReceiverCount = clusterValues.totalReceiverCount;
+        printf("Resumed %d receiver clusters with radius %f\n", (int)aabbClusters.size(),
+               newRadius);
+    }
+    else
     {
-        std::set<int> supportingProbes;
-        for (int i = 0; i < aabbClusters.size(); i++)
+        // Receiver radius
+        ProbeGrid probeGrid;
+        probeGrid.build(probes);
+        newRadius = calculate_radius(receivers, probeGrid, precalculationInfo.probeOverlaps);
+        printf("Radius for receivers: %f\n", newRadius);
+
+        // AABB clustering
+        AABB initial_node = {};
+        initial_node.min = scene.m_dimensions.min - glm::vec3(1.0); // adding some padding
+        initial_node.max = scene.m_dimensions.max + glm::vec3(1.0); // adding some padding
         {
-            for (int j = 0; j < aabbClusters[i].receivers.size(); j++)
+            std::vector<int> receiverIndices(receivers.size());
+            std::iota(receiverIndices.begin(), receiverIndices.end(), 0);
+            receiverIndices.erase(
+                std::remove_if(receiverIndices.begin(), receiverIndices.end(),
+                               [&](int receiver) {
+                                   const glm::vec3& position = receivers.positions[receiver];
+                                   return !glm::all(glm::greaterThanEqual(position,
+                                                                          initial_node.min)) ||
+                                          !glm::all(glm::lessThan(position, initial_node.max));
+                               }),
+                receiverIndices.end());
+
+#pragma omp parallel
+#pragma omp single
+            divide_aabb(aabbClusters, initial_node, receivers, receiverIndices.data(),
+                        receiverIndices.size(), precalculationInfo.maxReceiversInCluster);
+
+            int smallestCluster = receivers.size();
+            for (const AABB& cluster : aabbClusters)
             {
-                for (int k = 0; k < probes.size(); k++)
-                {
-                    if (calculate_density(glm::distance(aabbClusters[i].receivers[j].position,
-                                                        glm::vec3(probes[k])),
-                                          newRadius) > 0.0f)
-                    {
-                        supportingProbes.insert(k);
-                    }
-                }
+                smallestCluster = std::min(smallestCluster, (int)cluster.receivers.size());
             }
+            printf("Receiver clusters: %d, smallest cluster has %d receivers\n",
+                   (int)aabbClusters.size(), smallestCluster);
+        }
 
-            for (const auto elem : supportingProbes)
+        {
+            // Probes within the radius of any receiver of the cluster, in increasing order
+#pragma omp parallel for schedule(dynamic)
+            for (int i = 0; i < aabbClusters.size(); i++)
             {
-                aabbClusters[i].probes.push_back(elem);
-            }
+                std::vector<int>& supportingProbes = aabbClusters[i].probes;
+                for (int j = 0; j < aabbClusters[i].receivers.size(); j++)
+                {
+                    probeGrid.query_radius(
+                        receivers.positions[aabbClusters[i].receivers[j]], newRadius,
+                        [&](int probe, float distance) {
+                            if (calculate_density(distance, newRadius) > 0.0f)
+                            {
+                                supportingProbes.push_back(probe);
+                            }
+                        });
+                }
 
-            if (aabbClusters[i].probes.size() == 0)
-            {
-                printf("Cluster(%d) with no probe!\n", i);
+                std::sort(supportingProbes.begin(), supportingProbes.end());
+                supportingProbes.erase(
+                    std::unique(supportingProbes.begin(), supportingProbes.end()),
+                    supportingProbes.end());
             }
 
-            maxProbesPerCluster = MAX(maxProbesPerCluster, supportingProbes.size());
-            supportingProbes.clear();
-            totalReceiverCount += aabbClusters[i].receivers.size();
-        }
-        printf("MAX probe count per cluster: %d\n", maxProbesPerCluster);
-        printf("Total receivers %d\n", totalReceiverCount);
-    }
-
-    outPrecalculationResult.receiverProbeWeightData =
-        new float[totalReceiverCount * maxProbesPerCluster];
-
-    {
-        int recCounter = 0;
-        for (int i = 0; i < aabbClusters.size(); i++)
-        {
-            for (int j = 0; j < aabbClusters[i].receivers.size(); j++)
+            for (int i = 0; i < aabbClusters.size(); i++)
             {
-                for (int k = 0; k < aabbClusters[i].probes.size(); k++)
+                if (aabbClusters[i].probes.size() == 0)
                 {
-                    float value = calculate_density(
-                        glm::distance(aabbClusters[i].receivers[j].position,
-                                      glm::vec3(probes[aabbClusters[i].probes[k]])),
-                        newRadius);
-                    outPrecalculationResult
-                        .receiverProbeWeightData[(recCounter + j) * maxProbesPerCluster + k] =
-                        value;
+                    printf("Cluster(%d) with no probe!\n", i);
                 }
+
+                maxProbesPerCluster = MAX(maxProbesPerCluster, aabbClusters[i].probes.size());
+                totalReceiverCount += aabbClusters[i].receivers.size();
             }
-            recCounter += aabbClusters[i].receivers.size();
+            printf("MAX probe count per cluster: %d\n", maxProbesPerCluster);
+            printf("Total receivers %d\n", totalReceiverCount);
+        }
+
+        BakeContainerWriter writer;
+        if (checkpoints.begin(BAKE_STAGE_CLUSTERS, clustersKey, writer))
+        {
+            clusterValues = {newRadius, maxProbesPerCluster, totalReceiverCount, 0};
+            writer.add_section(BAKE_SECTION_STAGE_VALUES, &clusterValues,
+                               sizeof(clusterValues));
+            write_clusters(writer, aabbClusters);
+            checkpoints.commit(BAKE_STAGE_CLUSTERS, clustersKey, writer);
         }
     }
+    clusterCheckpoint.close();
+
+    // The weights are cheap to rebuild from the clusters, so they are not checkpointed. Most
+    // receivers are only within the radius of a few probes of their cluster.
+    std::vector<int> weightOffsets;
+    std::vector<GPUReceiverProbeWeight> weights;
+    build_receiver_probe_weights(receivers, probes, aabbClusters, newRadius, weightOffsets,
+                                 weights);
+    printf("Receiver probe weights: %zu nonzero, %.1f MB instead of %.1f MB dense\n",
+           weights.size(),
+           (weights.size() * sizeof(GPUReceiverProbeWeight) +
+            weightOffsets.size() * sizeof(int)) /
+               (1024.0 * 1024.0),
+           (size_t)totalReceiverCount * maxProbesPerCluster * sizeof(float) /
+               (1024.0 * 1024.0));
+    clustersZone.add_items(totalReceiverCount);
+    clustersZone.end();
 
     outPrecalculationLoadData.maxProbesPerCluster = maxProbesPerCluster;
     // outPrecalculationResult.receiverCoefficientMatrices = new float[totalReceiverCount *
@@ -818,15 +1125,106 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
 
     int* projectionMatricesSize = new int(0);
     int* reconstructionMatricesSize = new int(0);
+    float* projectionMatrices = nullptr;
+    float* reconstructionMatrices = nullptr;
+
+    // The receiver transfer is only checkpointed on the CPU, the GPU path traces and
+    // compresses every cluster in one go
+    uint64_t transferKey = bake_stage_key(
+        BAKE_STAGE_RECEIVER_TRANSFER, clustersKey, backend, precalculationInfo.raysPerReceiver,
+        precalculationInfo.sphericalHarmonicsOrder);
+    uint64_t pcaKey = bake_stage_key(BAKE_STAGE_PCA, transferKey,
+                                     precalculationInfo.clusterCoefficientCount);
+    std::vector<AABB> pcaClusters;
+    BakeProfileZone pcaZone(bake_stage_name(BAKE_STAGE_PCA));
+    BakeContainer pcaCheckpoint;
+    size_t projectionSize = 0;
+    size_t reconstructionSize = 0;
+    const float* pcaProjection = nullptr;
+    const float* pcaReconstruction = nullptr;
+    if (checkpoints.resume(BAKE_STAGE_PCA, pcaKey, pcaCheckpoint))
+    {
+        pcaProjection = (const float*)pcaCheckpoint.section(
+            BAKE_SECTION_PCA_PROJECTION_MATRICES, &projectionSize);
+        pcaReconstruction = (const float*)pcaCheckpoint.section(
+            BAKE_SECTION_PCA_RECONSTRUCTION_MATRICES, &reconstructionSize);
+    }
+    if (pcaProjection && pcaReconstruction && read_clusters(pcaCheckpoint, pcaClusters))
+    {
+        aabbClusters = std::move(pcaClusters);
+        *projectionMatricesSize = projectionSize / sizeof(float);
+        *reconstructionMatricesSize = reconstructionSize / sizeof(float);
+        projectionMatrices = (float*)malloc(projectionSize);
+        reconstructionMatrices = (float*)malloc(reconstructionSize);
+        memcpy(projectionMatrices, pcaProjection, projectionSize);
+        memcpy(reconstructionMatrices, pcaReconstruction, reconstructionSize);
+        printf("Resumed %d compressed clusters\n", (int)aabbClusters.size());
+    }
+    else
+    {
+#if USE_VULKAN_PRECALCULATION
+        if (engine != nullptr)
+        {
+            receiver_raycast(*engine, receivers, aabbClusters, probes,
+                             precalculationInfo.raysPerReceiver, newRadius,
+                             precalculationInfo.sphericalHarmonicsOrder,
+                             precalculationInfo.clusterCoefficientCount,
+                             precalculationInfo.maxReceiversInCluster, totalReceiverCount,
+                             maxProbesPerCluster, &projectionMatrices, &reconstructionMatrices,
+                             weightOffsets, weights, projectionMatricesSize,
+                             reconstructionMatricesSize);
+        }
+        else
+#endif
+        {
+            build_raytracer();
+
+            // With their checkpoint the transfer matrices are written out before the PCA
+            // reads them back, so a PCA that stops or is tuned does not trace again.
+            // Otherwise every cluster is compressed right after it is traced.
+            BakeContainer transferCheckpoint;
+            bool transferResumed = checkpoints.resume(BAKE_STAGE_RECEIVER_TRANSFER,
+                                                      transferKey, transferCheckpoint);
+            BakeContainerWriter writer;
+            if (!transferResumed && checkpointTransferMatrices &&
+                checkpoints.begin(BAKE_STAGE_RECEIVER_TRANSFER, transferKey, writer))
+            {
+                receiver_transfer_cpu(raytracer, receivers, aabbClusters, probes,
+                                      precalculationInfo.raysPerReceiver,
+                                      precalculationInfo.sphericalHarmonicsOrder,
+                                      precalculationInfo.maxReceiversInCluster,
+                                      weightOffsets, weights, writer);
+                transferResumed =
+                    checkpoints.commit(BAKE_STAGE_RECEIVER_TRANSFER, transferKey, writer) &&
+                    checkpoints.resume(BAKE_STAGE_RECEIVER_TRANSFER, transferKey,
+                                       transferCheckpoint);
+            }
 
-    receiver_raycast(engine, aabbClusters, probes, precalculationInfo.raysPerReceiver,
-                     newRadius, precalculationInfo.sphericalHarmonicsOrder,
-                     precalculationInfo.clusterCoefficientCount,
-                     precalculationInfo.maxReceiversInCluster, totalReceiverCount,
-                     maxProbesPerCluster, &outPrecalculationResult.clusterProjectionMatrices,
-                     &outPrecalculationResult.receiverCoefficientMatrices,
-                     outPrecalculationResult.receiverProbeWeightData, projectionMatricesSize,
-                     reconstructionMatricesSize);
+            receiver_raycast_cpu(raytracer, receivers, aabbClusters, probes,
+                                 precalculationInfo.raysPerReceiver,
+                                 precalculationInfo.sphericalHarmonicsOrder,
+                                 precalculationInfo.clusterCoefficientCount,
+                                 precalculationInfo.maxReceiversInCluster,
+                                 transferResumed ? &transferCheckpoint : nullptr,
+                                 &projectionMatrices, &reconstructionMatrices, weightOffsets,
+                                 weights, projectionMatricesSize, reconstructionMatricesSize);
+        }
+
+        BakeContainerWriter writer;
+        if (checkpoints.begin(BAKE_STAGE_PCA, pcaKey, writer))
+        {
+            write_clusters(writer, aabbClusters);
+            writer.add_section(BAKE_SECTION_PCA_PROJECTION_MATRICES, projectionMatrices,
+                               *projectionMatricesSize * sizeof(float));
+            writer.add_section(BAKE_SECTION_PCA_RECONSTRUCTION_MATRICES,
+                               reconstructionMatrices,
+                               *reconstructionMatricesSize * sizeof(float));
+            checkpoints.commit(BAKE_STAGE_PCA, pcaKey, writer);
+        }
+    }
+    pcaCheckpoint.close();
+    pcaZone.add_items(totalReceiverCount);
+    pcaZone.end();
 
     outPrecalculationLoadData.aabbClusterCount = aabbClusters.size();
     outPrecalculationResult.clusterReceiverInfos =
@@ -860,6 +1258,46 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
     outPrecalculationLoadData.reconstructionMatricesSize = *reconstructionMatricesSize;
 
     outPrecalculationLoadData.totalSvdCoeffCount = totalSvdCoeffCount;
+
+    // Only the packed matrices are kept, the renderer and the bake file use the same format
+    BakeProfileZone quantizeZone("quantize");
+    int matrixFormat = precalculationInfo.matrixFormat;
+    int basisFunctionCount =
+        SPHERICAL_HARMONICS_NUM_COEFF(precalculationInfo.sphericalHarmonicsOrder);
+    int projectionWords = matrix_format_word_count(matrixFormat, *projectionMatricesSize);
+    int reconstructionWords =
+        matrix_format_word_count(matrixFormat, *reconstructionMatricesSize);
+    outPrecalculationResult.clusterProjectionMatrices = new uint32_t[projectionWords];
+    outPrecalculationResult.clusterProjectionScales = new float[totalSvdCoeffCount];
+    outPrecalculationResult.receiverCoefficientMatrices = new uint32_t[reconstructionWords];
+    outPrecalculationResult.receiverCoefficientScales = new float[aabbClusters.size()];
+    quantize_matrices(matrixFormat, outPrecalculationResult.clusterReceiverInfos,
+                      aabbClusters.size(), basisFunctionCount, *projectionMatricesSize,
+                      *reconstructionMatricesSize, projectionMatrices, reconstructionMatrices,
+                      outPrecalculationResult.clusterProjectionMatrices,
+                      outPrecalculationResult.clusterProjectionScales,
+                      outPrecalculationResult.receiverCoefficientMatrices,
+                      outPrecalculationResult.receiverCoefficientScales);
+    MatrixQuantizationError quantizationError = measure_quantization_error(
+        matrixFormat, outPrecalculationResult.clusterReceiverInfos, aabbClusters.size(),
+        basisFunctionCount, projectionMatrices, reconstructionMatrices,
+        outPrecalculationResult.clusterProjectionMatrices,
+        outPrecalculationResult.clusterProjectionScales,
+        outPrecalculationResult.receiverCoefficientMatrices,
+        outPrecalculationResult.receiverCoefficientScales);
+    printf("Stored the PCA matrices as %s: %.1f MB instead of %.1f MB\n",
+           matrix_format_name(matrixFormat),
+           (projectionWords + reconstructionWords) * sizeof(uint32_t) / (1024.0 * 1024.0),
+           (*projectionMatricesSize + *reconstructionMatricesSize) * sizeof(float) /
+               (1024.0 * 1024.0));
+    printf("Quantization error against fp32: projection %g, reconstruction %g, receiver "
+           "colors %g (worst cluster %g)\n",
+           quantizationError.projectionRms, quantizationError.reconstructionRms,
+           quantizationError.transferRms, quantizationError.transferMax);
+    free(projectionMatrices);
+    free(reconstructionMatrices);
+    quantizeZone.add_items(*projectionMatricesSize + *reconstructionMatricesSize);
+    quantizeZone.end();
     outPrecalculationLoadData.totalClusterReceiverCount = clusterReceiverCount;
     outPrecalculationLoadData.totalProbesPerCluster = totalProbeCount;
     outPrecalculationResult.aabbReceivers = new Receiver[clusterReceiverCount];
@@ -872,10 +1310,12 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
     {
         for (int j = 0; j < aabbClusters[i].receivers.size(); j++)
         {
-            outPrecalculationResult.clusterReceiverUvs[currOffset + j] = glm::ivec4(
-                aabbClusters[i].receivers[j].uv.x, aabbClusters[i].receivers[j].uv.y, 0, 0);
-            outPrecalculationResult.aabbReceivers[currOffset + j] =
-                aabbClusters[i].receivers[j];
+            int receiver = aabbClusters[i].receivers[j];
+            outPrecalculationResult.clusterReceiverUvs[currOffset + j] =
+                glm::ivec4(receivers.uvs[receiver], 0, 0);
+            outPrecalculationResult.aabbReceivers[currOffset + j] = {
+                receivers.positions[receiver], receivers.normals[receiver],
+                receivers.uvs[receiver], receivers.objectIds[receiver]};
         }
         currOffset += aabbClusters[i].receivers.size();
         memcpy(outPrecalculationResult.clusterProbes + currProbeOffset,
@@ -883,8 +1323,20 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
         currProbeOffset += aabbClusters[i].probes.size();
     }
 
+    // The PCA splits the clusters and reorders their receivers, the saved weights follow the
+    // final clusters
+    build_receiver_probe_weights(receivers, probes, aabbClusters, newRadius, weightOffsets,
+                                 weights);
+    outPrecalculationResult.receiverProbeWeightOffsets = new int[weightOffsets.size()];
+    outPrecalculationResult.receiverProbeWeights = new GPUReceiverProbeWeight[weights.size()];
+    memcpy(outPrecalculationResult.receiverProbeWeightOffsets, weightOffsets.data(),
+           weightOffsets.size() * sizeof(int));
+    memcpy(outPrecalculationResult.receiverProbeWeights, weights.data(),
+           weights.size() * sizeof(GPUReceiverProbeWeight));
+
     // Save everything
-    std::string filename = "../precomputation/precalculation";
+    BakeProfileZone saveZone("save");
+    std::string filename = outputFilename;
 
     nlohmann::json config;
     config["voxelSize"] = precalculationInfo.voxelSize;
@@ -898,6 +1350,7 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
     config["lightmapResolution"] = precalculationInfo.lightmapResolution;
     config["texelSize"] = precalculationInfo.texelSize;
     config["desiredSpacing"] = precalculationInfo.desiredSpacing;
+    config["matrixFormat"] = precalculationInfo.matrixFormat;
 
     config["probesCount"] = outPrecalculationLoadData.probesCount;
     config["totalClusterReceiverCount"] = outPrecalculationLoadData.totalClusterReceiverCount;
@@ -909,2116 +1362,1593 @@ void Precalculation::prepare(VulkanEngine& engine, GltfScene& scene,
         outPrecalculationLoadData.reconstructionMatricesSize;
     config["totalSvdCoeffCount"] = outPrecalculationLoadData.totalSvdCoeffCount;
 
-    config["fileProbes"] = filename + ".Probes";
-    save_binary(filename + ".Probes", outPrecalculationResult.probes.data(),
-                sizeof(glm::vec4) * outPrecalculationResult.probes.size());
-
-    config["fileProbeRaycastResult"] = filename + ".ProbeRaycastResult";
-    save_binary(filename + ".ProbeRaycastResult", outPrecalculationResult.probeRaycastResult,
-                precalculationInfo.raysPerProbe * probes.size() *
-                    sizeof(GPUProbeRaycastResult));
-
-    config["fileProbeRaycastBasisFunctions"] = filename + ".ProbeRaycastBasisFunctions";
-    save_binary(filename + ".ProbeRaycastBasisFunctions",
-                outPrecalculationResult.probeRaycastBasisFunctions,
-                precalculationInfo.raysPerProbe *
-                    SPHERICAL_HARMONICS_NUM_COEFF(precalculationInfo.sphericalHarmonicsOrder) *
-                    sizeof(float));
-
-    config["fileAabbReceivers"] = filename + ".AabbReceivers";
-    save_binary(filename + ".AabbReceivers", outPrecalculationResult.aabbReceivers,
-                sizeof(Receiver) * clusterReceiverCount);
-
-    config["fileClusterProjectionMatrices"] = filename + ".ClusterProjectionMatrices";
-    save_binary(filename + ".ClusterProjectionMatrices",
-                outPrecalculationResult.clusterProjectionMatrices,
-                *projectionMatricesSize * sizeof(float));
-
-    config["fileReceiverCoefficientMatrices"] = filename + ".ReceiverCoefficientMatrices";
-    save_binary(filename + ".ReceiverCoefficientMatrices",
-                outPrecalculationResult.receiverCoefficientMatrices,
-                *reconstructionMatricesSize * sizeof(float));
-
-    config["fileClusterReceiverInfos"] = filename + ".ClusterReceiverInfos";
-    save_binary(filename + ".ClusterReceiverInfos",
-                outPrecalculationResult.clusterReceiverInfos,
-                aabbClusters.size() * sizeof(ClusterReceiverInfo));
-
-    config["fileClusterReceiverUvs"] = filename + ".ClusterReceiverUvs";
-    save_binary(filename + ".ClusterReceiverUvs", outPrecalculationResult.clusterReceiverUvs,
-                clusterReceiverCount * sizeof(glm::ivec4));
-
-    config["fileReceiverProbeWeightData"] = filename + ".ReceiverProbeWeightData";
-    save_binary(filename + ".ReceiverProbeWeightData",
-                outPrecalculationResult.receiverProbeWeightData,
-                clusterReceiverCount * maxProbesPerCluster * sizeof(float));
-
-    config["fileClusterProbes"] = filename + ".ClusterProbes";
-    save_binary(filename + ".ClusterProbes", outPrecalculationResult.clusterProbes,
-                totalProbeCount * sizeof(int));
-
-    std::ofstream file(filename + ".cfg");
-    file << config.dump();
-    file.close();
-
-    // Deal with this later
-}
-
-void Precalculation::load(const char* filename, PrecalculationInfo& precalculationInfo,
-                          PrecalculationLoadData& outPrecalculationLoadData,
-                          PrecalculationResult& outPrecalculationResult)
-{
-    std::ifstream i(filename);
-    nlohmann::json config;
-    i >> config;
-
-    precalculationInfo.voxelSize = config["voxelSize"];
-    precalculationInfo.voxelPadding = config["voxelPadding"];
-    precalculationInfo.probeOverlaps = config["probeOverlaps"];
-    precalculationInfo.raysPerProbe = config["raysPerProbe"];
-    precalculationInfo.raysPerReceiver = config["raysPerReceiver"];
-    precalculationInfo.sphericalHarmonicsOrder = config["sphericalHarmonicsOrder"];
-    precalculationInfo.clusterCoefficientCount = config["clusterCoefficientCount"];
-    precalculationInfo.maxReceiversInCluster = config["maxReceiversInCluster"];
-    precalculationInfo.lightmapResolution = config["lightmapResolution"];
-    precalculationInfo.texelSize = config["texelSize"];
-    precalculationInfo.desiredSpacing = config["desiredSpacing"];
-
-    outPrecalculationLoadData.probesCount = config["probesCount"];
-    outPrecalculationLoadData.totalClusterReceiverCount = config["totalClusterReceiverCount"];
-    outPrecalculationLoadData.aabbClusterCount = config["aabbClusterCount"];
-    outPrecalculationLoadData.maxProbesPerCluster = config["maxProbesPerCluster"];
-    outPrecalculationLoadData.totalProbesPerCluster = config["totalProbesPerCluster"];
-    outPrecalculationLoadData.projectionMatricesSize = config["projectionMatricesSize"];
-    outPrecalculationLoadData.reconstructionMatricesSize =
-        config["reconstructionMatricesSize"];
-    outPrecalculationLoadData.totalSvdCoeffCount = config["totalSvdCoeffCount"];
+    std::string configText = config.dump();
 
+    // Probes taken from another bake are an input too
+    uint64_t contentKey = bake_content_key(scene, precalculationInfo);
+    if (loadProbes)
     {
-        std::string file = config["fileProbes"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        printf("The size is %d\n", size);
-        outPrecalculationResult.probes.resize(size / sizeof(glm::vec4));
-        load_binary(file, outPrecalculationResult.probes.data(), size);
+        contentKey =
+            bake_checksum(probes.data(), probes.size() * sizeof(glm::vec4), contentKey);
     }
 
+    BakeContainerWriter writer;
+    if (!writer.open(filename))
     {
-        std::string file = config["fileProbeRaycastResult"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.probeRaycastResult = (GPUProbeRaycastResult*)malloc(size);
-        load_binary(file, outPrecalculationResult.probeRaycastResult, size);
+        return false;
     }
-
+    writer.set_content_key(contentKey);
+    writer.add_section(BAKE_SECTION_CONFIG, configText.data(), configText.size());
+    writer.add_section(BAKE_SECTION_PROBES, outPrecalculationResult.probes.data(),
+                       sizeof(glm::vec4) * outPrecalculationResult.probes.size());
+    writer.add_section(BAKE_SECTION_PROBE_RAYCAST_RESULT,
+                       outPrecalculationResult.probeRaycastResult,
+                       precalculationInfo.raysPerProbe * probes.size() *
+                           sizeof(GPUProbeRaycastResult));
+    writer.add_section(
+        BAKE_SECTION_PROBE_RAYCAST_BASIS_FUNCTIONS,
+        outPrecalculationResult.probeRaycastBasisFunctions,
+        precalculationInfo.raysPerProbe *
+            SPHERICAL_HARMONICS_NUM_COEFF(precalculationInfo.sphericalHarmonicsOrder) *
+            sizeof(float));
+    writer.add_section(BAKE_SECTION_AABB_RECEIVERS, outPrecalculationResult.aabbReceivers,
+                       sizeof(Receiver) * clusterReceiverCount);
+    writer.add_section(BAKE_SECTION_CLUSTER_PROJECTION_MATRICES,
+                       outPrecalculationResult.clusterProjectionMatrices,
+                       projectionWords * sizeof(uint32_t));
+    writer.add_section(BAKE_SECTION_CLUSTER_PROJECTION_SCALES,
+                       outPrecalculationResult.clusterProjectionScales,
+                       totalSvdCoeffCount * sizeof(float));
+    writer.add_section(BAKE_SECTION_RECEIVER_COEFFICIENT_MATRICES,
+                       outPrecalculationResult.receiverCoefficientMatrices,
+                       reconstructionWords * sizeof(uint32_t));
+    writer.add_section(BAKE_SECTION_RECEIVER_COEFFICIENT_SCALES,
+                       outPrecalculationResult.receiverCoefficientScales,
+                       aabbClusters.size() * sizeof(float));
+    writer.add_section(BAKE_SECTION_CLUSTER_RECEIVER_INFOS,
+                       outPrecalculationResult.clusterReceiverInfos,
+                       aabbClusters.size() * sizeof(ClusterReceiverInfo));
+    writer.add_section(BAKE_SECTION_CLUSTER_RECEIVER_UVS,
+                       outPrecalculationResult.clusterReceiverUvs,
+                       clusterReceiverCount * sizeof(glm::ivec4));
+    writer.add_section(BAKE_SECTION_RECEIVER_PROBE_WEIGHT_OFFSETS,
+                       outPrecalculationResult.receiverProbeWeightOffsets,
+                       (clusterReceiverCount + 1) * sizeof(int));
+    writer.add_section(BAKE_SECTION_RECEIVER_PROBE_WEIGHTS,
+                       outPrecalculationResult.receiverProbeWeights,
+                       weights.size() * sizeof(GPUReceiverProbeWeight));
+    writer.add_section(BAKE_SECTION_CLUSTER_PROBES, outPrecalculationResult.clusterProbes,
+                       totalProbeCount * sizeof(int));
+    bool saved = writer.finish();
+    if (saved)
     {
-        std::string file = config["fileProbeRaycastBasisFunctions"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.probeRaycastBasisFunctions = (float*)malloc(size);
-        load_binary(file, outPrecalculationResult.probeRaycastBasisFunctions, size);
+        printf("Saved the bake to %s\n", filename.c_str());
     }
+    saveZone.end();
+    bakeZone.end();
+
+    char contentKeyText[32];
+    snprintf(contentKeyText, sizeof(contentKeyText), "%016" PRIx64, contentKey);
+    config["contentKey"] = contentKeyText;
+    config["backend"] = backend ? "vulkan" : "cpu";
+    config["output"] = filename;
+    bake_profiler::print_summary();
+    bake_profiler::write_report(filename + PRECALCULATION_PROFILE_SUFFIX, config.dump());
+    return saved;
+}
 
+bool Precalculation::load(const char* filename, PrecalculationInfo& precalculationInfo,
+                          PrecalculationLoadData& outPrecalculationLoadData,
+                          PrecalculationResult& outPrecalculationResult,
+                          uint64_t expectedContentKey)
+{
+    auto bakeFile = std::make_shared<BakeContainer>();
+    if (!bakeFile->open(filename))
     {
-        std::string file = config["fileAabbReceivers"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.aabbReceivers = (Receiver*)malloc(size);
-        load_binary(file, outPrecalculationResult.aabbReceivers, size);
+        return false;
     }
-
+    if (expectedContentKey != 0 && bakeFile->content_key() != expectedContentKey)
     {
-        std::string file = config["fileClusterProjectionMatrices"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.clusterProjectionMatrices = (float*)malloc(size);
-        load_binary(file, outPrecalculationResult.clusterProjectionMatrices, size);
+        printf("%s was baked from different inputs\n", filename);
+        return false;
     }
 
+    size_t configSize;
+    const char* configText = (const char*)bakeFile->section(BAKE_SECTION_CONFIG, &configSize);
+    if (!configText)
     {
-        std::string file = config["fileReceiverCoefficientMatrices"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.receiverCoefficientMatrices = (float*)malloc(size);
-        load_binary(file, outPrecalculationResult.receiverCoefficientMatrices, size);
+        printf("%s has no config\n", filename);
+        return false;
     }
-
+    // Nothing is handed out before the whole bake is checked
+    PrecalculationInfo info = precalculationInfo;
+    PrecalculationLoadData loadData;
+    try
     {
-        std::string file = config["fileClusterReceiverInfos"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.clusterReceiverInfos = (ClusterReceiverInfo*)malloc(size);
-        load_binary(file, outPrecalculationResult.clusterReceiverInfos, size);
+        nlohmann::json config = nlohmann::json::parse(configText, configText + configSize);
+
+        info.voxelSize = config.at("voxelSize");
+        info.voxelPadding = config.at("voxelPadding");
+        info.probeOverlaps = config.at("probeOverlaps");
+        info.raysPerProbe = config.at("raysPerProbe");
+        info.raysPerReceiver = config.at("raysPerReceiver");
+        info.sphericalHarmonicsOrder = config.at("sphericalHarmonicsOrder");
+        info.clusterCoefficientCount = config.at("clusterCoefficientCount");
+        info.maxReceiversInCluster = config.at("maxReceiversInCluster");
+        info.lightmapResolution = config.at("lightmapResolution");
+        info.texelSize = config.at("texelSize");
+        info.desiredSpacing = config.at("desiredSpacing");
+        info.matrixFormat = config.at("matrixFormat");
+
+        loadData.probesCount = config.at("probesCount");
+        loadData.totalClusterReceiverCount = config.at("totalClusterReceiverCount");
+        loadData.aabbClusterCount = config.at("aabbClusterCount");
+        loadData.maxProbesPerCluster = config.at("maxProbesPerCluster");
+        loadData.totalProbesPerCluster = config.at("totalProbesPerCluster");
+        loadData.projectionMatricesSize = config.at("projectionMatricesSize");
+        loadData.reconstructionMatricesSize = config.at("reconstructionMatricesSize");
+        loadData.totalSvdCoeffCount = config.at("totalSvdCoeffCount");
     }
-
+    catch (const nlohmann::json::exception& e)
     {
-        std::string file = config["fileClusterReceiverUvs"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.clusterReceiverUvs = (glm::ivec4*)malloc(size);
-        load_binary(file, outPrecalculationResult.clusterReceiverUvs, size);
+        printf("%s has an invalid config: %s\n", filename, e.what());
+        return false;
     }
 
+    // Every section has to be there with the size the config implies, the renderer and the
+    // relighting index them with the config counts
+    bool isComplete = true;
+    auto section = [&](BakeSectionId id, size_t expectedSize) -> void* {
+        size_t size = 0;
+        void* data = bakeFile->section(id, &size);
+        if (!data || size != expectedSize)
+        {
+            printf("%s: section %u has %zu bytes, expected %zu\n", filename, id, size,
+                   expectedSize);
+            isComplete = false;
+            return nullptr;
+        }
+        return data;
+    };
+
+    size_t probeCount = std::max(loadData.probesCount, 0);
+    size_t receiverCount = std::max(loadData.totalClusterReceiverCount, 0);
+    size_t clusterCount = std::max(loadData.aabbClusterCount, 0);
+    size_t rays = std::max(info.raysPerProbe, 0) * probeCount;
+    size_t projectionWords =
+        matrix_format_word_count(info.matrixFormat, loadData.projectionMatricesSize);
+    size_t reconstructionWords =
+        matrix_format_word_count(info.matrixFormat, loadData.reconstructionMatricesSize);
+
+    const glm::vec4* probes =
+        (const glm::vec4*)section(BAKE_SECTION_PROBES, probeCount * sizeof(glm::vec4));
+    auto probeRaycastResult = (GPUProbeRaycastResult*)section(
+        BAKE_SECTION_PROBE_RAYCAST_RESULT, rays * sizeof(GPUProbeRaycastResult));
+    auto probeRaycastBasisFunctions =
+        (float*)section(BAKE_SECTION_PROBE_RAYCAST_BASIS_FUNCTIONS,
+                        std::max(info.raysPerProbe, 0) *
+                            SPHERICAL_HARMONICS_NUM_COEFF(info.sphericalHarmonicsOrder) *
+                            sizeof(float));
+    auto aabbReceivers =
+        (Receiver*)section(BAKE_SECTION_AABB_RECEIVERS, receiverCount * sizeof(Receiver));
+    auto clusterProjectionMatrices = (uint32_t*)section(
+        BAKE_SECTION_CLUSTER_PROJECTION_MATRICES, projectionWords * sizeof(uint32_t));
+    auto clusterProjectionScales =
+        (float*)section(BAKE_SECTION_CLUSTER_PROJECTION_SCALES,
+                        std::max(loadData.totalSvdCoeffCount, 0) * sizeof(float));
+    auto receiverCoefficientMatrices = (uint32_t*)section(
+        BAKE_SECTION_RECEIVER_COEFFICIENT_MATRICES, reconstructionWords * sizeof(uint32_t));
+    auto receiverCoefficientScales = (float*)section(BAKE_SECTION_RECEIVER_COEFFICIENT_SCALES,
+                                                     clusterCount * sizeof(float));
+    auto clusterReceiverInfos = (ClusterReceiverInfo*)section(
+        BAKE_SECTION_CLUSTER_RECEIVER_INFOS, clusterCount * sizeof(ClusterReceiverInfo));
+    auto clusterReceiverUvs = (glm::ivec4*)section(BAKE_SECTION_CLUSTER_RECEIVER_UVS,
+                                                   receiverCount * sizeof(glm::ivec4));
+    auto receiverProbeWeightOffsets = (int*)section(
+        BAKE_SECTION_RECEIVER_PROBE_WEIGHT_OFFSETS, (receiverCount + 1) * sizeof(int));
+    auto clusterProbes =
+        (int*)section(BAKE_SECTION_CLUSTER_PROBES,
+                      std::max(loadData.totalProbesPerCluster, 0) * sizeof(int));
+    // The weight count is the last offset
+    GPUReceiverProbeWeight* receiverProbeWeights = nullptr;
+    if (receiverProbeWeightOffsets && receiverProbeWeightOffsets[receiverCount] >= 0)
+    {
+        receiverProbeWeights = (GPUReceiverProbeWeight*)section(
+            BAKE_SECTION_RECEIVER_PROBE_WEIGHTS,
+            receiverProbeWeightOffsets[receiverCount] * sizeof(GPUReceiverProbeWeight));
+    }
+    else
+    {
+        isComplete = false;
+    }
+    if (!isComplete)
     {
-        std::string file = config["fileReceiverProbeWeightData"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.receiverProbeWeightData = (float*)malloc(size);
-        load_binary(file, outPrecalculationResult.receiverProbeWeightData, size);
+        printf("%s is incomplete\n", filename);
+        return false;
     }
 
+    precalculationInfo = info;
+    outPrecalculationLoadData = loadData;
+    outPrecalculationResult.probes.assign(probes, probes + probeCount);
+
+    // Everything else is used in place. The sections that are only uploaded to the GPU start
+    // reading in the background, the renderer streams them from the mapping.
+    static const BakeSectionId gpuSections[] = {
+        BAKE_SECTION_PROBE_RAYCAST_RESULT,         BAKE_SECTION_PROBE_RAYCAST_BASIS_FUNCTIONS,
+        BAKE_SECTION_CLUSTER_PROJECTION_MATRICES,  BAKE_SECTION_CLUSTER_PROJECTION_SCALES,
+        BAKE_SECTION_RECEIVER_COEFFICIENT_MATRICES, BAKE_SECTION_RECEIVER_COEFFICIENT_SCALES,
+        BAKE_SECTION_CLUSTER_RECEIVER_UVS};
+    for (BakeSectionId id : gpuSections)
     {
-        std::string file = config["fileClusterProbes"].get<std::string>();
-        printf(file.c_str());
-        printf("\n");
-        size_t size = seek_file(file);
-        outPrecalculationResult.clusterProbes = (int*)malloc(size);
-        load_binary(file, outPrecalculationResult.clusterProbes, size);
+        bakeFile->prefetch(id);
     }
+    outPrecalculationResult.probeRaycastResult = probeRaycastResult;
+    outPrecalculationResult.probeRaycastBasisFunctions = probeRaycastBasisFunctions;
+    outPrecalculationResult.aabbReceivers = aabbReceivers;
+    outPrecalculationResult.clusterProjectionMatrices = clusterProjectionMatrices;
+    outPrecalculationResult.clusterProjectionScales = clusterProjectionScales;
+    outPrecalculationResult.receiverCoefficientMatrices = receiverCoefficientMatrices;
+    outPrecalculationResult.receiverCoefficientScales = receiverCoefficientScales;
+    outPrecalculationResult.clusterReceiverInfos = clusterReceiverInfos;
+    outPrecalculationResult.clusterReceiverUvs = clusterReceiverUvs;
+    outPrecalculationResult.receiverProbeWeightOffsets = receiverProbeWeightOffsets;
+    outPrecalculationResult.receiverProbeWeights = receiverProbeWeights;
+    outPrecalculationResult.clusterProbes = clusterProbes;
+    outPrecalculationResult.bakeFile = bakeFile;
+
+    printf("Loaded %s: %d probes, %d clusters\n", filename,
+           outPrecalculationLoadData.probesCount, outPrecalculationLoadData.aabbClusterCount);
+    return true;
 }
 
-std::vector<uint8_t> Precalculation::voxelize(GltfScene& scene, float voxelSize, int padding,
-                                              int& dimX, int& dimY, int& dimZ)
+void Precalculation::voxelize(GltfScene& scene, float voxelSize, int padding,
+                              VoxelGrid& outGrid)
 {
     // OPTICK_EVENT();
 
-    int x = (scene.m_dimensions.max.x - scene.m_dimensions.min.x) / voxelSize + padding * 2;
-    int y = (scene.m_dimensions.max.y - scene.m_dimensions.min.y) / voxelSize + padding * 2;
-    int z = (scene.m_dimensions.max.z - scene.m_dimensions.min.z) / voxelSize + padding * 2;
-
-    glm::vec3 halfSize = {voxelSize / 2.f, voxelSize / 2.f, voxelSize / 2.f};
-    dimX = x;
-    dimY = y;
-    dimZ = z;
+    Voxelizer voxelizer;
+    voxelizer.voxelize(scene, voxelSize, padding, outGrid);
+}
 
-    int size = x * y * z;
-    int paddinglessSize = (x - padding * 2) * (y - padding * 2) * (z - padding * 2);
+void Precalculation::place_probes_cpu(std::vector<glm::vec4>& probes, int targetProbeCount,
+                                      float spacing)
+{
+    float radius = spacing;
+    int probeCount = (int)probes.size();
+    int removeCount = probeCount - std::max(targetProbeCount, 0);
+    if (removeCount <= 0)
+    {
+        printf("Found this many probes: %d\n", probeCount);
+        return;
+    }
 
-    // if (_voxelData != nullptr) {
-    //	delete[] _voxelData;
-    // }
+    // Probes only affect each other closer than the radius, so a grid with radius sized cells
+    // finds every neighbour of a probe in the surrounding 27 cells
+    ProbeGrid probeGrid;
+    probeGrid.build(probes, radius);
 
-    std::vector<uint8_t> voxelData(size);
+    std::vector<double> weights(probeCount);
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < probeCount; i++)
+    {
+        double weight = 0;
+        glm::vec3 position = glm::vec3(probes[i]);
+        probeGrid.query_radius(position, radius, [&](int neighbour, float distance) {
+            if (neighbour != i)
+            {
+                weight += calculate_density(distance, radius);
+            }
+        });
+        weights[i] = weight;
+    }
 
-    printf("Creating a voxel scene with: %d x %d x %d\n", x, y, z);
-    int totalVertexMarked = 0;
-#pragma omp parallel for
-    for (int nodeIndex = 0; nodeIndex < scene.nodes.size(); nodeIndex++)
+    // Lazy greedy removal: the heap keeps the weight a probe had when it was pushed. Weights
+    // only decrease, so an entry that no longer matches its probe is stale and skipped. Ties
+    // remove the probe with the higher index, like the last-max pick of the compute path.
+    std::priority_queue<std::pair<double, int>> heap;
+    for (int i = 0; i < probeCount; i++)
     {
-        auto& mesh = scene.prim_meshes[scene.nodes[nodeIndex].prim_mesh];
+        heap.push({weights[i], i});
+    }
 
-        for (int triangle = 0; triangle < mesh.idx_count; triangle += 3)
+    std::vector<bool> removed(probeCount, false);
+    int removedCount = 0;
+    int progressStep = std::max(removeCount / 10, 1);
+    while (removedCount < removeCount && !heap.empty())
+    {
+        auto [weight, index] = heap.top();
+        heap.pop();
+        if (removed[index] || weight != weights[index])
         {
-            glm::vec3 vertices[3] = {};
-            int minX = x, minY = y, minZ = z;
-            int maxX = 0, maxY = 0, maxZ = 0;
-            for (int i = 0; i < 3; i++)
-            {
-                glm::vec4 vertex =
-                    scene.nodes[nodeIndex].world_matrix *
-                    glm::vec4(scene.positions[mesh.vtx_offset +
-                                              scene.indices[mesh.first_idx + triangle + i]],
-                              1.0);
-                vertices[i].x = vertex.x / vertex.w;
-                vertices[i].y = vertex.y / vertex.w;
-                vertices[i].z = vertex.z / vertex.w;
-                int voxelX =
-                    (int)((vertices[i].x - scene.m_dimensions.min.x) / voxelSize) + padding;
-                int voxelY =
-                    (int)((vertices[i].y - scene.m_dimensions.min.y) / voxelSize) + padding;
-                int voxelZ =
-                    (int)((vertices[i].z - scene.m_dimensions.min.z) / voxelSize) + padding;
-
-                if (voxelX < minX)
-                {
-                    minX = voxelX;
-                }
-                if (voxelX > maxX)
-                {
-                    maxX = voxelX;
-                }
-                if (voxelY < minY)
-                {
-                    minY = voxelY;
-                }
-                if (voxelY > maxY)
-                {
-                    maxY = voxelY;
-                }
-                if (voxelZ < minZ)
-                {
-                    minZ = voxelZ;
-                }
-                if (voxelZ > maxZ)
-                {
-                    maxZ = voxelZ;
-                }
-            }
-
-            // printf("-------------\n");
-            // printf("The voxel MIN is %d %d %d\n", minZ, minY, minX);
-            // printf("The voxel MAX is %d %d %d\n", maxZ, maxY, maxX);
-
-            for (int k = minZ; k <= maxZ; k++)
-            {
-                for (int j = minY; j <= maxY; j++)
-                {
-                    for (int i = minX; i <= maxX; i++)
-                    {
-                        if (!tri_box_overlap({scene.m_dimensions.min.x +
-                                                  (i - padding) * voxelSize + voxelSize / 2.f,
-                                              scene.m_dimensions.min.y +
-                                                  (j - padding) * voxelSize + voxelSize / 2.f,
-                                              scene.m_dimensions.min.z +
-                                                  (k - padding) * voxelSize + voxelSize / 2.f},
-                                             halfSize, vertices[0], vertices[1], vertices[2]))
-                        {
-                            continue;
-                        }
-
-                        int index = i + j * x + k * x * y;
-                        if (index < size)
-                        {
-                            voxelData[index] = 1;
-                            totalVertexMarked++;
-                        }
-                    }
-                }
-            }
+            continue;
         }
-    }
-
-    printf("A total of voxels marked: %d\n", totalVertexMarked);
-
-    // FLOOD FILL
-    {
-        std::queue<glm::i32vec3> fillQueue;
-        fillQueue.push({0, 0, 0});
-        int index = 0;
-        voxelData[index] = 2;
-        while (fillQueue.size() > 0)
-        {
-            glm::i32vec3 curr = fillQueue.front();
-            fillQueue.pop();
 
-            glm::i32vec3 neighbors[6] = {
-                {curr.x - 1, curr.y, curr.z}, {curr.x + 1, curr.y, curr.z},
-                {curr.x, curr.y - 1, curr.z}, {curr.x, curr.y + 1, curr.z},
-                {curr.x, curr.y, curr.z - 1}, {curr.x, curr.y, curr.z + 1},
-            };
+        removed[index] = true;
+        removedCount++;
 
-            for (int i = 0; i < 6; i++)
+        // Only the neighbours inside the radius lose the density of the removed probe
+        glm::vec3 position = glm::vec3(probes[index]);
+        probeGrid.query_radius(position, radius, [&](int neighbour, float distance) {
+            if (!removed[neighbour])
             {
-                glm::i32vec3 neighbor = neighbors[i];
-                if (neighbor.x >= 0 && neighbor.x < x && neighbor.y >= 0 && neighbor.y < y &&
-                    neighbor.z >= 0 && neighbor.z < z)
-                {
-                    int ind = neighbor.x + neighbor.y * x + neighbor.z * x * y;
-                    if (voxelData[ind] == 0)
-                    {
-                        fillQueue.push(neighbor);
-                        voxelData[ind] = 2;
-                    }
-                    if (voxelData[ind] == 1)
-                    {
-                        int currInd = curr.x + curr.y * x + curr.z * x * y;
-                        voxelData[currInd] = 3;
-                    }
-                }
+                weights[neighbour] -= calculate_density(distance, radius);
+                heap.push({weights[neighbour], neighbour});
             }
-        }
+        });
 
-        for (int k = 1; k < z - 1; k++)
+        if (removedCount % progressStep == 0)
         {
-            for (int j = 1; j < y - 1; j++)
-            {
-                for (int i = 1; i < x - 1; i++)
-                {
-                    int index = i + j * x + k * x * y;
-                    if (voxelData[index] == 0)
-                    {
-                        voxelData[index] = 1;
-                    }
-                }
-            }
+            printf("Size of probes %d\n", probeCount - removedCount);
         }
     }
 
-    return voxelData;
-}
-
-void Precalculation::place_probes(VulkanEngine& engine, std::vector<glm::vec4>& probes,
-                                  int targetProbeCount, float spacing)
-{
-#if USE_COMPUTE_PROBE_DENSITY_CALCULATION
-    ComputeInstance instance = {};
-    engine._vulkanCompute.create_buffer(instance, UNIFORM, VMA_MEMORY_USAGE_CPU_TO_GPU,
-                                        sizeof(GPUProbeDensityUniformData));
-    engine._vulkanCompute.create_buffer(instance, STORAGE, VMA_MEMORY_USAGE_CPU_TO_GPU,
-                                        sizeof(glm::vec4) * probes.size());
-    engine._vulkanCompute.create_buffer(instance, STORAGE, VMA_MEMORY_USAGE_GPU_TO_CPU,
-                                        sizeof(float) * probes.size());
-
-    Slice<uint32_t> spirvProbeDensityWeights{};
-    engine._shaderManager.get_spirv(
-        "../shaders/precomputation/precalculate_probe_density_weights.comp", {},
-        spirvProbeDensityWeights);
-
-    engine._vulkanCompute.build(instance, engine._engineData.descriptorPool,
-                                spirvProbeDensityWeights);
-    vkutils::cpu_to_gpu(engine._engineData.allocator, instance.bindings[1].buffer,
-                        probes.data(), sizeof(glm::vec4) * probes.size());
-#endif
-
-    float currMaxWeight = -1;
-    int toRemoveIndex = -1;
-    float radius = spacing;
-
-    while (probes.size() > targetProbeCount)
+    // Survivors keep their relative order
+    int count = 0;
+    for (int i = 0; i < probeCount; i++)
     {
-#if USE_COMPUTE_PROBE_DENSITY_CALCULATION
-        GPUProbeDensityUniformData ub = {static_cast<int>(probes.size()), radius};
-        vkutils::cpu_to_gpu(engine._engineData.allocator, instance.bindings[0].buffer, &ub,
-                            sizeof(GPUProbeDensityUniformData));
-        int groupcount = ((probes.size()) / 256) + 1;
-        engine._vulkanCompute.compute(instance, groupcount, 1, 1);
-
-        void* gpuWeightData;
-        vmaMapMemory(engine._engineData.allocator, instance.bindings[2].buffer._allocation,
-                     &gpuWeightData);
-#endif
-        for (int i = 0; i < probes.size(); i++)
-        {
-#if USE_COMPUTE_PROBE_DENSITY_CALCULATION
-            float weight = ((float*)gpuWeightData)[i];
-#else
-            float weight = calculate_spatial_weight(radius, i, probes);
-#endif
-            if (weight >= currMaxWeight)
-            {
-                toRemoveIndex = i;
-                currMaxWeight = weight;
-            }
-        }
-
-#if USE_COMPUTE_PROBE_DENSITY_CALCULATION
-        vmaUnmapMemory(engine._engineData.allocator, instance.bindings[2].buffer._allocation);
-
-        void* gpuProbeData;
-        glm::vec4* castedGpuProbeData;
-        vmaMapMemory(engine._engineData.allocator, instance.bindings[1].buffer._allocation,
-                     &gpuProbeData);
-        castedGpuProbeData = (glm::vec4*)gpuProbeData;
-        castedGpuProbeData[toRemoveIndex] = castedGpuProbeData[probes.size() - 1];
-        vmaUnmapMemory(engine._engineData.allocator, instance.bindings[1].buffer._allocation);
-#endif
-
-        if (toRemoveIndex != -1)
+        if (!removed[i])
         {
-            probes[toRemoveIndex] = probes[probes.size() - 1];
-            probes.pop_back();
-            currMaxWeight = -1;
-            toRemoveIndex = -1;
+            probes[count++] = probes[i];
         }
-        else
-        {
-            break;
-        }
-        printf("Size of probes %d\n", probes.size());
     }
+    probes.resize(count);
 
-    printf("Found this many probes: %d\n", probes.size());
-
-#if USE_COMPUTE_PROBE_DENSITY_CALCULATION
-    engine._vulkanCompute.destroy_compute_instance(instance);
-#endif
+    printf("Found this many probes: %d\n", (int)probes.size());
 }
 
-std::vector<Receiver> Precalculation::generate_receivers_cpu(VulkanEngine& engine,
-                                                             GltfScene& scene,
-                                                             int lightmapResolution)
+void Precalculation::generate_receivers_cpu(GltfScene& scene, int lightmapResolution,
+                                            ReceiverStore& outReceivers)
 {
     // OPTICK_EVENT();
     printf("Generating receivers!\n");
 
-    int receiverCount = lightmapResolution * lightmapResolution;
-    std::vector<Receiver> _receivers(receiverCount);
-    int receiverCounter = 0;
+    struct TexelBounds
+    {
+        glm::ivec2 min;
+        glm::ivec2 max;
+    };
 
+    std::vector<uint32_t> nodeStart(scene.nodes.size() + 1, 0);
     for (int nodeIndex = 0; nodeIndex < scene.nodes.size(); nodeIndex++)
     {
         auto& mesh = scene.prim_meshes[scene.nodes[nodeIndex].prim_mesh];
-        for (int triangle = 0; triangle < mesh.idx_count; triangle += 3)
+        nodeStart[nodeIndex + 1] = nodeStart[nodeIndex] + mesh.idx_count / 3;
+    }
+    outReceivers = ReceiverStore();
+    if (nodeStart.back() >= (1u << (32 - RECEIVER_SAMPLE_BITS)))
+    {
+        printf("Too many triangles for the receiver samples: %u\n", nodeStart.back());
+        return;
+    }
+
+    std::vector<ReceiverTriangle>& triangles = outReceivers.triangles;
+    triangles.resize(nodeStart.back());
+    std::vector<TexelBounds> bounds(nodeStart.back());
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int nodeIndex = 0; nodeIndex < scene.nodes.size(); nodeIndex++)
+    {
+        auto& mesh = scene.prim_meshes[scene.nodes[nodeIndex].prim_mesh];
+        glm::mat3 normalMatrix =
+            glm::mat3(glm::transpose(glm::inverse(scene.nodes[nodeIndex].world_matrix)));
+
+        for (int triangle = 0; triangle < mesh.idx_count / 3; triangle++)
         {
-            glm::vec3 worldVertices[3];
-            glm::vec3 worldNormals[3];
-            glm::vec2 texVertices[3];
+            ReceiverTriangle& tri = triangles[nodeStart[nodeIndex] + triangle];
+            TexelBounds& texelBounds = bounds[nodeStart[nodeIndex] + triangle];
             int minX = lightmapResolution, minY = lightmapResolution;
             int maxX = 0, maxY = 0;
             for (int i = 0; i < 3; i++)
             {
                 int vertexIndex =
-                    mesh.vtx_offset + scene.indices[mesh.first_idx + triangle + i];
+                    mesh.vtx_offset + scene.indices[mesh.first_idx + triangle * 3 + i];
 
                 glm::vec4 vertex = scene.nodes[nodeIndex].world_matrix *
                                    glm::vec4(scene.positions[vertexIndex], 1.0);
-                worldVertices[i] = glm::vec3(vertex / vertex.w);
-
-                worldNormals[i] = glm::mat3(glm::transpose(
-                                      glm::inverse(scene.nodes[nodeIndex].world_matrix))) *
-                                  scene.normals[vertexIndex];
-
-                texVertices[i] = scene.lightmapUVs[vertexIndex] *
-                                 glm::vec2(lightmapResolution / (float)scene.lightmap_width,
-                                           lightmapResolution / (float)scene.lightmap_height);
-
-                if (texVertices[i].x < minX)
+                tri.worldVertices[i] = glm::vec3(vertex / vertex.w);
+                tri.worldNormals[i] = normalMatrix * scene.normals[vertexIndex];
+                tri.texVertices[i] =
+                    scene.lightmapUVs[vertexIndex] *
+                    glm::vec2(lightmapResolution / (float)scene.lightmap_width,
+                              lightmapResolution / (float)scene.lightmap_height);
+
+                if (tri.texVertices[i].x < minX)
                 {
-                    minX = texVertices[i].x;
+                    minX = tri.texVertices[i].x;
                 }
-                if (texVertices[i].x > maxX)
+                if (tri.texVertices[i].x > maxX)
                 {
-                    maxX = std::ceil(texVertices[i].x);
+                    maxX = std::ceil(tri.texVertices[i].x);
                 }
-                if (texVertices[i].y < minY)
+                if (tri.texVertices[i].y < minY)
                 {
-                    minY = texVertices[i].y;
+                    minY = tri.texVertices[i].y;
                 }
-                if (texVertices[i].y > maxY)
+                if (tri.texVertices[i].y > maxY)
                 {
-                    maxY = std::ceil(texVertices[i].y);
+                    maxY = std::ceil(tri.texVertices[i].y);
                 }
             }
 
-            for (int j = minY; j <= maxY; j++)
-            {
-                for (int i = minX; i <= maxX; i++)
-                {
-                    int maxSample = TEXEL_SAMPLES;
-                    int receiverIndex = i + j * lightmapResolution;
-
-                    // if (_receivers[receiverIndex].exists && nodeIndex !=
-                    // _receivers[receiverIndex].objectId) { 	continue;
-                    // }
-
-                    for (int sample = 0; sample < maxSample * maxSample; sample++)
-                    {
-                        glm::vec2 pixelMiddle;
-                        if (maxSample > 1)
-                        {
-                            pixelMiddle = {i + (sample / maxSample) / ((float)(maxSample - 1)),
-                                           j + (sample % maxSample) /
-                                                   ((float)(maxSample - 1))};
-                        }
-                        else
-                        {
-                            pixelMiddle = {i + 0.5, j + 0.5};
-                        }
-                        glm::vec3 barycentric = calculate_barycentric(
-                            pixelMiddle, texVertices[0], texVertices[1], texVertices[2]);
-                        if (barycentric.x >= 0 && barycentric.y >= 0 && barycentric.z >= 0)
-                        {
-                            if (!_receivers[receiverIndex].exists)
-                            {
-                                _receivers[receiverIndex].exists = true;
-                                _receivers[receiverIndex].objectId = nodeIndex;
-                                _receivers[receiverIndex].uv = glm::ivec2(i, j);
-                                receiverCounter++;
-                            }
-
-                            glm::vec3 sampledPos =
-                                apply_barycentric(barycentric, worldVertices[0],
-                                                  worldVertices[1], worldVertices[2]);
-                            glm::vec3 sampledNormal =
-                                apply_barycentric(barycentric, worldNormals[0],
-                                                  worldNormals[1], worldNormals[2]);
-                            bool exists = false;
-
-                            for (int checker = 0;
-                                 checker < _receivers[receiverIndex].poses.size(); checker++)
-                            {
-                                if (_receivers[receiverIndex].poses[checker] == sampledPos)
-                                {
-                                    exists = true;
-                                    break;
-                                }
-                            }
-
-                            if (!exists)
-                            {
-                                _receivers[receiverIndex].poses.push_back(sampledPos);
-                                _receivers[receiverIndex].norms.push_back(sampledNormal);
-                            }
-                        }
-                    }
-                }
-            }
+            texelBounds.min = glm::max(glm::ivec2(minX, minY), glm::ivec2(0));
+            texelBounds.max =
+                glm::min(glm::ivec2(maxX, maxY), glm::ivec2(lightmapResolution - 1));
+            tri.nodeIndex = nodeIndex;
         }
     }
 
-    int maxSamples = 0;
-    for (int i = 0; i < lightmapResolution * lightmapResolution; i++)
+    // Bin the triangles into tiles of the lightmap. Every tile is rasterized by one thread
+    // and visits its triangles in scene order, so the samples of a texel are gathered in the
+    // same order as a serial pass over the scene.
+    int tilesPerRow = (lightmapResolution + RECEIVER_TILE_SIZE - 1) / RECEIVER_TILE_SIZE;
+    int tileCount = tilesPerRow * tilesPerRow;
+    std::vector<uint32_t> tileStart(tileCount + 1, 0);
+    for (const TexelBounds& tri : bounds)
     {
-        if (_receivers[i].exists)
+        if (tri.min.x > tri.max.x || tri.min.y > tri.max.y)
         {
-            maxSamples = maxSamples > _receivers[i].poses.size() ? maxSamples
-                                                                 : _receivers[i].poses.size();
-
-            vec3 averagePosition = vec3(0);
-            vec3 averageNormal = vec3(0);
-            for (int j = 0; j < _receivers[i].poses.size(); j++)
+            continue;
+        }
+        for (int y = tri.min.y / RECEIVER_TILE_SIZE; y <= tri.max.y / RECEIVER_TILE_SIZE; y++)
+        {
+            for (int x = tri.min.x / RECEIVER_TILE_SIZE; x <= tri.max.x / RECEIVER_TILE_SIZE;
+                 x++)
             {
-                averagePosition += _receivers[i].poses[j];
-                averageNormal += _receivers[i].norms[j];
+                tileStart[x + y * tilesPerRow + 1]++;
             }
-
-            _receivers[i].position = averagePosition / (float)_receivers[i].poses.size();
-            _receivers[i].normal = averageNormal / (float)_receivers[i].norms.size();
         }
     }
-    printf("Largest number of samples for a texel: %d\n", maxSamples);
-
-    /*
-    for (int i = 0; i < lightmapResolution; i++) {
-        for (int j = 0; j < lightmapResolution; j++) {
-            if (!_receivers[j + i * lightmapResolution].exists) {
-                if (j + 1 < lightmapResolution && _receivers[j + 1 + i *
-    lightmapResolution].exists && !_receivers[j + 1 + i * lightmapResolution].processed) {
-                    _receivers[j + i * lightmapResolution] = _receivers[j + 1 + i *
-    lightmapResolution]; _receivers[j + i * lightmapResolution].processed = true; _receivers[j
-    + i * lightmapResolution].uv = glm::ivec2(j, i);
-                }
-                else if (j - 1 >= 0 && _receivers[j - 1 + i * lightmapResolution].exists &&
-    !_receivers[j - 1 + i * lightmapResolution].processed) { _receivers[j + i *
-    lightmapResolution] = _receivers[j - 1 + i * lightmapResolution]; _receivers[j + i *
-    lightmapResolution].processed = true; _receivers[j + i * lightmapResolution].uv =
-    glm::ivec2(j, i);
-                }
-                else if (i + 1 < lightmapResolution && _receivers[j + (i + 1) *
-    lightmapResolution].exists && !_receivers[j + (i + 1) * lightmapResolution].processed) {
-                    _receivers[j + i * lightmapResolution] = _receivers[j + (i + 1) *
-    lightmapResolution]; _receivers[j + i * lightmapResolution].processed = true; _receivers[j
-    + i * lightmapResolution].uv = glm::ivec2(j, i);
-                }
-                else if (i - 1 >= 0 && _receivers[j + (i - 1) * lightmapResolution].exists &&
-    !_receivers[j + (i - 1) * lightmapResolution].processed) { _receivers[j + i *
-    lightmapResolution] = _receivers[j + (i - 1) * lightmapResolution]; _receivers[j + i *
-    lightmapResolution].processed = true; _receivers[j + i * lightmapResolution].uv =
-    glm::ivec2(j, i);
-                }
-                else if (j + 1 < lightmapResolution && i + 1 < lightmapResolution &&
-    _receivers[j + 1 + (i + 1) * lightmapResolution].exists && !_receivers[j + 1 + (i + 1) *
-    lightmapResolution].processed) { _receivers[j + i * lightmapResolution] = _receivers[j + 1
-    + (i + 1) * lightmapResolution]; _receivers[j + i * lightmapResolution].processed = true;
-                    _receivers[j + i * lightmapResolution].uv = glm::ivec2(j, i);
-                }
-                else if (j + 1 < lightmapResolution && i - 1 >= 0 && _receivers[j + 1 + (i - 1)
-    * lightmapResolution].exists && !_receivers[j + 1 + (i - 1) *
-    lightmapResolution].processed) { _receivers[j + i * lightmapResolution] = _receivers[j + 1
-    + (i - 1) * lightmapResolution]; _receivers[j + i * lightmapResolution].processed = true;
-                    _receivers[j + i * lightmapResolution].uv = glm::ivec2(j, i);
-                }
-                else if (j - 1 >= 0 && i + 1 < lightmapResolution && _receivers[j - 1 + (i + 1)
-    * lightmapResolution].exists && !_receivers[j - 1 + (i + 1) *
-    lightmapResolution].processed) { _receivers[j + i * lightmapResolution] = _receivers[j - 1
-    + (i + 1) * lightmapResolution]; _receivers[j + i * lightmapResolution].processed = true;
-                    _receivers[j + i * lightmapResolution].uv = glm::ivec2(j, i);
-                }
-                else if (j - 1 >= 0 && i - 1 >= 0 && _receivers[j - 1 + (i - 1) *
-    lightmapResolution].exists && !_receivers[j - 1 + (i - 1) * lightmapResolution].processed)
-    { _receivers[j + i * lightmapResolution] = _receivers[j - 1 + (i - 1) *
-    lightmapResolution]; _receivers[j + i * lightmapResolution].processed = true; _receivers[j
-    + i * lightmapResolution].uv = glm::ivec2(j, i);
-                }
-            }
-        }
+    for (int i = 0; i < tileCount; i++)
+    {
+        tileStart[i + 1] += tileStart[i];
     }
-    */
-    char* image = new char[lightmapResolution * lightmapResolution];
-    memset(image, 0, lightmapResolution * lightmapResolution);
-    for (int i = 0; i < lightmapResolution; i++)
+
+    std::vector<uint32_t> cursor(tileStart.begin(), tileStart.end() - 1);
+    std::vector<uint32_t> tileTriangles(tileStart.back());
+    for (int triangle = 0; triangle < triangles.size(); triangle++)
     {
-        for (int j = 0; j < lightmapResolution; j++)
+        const TexelBounds& tri = bounds[triangle];
+        if (tri.min.x > tri.max.x || tri.min.y > tri.max.y)
+        {
+            continue;
+        }
+        for (int y = tri.min.y / RECEIVER_TILE_SIZE; y <= tri.max.y / RECEIVER_TILE_SIZE; y++)
         {
-            if (_receivers[j + i * lightmapResolution].exists)
+            for (int x = tri.min.x / RECEIVER_TILE_SIZE; x <= tri.max.x / RECEIVER_TILE_SIZE;
+                 x++)
             {
-                image[j + i * lightmapResolution] = 255;
+                tileTriangles[cursor[x + y * tilesPerRow]++] = triangle;
             }
         }
     }
 
-    FILE* ptr;
-    fopen_s(&ptr, "../precomputation/receiver_image.bin", "wb");
-    fwrite(image, lightmapResolution * lightmapResolution, 1, ptr);
-    fclose(ptr);
-    printf("Created receivers: %d!\n", receiverCounter);
+    // Receivers found in every tile, in the texel order of the tile. rowStart holds the first
+    // receiver of every texel row.
+    struct ReceiverTile
+    {
+        ReceiverStore receivers;
+        uint32_t rowStart[RECEIVER_TILE_SIZE + 1];
+    };
+    std::vector<ReceiverTile> tiles(tileCount);
+
+    // Exact duplicates of a sample are skipped with a small hash set per texel. Slots are
+    // invalidated by bumping the stamp instead of clearing the table.
+    struct SampleSlot
+    {
+        glm::vec3 position;
+        uint32_t stamp;
+    };
+    auto hash_position = [](const glm::vec3& position) {
+        // + 0 maps -0 to 0, the two compare equal
+        uint32_t bits[3];
+        glm::vec3 normalized = position + glm::vec3(0.f);
+        memcpy(bits, &normalized, sizeof(bits));
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    };
+
+#pragma omp parallel
+    {
+        std::vector<uint32_t> texelStart;
+        std::vector<uint32_t> texelTriangles;
+        std::vector<SampleSlot> slots;
+        uint32_t stamp = 0;
 
-    return _receivers;
-}
+#pragma omp for schedule(dynamic, 1)
+        for (int tile = 0; tile < tileCount; tile++)
+        {
+            glm::ivec2 tileMin =
+                glm::ivec2(tile % tilesPerRow, tile / tilesPerRow) * RECEIVER_TILE_SIZE;
+            glm::ivec2 tileMax = glm::min(tileMin + RECEIVER_TILE_SIZE - 1,
+                                          glm::ivec2(lightmapResolution - 1));
+            ReceiverStore& tileReceivers = tiles[tile].receivers;
+            uint32_t* rowStart = tiles[tile].rowStart;
+
+            // Triangles of every texel of the tile, in scene order
+            texelStart.assign(RECEIVER_TILE_SIZE * RECEIVER_TILE_SIZE + 1, 0);
+            for (int pass = 0; pass < 2; pass++)
+            {
+                for (uint32_t entry = tileStart[tile]; entry < tileStart[tile + 1]; entry++)
+                {
+                    const TexelBounds& tri = bounds[tileTriangles[entry]];
+                    glm::ivec2 minTexel = glm::max(tri.min, tileMin) - tileMin;
+                    glm::ivec2 maxTexel = glm::min(tri.max, tileMax) - tileMin;
+                    for (int j = minTexel.y; j <= maxTexel.y; j++)
+                    {
+                        for (int i = minTexel.x; i <= maxTexel.x; i++)
+                        {
+                            int texel = i + j * RECEIVER_TILE_SIZE;
+                            if (pass == 0)
+                            {
+                                texelStart[texel + 1]++;
+                            }
+                            else
+                            {
+                                texelTriangles[texelStart[texel]++] = tileTriangles[entry];
+                            }
+                        }
+                    }
+                }
 
-/*
-Receiver* Precalculation::generate_receivers(VulkanEngine& engine, GltfScene& scene, int
-lightmapResolution)
-{
-    //OPTICK_EVENT();
-    printf("Generating receivers!\n");
+                if (pass == 0)
+                {
+                    for (int texel = 1; texel < texelStart.size(); texel++)
+                    {
+                        texelStart[texel] += texelStart[texel - 1];
+                    }
+                    texelTriangles.resize(texelStart.back());
+                }
+            }
 
-    int receiverCount = lightmapResolution * lightmapResolution;
-    Receiver* _receivers = new Receiver[receiverCount];
-    memset(_receivers, 0, sizeof(Receiver) * receiverCount);
-    int receiverCounter = 0;
+            // texelStart now holds the end of every texel, and the start of the next one
+            for (int texel = 0; texel < RECEIVER_TILE_SIZE * RECEIVER_TILE_SIZE; texel++)
+            {
+                if (texel % RECEIVER_TILE_SIZE == 0)
+                {
+                    rowStart[texel / RECEIVER_TILE_SIZE] = tileReceivers.size();
+                }
 
-    VkExtent2D imageSize = { lightmapResolution, lightmapResolution };
+                uint32_t first = texel == 0 ? 0 : texelStart[texel - 1];
+                uint32_t last = texelStart[texel];
+                if (first == last)
+                {
+                    continue;
+                }
 
-    //Render pass
-    VkRenderPass gbufferRenderPass;
-    {
-        VkAttachmentDescription attachmentDescs[2] = {};
+                int i = tileMin.x + texel % RECEIVER_TILE_SIZE;
+                int j = tileMin.y + texel / RECEIVER_TILE_SIZE;
+                glm::ivec2 texelCoordinates = glm::ivec2(i, j);
+                int maxSample = TEXEL_SAMPLES;
+                bool exists = false;
+                int objectId = 0;
+                glm::vec3 positionSum = glm::vec3(0);
+                glm::vec3 normalSum = glm::vec3(0);
+
+                size_t slotCount = 64;
+                while (slotCount < 2 * (last - first) * maxSample * maxSample)
+                {
+                    slotCount *= 2;
+                }
+                if (slots.size() < slotCount || ++stamp == 0)
+                {
+                    slots.assign(std::max(slotCount, slots.size()), {glm::vec3(0), 0});
+                    stamp = 1;
+                }
+                uint32_t slotMask = (uint32_t)slotCount - 1;
 
-        for (uint32_t i = 0; i < 2; ++i)
-        {
-            attachmentDescs[i].samples = VK_SAMPLE_COUNT_1_BIT;
-            attachmentDescs[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-            attachmentDescs[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            attachmentDescs[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-            attachmentDescs[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
-            attachmentDescs[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            attachmentDescs[i].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        }
+                for (uint32_t entry = first; entry < last; entry++)
+                {
+                    const ReceiverTriangle& tri = triangles[texelTriangles[entry]];
+                    for (int sample = 0; sample < maxSample * maxSample; sample++)
+                    {
+                        glm::vec3 barycentric =
+                            ReceiverStore::sample_barycentric(tri, texelCoordinates, sample);
+                        // Written so that the NaNs of degenerate UV triangles fail the test
+                        if (!(barycentric.x >= 0 && barycentric.y >= 0 && barycentric.z >= 0))
+                        {
+                            continue;
+                        }
 
-        attachmentDescs[0].format = engine._engineData.color32Format;
-        attachmentDescs[1].format = engine._engineData.color32Format;
-
-        VkAttachmentReference colorReferences[2] = {};
-        colorReferences[0] = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-        colorReferences[1] = { 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.pColorAttachments = colorReferences;
-        subpass.colorAttachmentCount = static_cast<uint32_t>(2);
-        subpass.pDepthStencilAttachment = nullptr;
-
-        VkSubpassDependency dependencies[2] = {};
-
-        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[0].dstSubpass = 0;
-        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; dependencies[0].dependencyFlags =
-VK_DEPENDENCY_BY_REGION_BIT;
-
-        dependencies[1].srcSubpass = 0;
-        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; dependencies[1].dstAccessMask =
-VK_ACCESS_MEMORY_READ_BIT; dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-        VkRenderPassCreateInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.pAttachments = attachmentDescs;
-        renderPassInfo.attachmentCount = static_cast<uint32_t>(2);
-        renderPassInfo.subpassCount = 1;
-        renderPassInfo.pSubpasses = &subpass;
-        renderPassInfo.dependencyCount = 2;
-        renderPassInfo.pDependencies = dependencies;
-
-        VK_CHECK(vkCreateRenderPass(engine._engineData.device, &renderPassInfo, nullptr,
-&gbufferRenderPass));
-    }
-
-    //Images
-    AllocatedImage gbufferPosObjectIdImage;
-    AllocatedImage gbufferNormalImage;
-
-    AllocatedImage gbufferPosObjectIdImageCpu;
-    AllocatedImage gbufferNormalImageCpu;
-
-    VkImageView gbufferPosObjectIdImageView;
-    VkImageView gbufferNormalImageView;
-    VkFramebuffer gbufferFrameBuffer;
-    {
-        VkExtent3D extent3D = {
-            imageSize.width,
-            imageSize.height,
-            1
-        };
+                        if (!exists)
+                        {
+                            exists = true;
+                            objectId = tri.nodeIndex;
+                        }
 
-        {
-            VkImageCreateInfo dimg_info =
-vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-| VK_IMAGE_USAGE_TRANSFER_SRC_BIT, extent3D); VmaAllocationCreateInfo dimg_allocinfo = {};
-            dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
-&gbufferPosObjectIdImage._image, &gbufferPosObjectIdImage._allocation, nullptr);
-
-            VkImageViewCreateInfo imageViewInfo =
-vkinit::imageview_create_info(engine._engineData.color32Format, gbufferPosObjectIdImage._image,
-VK_IMAGE_ASPECT_COLOR_BIT); VK_CHECK(vkCreateImageView(engine._engineData.device,
-&imageViewInfo, nullptr, &gbufferPosObjectIdImageView));
-        }
+                        glm::vec3 sampledPos =
+                            apply_barycentric(barycentric, tri.worldVertices[0],
+                                              tri.worldVertices[1], tri.worldVertices[2]);
+                        uint32_t slot = hash_position(sampledPos) & slotMask;
+                        bool duplicate = false;
+                        while (slots[slot].stamp == stamp)
+                        {
+                            if (slots[slot].position == sampledPos)
+                            {
+                                duplicate = true;
+                                break;
+                            }
+                            slot = (slot + 1) & slotMask;
+                        }
+                        if (duplicate)
+                        {
+                            continue;
+                        }
+                        slots[slot] = {sampledPos, stamp};
 
-        {
-            VkImageCreateInfo dimg_info =
-vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-| VK_IMAGE_USAGE_TRANSFER_SRC_BIT, extent3D); VmaAllocationCreateInfo dimg_allocinfo = {};
-            dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
-&gbufferNormalImage._image, &gbufferNormalImage._allocation, nullptr);
-
-            VkImageViewCreateInfo imageViewInfo =
-vkinit::imageview_create_info(engine._engineData.color32Format, gbufferNormalImage._image,
-VK_IMAGE_ASPECT_COLOR_BIT); VK_CHECK(vkCreateImageView(engine._engineData.device,
-&imageViewInfo, nullptr, &gbufferNormalImageView));
-        }
+                        glm::vec3 sampledNormal =
+                            apply_barycentric(barycentric, tri.worldNormals[0],
+                                              tri.worldNormals[1], tri.worldNormals[2]);
+                        tileReceivers.samples.push_back(
+                            texelTriangles[entry] << RECEIVER_SAMPLE_BITS | sample);
 
-        {
-            VkImageCreateInfo dimg_info =
-vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-extent3D); dimg_info.tiling = VK_IMAGE_TILING_LINEAR; VmaAllocationCreateInfo dimg_allocinfo =
-{}; dimg_allocinfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
-&gbufferPosObjectIdImageCpu._image, &gbufferPosObjectIdImageCpu._allocation, nullptr);
-        }
+                        // Sums for the averages, in the order the samples are added
+                        positionSum += sampledPos;
+                        normalSum += sampledNormal;
+                    }
+                }
 
-        {
-            VkImageCreateInfo dimg_info =
-vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-extent3D); dimg_info.tiling = VK_IMAGE_TILING_LINEAR; VmaAllocationCreateInfo dimg_allocinfo =
-{}; dimg_allocinfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
-&gbufferNormalImageCpu._image, &gbufferNormalImageCpu._allocation, nullptr);
+                if (exists)
+                {
+                    uint32_t sampleCount =
+                        tileReceivers.samples.size() - tileReceivers.sampleStart.back();
+                    tileReceivers.positions.push_back(positionSum / (float)sampleCount);
+                    tileReceivers.normals.push_back(normalSum / (float)sampleCount);
+                    tileReceivers.uvs.push_back(texelCoordinates);
+                    tileReceivers.objectIds.push_back(objectId);
+                    tileReceivers.sampleStart.push_back(tileReceivers.samples.size());
+                }
+            }
+            rowStart[RECEIVER_TILE_SIZE] = tileReceivers.size();
         }
+    }
 
-        VkImageView attachments[2] = { gbufferPosObjectIdImageView, gbufferNormalImageView };
-
-        VkFramebufferCreateInfo fb_info = vkinit::framebuffer_create_info(gbufferRenderPass,
-imageSize); fb_info.pAttachments = attachments; fb_info.attachmentCount = 2;
-        VK_CHECK(vkCreateFramebuffer(engine._engineData.device, &fb_info, nullptr,
-&gbufferFrameBuffer));
+    // Gather the tiles in texel order, one row of tiles at a time
+    size_t receiverCount = 0;
+    size_t sampleCount = 0;
+    for (const ReceiverTile& tile : tiles)
+    {
+        receiverCount += tile.receivers.size();
+        sampleCount += tile.receivers.samples.size();
     }
 
-    //Pipeline
-    VkPipeline gbufferPipeline;
-    VkPipelineLayout gbufferPipelineLayout;
+    outReceivers.positions.reserve(receiverCount);
+    outReceivers.normals.reserve(receiverCount);
+    outReceivers.uvs.reserve(receiverCount);
+    outReceivers.objectIds.reserve(receiverCount);
+    outReceivers.sampleStart.reserve(receiverCount + 1);
+    outReceivers.samples.reserve(sampleCount);
+
+    int maxSamples = 0;
+    for (int tileY = 0; tileY < tilesPerRow; tileY++)
     {
-        VkShaderModule gbufferVertShader;
-        if (!vkutils::load_shader_module(engine._engineData.device,
-"../shaders/precalculate_receivers.vert", &gbufferVertShader))
+        for (int row = 0; row < RECEIVER_TILE_SIZE; row++)
         {
-            assert("G Buffer Vertex Shader Loading Issue");
+            for (int tileX = 0; tileX < tilesPerRow; tileX++)
+            {
+                const ReceiverTile& tile = tiles[tileX + tileY * tilesPerRow];
+                const ReceiverStore& tileReceivers = tile.receivers;
+                for (uint32_t r = tile.rowStart[row]; r < tile.rowStart[row + 1]; r++)
+                {
+                    outReceivers.positions.push_back(tileReceivers.positions[r]);
+                    outReceivers.normals.push_back(tileReceivers.normals[r]);
+                    outReceivers.uvs.push_back(tileReceivers.uvs[r]);
+                    outReceivers.objectIds.push_back(tileReceivers.objectIds[r]);
+                    outReceivers.samples.insert(
+                        outReceivers.samples.end(),
+                        tileReceivers.samples.begin() + tileReceivers.sampleStart[r],
+                        tileReceivers.samples.begin() + tileReceivers.sampleStart[r + 1]);
+                    outReceivers.sampleStart.push_back(outReceivers.samples.size());
+                    maxSamples = std::max(maxSamples, tileReceivers.sample_count(r));
+                }
+            }
         }
 
-        VkShaderModule gbufferFragShader;
-        if (!vkutils::load_shader_module(engine._engineData.device,
-"../shaders/precalculate_receivers.frag", &gbufferFragShader))
+        for (int tileX = 0; tileX < tilesPerRow; tileX++)
         {
-            assert("F Buffer Fragment Shader Loading Issue");
+            tiles[tileX + tileY * tilesPerRow] = ReceiverTile();
         }
-
-        VkDescriptorSetLayout setLayouts[] = { engine._sceneDescriptors.globalSetLayout,
-engine._sceneDescriptors.objectSetLayout }; VkPipelineLayoutCreateInfo pipeline_layout_info =
-vkinit::pipeline_layout_create_info(setLayouts, 2);
-        VK_CHECK(vkCreatePipelineLayout(engine._engineData.device, &pipeline_layout_info,
-nullptr, &gbufferPipelineLayout));
-
-        //build the stage-create-info for both vertex and fragment stages. This lets the
-pipeline know the shader modules per stage PipelineBuilder pipelineBuilder;
-
-        //vertex input controls how to read vertices from vertex buffers. We aren't using it
-yet pipelineBuilder._vertexInputInfo = vkinit::vertex_input_state_create_info();
-
-        //input assembly is the configuration for drawing triangle lists, strips, or individual
-points.
-        //we are just going to draw triangle list
-        pipelineBuilder._inputAssembly =
-vkinit::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-
-        //configure the rasterizer to draw filled triangles
-        pipelineBuilder._rasterizer =
-vkinit::rasterization_state_create_info(VK_POLYGON_MODE_FILL);
-
-        VkPipelineRasterizationConservativeStateCreateInfoEXT conservativeRasterStateCI{};
-        conservativeRasterStateCI.sType =
-VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT;
-        conservativeRasterStateCI.conservativeRasterizationMode =
-VK_CONSERVATIVE_RASTERIZATION_MODE_OVERESTIMATE_EXT;
-        conservativeRasterStateCI.extraPrimitiveOverestimationSize = 1.0;
-
-        pipelineBuilder._rasterizer.pNext = &conservativeRasterStateCI;
-
-        //we don't use multisampling, so just run the default one
-        pipelineBuilder._multisampling = vkinit::multisampling_state_create_info();
-
-        //a single blend attachment with no blending and writing to RGBA
-
-        VkPipelineColorBlendAttachmentState blendAttachmentState[2] = {
-            vkinit::color_blend_attachment_state(),
-            vkinit::color_blend_attachment_state(),
-        };
-
-        pipelineBuilder._colorBlending = vkinit::color_blend_state_create_info(2,
-blendAttachmentState);
-
-        //build the mesh pipeline
-        VertexInputDescription vertexDescription = Vertex::get_vertex_description();
-        pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions =
-vertexDescription.attributes.data();
-        pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount =
-vertexDescription.attributes.size();
-
-        pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions =
-vertexDescription.bindings.data();
-        pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount =
-vertexDescription.bindings.size();
-
-        pipelineBuilder._shaderStages.push_back(
-            vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT,
-gbufferVertShader));
-
-        pipelineBuilder._shaderStages.push_back(
-            vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT,
-gbufferFragShader));
-
-        pipelineBuilder._depthStencil = vkinit::depth_stencil_create_info(false, false,
-VK_COMPARE_OP_LESS_OR_EQUAL);
-
-        pipelineBuilder._rasterizer.cullMode = VK_CULL_MODE_NONE;
-        pipelineBuilder._pipelineLayout = gbufferPipelineLayout;
-
-        //build the mesh triangle pipeline
-        gbufferPipeline = pipelineBuilder.build_pipeline(engine._engineData.device,
-gbufferRenderPass);
-
-        vkDestroyShaderModule(engine._engineData.device, gbufferVertShader, nullptr);
-        vkDestroyShaderModule(engine._engineData.device, gbufferFragShader, nullptr);
     }
+    printf("Largest number of samples for a texel: %d\n", maxSamples);
 
-    //Rendering
+    if (!debugDumpDirectory.empty())
     {
-        engine._camData.lightmapInputSize = { (float)scene.lightmap_width,
-(float)scene.lightmap_height }; vkutils::cpu_to_gpu(engine._engineData.allocator,
-engine._cameraBuffer, &engine._camData, sizeof(GPUCameraData));
-
-        void* objectData;
-        vmaMapMemory(engine._engineData.allocator, engine._objectBuffer._allocation,
-&objectData); GPUObjectData* objectSSBO = (GPUObjectData*)objectData;
-
-        for (int i = 0; i < engine.gltf_scene.nodes.size(); i++)
+        char* image = new char[lightmapResolution * lightmapResolution];
+        memset(image, 0, lightmapResolution * lightmapResolution);
+        for (const glm::ivec2& uv : outReceivers.uvs)
         {
-            auto& mesh = engine.gltf_scene.prim_meshes[engine.gltf_scene.nodes[i].prim_mesh];
-            objectSSBO[i].model = engine.gltf_scene.nodes[i].world_matrix;
-            objectSSBO[i].material_id = mesh.material_idx;
+            image[uv.x + uv.y * lightmapResolution] = 255;
         }
-        vmaUnmapMemory(engine._engineData.allocator, engine._objectBuffer._allocation);
-
-        vkutils::immediate_submit(&engine._engineData, [&](VkCommandBuffer cmd) {
-            VkClearValue clearValues[2];
-            clearValues[0].color = { { 0.0f, 0.0f, 0.0f, -1.0f } };
-            clearValues[1].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
 
-            VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(gbufferRenderPass,
-imageSize, gbufferFrameBuffer); rpInfo.clearValueCount = 2; rpInfo.pClearValues = clearValues;
-
-            vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-            vkutils::cmd_viewport_scissor(cmd, imageSize);
-
-            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, gbufferPipeline);
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-gbufferPipelineLayout, 0, 1, &engine._sceneDescriptors.globalDescriptor, 0, nullptr);
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-gbufferPipelineLayout, 1, 1, &engine._sceneDescriptors.objectDescriptor, 0, nullptr);
+        save_binary(debugDumpDirectory + "/receiver_image.bin", image,
+                    lightmapResolution * lightmapResolution);
+        delete[] image;
+    }
+    printf("Created receivers: %d!\n", outReceivers.size());
+    printf("Receivers use %.2f MB\n", outReceivers.memory_size() / (1024.0 * 1024.0));
+}
 
-            engine.draw_objects(cmd);
 
-            vkCmdEndRenderPass(cmd);
-        });
-    }
+void Precalculation::probe_raycast_cpu(CpuRaytracer& raytracer, std::vector<glm::vec4>& probes,
+                                       int rays, GPUProbeRaycastResult* probeRaycastResult)
+{
+    auto start = std::chrono::system_clock::now();
 
-    //Copy images
-    vkutils::immediate_submit(&engine._engineData, [&](VkCommandBuffer cmd) {
+    // Consecutive fibonacci directions are far apart, so the rays are traced one by one
+#pragma omp parallel for schedule(dynamic)
+    for (int probe = 0; probe < probes.size(); probe++)
+    {
+        for (int i = 0; i < rays; i++)
         {
-            VkImageMemoryBarrier imageMemoryBarrier = {};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.image = gbufferPosObjectIdImageCpu._image;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-            vkCmdPipelineBarrier(
-                cmd,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &imageMemoryBarrier);
+            glm::vec3 direction = probe_ray_direction(i, rays);
+            GPUHitPayload payload =
+                raytracer.trace(glm::vec3(probes[probe]), direction, RAY_T_MIN, RAY_T_MAX);
+
+            GPUProbeRaycastResult& result = probeRaycastResult[i + rays * probe];
+            result = {};
+            result.worldPos = glm::vec4(payload.pos, 1.0);
+            result.lightmapUv = payload.lightmapUv;
+            result.texUv = payload.texUv;
+            result.objectId = payload.objectId;
+            result.direction = glm::vec4(direction, 0.0);
         }
+    }
 
-        // Issue the copy command
-        VkImageCopy imageCopyRegion{};
-        imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageCopyRegion.srcSubresource.layerCount = 1;
-        imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageCopyRegion.dstSubresource.layerCount = 1;
-        imageCopyRegion.extent.width = imageSize.width;
-        imageCopyRegion.extent.height = imageSize.height;
-        imageCopyRegion.extent.depth = 1;
-
-        vkCmdCopyImage(
-            cmd,
-            gbufferPosObjectIdImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            gbufferPosObjectIdImageCpu._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &imageCopyRegion);
-
-        // Transition destination image to general layout, which is the required layout for
-mapping the image memory later on
-        {
-            VkImageMemoryBarrier imageMemoryBarrier = {};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.image = gbufferPosObjectIdImageCpu._image;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-            vkCmdPipelineBarrier(
-                cmd,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &imageMemoryBarrier);
-        }
-    });
+    auto end = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end - start;
+    printf("Probe raycast took %f s (%f Mrays/s)\n", elapsed_seconds.count(),
+           probes.size() * (double)rays / elapsed_seconds.count() / 1e6);
+}
 
-    vkutils::immediate_submit(&engine._engineData, [&](VkCommandBuffer cmd) {
+// Scratch memory of trace_receiver_transfer, reused for every cluster a thread traces
+struct TransferArena
+{
+    std::vector<float> visibility;
+    std::vector<glm::vec3> probeDirections;
+    std::vector<CpuRay> probeRays;
+    std::vector<GPUHitPayload> probePayloads;
+    std::vector<int> missProbes;
+};
+
+// Transfer matrix of a cluster, a row of probeCount * shNumCoeff windowed coefficients per
+// receiver. The weight offsets of the cluster's first receiver are at clusterWeightOffsets.
+// Only the probes with a weight are traced, the columns of the others stay zero. The rows are
+// evicted from the buffer in blocks as soon as they are traced.
+static const float* trace_receiver_transfer(
+    const CpuRaytracer& raytracer, const ReceiverStore& receivers, const AABB& cluster,
+    const std::vector<glm::vec4>& probes, int rays, int sphericalHarmonicsOrder,
+    int maxReceiverInABatch, const float* windowing, const int* clusterWeightOffsets,
+    const GPUReceiverProbeWeight* weights, TransferArena& arena, ScratchBuffer& buffer)
+{
+    BakeProfileZone zone("trace_cluster");
+    zone.add_items((int64_t)cluster.receivers.size() * rays);
+    int shNumCoeff = SPHERICAL_HARMONICS_NUM_COEFF(sphericalHarmonicsOrder);
+    int probeCount = cluster.probes.size();
+    std::vector<float>& visibility = arena.visibility;
+    std::vector<glm::vec3>& probeDirections = arena.probeDirections;
+    std::vector<CpuRay>& probeRays = arena.probeRays;
+    std::vector<GPUHitPayload>& probePayloads = arena.probePayloads;
+    std::vector<int>& missProbes = arena.missProbes;
+
+    size_t rowSize = (size_t)probeCount * shNumCoeff;
+    float* clusterMatrix = buffer.allocate(cluster.receivers.size() * rowSize);
+    visibility.resize(probeCount);
+    probeDirections.resize(probeCount);
+    probeRays.resize(probeCount);
+    probePayloads.resize(probeCount);
+    missProbes.resize(probeCount);
+
+    for (int r = 0; r < cluster.receivers.size(); r++)
+    {
+        int receiver = cluster.receivers[r];
+        float* row = clusterMatrix + r * rowSize;
+        std::fill(row, row + rowSize, 0.f);
+        const GPUReceiverProbeWeight* receiverWeights = weights + clusterWeightOffsets[r];
+        int weightCount = clusterWeightOffsets[r + 1] - clusterWeightOffsets[r];
+        int recSampleCount = receivers.sample_count(receiver);
+
+        float basis[64];
+        int validRays = 0;
+
+        // A receiver without probes keeps a zero row
+        for (int y = 0; y < rays && weightCount > 0; y++)
         {
-            VkImageMemoryBarrier imageMemoryBarrier = {};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.image = gbufferNormalImageCpu._image;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-            vkCmdPipelineBarrier(
-                cmd,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &imageMemoryBarrier);
-        }
+            // precalculate_receiver_rt.rgen: pick a sample of the texel and trace a
+            // cosine distributed ray from it
+            glm::vec3 hitNormal;
+            glm::vec3 hitLocation;
+            int hitObjectId;
+            glm::vec3 selectedDirection;
+            glm::vec3 selectedReceiverPos;
+            glm::vec3 selectedReceiverNormal;
+            int counter = 0;
 
-        // Issue the copy command
-        VkImageCopy imageCopyRegion{};
-        imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageCopyRegion.srcSubresource.layerCount = 1;
-        imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageCopyRegion.dstSubresource.layerCount = 1;
-        imageCopyRegion.extent.width = imageSize.width;
-        imageCopyRegion.extent.height = imageSize.height;
-        imageCopyRegion.extent.depth = 1;
-
-        vkCmdCopyImage(
-            cmd,
-            gbufferNormalImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            gbufferNormalImageCpu._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &imageCopyRegion);
-
-        // Transition destination image to general layout, which is the required layout for
-mapping the image memory later on
-        {
-            VkImageMemoryBarrier imageMemoryBarrier = {};
-            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            imageMemoryBarrier.image = gbufferNormalImageCpu._image;
-            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-            vkCmdPipelineBarrier(
-                cmd,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &imageMemoryBarrier);
-        }
-        });
+            uint32_t randomSeed = init_rand(r % maxReceiverInABatch, y);
 
-    float* posObjectId = new float[imageSize.width * imageSize.height * 4];
-    float* normal = new float[imageSize.width * imageSize.height * 4];
+            for (int i = 0; i < recSampleCount; i++)
+            {
+                int selectedSample = (y + i) % recSampleCount;
+                glm::vec3 receiverPos;
+                glm::vec3 receiverNormal;
+                receivers.get_sample(receiver, selectedSample, receiverPos,
+                                     receiverNormal);
+                receiverNormal = glm::normalize(receiverNormal);
+
+                glm::vec2 offset;
+                offset.x = next_rand(randomSeed);
+                offset.y = next_rand(randomSeed);
+                glm::vec3 direction = glm::normalize(
+                    get_cos_hemisphere_sample(y, offset, receiverNormal));
+
+                GPUHitPayload payload =
+                    raytracer.trace(offset_ray(receiverPos, receiverNormal), direction,
+                                    RAY_T_MIN, RAY_T_MAX);
+
+                bool validHit = payload.normal == glm::vec3(0) ||
+                                glm::dot(payload.normal, direction) <= 0.0;
+                if (i == 0 || validHit)
+                {
+                    selectedReceiverNormal = receiverNormal;
+                    hitNormal = payload.normal;
+                    hitLocation = payload.pos;
+                    hitObjectId = payload.objectId;
+                    selectedDirection = direction;
+                    selectedReceiverPos = receiverPos;
+                    if (validHit)
+                    {
+                        counter++;
+                        if (counter > y % recSampleCount)
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
 
-    {
-        VkImageSubresource subResource{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(engine._engineData.device,
-gbufferPosObjectIdImageCpu._image, &subResource, &subResourceLayout);
+            // Visibility of the same ray from the probes with a weight, the others do not
+            // contribute to the receiver. The probes of a cluster are close to each other
+            // and aim at the same point, so their rays are traced as packets.
+            for (int e = 0; e < weightCount; e++)
+            {
+                int probe = cluster.probes[receiverWeights[e].clusterProbe];
+                glm::vec3 probePos = glm::vec3(probes[probe]);
+                visibility[e] = 0;
+                probeRays[e].origin = probePos;
+                probeRays[e].tMin = RAY_T_MIN;
+                probeRays[e].tMax = RAY_T_MAX;
+
+                if (hitObjectId == -1)
+                {
+                    probeDirections[e] = selectedDirection;
+                    probeRays[e].direction =
+                        glm::normalize(selectedReceiverPos - probePos);
+                }
+                else
+                {
+                    probeDirections[e] = glm::normalize(hitLocation - probePos);
+                    probeRays[e].direction = probeDirections[e];
+                }
+            }
 
-        const char* data;
-        vmaMapMemory(engine._engineData.allocator, gbufferPosObjectIdImageCpu._allocation,
-(void**)&data); data += subResourceLayout.offset;
+            raytracer.trace_packet(probeRays.data(), weightCount, probePayloads.data());
 
-        memcpy(posObjectId, data, imageSize.width* imageSize.height * 4 * sizeof(float));
+            int missRayCount = 0;
+            for (int e = 0; e < weightCount; e++)
+            {
+                const GPUHitPayload& payload = probePayloads[e];
+                const glm::vec3& rayDirection = probeRays[e].direction;
 
-        vmaUnmapMemory(engine._engineData.allocator, gbufferPosObjectIdImageCpu._allocation);
-    }
+                if (hitObjectId == -1)
+                {
+                    // The receiver ray is a miss, the probe has to see the receiver
+                    // and miss in the same direction
+                    if (payload.objectId != -1 &&
+                        glm::distance(payload.pos, selectedReceiverPos) < 0.001 &&
+                        glm::distance(selectedReceiverNormal, payload.normal) <=
+                            0.01 &&
+                        glm::dot(payload.normal, rayDirection) <= 0.0)
+                    {
+                        probeRays[missRayCount] = probeRays[e];
+                        probeRays[missRayCount].direction = selectedDirection;
+                        missProbes[missRayCount] = e;
+                        missRayCount++;
+                    }
+                }
+                else
+                {
+                    // The receiver ray hit a location, the probe has to see the same
+                    // point
+                    if (payload.objectId == hitObjectId &&
+                        glm::distance(hitLocation, payload.pos) < 0.001 &&
+                        glm::distance(hitNormal, payload.normal) <= 0.01 &&
+                        glm::dot(payload.normal, rayDirection) <= 0.0)
+                    {
+                        visibility[e] = 1;
+                    }
+                }
+            }
 
-    {
-        VkImageSubresource subResource{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(engine._engineData.device, gbufferNormalImageCpu._image,
-&subResource, &subResourceLayout);
+            if (missRayCount > 0)
+            {
+                raytracer.trace_packet(probeRays.data(), missRayCount,
+                                       probePayloads.data());
+                for (int i = 0; i < missRayCount; i++)
+                {
+                    if (probePayloads[i].objectId == -1)
+                    {
+                        visibility[missProbes[i]] = 1;
+                    }
+                }
+            }
 
-        const char* data;
-        vmaMapMemory(engine._engineData.allocator, gbufferNormalImageCpu._allocation,
-(void**)&data); data += subResourceLayout.offset;
+            float totalWeight = 0;
+            for (int e = 0; e < weightCount; e++)
+            {
+                totalWeight += visibility[e] * receiverWeights[e].weight;
+            }
 
-        memcpy(normal, data, imageSize.width * imageSize.height * 4 * sizeof(float));
+            // precalculate_construct_receiver_matrix.comp
+            if (totalWeight > 0.00001)
+            {
+                validRays++;
+                for (int e = 0; e < weightCount; e++)
+                {
+                    float weight = visibility[e] * receiverWeights[e].weight / totalWeight;
+                    if (weight > 0.00001)
+                    {
+                        float* coefficients =
+                            row + receiverWeights[e].clusterProbe * shNumCoeff;
+                        calcY(basis, glm::normalize(probeDirections[e]),
+                              sphericalHarmonicsOrder);
+                        for (int k = 0; k < shNumCoeff; k++)
+                        {
+                            coefficients[k] += weight * basis[k];
+                        }
+                    }
+                }
+            }
+        }
 
-        vmaUnmapMemory(engine._engineData.allocator, gbufferNormalImageCpu._allocation);
-    }
-    printf("----------\n");
-    for (int i = 0; i < lightmapResolution; i++) {
-        for (int j = 0; j < lightmapResolution; j++) {
-            int receiverId = j + i * lightmapResolution;
-            if (posObjectId[(receiverId) * 4 + 3] >= 0) {
-                _receivers[receiverId].exists = true;
-                _receivers[receiverId].uv = glm::ivec2(j, i);
-                _receivers[receiverId].position = { posObjectId[(receiverId) * 4 + 0],
-posObjectId[(receiverId) * 4 + 1], posObjectId[(receiverId) * 4 + 2] };
-                _receivers[receiverId].normal = { normal[(receiverId) * 4 + 0],
-normal[(receiverId) * 4 + 1], normal[(receiverId) * 4 + 2] }; _receivers[receiverId].objectId =
-posObjectId[(receiverId) * 4 + 3]; _receivers[receiverId].dPos = normal[(receiverId) * 4 + 3];
+        if (validRays > 0)
+        {
+            for (int e = 0; e < weightCount; e++)
+            {
+                float* coefficients = row + receiverWeights[e].clusterProbe * shNumCoeff;
+                for (int k = 0; k < shNumCoeff; k++)
+                {
+                    coefficients[k] *= windowing[k];
+                }
             }
         }
-    }
 
-    char* image = new char[lightmapResolution * lightmapResolution];
-    memset(image, 0, lightmapResolution* lightmapResolution);
-    for (int i = 0; i < lightmapResolution; i++) {
-        for (int j = 0; j < lightmapResolution; j++) {
-            if(posObjectId[(j + i * lightmapResolution) * 4 + 3] >= 0)
-            image[j + i * lightmapResolution] = 255;
+        int blockStart = r / TRANSFER_ROW_BLOCK * TRANSFER_ROW_BLOCK;
+        if (r + 1 == blockStart + TRANSFER_ROW_BLOCK || r + 1 == cluster.receivers.size())
+        {
+            buffer.evict(blockStart * rowSize, (r + 1 - blockStart) * rowSize);
         }
     }
 
-    FILE* ptr;
-    fopen_s(&ptr, "../precomputation/receiver_image.bin", "wb");
-    fwrite(image, lightmapResolution* lightmapResolution, 1, ptr);
-    fclose(ptr);
-    printf("Created receivers: %d!\n", receiverCounter);
-
-    return _receivers;
+    return clusterMatrix;
 }
-*/
-
-// Maybe instead of doing this, do that:
-// Do this in runtime (cast rays from each probe)
-// Then trace another ray from the hit location to light (to realize shadowing)
-// This might help me enabling reflections as well (perhaps)?
-void Precalculation::probe_raycast(VulkanEngine& engine, std::vector<glm::vec4>& probes,
-                                   int rays, int sphericalHarmonicsOrder,
-                                   GPUProbeRaycastResult* probeRaycastResult,
-                                   float* probeRaycastBasisFunctions)
-{
-    RaytracingPipeline rtPipeline = {};
-    VkDescriptorSetLayout rtDescriptorSetLayout;
-    VkDescriptorSet rtDescriptorSet;
-
-    // We need a buffer where we store raytracing results
-    // material_id, u, v
-
-    // Descriptors: Acceleration structure, storage buffer to save results, Materials
-    VkDescriptorSetLayoutBinding tlasBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0);
-    VkDescriptorSetLayoutBinding sceneDescBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 1);
-    VkDescriptorSetLayoutBinding meshInfoBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 2);
-    VkDescriptorSetLayoutBinding probeLocationsBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 3);
-    VkDescriptorSetLayoutBinding outBuffer = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 4);
-    VkDescriptorSetLayoutBinding bindings[5] = {tlasBind, sceneDescBind, meshInfoBind,
-                                                probeLocationsBind, outBuffer};
-    VkDescriptorSetLayoutCreateInfo setinfo =
-        vkinit::descriptorset_layout_create_info(bindings, 5);
-    vkCreateDescriptorSetLayout(engine._engineData.device, &setinfo, nullptr,
-                                &rtDescriptorSetLayout);
-
-    VkDescriptorSetAllocateInfo allocateInfo = vkinit::descriptorset_allocate_info(
-        engine._engineData.descriptorPool, &rtDescriptorSetLayout, 1);
-
-    vkAllocateDescriptorSets(engine._engineData.device, &allocateInfo, &rtDescriptorSet);
-
-    std::vector<VkWriteDescriptorSet> writes;
-
-    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
-        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
-    descASInfo.accelerationStructureCount = 1;
-    descASInfo.pAccelerationStructures = &engine._vulkanRaytracing.tlas.accel;
-    VkWriteDescriptorSet accelerationStructureWrite{};
-    accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    // The specialized acceleration structure descriptor has to be chained
-    accelerationStructureWrite.pNext = &descASInfo;
-    accelerationStructureWrite.dstSet = rtDescriptorSet;
-    accelerationStructureWrite.dstBinding = 0;
-    accelerationStructureWrite.descriptorCount = 1;
-    accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-    writes.emplace_back(accelerationStructureWrite);
-
-    AllocatedBuffer sceneDescBuffer = vkutils::create_buffer(
-        engine._engineData.allocator, sizeof(GPUSceneDesc), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, rtDescriptorSet,
-                                        &sceneDescBuffer._descriptorBufferInfo, 1));
-
-    AllocatedBuffer meshInfoBuffer = vkutils::create_buffer(
-        engine._engineData.allocator,
-        sizeof(GPUMeshInfo) * engine.gltf_scene.prim_meshes.size(),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &meshInfoBuffer._descriptorBufferInfo, 2));
-
-    AllocatedBuffer probeLocationsBuffer = vkutils::create_buffer(
-        engine._engineData.allocator, sizeof(glm::vec4) * probes.size(),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &probeLocationsBuffer._descriptorBufferInfo, 3));
-
-    AllocatedBuffer outputBuffer = vkutils::create_buffer(
-        engine._engineData.allocator, rays * probes.size() * sizeof(GPUProbeRaycastResult),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &outputBuffer._descriptorBufferInfo, 4));
-
-    vkUpdateDescriptorSets(engine._engineData.device, static_cast<uint32_t>(writes.size()),
-                           writes.data(), 0, nullptr);
-
-    VkPipelineLayout pipelineLayout;
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
-        vkinit::pipeline_layout_create_info(&rtDescriptorSetLayout, 1);
-    vkCreatePipelineLayout(engine._engineData.device, &pipelineLayoutCreateInfo, nullptr,
-                           &pipelineLayout);
-
-    Slice<uint32_t> probeRtRgen{};
-    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rgen", {},
-                                    probeRtRgen);
-
-    Slice<uint32_t> probeRtRmiss{};
-    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rmiss",
-                                    {}, probeRtRmiss);
-
-    Slice<uint32_t> probeRtRchit{};
-    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rchit",
-                                    {}, probeRtRchit);
-
-    engine._vulkanRaytracing.create_new_pipeline(rtPipeline, pipelineLayout, probeRtRgen,
-                                                 probeRtRmiss, probeRtRchit);
-
-    {
-        GPUSceneDesc desc = {};
-        VkBufferDeviceAddressInfo info = {};
-        info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-
-        info.buffer = engine._sceneData.vertexBuffer._buffer;
-        desc.vertexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.normalBuffer._buffer;
-        desc.normalAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.texBuffer._buffer;
-        desc.uvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.indexBuffer._buffer;
-        desc.indexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.lightmapTexBuffer._buffer;
-        desc.lightmapUvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
 
-        vkutils::cpu_to_gpu(engine._engineData.allocator, sceneDescBuffer, &desc,
-                            sizeof(GPUSceneDesc));
-    }
+// Receiver weights start at the number of receivers before the cluster, the ray tracing
+// windows the SH coefficients and traces the most expensive clusters first so that none of
+// them is left running alone at the end
+struct TransferSchedule
+{
+    std::vector<float> windowing;
+    std::vector<int> receiverOffsets;
+    std::vector<int> clusterOrder;
 
+    TransferSchedule(const std::vector<AABB>& aabbClusters, int rays, int shNumCoeff)
     {
-        vkutils::cpu_to_gpu(engine._engineData.allocator, probeLocationsBuffer, probes.data(),
-                            sizeof(glm::vec4) * probes.size());
-    }
+        windowing.resize(shNumCoeff);
+        for (int k = 0; k < shNumCoeff; k++)
+        {
+            windowing[k] =
+                window(std::floor(std::sqrt(float(k))), WINDOWING) * (float)M_PI / rays;
+        }
 
-    {
-        void* data;
-        vmaMapMemory(engine._engineData.allocator, meshInfoBuffer._allocation, &data);
-        GPUMeshInfo* dataMesh = (GPUMeshInfo*)data;
-        for (int i = 0; i < engine.gltf_scene.prim_meshes.size(); i++)
+        int clusterCount = aabbClusters.size();
+        receiverOffsets.assign(clusterCount + 1, 0);
+        for (int i = 0; i < clusterCount; i++)
         {
-            dataMesh[i].indexOffset = engine.gltf_scene.prim_meshes[i].first_idx;
-            dataMesh[i].vertexOffset = engine.gltf_scene.prim_meshes[i].vtx_offset;
-            dataMesh[i].materialIndex = engine.gltf_scene.prim_meshes[i].material_idx;
+            receiverOffsets[i + 1] = receiverOffsets[i] + aabbClusters[i].receivers.size();
         }
-        vmaUnmapMemory(engine._engineData.allocator, meshInfoBuffer._allocation);
-    }
 
-    {
-        VkCommandBuffer cmdBuf = vkutils::create_command_buffer(
-            engine._engineData.device, engine._vulkanRaytracing._raytracingContext.commandPool,
-            true);
-        std::vector<VkDescriptorSet> descSets{rtDescriptorSet};
-        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipeline.pipeline);
-        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout,
-                                0, (uint32_t)descSets.size(), descSets.data(), 0, nullptr);
-        vkCmdTraceRaysKHR(cmdBuf, &rtPipeline.rgenRegion, &rtPipeline.missRegion,
-                          &rtPipeline.hitRegion, &rtPipeline.callRegion, rays, probes.size(),
-                          1);
-        vkutils::submit_and_free_command_buffer(
-            engine._engineData.device, engine._vulkanRaytracing._raytracingContext.commandPool,
-            cmdBuf, engine._vulkanRaytracing._queue,
-            engine._vulkanRaytracing._raytracingContext.fence);
+        clusterOrder.resize(clusterCount);
+        std::iota(clusterOrder.begin(), clusterOrder.end(), 0);
+        std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](int a, int b) {
+            return (size_t)aabbClusters[a].receivers.size() * aabbClusters[a].probes.size() >
+                   (size_t)aabbClusters[b].receivers.size() * aabbClusters[b].probes.size();
+        });
     }
+};
+
+void Precalculation::receiver_transfer_cpu(
+    CpuRaytracer& raytracer, const ReceiverStore& receivers,
+    const std::vector<AABB>& aabbClusters, std::vector<glm::vec4>& probes, int rays,
+    int sphericalHarmonicsOrder, int maxReceivers, const std::vector<int>& weightOffsets,
+    const std::vector<GPUReceiverProbeWeight>& weights,
+    BakeContainerWriter& transferCheckpoint)
+{
+    printf("About to start receiver raycasting on the CPU...\n");
+    BakeProfileZone zone(bake_stage_name(BAKE_STAGE_RECEIVER_TRANSFER));
 
-    void* mappedOutputData;
-    vmaMapMemory(engine._engineData.allocator, outputBuffer._allocation, &mappedOutputData);
-    // printf("Ray cast result: %d\n", ((ProbeRaycastResult*)data)[i].objectId);
-    memcpy(probeRaycastResult, mappedOutputData,
-           rays * probes.size() * sizeof(GPUProbeRaycastResult));
-    vmaUnmapMemory(engine._engineData.allocator, outputBuffer._allocation);
-
-    int shCoeff = SPHERICAL_HARMONICS_NUM_COEFF(sphericalHarmonicsOrder);
+    int shNumCoeff = SPHERICAL_HARMONICS_NUM_COEFF(sphericalHarmonicsOrder);
+    int maxReceiverInABatch = MIN(64, maxReceivers);
+    int clusterCount = aabbClusters.size();
+    TransferSchedule schedule(aabbClusters, rays, shNumCoeff);
+    int doneCount = 0;
 
-    for (int i = 0; i < rays; i++)
+#pragma omp parallel
     {
-        calcY(&probeRaycastBasisFunctions[i * shCoeff],
-              normalize(glm::vec3(probeRaycastResult[i].direction)), sphericalHarmonicsOrder);
+        ScratchBuffer transferBuffer(PRECALCULATION_SCRATCH_DIRECTORY,
+                                     TRANSFER_SCRATCH_THRESHOLD);
+        TransferArena arena;
 
-        for (int l = 0; l < shCoeff; l++)
+#pragma omp for schedule(dynamic, 1)
+        for (int orderIndex = 0; orderIndex < clusterCount; orderIndex++)
         {
-            probeRaycastBasisFunctions[i * shCoeff + l] *= 4 * M_PI / rays;
+            int nodeIndex = schedule.clusterOrder[orderIndex];
+            const AABB& cluster = aabbClusters[nodeIndex];
+            auto start = std::chrono::system_clock::now();
+
+            const float* matrix = trace_receiver_transfer(
+                raytracer, receivers, cluster, probes, rays, sphericalHarmonicsOrder,
+                maxReceiverInABatch, schedule.windowing.data(),
+                weightOffsets.data() + schedule.receiverOffsets[nodeIndex], weights.data(),
+                arena, transferBuffer);
+            size_t matrixCount = cluster.receivers.size() * cluster.probes.size() * shNumCoeff;
+
+            int done;
+#pragma omp critical(transfer_checkpoint)
+            {
+                transferCheckpoint.add_section(
+                    (BakeSectionId)(BAKE_SECTION_TRANSFER_MATRICES + nodeIndex),
+                    matrix, matrixCount * sizeof(float));
+                done = ++doneCount;
+            }
+
+            auto end = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_seconds = end - start;
+            printf("Node tracing done %d/%d (node %d with %d probes and %d receivers took %f "
+                   "s)\n",
+                   done, clusterCount, nodeIndex, (int)cluster.probes.size(),
+                   (int)cluster.receivers.size(), elapsed_seconds.count());
         }
     }
-
-    engine._vulkanRaytracing.destroy_raytracing_pipeline(rtPipeline);
-
-    vmaDestroyBuffer(engine._engineData.allocator, sceneDescBuffer._buffer,
-                     sceneDescBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, meshInfoBuffer._buffer,
-                     meshInfoBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, probeLocationsBuffer._buffer,
-                     probeLocationsBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, outputBuffer._buffer,
-                     outputBuffer._allocation);
-    vkDestroyDescriptorSetLayout(engine._engineData.device, rtDescriptorSetLayout, nullptr);
 }
 
-void Precalculation::receiver_raycast(
-    VulkanEngine& engine, std::vector<AABB>& aabbClusters, std::vector<glm::vec4>& probes,
-    int rays, float radius, int sphericalHarmonicsOrder, int clusterCoefficientCount,
-    int maxReceivers, int totalReceiverCount, int maxProbesPerCluster,
+void Precalculation::receiver_raycast_cpu(
+    CpuRaytracer& raytracer, const ReceiverStore& receivers, std::vector<AABB>& aabbClusters,
+    std::vector<glm::vec4>& probes, int rays, int sphericalHarmonicsOrder,
+    int clusterCoefficientCount, int maxReceivers, const BakeContainer* transferCheckpoint,
     float** clusterProjectionMatrices, float** receiverCoefficientMatrices,
-    float* receiverProbeWeightData, int* projectionMatricesSize,
-    int* reconstructionMatricesSize)
+    const std::vector<int>& weightOffsets, const std::vector<GPUReceiverProbeWeight>& weights,
+    int* projectionMatricesSize, int* reconstructionMatricesSize)
 {
-    printf("About to start receiver raycasting...\n");
+    printf(transferCheckpoint ? "About to compress the receiver transfer on the CPU...\n"
+                              : "About to start receiver raycasting on the CPU...\n");
 
     int shNumCoeff = SPHERICAL_HARMONICS_NUM_COEFF(sphericalHarmonicsOrder);
+    // Only used to seed the random numbers the same way as the batched GPU dispatch
     int maxReceiverInABatch = MIN(64, maxReceivers);
 
-    RaytracingPipeline rtPipeline = {};
-    VkDescriptorSetLayout rtDescriptorSetLayout;
-    VkDescriptorSet rtDescriptorSet;
-
-    // Descriptors: Acceleration structure, storage buffer to save results, Materials
-    VkDescriptorSetLayoutBinding tlasBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0);
-    VkDescriptorSetLayoutBinding sceneDescBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 1);
-    VkDescriptorSetLayoutBinding meshInfoBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 2);
-    VkDescriptorSetLayoutBinding probeLocationsBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 3);
-    VkDescriptorSetLayoutBinding receiverLocationsBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 4);
-    VkDescriptorSetLayoutBinding outBuffer = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 5);
-    VkDescriptorSetLayoutBinding weightBuffer = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 6);
-    VkDescriptorSetLayoutBinding clusterProbesBind = vkinit::descriptorset_layout_binding(
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 7);
-    VkDescriptorSetLayoutBinding bindings[8] = {
-        tlasBind,  sceneDescBind, meshInfoBind,     probeLocationsBind, receiverLocationsBind,
-        outBuffer, weightBuffer,  clusterProbesBind};
-    VkDescriptorSetLayoutCreateInfo setinfo =
-        vkinit::descriptorset_layout_create_info(bindings, 8);
-    vkCreateDescriptorSetLayout(engine._engineData.device, &setinfo, nullptr,
-                                &rtDescriptorSetLayout);
-
-    VkDescriptorSetAllocateInfo allocateInfo = vkinit::descriptorset_allocate_info(
-        engine._engineData.descriptorPool, &rtDescriptorSetLayout, 1);
-
-    vkAllocateDescriptorSets(engine._engineData.device, &allocateInfo, &rtDescriptorSet);
-
-    std::vector<VkWriteDescriptorSet> writes;
-
-    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
-        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
-    descASInfo.accelerationStructureCount = 1;
-    descASInfo.pAccelerationStructures = &engine._vulkanRaytracing.tlas.accel;
-    VkWriteDescriptorSet accelerationStructureWrite{};
-    accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    // The specialized acceleration structure descriptor has to be chained
-    accelerationStructureWrite.pNext = &descASInfo;
-    accelerationStructureWrite.dstSet = rtDescriptorSet;
-    accelerationStructureWrite.dstBinding = 0;
-    accelerationStructureWrite.descriptorCount = 1;
-    accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-    writes.emplace_back(accelerationStructureWrite);
-
-    AllocatedBuffer sceneDescBuffer = vkutils::create_buffer(
-        engine._engineData.allocator, sizeof(GPUSceneDesc), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, rtDescriptorSet,
-                                        &sceneDescBuffer._descriptorBufferInfo, 1));
-
-    AllocatedBuffer meshInfoBuffer = vkutils::create_buffer(
-        engine._engineData.allocator,
-        sizeof(GPUMeshInfo) * engine.gltf_scene.prim_meshes.size(),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &meshInfoBuffer._descriptorBufferInfo, 2));
-
-    AllocatedBuffer probeLocationsBuffer = vkutils::create_buffer(
-        engine._engineData.allocator, sizeof(glm::vec4) * probes.size(),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &probeLocationsBuffer._descriptorBufferInfo, 3));
-
-    AllocatedBuffer receiverLocationsBuffer = vkutils::create_buffer(
-        engine._engineData.allocator,
-        sizeof(GPUReceiverData) * maxReceivers * (TEXEL_SAMPLES * TEXEL_SAMPLES),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &receiverLocationsBuffer._descriptorBufferInfo, 4));
-
-    AllocatedBuffer outputBuffer = vkutils::create_buffer(
-        engine._engineData.allocator,
-        maxReceiverInABatch * rays * maxProbesPerCluster * sizeof(GPUReceiverRaycastResult),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &outputBuffer._descriptorBufferInfo, 5));
-
-    AllocatedBuffer receiverProbeWeights = vkutils::create_upload_buffer(
-        &engine._engineData, receiverProbeWeightData,
-        sizeof(float) * (maxProbesPerCluster * totalReceiverCount),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &receiverProbeWeights._descriptorBufferInfo, 6));
-
-    AllocatedBuffer clusterProbesBuffer = vkutils::create_buffer(
-        engine._engineData.allocator, sizeof(int) * maxProbesPerCluster,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    writes.emplace_back(
-        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
-                                        &clusterProbesBuffer._descriptorBufferInfo, 7));
-
-    PrecalculateReceiverMatrixConfig matrixConfig = {};
-    matrixConfig.basisFunctionCount = shNumCoeff;
-    matrixConfig.rayCount = rays;
-    matrixConfig.totalProbeCount = probes.size();
-    matrixConfig.maxProbesPerCluster = maxProbesPerCluster;
-
-    AllocatedBuffer receiverMatrixConfig = vkutils::create_upload_buffer(
-        &engine._engineData, &matrixConfig, sizeof(PrecalculateReceiverMatrixConfig),
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    AllocatedBuffer matrixBuffer = vkutils::create_buffer(
-        engine._engineData.allocator,
-        maxReceiverInABatch * maxProbesPerCluster * shNumCoeff * sizeof(float),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY);
-    AllocatedBuffer matrixBufferCPU = vkutils::create_buffer(
-        engine._engineData.allocator,
-        maxReceiverInABatch * maxProbesPerCluster * shNumCoeff * sizeof(float),
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VMA_MEMORY_USAGE_CPU_ONLY);
-
-    vkUpdateDescriptorSets(engine._engineData.device, static_cast<uint32_t>(writes.size()),
-                           writes.data(), 0, nullptr);
-
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
-        vkinit::pipeline_layout_create_info(&rtDescriptorSetLayout, 1);
-
-    VkPushConstantRange pushConstantRanges = {VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0,
-                                              sizeof(int) * 3};
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRanges;
-
-    VkPipelineLayout pipelineLayout;
-    vkCreatePipelineLayout(engine._engineData.device, &pipelineLayoutCreateInfo, nullptr,
-                           &pipelineLayout);
-
-    Slice<uint32_t> receiverRtRgen{};
-    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_receiver_rt.rgen",
-                                    {}, receiverRtRgen);
-
-    Slice<uint32_t> receiverRtRmiss{};
-    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rmiss",
-                                    {}, receiverRtRmiss);
-
-    Slice<uint32_t> receiverRtRchit{};
-    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rchit",
-                                    {}, receiverRtRchit);
-
-    engine._vulkanRaytracing.create_new_pipeline(rtPipeline, pipelineLayout, receiverRtRgen,
-                                                 receiverRtRmiss, receiverRtRchit);
-
-    ComputeInstance matrixCompute = {};
-    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::UNIFORM,
-                                             receiverMatrixConfig);
-    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
-                                             outputBuffer);
-    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
-                                             receiverProbeWeights);
-    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
-                                             clusterProbesBuffer);
-    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
-                                             matrixBuffer);
-
-    Slice<uint32_t> spirvConstructReceiverMatrix{};
-    engine._shaderManager.get_spirv(
-        "../shaders/precomputation/precalculate_construct_receiver_matrix.comp", {},
-        spirvConstructReceiverMatrix);
-
-    engine._vulkanCompute.build(matrixCompute, engine._engineData.descriptorPool,
-                                spirvConstructReceiverMatrix);
-
-    {
-        GPUSceneDesc desc = {};
-        VkBufferDeviceAddressInfo info = {};
-        info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-
-        info.buffer = engine._sceneData.vertexBuffer._buffer;
-        desc.vertexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.normalBuffer._buffer;
-        desc.normalAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.texBuffer._buffer;
-        desc.uvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.indexBuffer._buffer;
-        desc.indexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
-
-        info.buffer = engine._sceneData.lightmapTexBuffer._buffer;
-        desc.lightmapUvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+    // Every cluster is traced and compressed by a single thread
+    int clusterCount = aabbClusters.size();
+    TransferSchedule schedule(aabbClusters, rays, shNumCoeff);
 
-        vkutils::cpu_to_gpu(engine._engineData.allocator, sceneDescBuffer, &desc,
-                            sizeof(GPUSceneDesc));
-    }
+    std::vector<CompressedCluster> compressed(clusterCount);
+    int doneCount = 0;
 
+#pragma omp parallel
     {
-        vkutils::cpu_to_gpu(engine._engineData.allocator, probeLocationsBuffer, probes.data(),
-                            sizeof(glm::vec4) * probes.size());
-    }
+        ScratchBuffer transferBuffer(PRECALCULATION_SCRATCH_DIRECTORY,
+                                     TRANSFER_SCRATCH_THRESHOLD);
+        TransferArena transferArena;
+        PcaArena arena;
 
-    {
-        void* data;
-        vmaMapMemory(engine._engineData.allocator, meshInfoBuffer._allocation, &data);
-        GPUMeshInfo* dataMesh = (GPUMeshInfo*)data;
-        for (int i = 0; i < engine.gltf_scene.prim_meshes.size(); i++)
+#pragma omp for schedule(dynamic, 1)
+        for (int orderIndex = 0; orderIndex < clusterCount; orderIndex++)
         {
-            dataMesh[i].indexOffset = engine.gltf_scene.prim_meshes[i].first_idx;
-            dataMesh[i].vertexOffset = engine.gltf_scene.prim_meshes[i].vtx_offset;
-            dataMesh[i].materialIndex = engine.gltf_scene.prim_meshes[i].material_idx;
-        }
-        vmaUnmapMemory(engine._engineData.allocator, meshInfoBuffer._allocation);
-    }
-
-    int nodeReceiverDataOffset = 0;
-    int nodeClusterDataOffset = 0;
-    int receiverOffset = 0;
-    int probeOffset = 0;
-
-    float totalError = 0;
-    int validClusters = 0;
-    float averageSquaredError = 0;
-
-    std::vector<AABB> newClusters;
-    int newClusterCount = 0;
-    float maxError = 0;
-
-    for (int nodeIndex = 0; nodeIndex < aabbClusters.size(); nodeIndex++)
-    {
-        printf("Starting node: %d with max probes: %d and receivers: %d\n", nodeIndex,
-               aabbClusters[nodeIndex].probes.size(),
-               aabbClusters[nodeIndex].receivers.size());
-        auto start = std::chrono::system_clock::now();
-
-        auto clusterMatrix = Eigen::Matrix<float, -1, -1, Eigen::RowMajor>(
-            aabbClusters[nodeIndex].receivers.size(),
-            shNumCoeff * aabbClusters[nodeIndex].probes.size());
-        clusterMatrix.fill(0);
-
-        {
-            void* data;
-            vmaMapMemory(engine._engineData.allocator, receiverLocationsBuffer._allocation,
-                         &data);
-            GPUReceiverData* dataReceiver = (GPUReceiverData*)data;
-            for (int i = 0; i < aabbClusters[nodeIndex].receivers.size(); i++)
+            int nodeIndex = schedule.clusterOrder[orderIndex];
+            const AABB& cluster = aabbClusters[nodeIndex];
+            int probeCount = cluster.probes.size();
+            auto start = std::chrono::system_clock::now();
+
+            // Transfer matrices of the receiver transfer checkpoint are only traced again if
+            // they do not fit the cluster
+            BakeSectionId matrixSection =
+                (BakeSectionId)(BAKE_SECTION_TRANSFER_MATRICES + nodeIndex);
+            size_t matrixSize = 0;
+            const float* matrix =
+                transferCheckpoint
+                    ? (const float*)transferCheckpoint->section(matrixSection, &matrixSize)
+                    : nullptr;
+            size_t matrixCount = cluster.receivers.size() * probeCount * shNumCoeff;
+            if (!matrix || matrixSize != matrixCount * sizeof(float))
             {
-                for (int j = 0; j < aabbClusters[nodeIndex].receivers[i].poses.size(); j++)
-                {
-                    dataReceiver[i * (TEXEL_SAMPLES * TEXEL_SAMPLES) + j].pos =
-                        aabbClusters[nodeIndex].receivers[i].poses[j];
-                    dataReceiver[i * (TEXEL_SAMPLES * TEXEL_SAMPLES) + j].normal =
-                        aabbClusters[nodeIndex].receivers[i].norms[j];
-                    dataReceiver[i * (TEXEL_SAMPLES * TEXEL_SAMPLES) + j].objectId =
-                        aabbClusters[nodeIndex].receivers[i].objectId;
-                    dataReceiver[i * (TEXEL_SAMPLES * TEXEL_SAMPLES) + j].dPos =
-                        aabbClusters[nodeIndex].receivers[i].poses.size();
-                }
+                matrix = trace_receiver_transfer(
+                    raytracer, receivers, cluster, probes, rays, sphericalHarmonicsOrder,
+                    maxReceiverInABatch, schedule.windowing.data(),
+                    weightOffsets.data() + schedule.receiverOffsets[nodeIndex],
+                    weights.data(), transferArena, transferBuffer);
             }
 
-            vmaUnmapMemory(engine._engineData.allocator, receiverLocationsBuffer._allocation);
+            compress_cluster(cluster, matrix, shNumCoeff, clusterCoefficientCount, arena,
+                             compressed[nodeIndex]);
+            transferBuffer.evict(0, matrixCount);
+            if (transferCheckpoint)
+            {
+                transferCheckpoint->release(matrixSection);
+            }
+            int done;
+#pragma omp atomic capture
+            done = ++doneCount;
+
+            auto end = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed_seconds = end - start;
+            printf("Node tracing done %d/%d (node %d with %d probes and %d receivers took %f "
+                   "s)\n\n",
+                   done, clusterCount, nodeIndex, probeCount, (int)cluster.receivers.size(),
+                   elapsed_seconds.count());
         }
+    }
 
-        vkutils::cpu_to_gpu(engine._engineData.allocator, clusterProbesBuffer,
-                            aabbClusters[nodeIndex].probes.data(),
-                            sizeof(int) * aabbClusters[nodeIndex].probes.size());
-
-        for (int i = 0; i < aabbClusters[nodeIndex].receivers.size(); i += maxReceiverInABatch)
-        {
-            int remaningSize =
-                MIN(aabbClusters[nodeIndex].receivers.size() - i, maxReceiverInABatch);
-
-            // printf("Batch size: %d\n I is %d\n", remaningSize, i);
-
-            {
-                matrixConfig.receiverOffset = receiverOffset;
-                matrixConfig.batchOffset = i;
-                matrixConfig.batchSize = remaningSize;
-                matrixConfig.clusterProbeCount = aabbClusters[nodeIndex].probes.size();
-                vkutils::cpu_to_gpu(engine._engineData.allocator, receiverMatrixConfig,
-                                    &matrixConfig, sizeof(PrecalculateReceiverMatrixConfig));
-                int probeCount = aabbClusters[nodeIndex].probes.size();
-                VkCommandBuffer cmdBuf = vkutils::create_command_buffer(
-                    engine._engineData.device,
-                    engine._vulkanRaytracing._raytracingContext.commandPool, true);
-                std::vector<VkDescriptorSet> descSets{rtDescriptorSet};
-                vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                                  rtPipeline.pipeline);
-                vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                                        pipelineLayout, 0, (uint32_t)descSets.size(),
-                                        descSets.data(), 0, nullptr);
-
-                int pushConstantVariables[3] = {
-                    static_cast<int>(aabbClusters[nodeIndex].probes.size()), i,
-                    receiverOffset};
-
-                vkCmdPushConstants(cmdBuf, pipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0,
-                                   sizeof(int) * 3, pushConstantVariables);
-                vkCmdTraceRaysKHR(cmdBuf, &rtPipeline.rgenRegion, &rtPipeline.missRegion,
-                                  &rtPipeline.hitRegion, &rtPipeline.callRegion,
-                                  maxReceiverInABatch, rays, 1);
-                {
-                    VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-                    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-                    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    std::vector<AABB> newClusters;
+    float maxError;
+    gather_compressed_clusters(compressed, newClusters, clusterProjectionMatrices,
+                               receiverCoefficientMatrices, projectionMatricesSize,
+                               reconstructionMatricesSize, &maxError);
+    aabbClusters = newClusters;
 
-                    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-                                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
-                                         &memoryBarrier, 0, nullptr, 0, nullptr);
-                }
-                // compute shader
-                {
-                    int groupcount = ((probeCount * remaningSize) / 256) + 1;
-                    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE,
-                                      matrixCompute.pipeline);
-                    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE,
-                                            matrixCompute.pipelineLayout, 0, 1,
-                                            &matrixCompute.descriptorSet, 0, nullptr);
-                    vkCmdDispatch(cmdBuf, groupcount, 1, 1);
-                }
+    printf("New cluster count: %d\n", (int)newClusters.size());
+    printf("Max singular value error: %f\n", maxError);
+}
 
-                {
-                    VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-                    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-                    memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+void Precalculation::compress_cluster(const AABB& cluster, const float* clusterMatrixData,
+                                      int basisFunctionCount, int clusterCoefficientCount,
+                                      PcaArena& arena, CompressedCluster& outCompressed)
+{
+    BakeProfileZone zone("compress_cluster");
+    zone.add_items(cluster.receivers.size());
+    int columns = basisFunctionCount * cluster.probes.size();
+    auto clusterMatrix = Eigen::Map<const Eigen::Matrix<float, -1, -1, Eigen::RowMajor>>(
+        clusterMatrixData, cluster.receivers.size(), columns);
 
-                    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier,
-                                         0, nullptr, 0, nullptr);
-                }
+    {
+        // std::ofstream file("eigenmatrix" + std::to_string(nodeIndex) + ".csv");
+        // const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
+        // Eigen::DontAlignCols, ", ", "\n"); file << clusterMatrix.format(CSVFormat);
+    }
 
-                VkBufferCopy cpy;
-                cpy.size = maxReceiverInABatch * aabbClusters[nodeIndex].probes.size() *
-                           shNumCoeff * sizeof(float);
-                cpy.srcOffset = 0;
-                cpy.dstOffset = 0;
+    // Eigen::JacobiSVD<Eigen::MatrixXf, Eigen::FullPivHouseholderQRPreconditioner>
+    // svd(clusterMatrix, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    //
+    int nc = clusterCoefficientCount;
+    //
+    //{
+    //	float total = 0.f;
+    //	float realTotal = 0.f;
+    //	for (int aa = 0; aa < nc; aa++) {
+    //		if (aa < svd.singularValues().size()) {
+    //			total += svd.singularValues()[aa];
+    //		}
+    //	}
+    //	for (int aa = 0; aa < svd.singularValues().size(); aa++) {
+    //		realTotal += svd.singularValues()[aa];
+    //	}
+    //
+    //	float error = 1.0f - sqrt(total / realTotal);
+    //
+    //	if (!isnan(error)) {
+    //		totalError += cluster.receivers.size() * error;
+    //
+    //		if (error > 0.0000001) {
+    //			validClusters += 1;
+    //		}
+    //	}
+    //
+    //	printf("Singular Value error: %f (total singular value count: %d)\n", error,
+    // svd.singularValues().size());
+    //}
+    //
+    // auto receiverReconstructionCoefficientMatrix = Eigen::Matrix<float, -1, -1,
+    // Eigen::RowMajor>(svd.matrixU().rows(), nc);
+    // receiverReconstructionCoefficientMatrix.fill(0);
+    // receiverReconstructionCoefficientMatrix.block(0, 0, svd.matrixU().rows(), MIN(nc,
+    // svd.matrixU().cols())) = svd.matrixU().block(0, 0, svd.matrixU().rows(), MIN(nc,
+    // svd.matrixU().cols()));
+    //
+    // Eigen::MatrixXf singularMatrix(nc, svd.matrixV().cols());
+    // int singularValueSize = svd.singularValues().size();
+    // singularMatrix.setZero();
+    // for (int aa = 0; aa < nc; aa++) {
+    //	if (aa < singularValueSize) {
+    //		singularMatrix(aa, aa) = svd.singularValues()[aa];
+    //	}
+    //	else if(aa < svd.matrixV().cols()) {
+    //		singularMatrix(aa, aa) = 0;
+    //	}
+    //}
+    // auto clusterProjectionMatrix = Eigen::Matrix<float, -1, -1,
+    // Eigen::RowMajor>(singularMatrix * svd.matrixV().transpose());
+    //
+    ////printf("Singular matrix size: %d x %d\n", singularMatrix.rows(),
+    /// singularMatrix.cols()); /printf("V matrix size: %d x %d\n", svd.matrixV().rows(),
+    /// svd.matrixV().cols());
+    //
+    // auto newMatrix = receiverReconstructionCoefficientMatrix * clusterProjectionMatrix;
+    //{
+    //	//std::ofstream file("eigenmatrix_pca" + std::to_string(nodeIndex) + ".csv");
+    //	//const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
+    // Eigen::DontAlignCols, ", ", "\n");
+    //	//file << newMatrix.format(CSVFormat);
+    //}
+    //
+    // auto diff = clusterMatrix - newMatrix;
+    // float squaredError = diff.squaredNorm();
+    // averageSquaredError += squaredError * cluster.receivers.size();
+    // printf("Squared Error: %f\n", squaredError);
+
+    // My take on iterative PCA
+
+    // Only the first currRow rows of the target matrix are ever read, so it is allocated once
+    // for the whole cluster
+    int rows = cluster.receivers.size();
+    arena.targetMatrix.resize((size_t)rows * columns);
+    arena.receiverErrors.resize(rows);
+    arena.used.assign(rows, 0);
+    auto targetMatrix = Eigen::Map<Eigen::Matrix<float, -1, -1, Eigen::RowMajor>>(
+        arena.targetMatrix.data(), rows, columns);
+    float* receiverErrors = arena.receiverErrors.data();
+    char* used = arena.used.data();
+    int usedCount = 0;
+
+    // The candidate rows are scored against the mean and the first rows of the sub cluster.
+    // Their dot products with the column sum and those rows are kept up to date instead of
+    // being recomputed for every added row.
+    arena.rowNorms.resize(rows);
+    arena.rowDotSum.resize(rows);
+    arena.targetDots.resize((size_t)rows * nc);
+    arena.columnSum.resize(columns);
+    auto columnSum = Eigen::Map<Eigen::VectorXd>(arena.columnSum.data(), columns);
+    double* rowDotSum = arena.rowDotSum.data();
+    double* targetDots = arena.targetDots.data();
+    std::vector<double> meanDots(nc);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < rows; i++)
+    {
+        arena.rowNorms[i] = clusterMatrix.row(i).cast<double>().squaredNorm();
+    }
 
-                vkCmdCopyBuffer(cmdBuf, matrixBuffer._buffer, matrixBufferCPU._buffer, 1,
-                                &cpy);
+    IncrementalSvd svd;
 
-                vkutils::submit_and_free_command_buffer(
-                    engine._engineData.device,
-                    engine._vulkanRaytracing._raytracingContext.commandPool, cmdBuf,
-                    engine._vulkanRaytracing._queue,
-                    engine._vulkanRaytracing._raytracingContext.fence);
-            }
+    outCompressed.clusters.clear();
+    outCompressed.projectionMatrices.clear();
+    outCompressed.reconstructionMatrices.clear();
+    outCompressed.maxError = 0;
 
-            void* mappedOutputData;
-            vmaMapMemory(engine._engineData.allocator, matrixBufferCPU._allocation,
-                         &mappedOutputData);
-            memcpy(clusterMatrix.data() +
-                       i * aabbClusters[nodeIndex].probes.size() * shNumCoeff,
-                   mappedOutputData,
-                   remaningSize * aabbClusters[nodeIndex].probes.size() * shNumCoeff *
-                       sizeof(float));
-            vmaUnmapMemory(engine._engineData.allocator, matrixBufferCPU._allocation);
-        }
+    while (true)
+    {
+        std::vector<int> rowIndices;
 
+        if (usedCount == rows)
         {
-            // std::ofstream file("eigenmatrix" + std::to_string(nodeIndex) + ".csv");
-            // const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
-            // Eigen::DontAlignCols, ", ", "\n"); file << clusterMatrix.format(CSVFormat);
+            break;
         }
 
-        // Eigen::JacobiSVD<Eigen::MatrixXf, Eigen::FullPivHouseholderQRPreconditioner>
-        // svd(clusterMatrix, Eigen::ComputeFullU | Eigen::ComputeFullV);
-        //
-        int nc = clusterCoefficientCount;
-        //
-        //{
-        //	float total = 0.f;
-        //	float realTotal = 0.f;
-        //	for (int aa = 0; aa < nc; aa++) {
-        //		if (aa < svd.singularValues().size()) {
-        //			total += svd.singularValues()[aa];
-        //		}
-        //	}
-        //	for (int aa = 0; aa < svd.singularValues().size(); aa++) {
-        //		realTotal += svd.singularValues()[aa];
-        //	}
-        //
-        //	float error = 1.0f - sqrt(total / realTotal);
-        //
-        //	if (!isnan(error)) {
-        //		totalError += aabbClusters[nodeIndex].receivers.size() * error;
-        //
-        //		if (error > 0.0000001) {
-        //			validClusters += 1;
-        //		}
-        //	}
-        //
-        //	printf("Singular Value error: %f (total singular value count: %d)\n", error,
-        // svd.singularValues().size());
-        //}
-        //
-        // auto receiverReconstructionCoefficientMatrix = Eigen::Matrix<float, -1, -1,
-        // Eigen::RowMajor>(svd.matrixU().rows(), nc);
-        // receiverReconstructionCoefficientMatrix.fill(0);
-        // receiverReconstructionCoefficientMatrix.block(0, 0, svd.matrixU().rows(), MIN(nc,
-        // svd.matrixU().cols())) = svd.matrixU().block(0, 0, svd.matrixU().rows(), MIN(nc,
-        // svd.matrixU().cols()));
-        //
-        // Eigen::MatrixXf singularMatrix(nc, svd.matrixV().cols());
-        // int singularValueSize = svd.singularValues().size();
-        // singularMatrix.setZero();
-        // for (int aa = 0; aa < nc; aa++) {
-        //	if (aa < singularValueSize) {
-        //		singularMatrix(aa, aa) = svd.singularValues()[aa];
-        //	}
-        //	else if(aa < svd.matrixV().cols()) {
-        //		singularMatrix(aa, aa) = 0;
-        //	}
-        //}
-        // auto clusterProjectionMatrix = Eigen::Matrix<float, -1, -1,
-        // Eigen::RowMajor>(singularMatrix * svd.matrixV().transpose());
-        //
-        ////printf("Singular matrix size: %d x %d\n", singularMatrix.rows(),
-        /// singularMatrix.cols()); /printf("V matrix size: %d x %d\n", svd.matrixV().rows(),
-        /// svd.matrixV().cols());
-        //
-        // auto newMatrix = receiverReconstructionCoefficientMatrix * clusterProjectionMatrix;
-        //{
-        //	//std::ofstream file("eigenmatrix_pca" + std::to_string(nodeIndex) + ".csv");
-        //	//const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
-        // Eigen::DontAlignCols, ", ", "\n");
-        //	//file << newMatrix.format(CSVFormat);
-        //}
-        //
-        // auto diff = clusterMatrix - newMatrix;
-        // float squaredError = diff.squaredNorm();
-        // averageSquaredError += squaredError * aabbClusters[nodeIndex].receivers.size();
-        // printf("Squared Error: %f\n", squaredError);
-
-        // My take on iterative PCA
-
-        float* receiverErrors = new float[aabbClusters[nodeIndex].receivers.size()];
-        std::unordered_set<int> used;
-        while (true)
+        for (int i = 0; i < rows; i++)
         {
-            auto targetMatrix = Eigen::Matrix<float, -1, -1, Eigen::RowMajor>(
-                aabbClusters[nodeIndex].receivers.size(),
-                shNumCoeff * aabbClusters[nodeIndex].probes.size());
-            std::vector<int> rowIndices;
-
-            if (used.size() == clusterMatrix.rows())
+            if (!used[i])
             {
+                targetMatrix.row(0) = clusterMatrix.row(i);
+                used[i] = 1;
+                usedCount++;
+                rowIndices.push_back(i);
                 break;
             }
+        }
 
-            for (int i = 0; i < clusterMatrix.rows(); i++)
+        int currRow = 1;
+        float err = 0;
+        bool done = false;
+
+        svd.reset(columns, nc + PCA_RANK_OVERSAMPLING);
+        svd.add_row(&targetMatrix(0, 0));
+        columnSum = targetMatrix.row(0).transpose().cast<double>();
+        int targetDotCount = 0;
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < rows; i++)
+        {
+            if (!used[i])
             {
-                if (used.find(i) == used.end())
-                {
-                    targetMatrix.row(0) = clusterMatrix.row(i);
-                    used.insert(i);
-                    rowIndices.push_back(i);
-                    break;
-                }
+                rowDotSum[i] = clusterMatrix.row(i).cast<double>().dot(columnSum);
             }
+        }
 
-            int currRow = 1;
-            float err = 0;
-            bool done = false;
-
-            float svdtook = 0;
-            float resttook = 0;
-
-            while (true)
+        while (true)
+        {
+            // The svd holds the first currRow rows, everything after its rank is error
+            err = svd.residual(nc);
+
+            // err = diff.squaredNorm();
+            //{
+            //	std::ofstream file("eigenmatrix_og" + std::to_string(nodeIndex) + ".csv");
+            //	const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
+            // Eigen::DontAlignCols, ", ", "\n"); 	file << constructed.format(CSVFormat);
+            //
+            // }
+            //{
+            //	std::ofstream file("eigenmatrix_constructed" + std::to_string(nodeIndex) +
+            //".csv"); 	const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
+            // Eigen::DontAlignCols, ", ", "\n"); 	file << targetMatrix.block(0, 0,
+            // currRow, targetMatrix.cols()).format(CSVFormat);
+            // }
+
+            if ((rows - usedCount > 4 && err > 0.005) || done)
             {
-                // recalculate:
-                auto svdstart = std::chrono::system_clock::now();
-                auto mean =
-                    targetMatrix.block(0, 0, currRow, targetMatrix.cols()).colwise().mean();
-                // Eigen::JacobiSVD<Eigen::MatrixXf> sub_svd(targetMatrix.block(0, 0, currRow,
-                // targetMatrix.cols()), Eigen::ComputeThinU | Eigen::ComputeThinV);
-                RedSVD::RedSVD sub_svd(targetMatrix.block(0, 0, currRow, targetMatrix.cols()),
-                                       nc);
-                auto svdend = std::chrono::system_clock::now();
-                std::chrono::duration<double> elapsed_seconds = svdend - svdstart;
-                svdtook += elapsed_seconds.count();
-
-                err = 0;
-                for (int i = 0; i < currRow; i++)
-                {
-                    auto diff = (targetMatrix.row(i));
-                    err += diff.squaredNorm();
-                }
-                int maxNc = MIN(sub_svd.singularValues().size(), nc);
-                for (int j = 0; j < maxNc; j++)
-                {
-                    err -= sub_svd.singularValues()[j] * sub_svd.singularValues()[j];
-                }
 
-                // err = diff.squaredNorm();
-                //{
-                //	std::ofstream file("eigenmatrix_og" + std::to_string(nodeIndex) + ".csv");
-                //	const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
-                // Eigen::DontAlignCols, ", ", "\n"); 	file << constructed.format(CSVFormat);
-                //
-                // }
-                //{
-                //	std::ofstream file("eigenmatrix_constructed" + std::to_string(nodeIndex) +
-                //".csv"); 	const static Eigen::IOFormat CSVFormat(Eigen::StreamPrecision,
-                // Eigen::DontAlignCols, ", ", "\n"); 	file << targetMatrix.block(0, 0,
-                // currRow, targetMatrix.cols()).format(CSVFormat);
+                // if (!done) {
+                //	done = true;
+                //	currRow--;
+                //	used.erase(rowIndices[rowIndices.size() - 1]);
+                //	rowIndices.pop_back();
+                //	goto recalculate;
                 // }
 
-                if ((clusterMatrix.rows() - used.size() > 4 && err > 0.005) || done)
-                {
-
-                    // if (!done) {
-                    //	done = true;
-                    //	currRow--;
-                    //	used.erase(rowIndices[rowIndices.size() - 1]);
-                    //	rowIndices.pop_back();
-                    //	goto recalculate;
-                    // }
+                // Seeded, so the result does not depend on the thread or the cluster order
+                RedSVD::Options svdOptions;
+                svdOptions.oversampling = PCA_RANK_OVERSAMPLING;
+                svdOptions.powerIterations = PCA_POWER_ITERATIONS;
+                RedSVD::RedSVD new_svd(targetMatrix.block(0, 0, currRow, targetMatrix.cols()),
+                                       nc, svdOptions);
 
-                    Eigen::JacobiSVD<Eigen::MatrixXf> new_svd(
-                        targetMatrix.block(0, 0, currRow, targetMatrix.cols()),
-                        Eigen::ComputeFullU | Eigen::ComputeFullV);
-
-                    int targetCoeffCount = nc;
+                int targetCoeffCount = nc;
 
+                {
+                    err = 0;
+                    for (int i = 0; i < currRow; i++)
                     {
-                        err = 0;
-                        for (int i = 0; i < currRow; i++)
-                        {
-                            auto diff = (targetMatrix.row(i));
-                            err += diff.squaredNorm();
-                        }
-                        int maxNc = MIN(new_svd.singularValues().size(), nc);
-                        for (int j = 0; j < maxNc; j++)
+                        auto diff = (targetMatrix.row(i));
+                        err += diff.squaredNorm();
+                    }
+                    int maxNc = MIN(new_svd.singularValues().size(), nc);
+                    for (int j = 0; j < maxNc; j++)
+                    {
+                        err -= new_svd.singularValues()[j] * new_svd.singularValues()[j];
+                        if (err < 0.005)
                         {
-                            err -= new_svd.singularValues()[j] * new_svd.singularValues()[j];
-                            if (err < 0.005)
-                            {
-                                printf("%d singular values would be enough\n", j + 1);
-                                targetCoeffCount = j + 1;
-                                break;
-                            }
+                            printf("%d singular values would be enough\n", j + 1);
+                            targetCoeffCount = j + 1;
+                            break;
                         }
-
-                        Eigen::MatrixXf constructed =
-                            new_svd.matrixU() *
-                            new_svd.singularValues()
-                                .head(MIN(targetCoeffCount, new_svd.singularValues().size()))
-                                .asDiagonal() *
-                            new_svd.matrixV().transpose();
-                        Eigen::MatrixXf diff =
-                            constructed -
-                            targetMatrix.block(0, 0, currRow, targetMatrix.cols());
-                        err = diff.squaredNorm();
                     }
 
-                    printf("Seperated %d rows. The cluster error is: %f.\n", currRow, err);
+                    int usedCoeffCount =
+                        MIN(targetCoeffCount, new_svd.singularValues().size());
+                    Eigen::MatrixXf constructed =
+                        new_svd.matrixU().leftCols(usedCoeffCount) *
+                        new_svd.singularValues().head(usedCoeffCount).asDiagonal() *
+                        new_svd.matrixV().leftCols(usedCoeffCount).transpose();
+                    Eigen::MatrixXf diff =
+                        constructed -
+                        targetMatrix.block(0, 0, currRow, targetMatrix.cols());
+                    err = diff.squaredNorm();
+                }
 
-                    if (err > maxError)
-                    {
-                        maxError = err;
-                    }
+                printf("Seperated %d rows. The cluster error is: %f.\n", currRow, err);
+
+                if (err > outCompressed.maxError)
+                {
+                    outCompressed.maxError = err;
+                }
 
-                    // printf("U size: %d x %d\n", sub_svd.matrixU().rows(),
-                    // sub_svd.matrixU().cols()); printf("Singular size: %d\n",
-                    // sub_svd.singularValues().size()); printf("V size: %d x %d\n",
-                    // sub_svd.matrixV().rows(), sub_svd.matrixV().cols());
-                    newClusterCount++;
-
-                    auto receiverReconstructionCoefficientMatrix =
-                        Eigen::Matrix<float, -1, -1, Eigen::RowMajor>(new_svd.matrixU().rows(),
-                                                                      targetCoeffCount);
-                    receiverReconstructionCoefficientMatrix.fill(0);
-                    receiverReconstructionCoefficientMatrix.block(
+                // printf("U size: %d x %d\n", sub_svd.matrixU().rows(),
+                // sub_svd.matrixU().cols()); printf("Singular size: %d\n",
+                // sub_svd.singularValues().size()); printf("V size: %d x %d\n",
+                // sub_svd.matrixV().rows(), sub_svd.matrixV().cols());
+                auto receiverReconstructionCoefficientMatrix =
+                    Eigen::Matrix<float, -1, -1, Eigen::RowMajor>(new_svd.matrixU().rows(),
+                                                                  targetCoeffCount);
+                receiverReconstructionCoefficientMatrix.fill(0);
+                receiverReconstructionCoefficientMatrix.block(
+                    0, 0, new_svd.matrixU().rows(),
+                    MIN(targetCoeffCount, new_svd.matrixU().cols())) =
+                    new_svd.matrixU().block(
                         0, 0, new_svd.matrixU().rows(),
-                        MIN(targetCoeffCount, new_svd.matrixU().cols())) =
-                        new_svd.matrixU().block(
-                            0, 0, new_svd.matrixU().rows(),
-                            MIN(targetCoeffCount, new_svd.matrixU().cols()));
-
-                    Eigen::MatrixXf singularMatrix(targetCoeffCount, new_svd.matrixV().cols());
-                    int singularValueSize = new_svd.singularValues().size();
-                    singularMatrix.setZero();
-                    for (int aa = 0; aa < targetCoeffCount; aa++)
+                        MIN(targetCoeffCount, new_svd.matrixU().cols()));
+
+                Eigen::MatrixXf singularMatrix(targetCoeffCount, new_svd.matrixV().cols());
+                int singularValueSize = new_svd.singularValues().size();
+                singularMatrix.setZero();
+                for (int aa = 0; aa < targetCoeffCount; aa++)
+                {
+                    if (aa < singularValueSize)
                     {
-                        if (aa < singularValueSize)
-                        {
-                            singularMatrix(aa, aa) = new_svd.singularValues()[aa];
-                        }
-                        else if (aa < new_svd.matrixV().cols())
-                        {
-                            singularMatrix(aa, aa) = 0;
-                        }
+                        singularMatrix(aa, aa) = new_svd.singularValues()[aa];
                     }
-
-                    auto clusterProjectionMatrix =
-                        Eigen::Matrix<float, -1, -1, Eigen::RowMajor>(
-                            singularMatrix * new_svd.matrixV().transpose());
-
-                    AABB newCluster = {};
-                    newCluster.svdCoeffCount = targetCoeffCount;
-                    newCluster.probes = aabbClusters[nodeIndex].probes;
-                    newCluster.projectionMatrixOffset = nodeClusterDataOffset;
-                    newCluster.reconstructionMatrixOffset = nodeReceiverDataOffset;
-                    for (int k = 0; k < rowIndices.size(); k++)
+                    else if (aa < new_svd.matrixV().cols())
                     {
-                        newCluster.receivers.push_back(
-                            aabbClusters[nodeIndex].receivers[rowIndices[k]]);
+                        singularMatrix(aa, aa) = 0;
                     }
-                    rowIndices.clear();
-                    newClusters.push_back(newCluster);
-
-                    *clusterProjectionMatrices =
-                        (float*)realloc(*clusterProjectionMatrices,
-                                        nodeClusterDataOffset * sizeof(float) +
-                                            clusterProjectionMatrix.size() * sizeof(float));
-                    memcpy(*clusterProjectionMatrices + nodeClusterDataOffset,
-                           clusterProjectionMatrix.data(),
-                           clusterProjectionMatrix.size() * sizeof(float));
-                    nodeClusterDataOffset += clusterProjectionMatrix.size();
-
-                    *receiverCoefficientMatrices = (float*)realloc(
-                        *receiverCoefficientMatrices,
-                        nodeReceiverDataOffset * sizeof(float) +
-                            receiverReconstructionCoefficientMatrix.size() * sizeof(float));
-                    memcpy(*receiverCoefficientMatrices + nodeReceiverDataOffset,
-                           receiverReconstructionCoefficientMatrix.data(),
-                           receiverReconstructionCoefficientMatrix.size() * sizeof(float));
-                    nodeReceiverDataOffset += receiverReconstructionCoefficientMatrix.size();
-
-                    break;
                 }
 
-                auto reststart = std::chrono::system_clock::now();
-
-#pragma omp parallel for schedule(static)
-                for (int i = 0; i < clusterMatrix.rows(); i++)
+                auto clusterProjectionMatrix =
+                    Eigen::Matrix<float, -1, -1, Eigen::RowMajor>(
+                        singularMatrix * new_svd.matrixV().transpose());
+
+                AABB newCluster = {};
+                newCluster.svdCoeffCount = targetCoeffCount;
+                newCluster.probes = cluster.probes;
+                // Relative to this cluster, gather_compressed_clusters moves the offsets
+                newCluster.projectionMatrixOffset = outCompressed.projectionMatrices.size();
+                newCluster.reconstructionMatrixOffset =
+                    outCompressed.reconstructionMatrices.size();
+                for (int k = 0; k < rowIndices.size(); k++)
                 {
-                    if (used.find(i) == used.end())
-                    {
-                        Eigen::VectorXf diff = (clusterMatrix.row(i) - mean);
-                        float squared_norm = diff.squaredNorm();
-                        int maxNc =
-                            MIN(MIN(sub_svd.singularValues().size(), nc), currRow / 20);
+                    newCluster.receivers.push_back(
+                        cluster.receivers[rowIndices[k]]);
+                }
+                rowIndices.clear();
+                outCompressed.clusters.push_back(std::move(newCluster));
+
+                outCompressed.projectionMatrices.insert(
+                    outCompressed.projectionMatrices.end(), clusterProjectionMatrix.data(),
+                    clusterProjectionMatrix.data() + clusterProjectionMatrix.size());
+                outCompressed.reconstructionMatrices.insert(
+                    outCompressed.reconstructionMatrices.end(),
+                    receiverReconstructionCoefficientMatrix.data(),
+                    receiverReconstructionCoefficientMatrix.data() +
+                        receiverReconstructionCoefficientMatrix.size());
 
-                        float approximation = 0;
-                        for (int j = 0; j < maxNc; j++)
-                        {
-                            float diff2 = (diff.dot(targetMatrix.row(j)));
-                            // float diff2 = dot_product(diff.data(),
-                            // targetMatrix.row(j).data(), diff.size());
-                            approximation += diff2 * diff2;
-                        }
+                break;
+            }
 
-                        float approximation_error = squared_norm - approximation;
-                        receiverErrors[i] = approximation_error;
-                    }
-                    else
+            BakeProfileZone selectionZone("pca_row_selection", false);
+            selectionZone.add_items(rows - usedCount);
+
+            int maxNc = MIN(MIN(svd.rank(), nc), currRow / 20);
+            for (; targetDotCount < maxNc; targetDotCount++)
+            {
+                auto targetRow = targetMatrix.row(targetDotCount).cast<double>();
+#pragma omp parallel for schedule(static)
+                for (int i = 0; i < rows; i++)
+                {
+                    if (!used[i])
                     {
-                        receiverErrors[i] = 0;
+                        targetDots[(size_t)i * nc + targetDotCount] =
+                            clusterMatrix.row(i).cast<double>().dot(targetRow);
                     }
                 }
+            }
 
-                int selected = -1;
-                float selectedErr = 99999999;
-                for (int i = 0; i < clusterMatrix.rows(); i++)
+            // |row - mean|^2 minus its squared dot products with the first maxNc rows
+            double meanNorm = columnSum.squaredNorm() / ((double)currRow * currRow);
+            for (int j = 0; j < maxNc; j++)
+            {
+                meanDots[j] = targetMatrix.row(j).cast<double>().dot(columnSum) / currRow;
+            }
+
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < rows; i++)
+            {
+                if (!used[i])
                 {
-                    if (used.find(i) == used.end())
+                    double squared_norm =
+                        arena.rowNorms[i] - 2 * rowDotSum[i] / currRow + meanNorm;
+                    double approximation = 0;
+                    for (int j = 0; j < maxNc; j++)
                     {
-                        if (receiverErrors[i] < selectedErr)
-                        {
-                            selected = i;
-                            selectedErr = receiverErrors[i];
-                        }
+                        double diff2 = targetDots[(size_t)i * nc + j] - meanDots[j];
+                        approximation += diff2 * diff2;
                     }
+
+                    receiverErrors[i] = squared_norm - approximation;
                 }
-                if (selected != -1)
+                else
                 {
-                    targetMatrix.row(currRow) = clusterMatrix.row(selected);
-                    currRow++;
-                    used.insert(selected);
-                    rowIndices.push_back(selected);
+                    receiverErrors[i] = 0;
                 }
-                else
+            }
+
+            int selected = -1;
+            float selectedErr = 99999999;
+            for (int i = 0; i < rows; i++)
+            {
+                if (!used[i])
                 {
-                    done = true;
+                    if (receiverErrors[i] < selectedErr)
+                    {
+                        selected = i;
+                        selectedErr = receiverErrors[i];
+                    }
                 }
+            }
+            if (selected != -1)
+            {
+                targetMatrix.row(currRow) = clusterMatrix.row(selected);
+                used[selected] = 1;
+                usedCount++;
+                rowIndices.push_back(selected);
 
-                auto restend = std::chrono::system_clock::now();
-                elapsed_seconds = restend - reststart;
-                resttook += elapsed_seconds.count();
+                auto selectedRow = targetMatrix.row(currRow).cast<double>();
+                columnSum += selectedRow.transpose();
+#pragma omp parallel for schedule(static)
+                for (int i = 0; i < rows; i++)
+                {
+                    if (!used[i])
+                    {
+                        rowDotSum[i] += clusterMatrix.row(i).cast<double>().dot(selectedRow);
+                    }
+                }
             }
-            printf("SVD took: %f, Rest took %f s\n", svdtook, resttook);
-        }
-        delete[] receiverErrors;
-
-        /*
-        int globalcounterr = 0;
-        for (int y = 0; y < clusterProjectionMatrix.rows(); y++) {
-            for (int x = 0; x < clusterProjectionMatrix.cols(); x++) {
-                printf("%f vs %f\n", clusterProjectionMatrix(y, x),
-        *(clusterProjectionMatrix.data() + globalcounterr)); globalcounterr++;
+            else
+            {
+                done = true;
             }
-        }
-        */
 
-        // memcpy(clusterProjectionMatrices + nodeClusterDataOffset,
-        // clusterProjectionMatrix.data(), clusterProjectionMatrix.size() * sizeof(float));
-        // nodeClusterDataOffset += clusterProjectionMatrix.size();
-        //
-        // memcpy(receiverCoefficientMatrices + nodeReceiverDataOffset,
-        // receiverReconstructionCoefficientMatrix.data(),
-        // receiverReconstructionCoefficientMatrix.size() * sizeof(float));
-        // nodeReceiverDataOffset += receiverReconstructionCoefficientMatrix.size();
+            selectionZone.end();
 
-        receiverOffset += aabbClusters[nodeIndex].receivers.size();
-        probeOffset += aabbClusters[nodeIndex].probes.size();
+            if (selected != -1)
+            {
+                BakeProfileZone svdZone("pca_svd_update", false);
+                svdZone.add_items(1);
+                svd.add_row(&targetMatrix(currRow, 0));
+                currRow++;
+            }
+        }
+    }
+}
 
-        auto end = std::chrono::system_clock::now();
-        std::chrono::duration<double> elapsed_seconds = end - start;
-        printf("Node tracing done %d/%d (took %f s). Current cluster count: %d\n\n", nodeIndex,
-               aabbClusters.size(), elapsed_seconds.count(), newClusterCount);
+void Precalculation::gather_compressed_clusters(std::vector<CompressedCluster>& compressed,
+                                                std::vector<AABB>& outClusters,
+                                                float** clusterProjectionMatrices,
+                                                float** receiverCoefficientMatrices,
+                                                int* projectionMatricesSize,
+                                                int* reconstructionMatricesSize,
+                                                float* maxError)
+{
+    // Prefix sums over the clusters give every result its place in the output arrays
+    size_t clusterCount = 0;
+    size_t projectionSize = 0;
+    size_t reconstructionSize = 0;
+    *maxError = 0;
+    for (CompressedCluster& result : compressed)
+    {
+        for (AABB& cluster : result.clusters)
+        {
+            cluster.projectionMatrixOffset += projectionSize;
+            cluster.reconstructionMatrixOffset += reconstructionSize;
+        }
+        clusterCount += result.clusters.size();
+        projectionSize += result.projectionMatrices.size();
+        reconstructionSize += result.reconstructionMatrices.size();
+        *maxError = MAX(*maxError, result.maxError);
     }
 
-    *projectionMatricesSize = nodeClusterDataOffset;
-    *reconstructionMatricesSize = nodeReceiverDataOffset;
-    aabbClusters = newClusters;
+    *clusterProjectionMatrices =
+        (float*)realloc(*clusterProjectionMatrices, projectionSize * sizeof(float));
+    *receiverCoefficientMatrices =
+        (float*)realloc(*receiverCoefficientMatrices, reconstructionSize * sizeof(float));
+    outClusters.clear();
+    outClusters.reserve(clusterCount);
 
-    printf("New cluster count: %d\n", newClusterCount);
-    printf("Max singular value error: %f\n", maxError);
+    for (CompressedCluster& result : compressed)
+    {
+        if (!result.clusters.empty())
+        {
+            const AABB& first = result.clusters[0];
+            memcpy(*clusterProjectionMatrices + first.projectionMatrixOffset,
+                   result.projectionMatrices.data(),
+                   result.projectionMatrices.size() * sizeof(float));
+            memcpy(*receiverCoefficientMatrices + first.reconstructionMatrixOffset,
+                   result.reconstructionMatrices.data(),
+                   result.reconstructionMatrices.size() * sizeof(float));
+        }
+        std::move(result.clusters.begin(), result.clusters.end(),
+                  std::back_inserter(outClusters));
+    }
 
-    engine._vulkanRaytracing.destroy_raytracing_pipeline(rtPipeline);
-
-    vmaDestroyBuffer(engine._engineData.allocator, sceneDescBuffer._buffer,
-                     sceneDescBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, meshInfoBuffer._buffer,
-                     meshInfoBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, probeLocationsBuffer._buffer,
-                     probeLocationsBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, receiverLocationsBuffer._buffer,
-                     probeLocationsBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, outputBuffer._buffer,
-                     outputBuffer._allocation);
-
-    vmaDestroyBuffer(engine._engineData.allocator, receiverMatrixConfig._buffer,
-                     receiverMatrixConfig._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, receiverProbeWeights._buffer,
-                     receiverProbeWeights._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, matrixBuffer._buffer,
-                     matrixBuffer._allocation);
-    vmaDestroyBuffer(engine._engineData.allocator, matrixBufferCPU._buffer,
-                     matrixBufferCPU._allocation);
-
-    vkDestroyDescriptorSetLayout(engine._engineData.device, rtDescriptorSetLayout, nullptr);
+    *projectionMatricesSize = projectionSize;
+    *reconstructionMatricesSize = reconstructionSize;
 }
@@ -1,38 +1,133 @@
 #pragma once
 
-#define RAYTRACING
 #include <glm/glm.hpp>
 #include <gltf_scene.hpp>
 #include <precalculation_types.h>
+#include <string>
 #include <vector>
-#include <vk_engine.h>
+
+// Default output of panko_bake
+#define PRECALCULATION_DEFAULT_FILE "../precomputation/precalculation.bake"
+// Bakes named after their bake_content_key, the renderer reuses the entry of its inputs
+#define PRECALCULATION_CACHE_DIRECTORY "../precomputation/cache"
+// Outputs of the bake stages, an interrupted or retuned bake resumes from them
+#define PRECALCULATION_CHECKPOINT_DIRECTORY "../precomputation/checkpoints"
+// Transfer matrices of clusters larger than this are traced into a memory mapped scratch file
+// in PRECALCULATION_SCRATCH_DIRECTORY instead of memory. Every TRANSFER_ROW_BLOCK rows are
+// written back to the file once they are traced, the PCA pages them in again as it reads them.
+#define TRANSFER_SCRATCH_THRESHOLD (64 * 1024 * 1024)
+#define TRANSFER_ROW_BLOCK 64
+#define PRECALCULATION_SCRATCH_DIRECTORY "../precomputation"
+// Timing report of the bake stages (bake/bake_profiler.h), written next to the bake
+#define PRECALCULATION_PROFILE_SUFFIX ".profile.json"
+
+class VulkanEngine;
+class CpuRaytracer;
+class VoxelGrid;
+class BakeContainer;
+class BakeContainerWriter;
+struct ReceiverStore;
 
 class Precalculation
 {
 public:
-    void prepare(VulkanEngine& engine, GltfScene& scene, PrecalculationInfo precalculationInfo,
+    // Passing a null engine runs every stage on the CPU (used by the headless panko_bake).
+    // Every stage resumes from its checkpoint if its inputs did not change since it was
+    // written, a null checkpoint directory runs them all. The transfer matrices are only
+    // checkpointed when asked for: they let a changed PCA skip the tracing, but are as large
+    // as the traced data (~307 MB for the cornell box, unbounded on larger scenes). Returns
+    // false if the probes to load or the bake could not be read or written.
+    bool prepare(VulkanEngine* engine, GltfScene& scene, PrecalculationInfo precalculationInfo,
                  PrecalculationLoadData& outPrecalculationLoadData,
                  PrecalculationResult& outPrecalculationResult,
-                 const char* loadProbes = nullptr);
-    void load(const char* filename, PrecalculationInfo& precalculationInfo,
+                 const char* loadProbes = nullptr,
+                 const char* outputFilename = PRECALCULATION_DEFAULT_FILE,
+                 const char* checkpointDirectory = PRECALCULATION_CHECKPOINT_DIRECTORY,
+                 bool checkpointTransferMatrices = false);
+    // Maps a bake written by prepare, the result arrays point into the mapping. Bakes with
+    // another content key are rejected unless expectedContentKey is 0.
+    bool load(const char* filename, PrecalculationInfo& precalculationInfo,
               PrecalculationLoadData& outPrecalculationLoadData,
-              PrecalculationResult& outPrecalculationResult);
+              PrecalculationResult& outPrecalculationResult,
+              uint64_t expectedContentKey = 0);
+
+    // Directory prepare writes the voxels, the probes and the receiver mask to for debugging,
+    // nothing is written if it is empty
+    std::string debugDumpDirectory;
 
 private:
-    std::vector<uint8_t> voxelize(GltfScene& scene, float voxelSize, int padding, int& dimX,
-                                  int& dimY, int& dimZ);
+    void voxelize(GltfScene& scene, float voxelSize, int padding, VoxelGrid& outGrid);
     void place_probes(VulkanEngine& engine, std::vector<glm::vec4>& probes,
                       int targetProbeCount, float spacing);
-    std::vector<Receiver> generate_receivers_cpu(VulkanEngine& engine, GltfScene& scene,
-                                                 int lightmapResolution);
+    void place_probes_cpu(std::vector<glm::vec4>& probes, int targetProbeCount, float spacing);
+    void generate_receivers_cpu(GltfScene& scene, int lightmapResolution,
+                                ReceiverStore& outReceivers);
     void probe_raycast(VulkanEngine& engine, std::vector<glm::vec4>& probes, int rays,
-                       int sphericalHarmonicsOrder, GPUProbeRaycastResult* probeRaycastResult,
-                       float* probeRaycastBasisFunctions);
-    void receiver_raycast(VulkanEngine& engine, std::vector<AABB>& aabbClusters,
-                          std::vector<glm::vec4>& probes, int rays, float radius,
-                          int sphericalHarmonicsOrder, int clusterCoefficientCount,
-                          int maxReceivers, int totalReceiverCount, int maxProbesPerCluster,
+                       GPUProbeRaycastResult* probeRaycastResult);
+    void probe_raycast_cpu(CpuRaytracer& raytracer, std::vector<glm::vec4>& probes, int rays,
+                           GPUProbeRaycastResult* probeRaycastResult);
+    void receiver_raycast(VulkanEngine& engine, const ReceiverStore& receivers,
+                          std::vector<AABB>& aabbClusters, std::vector<glm::vec4>& probes,
+                          int rays, float radius, int sphericalHarmonicsOrder,
+                          int clusterCoefficientCount, int maxReceivers,
+                          int totalReceiverCount, int maxProbesPerCluster,
                           float** clusterProjectionMatrices,
-                          float** receiverCoefficientMatrices, float* receiverProbeWeightData,
+                          float** receiverCoefficientMatrices,
+                          const std::vector<int>& receiverProbeWeightOffsets,
+                          const std::vector<GPUReceiverProbeWeight>& receiverProbeWeights,
                           int* projectionMatricesSize, int* reconstructionMatricesSize);
+    // Writes the transfer matrix of every cluster to the checkpoint without compressing it
+    void receiver_transfer_cpu(CpuRaytracer& raytracer, const ReceiverStore& receivers,
+                               const std::vector<AABB>& aabbClusters,
+                               std::vector<glm::vec4>& probes, int rays,
+                               int sphericalHarmonicsOrder, int maxReceivers,
+                               const std::vector<int>& receiverProbeWeightOffsets,
+                               const std::vector<GPUReceiverProbeWeight>& receiverProbeWeights,
+                               BakeContainerWriter& transferCheckpoint);
+    // Compresses the transfer matrices of a receiver_transfer_cpu checkpoint if there is one,
+    // traces them otherwise
+    void receiver_raycast_cpu(CpuRaytracer& raytracer, const ReceiverStore& receivers,
+                              std::vector<AABB>& aabbClusters,
+                              std::vector<glm::vec4>& probes, int rays,
+                              int sphericalHarmonicsOrder, int clusterCoefficientCount,
+                              int maxReceivers, const BakeContainer* transferCheckpoint,
+                              float** clusterProjectionMatrices,
+                              float** receiverCoefficientMatrices,
+                              const std::vector<int>& receiverProbeWeightOffsets,
+                              const std::vector<GPUReceiverProbeWeight>& receiverProbeWeights,
+                              int* projectionMatricesSize, int* reconstructionMatricesSize);
+
+    // Sub clusters and PCA matrices of one cluster, the matrix offsets of the sub clusters are
+    // relative to this cluster until gather_compressed_clusters places them
+    struct CompressedCluster
+    {
+        std::vector<AABB> clusters;
+        std::vector<float> projectionMatrices;
+        std::vector<float> reconstructionMatrices;
+        float maxError = 0;
+    };
+    // Scratch memory of compress_cluster, reused for every cluster a thread compresses
+    struct PcaArena
+    {
+        std::vector<float> targetMatrix;
+        std::vector<float> receiverErrors;
+        std::vector<char> used;
+        std::vector<double> rowNorms;
+        std::vector<double> rowDotSum;  // dot product with the column sum of the sub cluster
+        std::vector<double> targetDots; // dot products with its first rows
+        std::vector<double> columnSum;
+    };
+
+    // Splits a cluster's transfer matrix into sub clusters with their PCA matrices. Clusters
+    // do not share any state, so they can be compressed in parallel.
+    void compress_cluster(const AABB& cluster, const float* clusterMatrix,
+                          int basisFunctionCount, int clusterCoefficientCount, PcaArena& arena,
+                          CompressedCluster& outCompressed);
+    // Concatenates the compressed clusters in order and fixes their matrix offsets
+    void gather_compressed_clusters(std::vector<CompressedCluster>& compressed,
+                                    std::vector<AABB>& outClusters,
+                                    float** clusterProjectionMatrices,
+                                    float** receiverCoefficientMatrices,
+                                    int* projectionMatricesSize,
+                                    int* reconstructionMatricesSize, float* maxError);
 };
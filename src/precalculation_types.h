@@ -2,28 +2,28 @@
 
 #include "../shaders/common.glsl"
 #include <glm/glm.hpp>
+#include <memory>
+#include <stdint.h>
 #include <vector>
 
 #define SPHERICAL_HARMONICS_NUM_COEFF(ORDER) ((ORDER + 1) * (ORDER + 1))
 
+class BakeContainer;
+
+// Receiver as it is saved with the bake, used by the debug views of the renderer
 struct Receiver
 {
     glm::vec3 position;
     glm::vec3 normal;
     glm::ivec2 uv;
     int objectId;
-    float dPos;
-    bool exists;
-    bool processed;
-    std::vector<glm::vec3> poses;
-    std::vector<glm::vec3> norms;
 };
 
 struct AABB
 {
     glm::vec3 min;
     glm::vec3 max;
-    std::vector<Receiver> receivers;
+    std::vector<int> receivers; // indices into the ReceiverStore of the bake
     std::vector<int> probes;
     int svdCoeffCount;
     int projectionMatrixOffset;
@@ -52,6 +52,8 @@ struct PrecalculationInfo
     int lightmapResolution;
     int texelSize;
     float desiredSpacing;
+    // Storage of the PCA matrices, one of the MATRIX_FORMAT_* of common.glsl
+    int matrixFormat;
 };
 
 struct PrecalculationLoadData
@@ -75,13 +77,22 @@ struct PrecalculationResult
 
     // Receivers
     Receiver* aabbReceivers;
-    float* clusterProjectionMatrices;
-    float* receiverCoefficientMatrices;
+    // Packed in PrecalculationInfo::matrixFormat, see bake/matrix_quantization.h
+    uint32_t* clusterProjectionMatrices;
+    float* clusterProjectionScales;
+    uint32_t* receiverCoefficientMatrices;
+    float* receiverCoefficientScales;
     ClusterReceiverInfo* clusterReceiverInfos;
     glm::ivec4* clusterReceiverUvs;
 
     int* clusterProbes;
 
-    // Debug data
-    float* receiverProbeWeightData;
+    // Probe weights of the cluster receivers in CSR form: the weights of receiver i are
+    // receiverProbeWeights[receiverProbeWeightOffsets[i]] up to the offset of receiver i + 1,
+    // probes without a weight are left out. totalClusterReceiverCount + 1 offsets.
+    int* receiverProbeWeightOffsets;
+    GPUReceiverProbeWeight* receiverProbeWeights;
+
+    // Set by Precalculation::load, the arrays above point into the mapped bake file
+    std::shared_ptr<BakeContainer> bakeFile;
 };
\ No newline at end of file
@@ -0,0 +1,1199 @@
+#include "vk_engine.h"
+
+#include "precalculation.h"
+#include <stdint.h>
+
+#include <vk_initializers.h>
+#include <vk_pipeline.h>
+#include <vk_utils.h>
+
+#include <Eigen/Dense>
+#include <bake/bake_profiler.h>
+#include <bake/receiver_store.h>
+#include <bake/scratch_file.h>
+#include <chrono>
+#include <vector>
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+// Vulkan backend of the precalculation stages, the CPU stages live in precalculation.cpp
+
+void Precalculation::place_probes(VulkanEngine& engine, std::vector<glm::vec4>& probes,
+                                  int targetProbeCount, float spacing)
+{
+    ComputeInstance instance = {};
+    engine._vulkanCompute.create_buffer(instance, UNIFORM, VMA_MEMORY_USAGE_CPU_TO_GPU,
+                                        sizeof(GPUProbeDensityUniformData));
+    engine._vulkanCompute.create_buffer(instance, STORAGE, VMA_MEMORY_USAGE_CPU_TO_GPU,
+                                        sizeof(glm::vec4) * probes.size());
+    engine._vulkanCompute.create_buffer(instance, STORAGE, VMA_MEMORY_USAGE_GPU_TO_CPU,
+                                        sizeof(float) * probes.size());
+
+    Slice<uint32_t> spirvProbeDensityWeights{};
+    engine._shaderManager.get_spirv(
+        "../shaders/precomputation/precalculate_probe_density_weights.comp", {},
+        spirvProbeDensityWeights);
+
+    engine._vulkanCompute.build(instance, engine._engineData.descriptorPool,
+                                spirvProbeDensityWeights);
+    vkutils::cpu_to_gpu(engine._engineData.allocator, instance.bindings[1].buffer,
+                        probes.data(), sizeof(glm::vec4) * probes.size());
+
+    float currMaxWeight = -1;
+    int toRemoveIndex = -1;
+    float radius = spacing;
+
+    while (probes.size() > targetProbeCount)
+    {
+        GPUProbeDensityUniformData ub = {static_cast<int>(probes.size()), radius};
+        vkutils::cpu_to_gpu(engine._engineData.allocator, instance.bindings[0].buffer, &ub,
+                            sizeof(GPUProbeDensityUniformData));
+        int groupcount = ((probes.size()) / 256) + 1;
+        engine._vulkanCompute.compute(instance, groupcount, 1, 1);
+
+        void* gpuWeightData;
+        vmaMapMemory(engine._engineData.allocator, instance.bindings[2].buffer._allocation,
+                     &gpuWeightData);
+        for (int i = 0; i < probes.size(); i++)
+        {
+            float weight = ((float*)gpuWeightData)[i];
+            if (weight >= currMaxWeight)
+            {
+                toRemoveIndex = i;
+                currMaxWeight = weight;
+            }
+        }
+
+        vmaUnmapMemory(engine._engineData.allocator, instance.bindings[2].buffer._allocation);
+
+        void* gpuProbeData;
+        glm::vec4* castedGpuProbeData;
+        vmaMapMemory(engine._engineData.allocator, instance.bindings[1].buffer._allocation,
+                     &gpuProbeData);
+        castedGpuProbeData = (glm::vec4*)gpuProbeData;
+        castedGpuProbeData[toRemoveIndex] = castedGpuProbeData[probes.size() - 1];
+        vmaUnmapMemory(engine._engineData.allocator, instance.bindings[1].buffer._allocation);
+
+        if (toRemoveIndex != -1)
+        {
+            probes[toRemoveIndex] = probes[probes.size() - 1];
+            probes.pop_back();
+            currMaxWeight = -1;
+            toRemoveIndex = -1;
+        }
+        else
+        {
+            break;
+        }
+        printf("Size of probes %d\n", probes.size());
+    }
+
+    printf("Found this many probes: %d\n", probes.size());
+
+    engine._vulkanCompute.destroy_compute_instance(instance);
+}
+
+/*
+Receiver* Precalculation::generate_receivers(VulkanEngine& engine, GltfScene& scene, int
+lightmapResolution)
+{
+    //OPTICK_EVENT();
+    printf("Generating receivers!\n");
+
+    int receiverCount = lightmapResolution * lightmapResolution;
+    Receiver* _receivers = new Receiver[receiverCount];
+    memset(_receivers, 0, sizeof(Receiver) * receiverCount);
+    int receiverCounter = 0;
+
+    VkExtent2D imageSize = { lightmapResolution, lightmapResolution };
+
+    //Render pass
+    VkRenderPass gbufferRenderPass;
+    {
+        VkAttachmentDescription attachmentDescs[2] = {};
+
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            attachmentDescs[i].samples = VK_SAMPLE_COUNT_1_BIT;
+            attachmentDescs[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            attachmentDescs[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            attachmentDescs[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachmentDescs[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+            attachmentDescs[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            attachmentDescs[i].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        }
+
+        attachmentDescs[0].format = engine._engineData.color32Format;
+        attachmentDescs[1].format = engine._engineData.color32Format;
+
+        VkAttachmentReference colorReferences[2] = {};
+        colorReferences[0] = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        colorReferences[1] = { 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.pColorAttachments = colorReferences;
+        subpass.colorAttachmentCount = static_cast<uint32_t>(2);
+        subpass.pDepthStencilAttachment = nullptr;
+
+        VkSubpassDependency dependencies[2] = {};
+
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; dependencies[0].dependencyFlags =
+VK_DEPENDENCY_BY_REGION_BIT;
+
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT; dependencies[1].dstAccessMask =
+VK_ACCESS_MEMORY_READ_BIT; dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.pAttachments = attachmentDescs;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(2);
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = 2;
+        renderPassInfo.pDependencies = dependencies;
+
+        VK_CHECK(vkCreateRenderPass(engine._engineData.device, &renderPassInfo, nullptr,
+&gbufferRenderPass));
+    }
+
+    //Images
+    AllocatedImage gbufferPosObjectIdImage;
+    AllocatedImage gbufferNormalImage;
+
+    AllocatedImage gbufferPosObjectIdImageCpu;
+    AllocatedImage gbufferNormalImageCpu;
+
+    VkImageView gbufferPosObjectIdImageView;
+    VkImageView gbufferNormalImageView;
+    VkFramebuffer gbufferFrameBuffer;
+    {
+        VkExtent3D extent3D = {
+            imageSize.width,
+            imageSize.height,
+            1
+        };
+
+        {
+            VkImageCreateInfo dimg_info =
+vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+| VK_IMAGE_USAGE_TRANSFER_SRC_BIT, extent3D); VmaAllocationCreateInfo dimg_allocinfo = {};
+            dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
+&gbufferPosObjectIdImage._image, &gbufferPosObjectIdImage._allocation, nullptr);
+
+            VkImageViewCreateInfo imageViewInfo =
+vkinit::imageview_create_info(engine._engineData.color32Format, gbufferPosObjectIdImage._image,
+VK_IMAGE_ASPECT_COLOR_BIT); VK_CHECK(vkCreateImageView(engine._engineData.device,
+&imageViewInfo, nullptr, &gbufferPosObjectIdImageView));
+        }
+
+        {
+            VkImageCreateInfo dimg_info =
+vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+| VK_IMAGE_USAGE_TRANSFER_SRC_BIT, extent3D); VmaAllocationCreateInfo dimg_allocinfo = {};
+            dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
+&gbufferNormalImage._image, &gbufferNormalImage._allocation, nullptr);
+
+            VkImageViewCreateInfo imageViewInfo =
+vkinit::imageview_create_info(engine._engineData.color32Format, gbufferNormalImage._image,
+VK_IMAGE_ASPECT_COLOR_BIT); VK_CHECK(vkCreateImageView(engine._engineData.device,
+&imageViewInfo, nullptr, &gbufferNormalImageView));
+        }
+
+        {
+            VkImageCreateInfo dimg_info =
+vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+extent3D); dimg_info.tiling = VK_IMAGE_TILING_LINEAR; VmaAllocationCreateInfo dimg_allocinfo =
+{}; dimg_allocinfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
+&gbufferPosObjectIdImageCpu._image, &gbufferPosObjectIdImageCpu._allocation, nullptr);
+        }
+
+        {
+            VkImageCreateInfo dimg_info =
+vkinit::image_create_info(engine._engineData.color32Format, VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+extent3D); dimg_info.tiling = VK_IMAGE_TILING_LINEAR; VmaAllocationCreateInfo dimg_allocinfo =
+{}; dimg_allocinfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+            vmaCreateImage(engine._engineData.allocator, &dimg_info, &dimg_allocinfo,
+&gbufferNormalImageCpu._image, &gbufferNormalImageCpu._allocation, nullptr);
+        }
+
+        VkImageView attachments[2] = { gbufferPosObjectIdImageView, gbufferNormalImageView };
+
+        VkFramebufferCreateInfo fb_info = vkinit::framebuffer_create_info(gbufferRenderPass,
+imageSize); fb_info.pAttachments = attachments; fb_info.attachmentCount = 2;
+        VK_CHECK(vkCreateFramebuffer(engine._engineData.device, &fb_info, nullptr,
+&gbufferFrameBuffer));
+    }
+
+    //Pipeline
+    VkPipeline gbufferPipeline;
+    VkPipelineLayout gbufferPipelineLayout;
+    {
+        VkShaderModule gbufferVertShader;
+        if (!vkutils::load_shader_module(engine._engineData.device,
+"../shaders/precalculate_receivers.vert", &gbufferVertShader))
+        {
+            assert("G Buffer Vertex Shader Loading Issue");
+        }
+
+        VkShaderModule gbufferFragShader;
+        if (!vkutils::load_shader_module(engine._engineData.device,
+"../shaders/precalculate_receivers.frag", &gbufferFragShader))
+        {
+            assert("F Buffer Fragment Shader Loading Issue");
+        }
+
+        VkDescriptorSetLayout setLayouts[] = { engine._sceneDescriptors.globalSetLayout,
+engine._sceneDescriptors.objectSetLayout }; VkPipelineLayoutCreateInfo pipeline_layout_info =
+vkinit::pipeline_layout_create_info(setLayouts, 2);
+        VK_CHECK(vkCreatePipelineLayout(engine._engineData.device, &pipeline_layout_info,
+nullptr, &gbufferPipelineLayout));
+
+        //build the stage-create-info for both vertex and fragment stages. This lets the
+pipeline know the shader modules per stage PipelineBuilder pipelineBuilder;
+
+        //vertex input controls how to read vertices from vertex buffers. We aren't using it
+yet pipelineBuilder._vertexInputInfo = vkinit::vertex_input_state_create_info();
+
+        //input assembly is the configuration for drawing triangle lists, strips, or individual
+points.
+        //we are just going to draw triangle list
+        pipelineBuilder._inputAssembly =
+vkinit::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+        //configure the rasterizer to draw filled triangles
+        pipelineBuilder._rasterizer =
+vkinit::rasterization_state_create_info(VK_POLYGON_MODE_FILL);
+
+        VkPipelineRasterizationConservativeStateCreateInfoEXT conservativeRasterStateCI{};
+        conservativeRasterStateCI.sType =
+VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT;
+        conservativeRasterStateCI.conservativeRasterizationMode =
+VK_CONSERVATIVE_RASTERIZATION_MODE_OVERESTIMATE_EXT;
+        conservativeRasterStateCI.extraPrimitiveOverestimationSize = 1.0;
+
+        pipelineBuilder._rasterizer.pNext = &conservativeRasterStateCI;
+
+        //we don't use multisampling, so just run the default one
+        pipelineBuilder._multisampling = vkinit::multisampling_state_create_info();
+
+        //a single blend attachment with no blending and writing to RGBA
+
+        VkPipelineColorBlendAttachmentState blendAttachmentState[2] = {
+            vkinit::color_blend_attachment_state(),
+            vkinit::color_blend_attachment_state(),
+        };
+
+        pipelineBuilder._colorBlending = vkinit::color_blend_state_create_info(2,
+blendAttachmentState);
+
+        //build the mesh pipeline
+        VertexInputDescription vertexDescription = Vertex::get_vertex_description();
+        pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions =
+vertexDescription.attributes.data();
+        pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount =
+vertexDescription.attributes.size();
+
+        pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions =
+vertexDescription.bindings.data();
+        pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount =
+vertexDescription.bindings.size();
+
+        pipelineBuilder._shaderStages.push_back(
+            vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT,
+gbufferVertShader));
+
+        pipelineBuilder._shaderStages.push_back(
+            vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT,
+gbufferFragShader));
+
+        pipelineBuilder._depthStencil = vkinit::depth_stencil_create_info(false, false,
+VK_COMPARE_OP_LESS_OR_EQUAL);
+
+        pipelineBuilder._rasterizer.cullMode = VK_CULL_MODE_NONE;
+        pipelineBuilder._pipelineLayout = gbufferPipelineLayout;
+
+        //build the mesh triangle pipeline
+        gbufferPipeline = pipelineBuilder.build_pipeline(engine._engineData.device,
+gbufferRenderPass);
+
+        vkDestroyShaderModule(engine._engineData.device, gbufferVertShader, nullptr);
+        vkDestroyShaderModule(engine._engineData.device, gbufferFragShader, nullptr);
+    }
+
+    //Rendering
+    {
+        engine._camData.lightmapInputSize = { (float)scene.lightmap_width,
+(float)scene.lightmap_height }; vkutils::cpu_to_gpu(engine._engineData.allocator,
+engine._cameraBuffer, &engine._camData, sizeof(GPUCameraData));
+
+        void* objectData;
+        vmaMapMemory(engine._engineData.allocator, engine._objectBuffer._allocation,
+&objectData); GPUObjectData* objectSSBO = (GPUObjectData*)objectData;
+
+        for (int i = 0; i < engine.gltf_scene.nodes.size(); i++)
+        {
+            auto& mesh = engine.gltf_scene.prim_meshes[engine.gltf_scene.nodes[i].prim_mesh];
+            objectSSBO[i].model = engine.gltf_scene.nodes[i].world_matrix;
+            objectSSBO[i].material_id = mesh.material_idx;
+        }
+        vmaUnmapMemory(engine._engineData.allocator, engine._objectBuffer._allocation);
+
+        vkutils::immediate_submit(&engine._engineData, [&](VkCommandBuffer cmd) {
+            VkClearValue clearValues[2];
+            clearValues[0].color = { { 0.0f, 0.0f, 0.0f, -1.0f } };
+            clearValues[1].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+
+            VkRenderPassBeginInfo rpInfo = vkinit::renderpass_begin_info(gbufferRenderPass,
+imageSize, gbufferFrameBuffer); rpInfo.clearValueCount = 2; rpInfo.pClearValues = clearValues;
+
+            vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            vkutils::cmd_viewport_scissor(cmd, imageSize);
+
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, gbufferPipeline);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+gbufferPipelineLayout, 0, 1, &engine._sceneDescriptors.globalDescriptor, 0, nullptr);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+gbufferPipelineLayout, 1, 1, &engine._sceneDescriptors.objectDescriptor, 0, nullptr);
+
+            engine.draw_objects(cmd);
+
+            vkCmdEndRenderPass(cmd);
+        });
+    }
+
+    //Copy images
+    vkutils::immediate_submit(&engine._engineData, [&](VkCommandBuffer cmd) {
+        {
+            VkImageMemoryBarrier imageMemoryBarrier = {};
+            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageMemoryBarrier.image = gbufferPosObjectIdImageCpu._image;
+            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            imageMemoryBarrier.srcAccessMask = 0;
+            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+            vkCmdPipelineBarrier(
+                cmd,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &imageMemoryBarrier);
+        }
+
+        // Issue the copy command
+        VkImageCopy imageCopyRegion{};
+        imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageCopyRegion.srcSubresource.layerCount = 1;
+        imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageCopyRegion.dstSubresource.layerCount = 1;
+        imageCopyRegion.extent.width = imageSize.width;
+        imageCopyRegion.extent.height = imageSize.height;
+        imageCopyRegion.extent.depth = 1;
+
+        vkCmdCopyImage(
+            cmd,
+            gbufferPosObjectIdImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            gbufferPosObjectIdImageCpu._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1,
+            &imageCopyRegion);
+
+        // Transition destination image to general layout, which is the required layout for
+mapping the image memory later on
+        {
+            VkImageMemoryBarrier imageMemoryBarrier = {};
+            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageMemoryBarrier.image = gbufferPosObjectIdImageCpu._image;
+            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageMemoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+            vkCmdPipelineBarrier(
+                cmd,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &imageMemoryBarrier);
+        }
+    });
+
+    vkutils::immediate_submit(&engine._engineData, [&](VkCommandBuffer cmd) {
+        {
+            VkImageMemoryBarrier imageMemoryBarrier = {};
+            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageMemoryBarrier.image = gbufferNormalImageCpu._image;
+            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            imageMemoryBarrier.srcAccessMask = 0;
+            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+            vkCmdPipelineBarrier(
+                cmd,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &imageMemoryBarrier);
+        }
+
+        // Issue the copy command
+        VkImageCopy imageCopyRegion{};
+        imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageCopyRegion.srcSubresource.layerCount = 1;
+        imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageCopyRegion.dstSubresource.layerCount = 1;
+        imageCopyRegion.extent.width = imageSize.width;
+        imageCopyRegion.extent.height = imageSize.height;
+        imageCopyRegion.extent.depth = 1;
+
+        vkCmdCopyImage(
+            cmd,
+            gbufferNormalImage._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            gbufferNormalImageCpu._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1,
+            &imageCopyRegion);
+
+        // Transition destination image to general layout, which is the required layout for
+mapping the image memory later on
+        {
+            VkImageMemoryBarrier imageMemoryBarrier = {};
+            imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            imageMemoryBarrier.image = gbufferNormalImageCpu._image;
+            imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageMemoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+            vkCmdPipelineBarrier(
+                cmd,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &imageMemoryBarrier);
+        }
+        });
+
+    float* posObjectId = new float[imageSize.width * imageSize.height * 4];
+    float* normal = new float[imageSize.width * imageSize.height * 4];
+
+    {
+        VkImageSubresource subResource{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
+        VkSubresourceLayout subResourceLayout;
+        vkGetImageSubresourceLayout(engine._engineData.device,
+gbufferPosObjectIdImageCpu._image, &subResource, &subResourceLayout);
+
+        const char* data;
+        vmaMapMemory(engine._engineData.allocator, gbufferPosObjectIdImageCpu._allocation,
+(void**)&data); data += subResourceLayout.offset;
+
+        memcpy(posObjectId, data, imageSize.width* imageSize.height * 4 * sizeof(float));
+
+        vmaUnmapMemory(engine._engineData.allocator, gbufferPosObjectIdImageCpu._allocation);
+    }
+
+    {
+        VkImageSubresource subResource{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
+        VkSubresourceLayout subResourceLayout;
+        vkGetImageSubresourceLayout(engine._engineData.device, gbufferNormalImageCpu._image,
+&subResource, &subResourceLayout);
+
+        const char* data;
+        vmaMapMemory(engine._engineData.allocator, gbufferNormalImageCpu._allocation,
+(void**)&data); data += subResourceLayout.offset;
+
+        memcpy(normal, data, imageSize.width * imageSize.height * 4 * sizeof(float));
+
+        vmaUnmapMemory(engine._engineData.allocator, gbufferNormalImageCpu._allocation);
+    }
+    printf("----------\n");
+    for (int i = 0; i < lightmapResolution; i++) {
+        for (int j = 0; j < lightmapResolution; j++) {
+            int receiverId = j + i * lightmapResolution;
+            if (posObjectId[(receiverId) * 4 + 3] >= 0) {
+                _receivers[receiverId].exists = true;
+                _receivers[receiverId].uv = glm::ivec2(j, i);
+                _receivers[receiverId].position = { posObjectId[(receiverId) * 4 + 0],
+posObjectId[(receiverId) * 4 + 1], posObjectId[(receiverId) * 4 + 2] };
+                _receivers[receiverId].normal = { normal[(receiverId) * 4 + 0],
+normal[(receiverId) * 4 + 1], normal[(receiverId) * 4 + 2] }; _receivers[receiverId].objectId =
+posObjectId[(receiverId) * 4 + 3]; _receivers[receiverId].dPos = normal[(receiverId) * 4 + 3];
+            }
+        }
+    }
+
+    char* image = new char[lightmapResolution * lightmapResolution];
+    memset(image, 0, lightmapResolution* lightmapResolution);
+    for (int i = 0; i < lightmapResolution; i++) {
+        for (int j = 0; j < lightmapResolution; j++) {
+            if(posObjectId[(j + i * lightmapResolution) * 4 + 3] >= 0)
+            image[j + i * lightmapResolution] = 255;
+        }
+    }
+
+    FILE* ptr;
+    fopen_s(&ptr, "../precomputation/receiver_image.bin", "wb");
+    fwrite(image, lightmapResolution* lightmapResolution, 1, ptr);
+    fclose(ptr);
+    printf("Created receivers: %d!\n", receiverCounter);
+
+    return _receivers;
+}
+*/
+
+// Maybe instead of doing this, do that:
+// Do this in runtime (cast rays from each probe)
+// Then trace another ray from the hit location to light (to realize shadowing)
+// This might help me enabling reflections as well (perhaps)?
+void Precalculation::probe_raycast(VulkanEngine& engine, std::vector<glm::vec4>& probes,
+                                   int rays, GPUProbeRaycastResult* probeRaycastResult)
+{
+    RaytracingPipeline rtPipeline = {};
+    VkDescriptorSetLayout rtDescriptorSetLayout;
+    VkDescriptorSet rtDescriptorSet;
+
+    // We need a buffer where we store raytracing results
+    // material_id, u, v
+
+    // Descriptors: Acceleration structure, storage buffer to save results, Materials
+    VkDescriptorSetLayoutBinding tlasBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0);
+    VkDescriptorSetLayoutBinding sceneDescBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 1);
+    VkDescriptorSetLayoutBinding meshInfoBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 2);
+    VkDescriptorSetLayoutBinding probeLocationsBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 3);
+    VkDescriptorSetLayoutBinding outBuffer = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 4);
+    VkDescriptorSetLayoutBinding bindings[5] = {tlasBind, sceneDescBind, meshInfoBind,
+                                                probeLocationsBind, outBuffer};
+    VkDescriptorSetLayoutCreateInfo setinfo =
+        vkinit::descriptorset_layout_create_info(bindings, 5);
+    vkCreateDescriptorSetLayout(engine._engineData.device, &setinfo, nullptr,
+                                &rtDescriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocateInfo = vkinit::descriptorset_allocate_info(
+        engine._engineData.descriptorPool, &rtDescriptorSetLayout, 1);
+
+    vkAllocateDescriptorSets(engine._engineData.device, &allocateInfo, &rtDescriptorSet);
+
+    std::vector<VkWriteDescriptorSet> writes;
+
+    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
+    descASInfo.accelerationStructureCount = 1;
+    descASInfo.pAccelerationStructures = &engine._vulkanRaytracing.tlas.accel;
+    VkWriteDescriptorSet accelerationStructureWrite{};
+    accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    // The specialized acceleration structure descriptor has to be chained
+    accelerationStructureWrite.pNext = &descASInfo;
+    accelerationStructureWrite.dstSet = rtDescriptorSet;
+    accelerationStructureWrite.dstBinding = 0;
+    accelerationStructureWrite.descriptorCount = 1;
+    accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    writes.emplace_back(accelerationStructureWrite);
+
+    AllocatedBuffer sceneDescBuffer = vkutils::create_buffer(
+        engine._engineData.allocator, sizeof(GPUSceneDesc), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, rtDescriptorSet,
+                                        &sceneDescBuffer._descriptorBufferInfo, 1));
+
+    AllocatedBuffer meshInfoBuffer = vkutils::create_buffer(
+        engine._engineData.allocator,
+        sizeof(GPUMeshInfo) * engine.gltf_scene.prim_meshes.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &meshInfoBuffer._descriptorBufferInfo, 2));
+
+    AllocatedBuffer probeLocationsBuffer = vkutils::create_buffer(
+        engine._engineData.allocator, sizeof(glm::vec4) * probes.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &probeLocationsBuffer._descriptorBufferInfo, 3));
+
+    AllocatedBuffer outputBuffer = vkutils::create_buffer(
+        engine._engineData.allocator, rays * probes.size() * sizeof(GPUProbeRaycastResult),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &outputBuffer._descriptorBufferInfo, 4));
+
+    vkUpdateDescriptorSets(engine._engineData.device, static_cast<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
+
+    VkPipelineLayout pipelineLayout;
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+        vkinit::pipeline_layout_create_info(&rtDescriptorSetLayout, 1);
+    vkCreatePipelineLayout(engine._engineData.device, &pipelineLayoutCreateInfo, nullptr,
+                           &pipelineLayout);
+
+    Slice<uint32_t> probeRtRgen{};
+    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rgen", {},
+                                    probeRtRgen);
+
+    Slice<uint32_t> probeRtRmiss{};
+    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rmiss",
+                                    {}, probeRtRmiss);
+
+    Slice<uint32_t> probeRtRchit{};
+    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rchit",
+                                    {}, probeRtRchit);
+
+    engine._vulkanRaytracing.create_new_pipeline(rtPipeline, pipelineLayout, probeRtRgen,
+                                                 probeRtRmiss, probeRtRchit);
+
+    {
+        GPUSceneDesc desc = {};
+        VkBufferDeviceAddressInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+
+        info.buffer = engine._sceneData.vertexBuffer._buffer;
+        desc.vertexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.normalBuffer._buffer;
+        desc.normalAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.texBuffer._buffer;
+        desc.uvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.indexBuffer._buffer;
+        desc.indexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.lightmapTexBuffer._buffer;
+        desc.lightmapUvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        vkutils::cpu_to_gpu(engine._engineData.allocator, sceneDescBuffer, &desc,
+                            sizeof(GPUSceneDesc));
+    }
+
+    {
+        vkutils::cpu_to_gpu(engine._engineData.allocator, probeLocationsBuffer, probes.data(),
+                            sizeof(glm::vec4) * probes.size());
+    }
+
+    {
+        void* data;
+        vmaMapMemory(engine._engineData.allocator, meshInfoBuffer._allocation, &data);
+        GPUMeshInfo* dataMesh = (GPUMeshInfo*)data;
+        for (int i = 0; i < engine.gltf_scene.prim_meshes.size(); i++)
+        {
+            dataMesh[i].indexOffset = engine.gltf_scene.prim_meshes[i].first_idx;
+            dataMesh[i].vertexOffset = engine.gltf_scene.prim_meshes[i].vtx_offset;
+            dataMesh[i].materialIndex = engine.gltf_scene.prim_meshes[i].material_idx;
+        }
+        vmaUnmapMemory(engine._engineData.allocator, meshInfoBuffer._allocation);
+    }
+
+    {
+        VkCommandBuffer cmdBuf = vkutils::create_command_buffer(
+            engine._engineData.device, engine._vulkanRaytracing._raytracingContext.commandPool,
+            true);
+        std::vector<VkDescriptorSet> descSets{rtDescriptorSet};
+        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipeline.pipeline);
+        vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout,
+                                0, (uint32_t)descSets.size(), descSets.data(), 0, nullptr);
+        vkCmdTraceRaysKHR(cmdBuf, &rtPipeline.rgenRegion, &rtPipeline.missRegion,
+                          &rtPipeline.hitRegion, &rtPipeline.callRegion, rays, probes.size(),
+                          1);
+        vkutils::submit_and_free_command_buffer(
+            engine._engineData.device, engine._vulkanRaytracing._raytracingContext.commandPool,
+            cmdBuf, engine._vulkanRaytracing._queue,
+            engine._vulkanRaytracing._raytracingContext.fence);
+    }
+
+    void* mappedOutputData;
+    vmaMapMemory(engine._engineData.allocator, outputBuffer._allocation, &mappedOutputData);
+    // printf("Ray cast result: %d\n", ((ProbeRaycastResult*)data)[i].objectId);
+    memcpy(probeRaycastResult, mappedOutputData,
+           rays * probes.size() * sizeof(GPUProbeRaycastResult));
+    vmaUnmapMemory(engine._engineData.allocator, outputBuffer._allocation);
+
+    engine._vulkanRaytracing.destroy_raytracing_pipeline(rtPipeline);
+
+    vmaDestroyBuffer(engine._engineData.allocator, sceneDescBuffer._buffer,
+                     sceneDescBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, meshInfoBuffer._buffer,
+                     meshInfoBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, probeLocationsBuffer._buffer,
+                     probeLocationsBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, outputBuffer._buffer,
+                     outputBuffer._allocation);
+    vkDestroyDescriptorSetLayout(engine._engineData.device, rtDescriptorSetLayout, nullptr);
+}
+
+void Precalculation::receiver_raycast(
+    VulkanEngine& engine, const ReceiverStore& receivers, std::vector<AABB>& aabbClusters,
+    std::vector<glm::vec4>& probes, int rays, float radius, int sphericalHarmonicsOrder,
+    int clusterCoefficientCount, int maxReceivers, int totalReceiverCount,
+    int maxProbesPerCluster, float** clusterProjectionMatrices,
+    float** receiverCoefficientMatrices, const std::vector<int>& receiverProbeWeightOffsets,
+    const std::vector<GPUReceiverProbeWeight>& receiverProbeWeights,
+    int* projectionMatricesSize, int* reconstructionMatricesSize)
+{
+    printf("About to start receiver raycasting...\n");
+
+    int shNumCoeff = SPHERICAL_HARMONICS_NUM_COEFF(sphericalHarmonicsOrder);
+    int maxReceiverInABatch = MIN(64, maxReceivers);
+
+    RaytracingPipeline rtPipeline = {};
+    VkDescriptorSetLayout rtDescriptorSetLayout;
+    VkDescriptorSet rtDescriptorSet;
+
+    // Descriptors: Acceleration structure, storage buffer to save results, Materials
+    VkDescriptorSetLayoutBinding tlasBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0);
+    VkDescriptorSetLayoutBinding sceneDescBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 1);
+    VkDescriptorSetLayoutBinding meshInfoBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 2);
+    VkDescriptorSetLayoutBinding probeLocationsBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 3);
+    VkDescriptorSetLayoutBinding receiverLocationsBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 4);
+    VkDescriptorSetLayoutBinding outBuffer = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 5);
+    VkDescriptorSetLayoutBinding weightBuffer = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 6);
+    VkDescriptorSetLayoutBinding clusterProbesBind = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 7);
+    VkDescriptorSetLayoutBinding weightOffsetBuffer = vkinit::descriptorset_layout_binding(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 8);
+    VkDescriptorSetLayoutBinding bindings[9] = {
+        tlasBind,  sceneDescBind, meshInfoBind,      probeLocationsBind, receiverLocationsBind,
+        outBuffer, weightBuffer,  clusterProbesBind, weightOffsetBuffer};
+    VkDescriptorSetLayoutCreateInfo setinfo =
+        vkinit::descriptorset_layout_create_info(bindings, 9);
+    vkCreateDescriptorSetLayout(engine._engineData.device, &setinfo, nullptr,
+                                &rtDescriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocateInfo = vkinit::descriptorset_allocate_info(
+        engine._engineData.descriptorPool, &rtDescriptorSetLayout, 1);
+
+    vkAllocateDescriptorSets(engine._engineData.device, &allocateInfo, &rtDescriptorSet);
+
+    std::vector<VkWriteDescriptorSet> writes;
+
+    VkWriteDescriptorSetAccelerationStructureKHR descASInfo{
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR};
+    descASInfo.accelerationStructureCount = 1;
+    descASInfo.pAccelerationStructures = &engine._vulkanRaytracing.tlas.accel;
+    VkWriteDescriptorSet accelerationStructureWrite{};
+    accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    // The specialized acceleration structure descriptor has to be chained
+    accelerationStructureWrite.pNext = &descASInfo;
+    accelerationStructureWrite.dstSet = rtDescriptorSet;
+    accelerationStructureWrite.dstBinding = 0;
+    accelerationStructureWrite.descriptorCount = 1;
+    accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    writes.emplace_back(accelerationStructureWrite);
+
+    AllocatedBuffer sceneDescBuffer = vkutils::create_buffer(
+        engine._engineData.allocator, sizeof(GPUSceneDesc), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, rtDescriptorSet,
+                                        &sceneDescBuffer._descriptorBufferInfo, 1));
+
+    AllocatedBuffer meshInfoBuffer = vkutils::create_buffer(
+        engine._engineData.allocator,
+        sizeof(GPUMeshInfo) * engine.gltf_scene.prim_meshes.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &meshInfoBuffer._descriptorBufferInfo, 2));
+
+    AllocatedBuffer probeLocationsBuffer = vkutils::create_buffer(
+        engine._engineData.allocator, sizeof(glm::vec4) * probes.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &probeLocationsBuffer._descriptorBufferInfo, 3));
+
+    AllocatedBuffer receiverLocationsBuffer = vkutils::create_buffer(
+        engine._engineData.allocator,
+        sizeof(GPUReceiverData) * maxReceivers * (TEXEL_SAMPLES * TEXEL_SAMPLES),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &receiverLocationsBuffer._descriptorBufferInfo, 4));
+
+    AllocatedBuffer outputBuffer = vkutils::create_buffer(
+        engine._engineData.allocator,
+        maxReceiverInABatch * rays * maxProbesPerCluster * sizeof(GPUReceiverRaycastResult),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &outputBuffer._descriptorBufferInfo, 5));
+
+    // Only the nonzero weights are uploaded, the shaders skip the probes without one
+    AllocatedBuffer receiverProbeWeightsBuffer = vkutils::create_upload_buffer(
+        &engine._engineData, receiverProbeWeights.data(),
+        sizeof(GPUReceiverProbeWeight) * receiverProbeWeights.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    writes.emplace_back(vkinit::write_descriptor_buffer(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+        &receiverProbeWeightsBuffer._descriptorBufferInfo, 6));
+
+    AllocatedBuffer receiverProbeWeightOffsetsBuffer = vkutils::create_upload_buffer(
+        &engine._engineData, receiverProbeWeightOffsets.data(),
+        sizeof(int) * receiverProbeWeightOffsets.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    writes.emplace_back(vkinit::write_descriptor_buffer(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+        &receiverProbeWeightOffsetsBuffer._descriptorBufferInfo, 8));
+
+    AllocatedBuffer clusterProbesBuffer = vkutils::create_buffer(
+        engine._engineData.allocator, sizeof(int) * maxProbesPerCluster,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    writes.emplace_back(
+        vkinit::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, rtDescriptorSet,
+                                        &clusterProbesBuffer._descriptorBufferInfo, 7));
+
+    PrecalculateReceiverMatrixConfig matrixConfig = {};
+    matrixConfig.basisFunctionCount = shNumCoeff;
+    matrixConfig.rayCount = rays;
+    matrixConfig.totalProbeCount = probes.size();
+    matrixConfig.maxProbesPerCluster = maxProbesPerCluster;
+
+    AllocatedBuffer receiverMatrixConfig = vkutils::create_upload_buffer(
+        &engine._engineData, &matrixConfig, sizeof(PrecalculateReceiverMatrixConfig),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    AllocatedBuffer matrixBuffer = vkutils::create_buffer(
+        engine._engineData.allocator,
+        maxReceiverInABatch * maxProbesPerCluster * shNumCoeff * sizeof(float),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    AllocatedBuffer matrixBufferCPU = vkutils::create_buffer(
+        engine._engineData.allocator,
+        maxReceiverInABatch * maxProbesPerCluster * shNumCoeff * sizeof(float),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_CPU_ONLY);
+
+    vkUpdateDescriptorSets(engine._engineData.device, static_cast<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+        vkinit::pipeline_layout_create_info(&rtDescriptorSetLayout, 1);
+
+    VkPushConstantRange pushConstantRanges = {VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0,
+                                              sizeof(int) * 4};
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRanges;
+
+    VkPipelineLayout pipelineLayout;
+    vkCreatePipelineLayout(engine._engineData.device, &pipelineLayoutCreateInfo, nullptr,
+                           &pipelineLayout);
+
+    Slice<uint32_t> receiverRtRgen{};
+    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_receiver_rt.rgen",
+                                    {}, receiverRtRgen);
+
+    Slice<uint32_t> receiverRtRmiss{};
+    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rmiss",
+                                    {}, receiverRtRmiss);
+
+    Slice<uint32_t> receiverRtRchit{};
+    engine._shaderManager.get_spirv("../shaders/precomputation/precalculate_probe_rt.rchit",
+                                    {}, receiverRtRchit);
+
+    engine._vulkanRaytracing.create_new_pipeline(rtPipeline, pipelineLayout, receiverRtRgen,
+                                                 receiverRtRmiss, receiverRtRchit);
+
+    ComputeInstance matrixCompute = {};
+    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::UNIFORM,
+                                             receiverMatrixConfig);
+    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
+                                             outputBuffer);
+    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
+                                             receiverProbeWeightOffsetsBuffer);
+    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
+                                             receiverProbeWeightsBuffer);
+    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
+                                             clusterProbesBuffer);
+    engine._vulkanCompute.add_buffer_binding(matrixCompute, ComputeBufferType::STORAGE,
+                                             matrixBuffer);
+
+    Slice<uint32_t> spirvConstructReceiverMatrix{};
+    engine._shaderManager.get_spirv(
+        "../shaders/precomputation/precalculate_construct_receiver_matrix.comp", {},
+        spirvConstructReceiverMatrix);
+
+    engine._vulkanCompute.build(matrixCompute, engine._engineData.descriptorPool,
+                                spirvConstructReceiverMatrix);
+
+    {
+        GPUSceneDesc desc = {};
+        VkBufferDeviceAddressInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+
+        info.buffer = engine._sceneData.vertexBuffer._buffer;
+        desc.vertexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.normalBuffer._buffer;
+        desc.normalAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.texBuffer._buffer;
+        desc.uvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.indexBuffer._buffer;
+        desc.indexAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        info.buffer = engine._sceneData.lightmapTexBuffer._buffer;
+        desc.lightmapUvAddress = vkGetBufferDeviceAddress(engine._engineData.device, &info);
+
+        vkutils::cpu_to_gpu(engine._engineData.allocator, sceneDescBuffer, &desc,
+                            sizeof(GPUSceneDesc));
+    }
+
+    {
+        vkutils::cpu_to_gpu(engine._engineData.allocator, probeLocationsBuffer, probes.data(),
+                            sizeof(glm::vec4) * probes.size());
+    }
+
+    {
+        void* data;
+        vmaMapMemory(engine._engineData.allocator, meshInfoBuffer._allocation, &data);
+        GPUMeshInfo* dataMesh = (GPUMeshInfo*)data;
+        for (int i = 0; i < engine.gltf_scene.prim_meshes.size(); i++)
+        {
+            dataMesh[i].indexOffset = engine.gltf_scene.prim_meshes[i].first_idx;
+            dataMesh[i].vertexOffset = engine.gltf_scene.prim_meshes[i].vtx_offset;
+            dataMesh[i].materialIndex = engine.gltf_scene.prim_meshes[i].material_idx;
+        }
+        vmaUnmapMemory(engine._engineData.allocator, meshInfoBuffer._allocation);
+    }
+
+    int receiverOffset = 0;
+    int probeOffset = 0;
+
+    std::vector<CompressedCluster> compressed(aabbClusters.size());
+    PcaArena arena;
+    ScratchBuffer transferBuffer(PRECALCULATION_SCRATCH_DIRECTORY, TRANSFER_SCRATCH_THRESHOLD);
+
+    for (int nodeIndex = 0; nodeIndex < aabbClusters.size(); nodeIndex++)
+    {
+        printf("Starting node: %d with max probes: %d and receivers: %d\n", nodeIndex,
+               aabbClusters[nodeIndex].probes.size(),
+               aabbClusters[nodeIndex].receivers.size());
+        auto start = std::chrono::system_clock::now();
+        BakeProfileZone traceZone("trace_cluster");
+        traceZone.add_items((int64_t)aabbClusters[nodeIndex].receivers.size() * rays);
+
+        // Every row is copied back from the GPU, so the matrix is not cleared first
+        size_t rowSize = shNumCoeff * aabbClusters[nodeIndex].probes.size();
+        size_t matrixCount = aabbClusters[nodeIndex].receivers.size() * rowSize;
+        float* clusterMatrix = transferBuffer.allocate(matrixCount);
+
+        {
+            void* data;
+            vmaMapMemory(engine._engineData.allocator, receiverLocationsBuffer._allocation,
+                         &data);
+            GPUReceiverData* dataReceiver = (GPUReceiverData*)data;
+            for (int i = 0; i < aabbClusters[nodeIndex].receivers.size(); i++)
+            {
+                int receiver = aabbClusters[nodeIndex].receivers[i];
+                for (int j = 0; j < receivers.sample_count(receiver); j++)
+                {
+                    GPUReceiverData& sample =
+                        dataReceiver[i * (TEXEL_SAMPLES * TEXEL_SAMPLES) + j];
+                    receivers.get_sample(receiver, j, sample.pos, sample.normal);
+                    sample.objectId = receivers.objectIds[receiver];
+                    sample.dPos = receivers.sample_count(receiver);
+                }
+            }
+
+            vmaUnmapMemory(engine._engineData.allocator, receiverLocationsBuffer._allocation);
+        }
+
+        vkutils::cpu_to_gpu(engine._engineData.allocator, clusterProbesBuffer,
+                            aabbClusters[nodeIndex].probes.data(),
+                            sizeof(int) * aabbClusters[nodeIndex].probes.size());
+
+        for (int i = 0; i < aabbClusters[nodeIndex].receivers.size(); i += maxReceiverInABatch)
+        {
+            int remaningSize =
+                MIN(aabbClusters[nodeIndex].receivers.size() - i, maxReceiverInABatch);
+
+            // printf("Batch size: %d\n I is %d\n", remaningSize, i);
+
+            {
+                matrixConfig.receiverOffset = receiverOffset;
+                matrixConfig.batchOffset = i;
+                matrixConfig.batchSize = remaningSize;
+                matrixConfig.clusterProbeCount = aabbClusters[nodeIndex].probes.size();
+                vkutils::cpu_to_gpu(engine._engineData.allocator, receiverMatrixConfig,
+                                    &matrixConfig, sizeof(PrecalculateReceiverMatrixConfig));
+                int probeCount = aabbClusters[nodeIndex].probes.size();
+                VkCommandBuffer cmdBuf = vkutils::create_command_buffer(
+                    engine._engineData.device,
+                    engine._vulkanRaytracing._raytracingContext.commandPool, true);
+                std::vector<VkDescriptorSet> descSets{rtDescriptorSet};
+                vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                                  rtPipeline.pipeline);
+                vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                                        pipelineLayout, 0, (uint32_t)descSets.size(),
+                                        descSets.data(), 0, nullptr);
+
+                int pushConstantVariables[4] = {
+                    static_cast<int>(aabbClusters[nodeIndex].probes.size()), i,
+                    receiverOffset, remaningSize};
+
+                vkCmdPushConstants(cmdBuf, pipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0,
+                                   sizeof(int) * 4, pushConstantVariables);
+                vkCmdTraceRaysKHR(cmdBuf, &rtPipeline.rgenRegion, &rtPipeline.missRegion,
+                                  &rtPipeline.hitRegion, &rtPipeline.callRegion,
+                                  maxReceiverInABatch, rays, 1);
+                {
+                    VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+                    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+                    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                                         &memoryBarrier, 0, nullptr, 0, nullptr);
+                }
+                // compute shader
+                {
+                    int groupcount = ((probeCount * remaningSize) / 256) + 1;
+                    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                      matrixCompute.pipeline);
+                    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                            matrixCompute.pipelineLayout, 0, 1,
+                                            &matrixCompute.descriptorSet, 0, nullptr);
+                    vkCmdDispatch(cmdBuf, groupcount, 1, 1);
+                }
+
+                {
+                    VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+                    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                    memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+                    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier,
+                                         0, nullptr, 0, nullptr);
+                }
+
+                VkBufferCopy cpy;
+                cpy.size = maxReceiverInABatch * aabbClusters[nodeIndex].probes.size() *
+                           shNumCoeff * sizeof(float);
+                cpy.srcOffset = 0;
+                cpy.dstOffset = 0;
+
+                vkCmdCopyBuffer(cmdBuf, matrixBuffer._buffer, matrixBufferCPU._buffer, 1,
+                                &cpy);
+
+                vkutils::submit_and_free_command_buffer(
+                    engine._engineData.device,
+                    engine._vulkanRaytracing._raytracingContext.commandPool, cmdBuf,
+                    engine._vulkanRaytracing._queue,
+                    engine._vulkanRaytracing._raytracingContext.fence);
+            }
+
+            void* mappedOutputData;
+            vmaMapMemory(engine._engineData.allocator, matrixBufferCPU._allocation,
+                         &mappedOutputData);
+            memcpy(clusterMatrix + i * rowSize, mappedOutputData,
+                   remaningSize * rowSize * sizeof(float));
+            vmaUnmapMemory(engine._engineData.allocator, matrixBufferCPU._allocation);
+            transferBuffer.evict(i * rowSize, remaningSize * rowSize);
+        }
+
+        traceZone.end();
+
+        compress_cluster(aabbClusters[nodeIndex], clusterMatrix, shNumCoeff,
+                         clusterCoefficientCount, arena, compressed[nodeIndex]);
+        transferBuffer.evict(0, matrixCount);
+
+        receiverOffset += aabbClusters[nodeIndex].receivers.size();
+        probeOffset += aabbClusters[nodeIndex].probes.size();
+
+        auto end = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_seconds = end - start;
+        printf("Node tracing done %d/%d (took %f s). Split into %d clusters\n\n", nodeIndex,
+               aabbClusters.size(), elapsed_seconds.count(),
+               (int)compressed[nodeIndex].clusters.size());
+    }
+
+    std::vector<AABB> newClusters;
+    float maxError;
+    gather_compressed_clusters(compressed, newClusters, clusterProjectionMatrices,
+                               receiverCoefficientMatrices, projectionMatricesSize,
+                               reconstructionMatricesSize, &maxError);
+    aabbClusters = newClusters;
+
+    printf("New cluster count: %d\n", (int)newClusters.size());
+    printf("Max singular value error: %f\n", maxError);
+
+    engine._vulkanRaytracing.destroy_raytracing_pipeline(rtPipeline);
+
+    vmaDestroyBuffer(engine._engineData.allocator, sceneDescBuffer._buffer,
+                     sceneDescBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, meshInfoBuffer._buffer,
+                     meshInfoBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, probeLocationsBuffer._buffer,
+                     probeLocationsBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, receiverLocationsBuffer._buffer,
+                     probeLocationsBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, outputBuffer._buffer,
+                     outputBuffer._allocation);
+
+    vmaDestroyBuffer(engine._engineData.allocator, receiverMatrixConfig._buffer,
+                     receiverMatrixConfig._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, receiverProbeWeightsBuffer._buffer,
+                     receiverProbeWeightsBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, receiverProbeWeightOffsetsBuffer._buffer,
+                     receiverProbeWeightOffsetsBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, matrixBuffer._buffer,
+                     matrixBuffer._allocation);
+    vmaDestroyBuffer(engine._engineData.allocator, matrixBufferCPU._buffer,
+                     matrixBufferCPU._allocation);
+
+    vkDestroyDescriptorSetLayout(engine._engineData.device, rtDescriptorSetLayout, nullptr);
+}
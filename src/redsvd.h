@@ -31,66 +31,115 @@
 #include <Eigen/Sparse>
 
 #include <cmath>
-#include <cstdlib>
+#include <cstdint>
 
 namespace RedSVD
 {
-template <typename Scalar> inline void sample_gaussian(Scalar& x, Scalar& y)
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel Random Numbers: As Easy as
+// 1, 2, 3"). A block of four words only depends on the seed and the block index, so every
+// decomposition owns its sequence and the result does not depend on which thread runs it.
+class Philox4x32
 {
-    using std::cos;
-    using std::log;
-    using std::sin;
-    using std::sqrt;
-
-    const Scalar PI(3.1415926535897932384626433832795028841971693993751);
-
-    Scalar v1 = (Scalar)(std::rand() + Scalar(1)) / ((Scalar)RAND_MAX + Scalar(2));
-    Scalar v2 = (Scalar)(std::rand() + Scalar(1)) / ((Scalar)RAND_MAX + Scalar(2));
-    Scalar len = sqrt(Scalar(-2) * log(v1));
-    x = len * cos(Scalar(2) * PI * v2);
-    y = len * sin(Scalar(2) * PI * v2);
-}
+public:
+    explicit Philox4x32(uint64_t seed = 0)
+        : m_key{(uint32_t)seed, (uint32_t)(seed >> 32)}
+    {
+    }
 
-template <typename MatrixType> inline void sample_gaussian(MatrixType& mat)
-{
-    typedef typename MatrixType::Index Index;
+    void block(uint64_t counter, uint32_t out[4]) const
+    {
+        uint32_t c[4] = {(uint32_t)counter, (uint32_t)(counter >> 32), 0, 0};
+        uint32_t k0 = m_key[0];
+        uint32_t k1 = m_key[1];
+
+        for (int round = 0; round < 10; ++round)
+        {
+            uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+            uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c[1] ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c[3] ^ k1;
+            c[1] = (uint32_t)p1;
+            c[3] = (uint32_t)p0;
+            c[0] = n0;
+            c[2] = n2;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
 
-    for (Index i = 0; i < mat.rows(); ++i)
+        for (int i = 0; i < 4; ++i)
+            out[i] = c[i];
+    }
+
+    // Advances the sequence by the given number of blocks
+    uint64_t take(uint64_t blocks)
     {
-        for (Index j = 0; j + 1 < mat.cols(); j += 2)
-            sample_gaussian(mat(i, j), mat(i, j + 1));
-        if (mat.cols() % 2)
-            sample_gaussian(mat(i, mat.cols() - 1), mat(i, mat.cols() - 1));
+        uint64_t first = m_counter;
+        m_counter += blocks;
+        return first;
     }
-}
 
-template <typename MatrixType> inline void gram_schmidt(MatrixType& mat)
+private:
+    uint32_t m_key[2];
+    uint64_t m_counter = 0;
+};
+
+// Fills a matrix with standard normal samples, column major. Every Philox block gives four
+// uniforms that are turned into two Box-Muller pairs at once.
+template <typename MatrixType> inline void sample_gaussian(MatrixType& mat, Philox4x32& rng)
 {
     typedef typename MatrixType::Scalar Scalar;
     typedef typename MatrixType::Index Index;
 
-    static const Scalar EPS(1E-4);
+    const Scalar TWO_PI(6.2831853071795864769252867665590057683943387987502);
+    const Scalar SCALE(1.0 / 4294967296.0);
+
+    Index size = mat.rows() * mat.cols();
+    Index blocks = (size + 3) / 4;
+    uint64_t first = rng.take(blocks);
 
-    for (Index i = 0; i < mat.cols(); ++i)
+    for (Index b = 0; b < blocks; ++b)
     {
-        for (Index j = 0; j < i; ++j)
+        uint32_t words[4];
+        rng.block(first + b, words);
+
+        // Uniforms in (0, 1)
+        Scalar u[4];
+        for (int i = 0; i < 4; ++i)
+            u[i] = ((Scalar)words[i] + Scalar(0.5)) * SCALE;
+
+        Scalar g[4];
+        for (int i = 0; i < 2; ++i)
         {
-            Scalar r = mat.col(i).dot(mat.col(j));
-            mat.col(i) -= r * mat.col(j);
+            Scalar len = std::sqrt(Scalar(-2) * std::log(u[2 * i]));
+            g[2 * i] = len * std::cos(TWO_PI * u[2 * i + 1]);
+            g[2 * i + 1] = len * std::sin(TWO_PI * u[2 * i + 1]);
         }
 
-        Scalar norm = mat.col(i).norm();
-
-        if (norm < EPS)
+        for (int i = 0; i < 4 && b * 4 + i < size; ++i)
         {
-            for (Index k = i; k < mat.cols(); ++k)
-                mat.col(k).setZero();
-            return;
+            Index index = b * 4 + i;
+            mat(index % mat.rows(), index / mat.rows()) = g[i];
         }
-        mat.col(i) /= norm;
     }
 }
 
+// Replaces the columns of mat with an orthonormal basis of their span
+template <typename MatrixType> inline void orthonormalize(MatrixType& mat)
+{
+    Eigen::HouseholderQR<MatrixType> qr(mat);
+    mat = qr.householderQ() * MatrixType::Identity(mat.rows(), mat.cols());
+}
+
+struct Options
+{
+    // Extra random samples beyond the rank, improves the accuracy of the last vectors
+    int oversampling = 0;
+    // Multiplications with A * A^T after the first sample, separates the singular values
+    // when they decay slowly
+    int powerIterations = 0;
+    uint64_t seed = 0;
+};
+
 template <typename _MatrixType> class RedSVD
 {
 public:
@@ -110,66 +159,62 @@ public:
         compute(A, r);
     }
 
-    RedSVD(const MatrixType& A, const Index rank)
+    RedSVD(const MatrixType& A, const Index rank, const Options& options = Options())
     {
-        compute(A, rank);
+        compute(A, rank, options);
     }
 
-    void compute(const MatrixType& A, const Index rank)
+    void compute(const MatrixType& A, const Index rank, const Options& options = Options())
     {
         if (A.cols() == 0 || A.rows() == 0)
             return;
 
-        Index r = (rank < A.cols()) ? rank : A.cols();
+        Index maxRank = (A.rows() < A.cols()) ? A.rows() : A.cols();
+        Index r = (rank < maxRank) ? rank : maxRank;
+        Index samples = r + options.oversampling;
+        samples = (samples < maxRank) ? samples : maxRank;
 
-        r = (r < A.rows()) ? r : A.rows();
+        Philox4x32 rng(options.seed);
 
         // Gaussian Random Matrix for A^T
-        DenseMatrix O(A.rows(), r);
-        sample_gaussian(O);
+        DenseMatrix O(A.rows(), samples);
+        sample_gaussian(O, rng);
 
-        // Compute Sample Matrix of A^T
+        // Range(Y) approximates Range(A^T)
         DenseMatrix Y = A.transpose() * O;
+        orthonormalize(Y);
 
-        // Orthonormalize Y
-        gram_schmidt(Y);
+        for (int i = 0; i < options.powerIterations; ++i)
+        {
+            DenseMatrix Z = A * Y;
+            orthonormalize(Z);
+            Y = A.transpose() * Z;
+            orthonormalize(Y);
+        }
 
-        // Range(B) = Range(A^T)
+        // A ~= B * Y^T
         DenseMatrix B = A * Y;
 
-        // Gaussian Random Matrix
-        DenseMatrix P(B.cols(), r);
-        sample_gaussian(P);
-
-        // Compute Sample Matrix of B
-        DenseMatrix Z = B * P;
-
-        // Orthonormalize Z
-        gram_schmidt(Z);
-
-        // Range(C) = Range(B)
-        DenseMatrix C = Z.transpose() * B;
+        Eigen::JacobiSVD<DenseMatrix> svdOfB(B, Eigen::ComputeThinU | Eigen::ComputeThinV);
 
-        Eigen::JacobiSVD<DenseMatrix> svdOfC(C, Eigen::ComputeThinU | Eigen::ComputeThinV);
-
-        // C = USV^T
-        // A = Z * U * S * V^T * Y^T()
-        m_matrixU = Z * svdOfC.matrixU();
-        m_vectorS = svdOfC.singularValues();
-        m_matrixV = Y * svdOfC.matrixV();
+        // B = USV^T
+        // A = U * S * (Y * V)^T
+        m_matrixU = svdOfB.matrixU().leftCols(r);
+        m_vectorS = svdOfB.singularValues().head(r);
+        m_matrixV = Y * svdOfB.matrixV().leftCols(r);
     }
 
-    DenseMatrix matrixU() const
+    const DenseMatrix& matrixU() const
     {
         return m_matrixU;
     }
 
-    ScalarVector singularValues() const
+    const ScalarVector& singularValues() const
     {
         return m_vectorS;
     }
 
-    DenseMatrix matrixV() const
+    const DenseMatrix& matrixV() const
     {
         return m_matrixV;
     }
@@ -199,43 +244,51 @@ public:
         compute(A, r);
     }
 
-    RedSymEigen(const MatrixType& A, const Index rank)
+    RedSymEigen(const MatrixType& A, const Index rank, const Options& options = Options())
     {
-        compute(A, rank);
+        compute(A, rank, options);
     }
 
-    void compute(const MatrixType& A, const Index rank)
+    void compute(const MatrixType& A, const Index rank, const Options& options = Options())
     {
         if (A.cols() == 0 || A.rows() == 0)
             return;
 
         Index r = (rank < A.cols()) ? rank : A.cols();
-
         r = (r < A.rows()) ? r : A.rows();
+        Index samples = r + options.oversampling;
+        samples = (samples < A.cols()) ? samples : A.cols();
+
+        Philox4x32 rng(options.seed);
 
         // Gaussian Random Matrix
-        DenseMatrix O(A.rows(), r);
-        sample_gaussian(O);
+        DenseMatrix O(A.rows(), samples);
+        sample_gaussian(O, rng);
 
         // Compute Sample Matrix of A
         DenseMatrix Y = A.transpose() * O;
+        orthonormalize(Y);
 
-        // Orthonormalize Y
-        gram_schmidt(Y);
+        for (int i = 0; i < options.powerIterations; ++i)
+        {
+            Y = A * Y;
+            orthonormalize(Y);
+        }
 
         DenseMatrix B = Y.transpose() * A * Y;
         Eigen::SelfAdjointEigenSolver<DenseMatrix> eigenOfB(B);
 
-        m_eigenvalues = eigenOfB.eigenvalues();
-        m_eigenvectors = Y * eigenOfB.eigenvectors();
+        // Eigenvalues are ascending, keep the r largest
+        m_eigenvalues = eigenOfB.eigenvalues().tail(r);
+        m_eigenvectors = Y * eigenOfB.eigenvectors().rightCols(r);
     }
 
-    ScalarVector eigenvalues() const
+    const ScalarVector& eigenvalues() const
     {
         return m_eigenvalues;
     }
 
-    DenseMatrix eigenvectors() const
+    const DenseMatrix& eigenvectors() const
     {
         return m_eigenvectors;
     }
@@ -264,27 +317,27 @@ public:
         compute(A, r);
     }
 
-    RedPCA(const MatrixType& A, const Index rank)
+    RedPCA(const MatrixType& A, const Index rank, const Options& options = Options())
     {
-        compute(A, rank);
+        compute(A, rank, options);
     }
 
-    void compute(const DenseMatrix& A, const Index rank)
+    void compute(const DenseMatrix& A, const Index rank, const Options& options = Options())
     {
-        RedSVD<MatrixType> redsvd(A, rank);
+        RedSVD<MatrixType> redsvd(A, rank, options);
 
-        ScalarVector S = redsvd.singularValues();
+        const ScalarVector& S = redsvd.singularValues();
 
         m_components = redsvd.matrixV();
         m_scores = redsvd.matrixU() * S.asDiagonal();
     }
 
-    DenseMatrix components() const
+    const DenseMatrix& components() const
     {
         return m_components;
     }
 
-    DenseMatrix scores() const
+    const DenseMatrix& scores() const
     {
         return m_scores;
     }
@@ -2,6 +2,7 @@
 
 #include "vk_rendergraph_types.h"
 #include <span>
+#include <string.h>
 
 namespace Vrg
 {
@@ -0,0 +1,108 @@
+#include "vk_command_recorder.h"
+
+#include <vk_utils.h>
+
+using namespace Vrg;
+
+VulkanCommandRecorder::VulkanCommandRecorder(EngineData* _engineData, VulkanTimer* _timer)
+{
+    engineData = _engineData;
+    timer = _timer;
+}
+
+void VulkanCommandRecorder::begin_pass(VkCommandBuffer cmd, const std::string& name)
+{
+    timer->start_recording(*engineData, cmd, name);
+}
+
+void VulkanCommandRecorder::end_pass(VkCommandBuffer cmd)
+{
+    timer->stop_recording(*engineData, cmd);
+}
+
+void VulkanCommandRecorder::pipeline_barrier(VkCommandBuffer cmd,
+                                             const VkDependencyInfo& dependencyInfo)
+{
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+void VulkanCommandRecorder::bind_pipeline(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                                          VkPipeline pipeline)
+{
+    vkCmdBindPipeline(cmd, bindPoint, pipeline);
+}
+
+void VulkanCommandRecorder::bind_descriptor_sets(VkCommandBuffer cmd,
+                                                 VkPipelineBindPoint bindPoint,
+                                                 VkPipelineLayout layout, uint32_t setCount,
+                                                 const VkDescriptorSet* descriptorSets)
+{
+    vkCmdBindDescriptorSets(cmd, bindPoint, layout, 0, setCount, descriptorSets, 0, nullptr);
+}
+
+void VulkanCommandRecorder::push_constants(VkCommandBuffer cmd, VkPipelineLayout layout,
+                                           uint32_t size, const void* data)
+{
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_ALL, 0, size, data);
+}
+
+void VulkanCommandRecorder::bind_vertex_buffers(VkCommandBuffer cmd, uint32_t bufferCount,
+                                                const VkBuffer* buffers)
+{
+    VkDeviceSize offsets[16] = {};
+    vkCmdBindVertexBuffers(cmd, 0, bufferCount, buffers, offsets);
+}
+
+void VulkanCommandRecorder::bind_index_buffer(VkCommandBuffer cmd, VkBuffer buffer)
+{
+    // TODO: support different index types
+    vkCmdBindIndexBuffer(cmd, buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void VulkanCommandRecorder::set_viewport_scissor(VkCommandBuffer cmd, VkExtent2D extent)
+{
+    vkutils::cmd_viewport_scissor(cmd, extent);
+}
+
+void VulkanCommandRecorder::begin_rendering(VkCommandBuffer cmd,
+                                            const VkRenderingInfo& renderingInfo)
+{
+    vkCmdBeginRendering(cmd, &renderingInfo);
+}
+
+void VulkanCommandRecorder::end_rendering(VkCommandBuffer cmd)
+{
+    vkCmdEndRendering(cmd);
+}
+
+void VulkanCommandRecorder::dispatch(VkCommandBuffer cmd, uint32_t x, uint32_t y, uint32_t z)
+{
+    vkCmdDispatch(cmd, x, y, z);
+}
+
+void VulkanCommandRecorder::draw(VkCommandBuffer cmd, uint32_t vertexCount,
+                                 uint32_t instanceCount, uint32_t firstVertex,
+                                 uint32_t firstInstance)
+{
+    vkCmdDraw(cmd, vertexCount, instanceCount, firstVertex, firstInstance);
+}
+
+void VulkanCommandRecorder::draw_indexed(VkCommandBuffer cmd, uint32_t indexCount,
+                                         uint32_t instanceCount, uint32_t firstIndex,
+                                         int32_t vertexOffset, uint32_t firstInstance)
+{
+    vkCmdDrawIndexed(cmd, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+}
+
+void VulkanCommandRecorder::trace_rays(VkCommandBuffer cmd, const RaytracingPipeline& pipeline,
+                                       uint32_t width, uint32_t height, uint32_t depth)
+{
+    vkCmdTraceRaysKHR(cmd, &pipeline.rgenRegion, &pipeline.missRegion, &pipeline.hitRegion,
+                      &pipeline.callRegion, width, height, depth);
+}
+
+void VulkanCommandRecorder::external(VkCommandBuffer cmd, const std::string& name,
+                                     const std::function<void(VkCommandBuffer cmd)>& function)
+{
+    function(cmd);
+}
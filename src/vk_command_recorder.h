@@ -0,0 +1,178 @@
+#pragma once
+
+#include "vk_raytracing.h"
+#include "vk_timer.h"
+#include <functional>
+#include <string>
+#include <vector>
+#include <vk_types.h>
+
+namespace Vrg
+{
+// Everything RenderGraph::execute records goes through a recorder, so the graph can be run
+// without submitting anything to the GPU. Passes record their draws with it as well.
+class CommandRecorder
+{
+public:
+    virtual ~CommandRecorder() = default;
+
+    virtual void begin_pass(VkCommandBuffer cmd, const std::string& name) = 0;
+    virtual void end_pass(VkCommandBuffer cmd) = 0;
+    virtual void pipeline_barrier(VkCommandBuffer cmd,
+                                  const VkDependencyInfo& dependencyInfo) = 0;
+    virtual void bind_pipeline(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                               VkPipeline pipeline) = 0;
+    virtual void bind_descriptor_sets(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                                      VkPipelineLayout layout, uint32_t setCount,
+                                      const VkDescriptorSet* descriptorSets) = 0;
+    virtual void push_constants(VkCommandBuffer cmd, VkPipelineLayout layout, uint32_t size,
+                                const void* data) = 0;
+    virtual void bind_vertex_buffers(VkCommandBuffer cmd, uint32_t bufferCount,
+                                     const VkBuffer* buffers) = 0;
+    virtual void bind_index_buffer(VkCommandBuffer cmd, VkBuffer buffer) = 0;
+    virtual void set_viewport_scissor(VkCommandBuffer cmd, VkExtent2D extent) = 0;
+    virtual void begin_rendering(VkCommandBuffer cmd,
+                                 const VkRenderingInfo& renderingInfo) = 0;
+    virtual void end_rendering(VkCommandBuffer cmd) = 0;
+    virtual void dispatch(VkCommandBuffer cmd, uint32_t x, uint32_t y, uint32_t z) = 0;
+    virtual void draw(VkCommandBuffer cmd, uint32_t vertexCount, uint32_t instanceCount,
+                      uint32_t firstVertex, uint32_t firstInstance) = 0;
+    virtual void draw_indexed(VkCommandBuffer cmd, uint32_t indexCount, uint32_t instanceCount,
+                              uint32_t firstIndex, int32_t vertexOffset,
+                              uint32_t firstInstance) = 0;
+    virtual void trace_rays(VkCommandBuffer cmd, const RaytracingPipeline& pipeline,
+                            uint32_t width, uint32_t height, uint32_t depth) = 0;
+    // Commands recorded by code outside the graph (custom passes, FSR2, ImGui)
+    virtual void external(VkCommandBuffer cmd, const std::string& name,
+                          const std::function<void(VkCommandBuffer cmd)>& function) = 0;
+};
+
+// Records into the command buffer, the default of the graph
+class VulkanCommandRecorder : public CommandRecorder
+{
+public:
+    VulkanCommandRecorder(EngineData* _engineData, VulkanTimer* _timer);
+
+    void begin_pass(VkCommandBuffer cmd, const std::string& name) override;
+    void end_pass(VkCommandBuffer cmd) override;
+    void pipeline_barrier(VkCommandBuffer cmd,
+                          const VkDependencyInfo& dependencyInfo) override;
+    void bind_pipeline(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                       VkPipeline pipeline) override;
+    void bind_descriptor_sets(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                              VkPipelineLayout layout, uint32_t setCount,
+                              const VkDescriptorSet* descriptorSets) override;
+    void push_constants(VkCommandBuffer cmd, VkPipelineLayout layout, uint32_t size,
+                        const void* data) override;
+    void bind_vertex_buffers(VkCommandBuffer cmd, uint32_t bufferCount,
+                             const VkBuffer* buffers) override;
+    void bind_index_buffer(VkCommandBuffer cmd, VkBuffer buffer) override;
+    void set_viewport_scissor(VkCommandBuffer cmd, VkExtent2D extent) override;
+    void begin_rendering(VkCommandBuffer cmd, const VkRenderingInfo& renderingInfo) override;
+    void end_rendering(VkCommandBuffer cmd) override;
+    void dispatch(VkCommandBuffer cmd, uint32_t x, uint32_t y, uint32_t z) override;
+    void draw(VkCommandBuffer cmd, uint32_t vertexCount, uint32_t instanceCount,
+              uint32_t firstVertex, uint32_t firstInstance) override;
+    void draw_indexed(VkCommandBuffer cmd, uint32_t indexCount, uint32_t instanceCount,
+                      uint32_t firstIndex, int32_t vertexOffset,
+                      uint32_t firstInstance) override;
+    void trace_rays(VkCommandBuffer cmd, const RaytracingPipeline& pipeline, uint32_t width,
+                    uint32_t height, uint32_t depth) override;
+    void external(VkCommandBuffer cmd, const std::string& name,
+                  const std::function<void(VkCommandBuffer cmd)>& function) override;
+
+private:
+    EngineData* engineData;
+    VulkanTimer* timer;
+};
+
+// What args, offset and handle of a RecordedCommand hold for each type
+enum class RecordedCommandType : uint8_t
+{
+    BEGIN_PASS,           // offset: name
+    END_PASS,             //
+    PIPELINE_BARRIER,     // args: image and buffer barrier count, first buffer barrier;
+                          // offset: first image barrier
+    BIND_PIPELINE,        // args: bind point; handle: pipeline
+    BIND_DESCRIPTOR_SETS, // args: bind point, set count; offset: first set; handle: layout
+    PUSH_CONSTANTS,       // args: size; offset: first byte; handle: layout
+    BIND_VERTEX_BUFFERS,  // args: buffer count; offset: first buffer
+    BIND_INDEX_BUFFER,    // handle: buffer
+    SET_VIEWPORT_SCISSOR, // args: width, height
+    BEGIN_RENDERING,      // args: color attachment count, has depth, width, height
+    END_RENDERING,        //
+    DISPATCH,             // args: x, y, z
+    DRAW,                 // args: vertex count, instance count, first vertex, first instance
+    DRAW_INDEXED,         // args: index count, instance count, first index, first instance;
+                          // offset: vertex offset
+    TRACE_RAYS,           // args: width, height, depth; handle: raygen shader address
+    EXTERNAL,             // offset: name
+    COUNT
+};
+
+// One command of a MemoryCommandRecorder stream. offset indexes the array of the recorder the
+// command keeps its data in.
+struct RecordedCommand
+{
+    RecordedCommandType type;
+    uint32_t args[4];
+    uint32_t offset;
+    uint64_t handle;
+};
+
+// Keeps the commands in memory instead of recording them, external commands are not called.
+// clear() keeps the memory of the arrays, so recording the same frame again does not
+// allocate. It only needs the Vulkan headers, no device (vk_memory_command_recorder.cpp).
+class MemoryCommandRecorder : public CommandRecorder
+{
+public:
+    void begin_pass(VkCommandBuffer cmd, const std::string& name) override;
+    void end_pass(VkCommandBuffer cmd) override;
+    void pipeline_barrier(VkCommandBuffer cmd,
+                          const VkDependencyInfo& dependencyInfo) override;
+    void bind_pipeline(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                       VkPipeline pipeline) override;
+    void bind_descriptor_sets(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                              VkPipelineLayout layout, uint32_t setCount,
+                              const VkDescriptorSet* descriptorSets) override;
+    void push_constants(VkCommandBuffer cmd, VkPipelineLayout layout, uint32_t size,
+                        const void* data) override;
+    void bind_vertex_buffers(VkCommandBuffer cmd, uint32_t bufferCount,
+                             const VkBuffer* buffers) override;
+    void bind_index_buffer(VkCommandBuffer cmd, VkBuffer buffer) override;
+    void set_viewport_scissor(VkCommandBuffer cmd, VkExtent2D extent) override;
+    void begin_rendering(VkCommandBuffer cmd, const VkRenderingInfo& renderingInfo) override;
+    void end_rendering(VkCommandBuffer cmd) override;
+    void dispatch(VkCommandBuffer cmd, uint32_t x, uint32_t y, uint32_t z) override;
+    void draw(VkCommandBuffer cmd, uint32_t vertexCount, uint32_t instanceCount,
+              uint32_t firstVertex, uint32_t firstInstance) override;
+    void draw_indexed(VkCommandBuffer cmd, uint32_t indexCount, uint32_t instanceCount,
+                      uint32_t firstIndex, int32_t vertexOffset,
+                      uint32_t firstInstance) override;
+    void trace_rays(VkCommandBuffer cmd, const RaytracingPipeline& pipeline, uint32_t width,
+                    uint32_t height, uint32_t depth) override;
+    void external(VkCommandBuffer cmd, const std::string& name,
+                  const std::function<void(VkCommandBuffer cmd)>& function) override;
+
+    void clear();
+    uint32_t count(RecordedCommandType type) const;
+    // Command counts by type and the memory of the stream
+    void print_summary() const;
+
+    std::vector<RecordedCommand> commands;
+    std::vector<std::string> names;
+    std::vector<VkImageMemoryBarrier2> imageBarriers;
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+    std::vector<VkDescriptorSet> descriptorSets;
+    std::vector<VkBuffer> vertexBuffers;
+    std::vector<uint8_t> pushConstantData;
+
+private:
+    RecordedCommand& add_command(RecordedCommandType type, uint32_t offset = 0,
+                                 uint64_t handle = 0);
+    uint32_t add_name(const std::string& name);
+
+    uint32_t nameCount = 0;
+    uint32_t commandCounts[(int)RecordedCommandType::COUNT] = {};
+};
+} // namespace Vrg
@@ -2,28 +2,27 @@
 #include "vk_rendergraph.h"
 #include <vk_initializers.h>
 #include <vk_pipeline.h>
-#include <vk_utils.h>
 
 void VulkanDebugRenderer::init(EngineData& _engineData)
 {
     // Create the buffers
-    _pointVertexBuffer =
-        vkutils::create_buffer(_engineData.allocator, sizeof(glm::vec3) * 1024000,
-                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    _pointColorBuffer =
-        vkutils::create_buffer(_engineData.allocator, sizeof(glm::vec3) * 1024000,
-                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    _pointVertexBuffer = _engineData.renderDevice->create_buffer(
+        sizeof(glm::vec3) * 1024000, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
+    _pointColorBuffer = _engineData.renderDevice->create_buffer(
+        sizeof(glm::vec3) * 1024000, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
     _pointVertexBufferBinding = _engineData.renderGraph->register_vertex_buffer(
         &_pointVertexBuffer, VK_FORMAT_R32G32B32_SFLOAT, "DebugPointVertexPosBuffer");
     _pointColorBufferBinding = _engineData.renderGraph->register_vertex_buffer(
         &_pointColorBuffer, VK_FORMAT_R32G32B32_SFLOAT, "DebugPointVertexColorBuffer");
 
-    _lineVertexBuffer =
-        vkutils::create_buffer(_engineData.allocator, sizeof(glm::vec3) * 1024000,
-                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    _lineColorBuffer =
-        vkutils::create_buffer(_engineData.allocator, sizeof(glm::vec3) * 1024000,
-                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    _lineVertexBuffer = _engineData.renderDevice->create_buffer(
+        sizeof(glm::vec3) * 1024000, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
+    _lineColorBuffer = _engineData.renderDevice->create_buffer(
+        sizeof(glm::vec3) * 1024000, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
     _lineVertexBufferBinding = _engineData.renderGraph->register_vertex_buffer(
         &_lineVertexBuffer, VK_FORMAT_R32G32B32_SFLOAT, "DebugLineVertexPosBuffer");
     _lineColorBufferBinding = _engineData.renderGraph->register_vertex_buffer(
@@ -56,10 +55,10 @@ void VulkanDebugRenderer::render(EngineData& _engineData, SceneData& _sceneData,
 
     if (_pointPositions.size() > 0)
     {
-        vkutils::cpu_to_gpu(_engineData.allocator, _pointVertexBuffer, _pointPositions.data(),
-                            _pointPositions.size() * sizeof(glm::vec3));
-        vkutils::cpu_to_gpu(_engineData.allocator, _pointColorBuffer, _pointColors.data(),
-                            _pointColors.size() * sizeof(glm::vec3));
+        _engineData.renderDevice->write_buffer(_pointVertexBuffer, _pointPositions.data(),
+                                               _pointPositions.size() * sizeof(glm::vec3));
+        _engineData.renderDevice->write_buffer(_pointColorBuffer, _pointColors.data(),
+                                               _pointColors.size() * sizeof(glm::vec3));
 
         pointPass = _engineData.renderGraph->add_render_pass(
             {.name = "DebugPointPass",
@@ -86,16 +85,19 @@ void VulkanDebugRenderer::render(EngineData& _engineData, SceneData& _sceneData,
                  },
              .reads = {{0, _sceneData.cameraBufferBinding}},
              .execute =
-                 [&](VkCommandBuffer cmd) { vkCmdDraw(cmd, _pointPositions.size(), 1, 0, 0); },
+                 [&](VkCommandBuffer cmd) {
+                     auto recorder = _engineData.renderGraph->get_recorder();
+                     recorder->draw(cmd, _pointPositions.size(), 1, 0, 0);
+                 },
              .skipExecution = true});
     }
 
     if (_linePositions.size() > 0)
     {
-        vkutils::cpu_to_gpu(_engineData.allocator, _lineVertexBuffer, _linePositions.data(),
-                            _linePositions.size() * sizeof(glm::vec3));
-        vkutils::cpu_to_gpu(_engineData.allocator, _lineColorBuffer, _lineColors.data(),
-                            _lineColors.size() * sizeof(glm::vec3));
+        _engineData.renderDevice->write_buffer(_lineVertexBuffer, _linePositions.data(),
+                                               _linePositions.size() * sizeof(glm::vec3));
+        _engineData.renderDevice->write_buffer(_lineColorBuffer, _lineColors.data(),
+                                               _lineColors.size() * sizeof(glm::vec3));
 
         linePass = _engineData.renderGraph->add_render_pass(
             {.name = "DebugLinePass",
@@ -122,7 +124,10 @@ void VulkanDebugRenderer::render(EngineData& _engineData, SceneData& _sceneData,
                  },
              .reads = {{0, _sceneData.cameraBufferBinding}},
              .execute =
-                 [&](VkCommandBuffer cmd) { vkCmdDraw(cmd, _linePositions.size(), 1, 0, 0); },
+                 [&](VkCommandBuffer cmd) {
+                     auto recorder = _engineData.renderGraph->get_recorder();
+                     recorder->draw(cmd, _linePositions.size(), 1, 0, 0);
+                 },
              .skipExecution = true});
     }
 }
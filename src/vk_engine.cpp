@@ -13,11 +13,13 @@
 
 #include <glm/gtx/transform.hpp>
 
+#include <bake/bake_cache.h>
+#include <bake/bake_scene.h>
 #include <precalculation.h>
 #include <vk_extensions.h>
 #include <vk_utils.h>
-#include <xatlas.h>
 
+#include <frame_passes.h>
 #include <gi_brdf.h>
 #include <gi_deferred.h>
 #include <gi_diffuse.h>
@@ -28,6 +30,7 @@
 #include <vk_timer.h>
 
 #include <ctime>
+#include <filesystem>
 
 #include "VkBootstrap.h"
 #include <functional>
@@ -83,7 +86,9 @@ void VulkanEngine::init()
     _shaderManager.initialize();
 
     init_vulkan();
-    _engineData.renderGraph = new Vrg::RenderGraph(&_engineData, &_shaderManager);
+    _renderDevice = new Vrg::VulkanRenderDevice(&_engineData, &_shaderManager);
+    _engineData.renderDevice = _renderDevice;
+    _engineData.renderGraph = new Vrg::RenderGraph(_renderDevice);
 
     init_swapchain();
     init_commands();
@@ -92,41 +97,46 @@ void VulkanEngine::init()
 
     _vulkanCompute.init(_engineData);
     _vulkanRaytracing.init(_engineData, _gpuRaytracingProperties);
-    _engineData.renderGraph->enable_raytracing(&_vulkanRaytracing);
+    _renderDevice->enable_raytracing(&_vulkanRaytracing);
 
     editor.initialize(_engineData, _window, _swachainImageFormat);
 
-    bool loadPrecomputedData = false;
-    if (!loadPrecomputedData)
-    {
-        precalculationInfo.voxelSize = 0.25;
-        precalculationInfo.voxelPadding = 2;
-        precalculationInfo.probeOverlaps = 10;
-        precalculationInfo.raysPerProbe = 1000;
-        precalculationInfo.raysPerReceiver = 40000;
-        precalculationInfo.sphericalHarmonicsOrder = 7;
-        precalculationInfo.clusterCoefficientCount = 32;
-        precalculationInfo.maxReceiversInCluster = 1024;
-        precalculationInfo.lightmapResolution = 261;
-        precalculationInfo.texelSize = 6;
-        precalculationInfo.desiredSpacing = 2;
-    }
-    else
-    {
-        precalculation.load("../precomputation/precalculation.cfg", precalculationInfo,
-                            precalculationLoadData, precalculationResult);
-    }
+    precalculationInfo.voxelSize = 0.25;
+    precalculationInfo.voxelPadding = 2;
+    precalculationInfo.probeOverlaps = 10;
+    precalculationInfo.raysPerProbe = 1000;
+    precalculationInfo.raysPerReceiver = 40000;
+    precalculationInfo.sphericalHarmonicsOrder = 7;
+    precalculationInfo.clusterCoefficientCount = 32;
+    precalculationInfo.maxReceiversInCluster = 1024;
+    precalculationInfo.lightmapResolution = 261;
+    precalculationInfo.texelSize = 6;
+    precalculationInfo.desiredSpacing = 2;
+    precalculationInfo.matrixFormat = MATRIX_FORMAT_SNORM16;
 
     init_scene();
 
-    if (!loadPrecomputedData)
+    // The bake of these inputs is reused if it is in the cache, anything else is baked again
+    uint64_t bakeKey = bake_content_key(gltf_scene, precalculationInfo);
+    std::string bakeFile = bake_cache_path(PRECALCULATION_CACHE_DIRECTORY, bakeKey);
+    if (!std::filesystem::exists(bakeFile) ||
+        !precalculation.load(bakeFile.c_str(), precalculationInfo, precalculationLoadData,
+                             precalculationResult, bakeKey))
     {
-        precalculation.prepare(*this, gltf_scene, precalculationInfo, precalculationLoadData,
-                               precalculationResult);
-        // precalculation.prepare(*this, gltf_scene, precalculationInfo,
-        // precalculationLoadData, precalculationResult,
-        // "../precomputation/precalculation.Probes");
-        exit(0);
+        // The reasons are printed by prepare and load
+        if (!precalculation.prepare(this, gltf_scene, precalculationInfo,
+                                    precalculationLoadData, precalculationResult, nullptr,
+                                    bakeFile.c_str()))
+        {
+            printf("Baking %s failed\n", bakeFile.c_str());
+            exit(1);
+        }
+        if (!precalculation.load(bakeFile.c_str(), precalculationInfo, precalculationLoadData,
+                                 precalculationResult, bakeKey))
+        {
+            printf("Could not load the new bake %s\n", bakeFile.c_str());
+            exit(1);
+        }
     }
 
     init_query_pool();
@@ -168,8 +178,8 @@ void VulkanEngine::cleanup()
         // make sure the GPU has stopped doing its things
         vkDeviceWaitIdle(_engineData.device);
 
-        // TODO
-        //_engineData.renderGraph->clear();
+        _engineData.renderGraph->destroy();
+        _renderDevice->destroy();
         _mainDeletionQueue.flush();
 
         vmaDestroyAllocator(_engineData.allocator);
@@ -210,7 +220,7 @@ void VulkanEngine::draw(double deltaTime)
     VK_CHECK(vkResetFences(_engineData.device, 1, &_renderFence));
 
     // TODO: Enable
-    _engineData.renderGraph->vkTimer.get_results(_engineData);
+    _renderDevice->timer.get_results(_engineData);
 
     // now that we are sure that the commands finished executing, we can safely reset the
     // command buffer to begin recording again.
@@ -335,7 +345,7 @@ void VulkanEngine::draw(double deltaTime)
     editor.prepare_debug_settings(_engineData);
     editor.prepare_camera_settings(_engineData, _camData, cameraConfig,
                                    gltf_scene.cameras.size() > 0);
-    editor.prepare_performance_settings(_engineData);
+    editor.prepare_performance_settings(_renderDevice->timer);
     editor.prepare_material_settings(_engineData, _sceneData, materials.data(),
                                      materials.size());
     editor.prepare_object_settings(_engineData, gltf_scene.nodes.data(),
@@ -391,98 +401,7 @@ void VulkanEngine::draw(double deltaTime)
     VkCommandBufferBeginInfo cmdBeginInfo =
         vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
-    {
-        shadow.render(_engineData, _sceneData,
-                      [&](VkCommandBuffer cmd) { draw_objects(cmd); });
-        gbuffer.render(_engineData, _sceneData,
-                       [&](VkCommandBuffer cmd) { draw_objects(cmd); });
-        if (editor.editorSettings.enableGroundTruthDiffuse)
-        {
-            diffuseIllumination.render_ground_truth(cmd, _engineData, _sceneData, shadow,
-                                                    brdfUtils);
-        }
-        else
-        {
-            diffuseIllumination.render(
-                cmd, _engineData, _sceneData, shadow, brdfUtils,
-                [&](VkCommandBuffer cmd) { draw_objects(cmd); },
-                editor.editorSettings.useRealtimeRaycast,
-                editor.editorSettings.numberOfBasisFunctions);
-        }
-        glossyIllumination.render(_engineData, _sceneData, gbuffer, shadow,
-                                  diffuseIllumination, brdfUtils);
-
-        if (_camData.useStochasticSpecular)
-        {
-            glossyDenoise.render(_engineData, _sceneData, gbuffer, glossyIllumination);
-
-            if (editor.editorSettings.enableDenoise)
-            {
-                deferred.render(_engineData, _sceneData, gbuffer, shadow, diffuseIllumination,
-                                glossyIllumination, brdfUtils,
-                                glossyDenoise.get_denoised_binding());
-            }
-            else
-            {
-                deferred.render(_engineData, _sceneData, gbuffer, shadow, diffuseIllumination,
-                                glossyIllumination, brdfUtils,
-                                glossyIllumination._glossyReflectionsColorImageBinding);
-            }
-        }
-        else
-        {
-            deferred.render(_engineData, _sceneData, gbuffer, shadow, diffuseIllumination,
-                            glossyIllumination, brdfUtils,
-                            glossyIllumination._glossyReflectionsColorImageBinding);
-        }
-
-        auto gbufferData = gbuffer.get_current_frame_data();
-
-        _engineData.renderGraph->add_render_pass(
-            {.name = "SuperResolutionPass",
-             .pipelineType = Vrg::PipelineType::CUSTOM,
-             .execute = [&](VkCommandBuffer cmd) {
-                 superResolution.dispatch(
-                     _engineData, cmd, deferred._deferredColorImageBinding,
-                     gbufferData->depthBinding, gbufferData->motionBinding, &cameraConfig,
-                     deltaTime);
-             }});
-
-        _vulkanDebugRenderer.render(_engineData, _sceneData, _displayResolution,
-                                    _swapchainBindings[swapchainImageIndex]);
-
-        VkClearValue clearValue;
-        clearValue.color = {{1.0f, 1.0f, 1.0f, 1.0f}};
-
-        _engineData.renderGraph->add_render_pass(
-            {.name = "PresentPass",
-             .pipelineType = Vrg::PipelineType::RASTER_TYPE,
-             .rasterPipeline =
-                 {
-                     .vertexShader = "../shaders/fullscreen.vert",
-                     .fragmentShader = "../shaders/gamma.frag",
-                     .size = _displayResolution,
-                     .depthState = {false, false, VK_COMPARE_OP_NEVER},
-                     .cullMode = Vrg::CullMode::NONE,
-                     .blendAttachmentStates =
-                         {
-                             vkinit::color_blend_attachment_state(),
-                         },
-                     .colorOutputs =
-                         {
-                             {_swapchainBindings[swapchainImageIndex], clearValue, true},
-                         },
-
-                 },
-             .reads = {{0, editor.editorSettings.selectedRenderBinding.isValid()
-                               ? editor.editorSettings.selectedRenderBinding
-                               : superResolution.outputBindable}},
-             .execute = [&](VkCommandBuffer cmd) {
-                 vkCmdDraw(cmd, 3, 1, 0, 0);
-                 _vulkanDebugRenderer.custom_execute(cmd, _engineData);
-                 editor.render(cmd);
-             }});
-    }
+    add_frame_passes(cmd, swapchainImageIndex, deltaTime);
 
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
     {
@@ -558,6 +477,76 @@ void VulkanEngine::draw(double deltaTime)
     _camData.glossyFrameCount++;
 }
 
+// Adds the passes of a frame to the render graph. The camera and object data of the frame
+// are uploaded by draw.
+void VulkanEngine::add_frame_passes(VkCommandBuffer cmd, uint32_t swapchainImageIndex,
+                                    double deltaTime)
+{
+    FrameModules modules = {brdfUtils,          shadow,        gbuffer, diffuseIllumination,
+                            glossyIllumination, glossyDenoise, deferred};
+    FrameSettings settings = {
+        .groundTruthDiffuse = editor.editorSettings.enableGroundTruthDiffuse,
+        .realtimeRaycast = editor.editorSettings.useRealtimeRaycast,
+        .basisFunctionCount = editor.editorSettings.numberOfBasisFunctions,
+        .stochasticSpecular = (bool)_camData.useStochasticSpecular,
+        .denoise = editor.editorSettings.enableDenoise};
+    add_lighting_passes(cmd, _engineData, _sceneData, modules, settings,
+                        [this](VkCommandBuffer cmd) { draw_objects(cmd); });
+
+    auto gbufferData = gbuffer.get_current_frame_data();
+
+    _engineData.renderGraph->add_render_pass(
+        {.name = "SuperResolutionPass",
+         .pipelineType = Vrg::PipelineType::CUSTOM,
+         .writes = {{0, superResolution.outputBindable}},
+         .reads = {{0, deferred._deferredColorImageBinding},
+                   {0, gbufferData->depthBinding},
+                   {0, gbufferData->motionBinding}},
+         .execute = [&, gbufferData, deltaTime](VkCommandBuffer cmd) {
+             superResolution.dispatch(
+                 _engineData, cmd, deferred._deferredColorImageBinding,
+                 gbufferData->depthBinding, gbufferData->motionBinding, &cameraConfig,
+                 deltaTime);
+         }});
+
+    _vulkanDebugRenderer.render(_engineData, _sceneData, _displayResolution,
+                                _swapchainBindings[swapchainImageIndex]);
+
+    VkClearValue clearValue;
+    clearValue.color = {{1.0f, 1.0f, 1.0f, 1.0f}};
+
+    _engineData.renderGraph->add_render_pass(
+        {.name = "PresentPass",
+         .pipelineType = Vrg::PipelineType::RASTER_TYPE,
+         .rasterPipeline =
+             {
+                 .vertexShader = "../shaders/fullscreen.vert",
+                 .fragmentShader = "../shaders/gamma.frag",
+                 .size = _displayResolution,
+                 .depthState = {false, false, VK_COMPARE_OP_NEVER},
+                 .cullMode = Vrg::CullMode::NONE,
+                 .blendAttachmentStates =
+                     {
+                         vkinit::color_blend_attachment_state(),
+                     },
+                 .colorOutputs =
+                     {
+                         {_swapchainBindings[swapchainImageIndex], clearValue, true},
+                     },
+
+             },
+         .reads = {{0, editor.editorSettings.selectedRenderBinding.isValid()
+                           ? editor.editorSettings.selectedRenderBinding
+                           : superResolution.outputBindable}},
+         .execute = [&](VkCommandBuffer cmd) {
+             auto recorder = _engineData.renderGraph->get_recorder();
+             recorder->draw(cmd, 3, 1, 0, 0);
+             _vulkanDebugRenderer.custom_execute(cmd, _engineData);
+             recorder->external(cmd, "ImGui",
+                                [&](VkCommandBuffer cmd) { editor.render(cmd); });
+         }});
+}
+
 void VulkanEngine::run()
 {
     SDL_Event e;
@@ -712,9 +701,6 @@ void VulkanEngine::init_vulkan()
     VkPhysicalDeviceVulkan11Features features11 = {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES};
 
-    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_feature = {
-        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR};
-
     features11.shaderDrawParameters = VK_TRUE;
     features11.pNext = &features12;
 
@@ -723,13 +709,13 @@ void VulkanEngine::init_vulkan()
     features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
     features12.runtimeDescriptorArray = VK_TRUE;
     features12.descriptorBindingVariableDescriptorCount = VK_TRUE;
-    features12.pNext = &dynamic_rendering_feature;
+    features12.pNext = &features13;
     features12.shaderFloat16 = VK_TRUE;
 
+    // The render graph records its barriers with vkCmdPipelineBarrier2
     features13.dynamicRendering = VK_TRUE;
+    features13.synchronization2 = VK_TRUE;
     features13.pNext = &featureRt;
-    dynamic_rendering_feature.dynamicRendering = VK_TRUE;
-    dynamic_rendering_feature.pNext = &featureRt;
 
     featureRt.rayTracingPipeline = VK_TRUE;
     featureRt.pNext = &featureAccel;
@@ -935,7 +921,8 @@ void VulkanEngine::init_descriptor_pool()
 
     VkDescriptorPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    pool_info.flags = 0;
+    // The render graph frees the descriptor sets of recreated transient images
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
     pool_info.maxSets = 1000;
     pool_info.poolSizeCount = (uint32_t)sizes.size();
     pool_info.pPoolSizes = sizes.data();
@@ -1023,29 +1010,10 @@ void VulkanEngine::init_scene()
     // std::string file_name = "../assets/picapica/scene.gltf";
     // std::string file_name = "D:/newsponza/combined/sponza.gltf";
 
-    tinygltf::Model tmodel;
-    tinygltf::TinyGLTF tcontext;
-
-    std::string warn, error;
-    if (!tcontext.LoadASCIIFromFile(&tmodel, &error, &warn, file_name))
+    if (!load_gltf_scene(file_name, gltf_scene))
     {
         assert(!"Error while loading scene");
     }
-    if (!warn.empty())
-    {
-        printf("WARNING: SCENE LOADING: %s\n", warn.c_str());
-    }
-    if (!error.empty())
-    {
-        printf("WARNING: SCENE LOADING: %s\n", error.c_str());
-    }
-
-    gltf_scene.import_materials(tmodel);
-    gltf_scene.import_drawable_nodes(
-        tmodel, GltfAttributes::Normal | GltfAttributes::Texcoord_0 | GltfAttributes::Tangent);
-
-    printf("dimensions: %f %f %f\n", gltf_scene.m_dimensions.size.x,
-           gltf_scene.m_dimensions.size.y, gltf_scene.m_dimensions.size.z);
 
     for (int i = 0; i < gltf_scene.materials.size(); i++)
     {
@@ -1068,96 +1036,7 @@ void VulkanEngine::init_scene()
      * all the data
      * vec2 data as byte
      */
-    printf("Generating lightmap uvs\n");
-    xatlas::Atlas* atlas = xatlas::Create();
-    for (int i = 0; i < gltf_scene.nodes.size(); i++)
-    {
-        auto& mesh = gltf_scene.prim_meshes[gltf_scene.nodes[i].prim_mesh];
-        xatlas::MeshDecl meshDecleration = {};
-        meshDecleration.vertexPositionData = &gltf_scene.positions[mesh.vtx_offset];
-        meshDecleration.vertexPositionStride = sizeof(glm::vec3);
-        meshDecleration.vertexCount = mesh.vtx_count;
-
-        if (gltf_scene.texcoords0.size() > 0)
-        {
-            meshDecleration.vertexUvData = &gltf_scene.texcoords0[mesh.vtx_offset];
-            meshDecleration.vertexUvStride = sizeof(glm::vec2);
-        }
-
-        meshDecleration.indexData = &gltf_scene.indices[mesh.first_idx];
-        meshDecleration.indexCount = mesh.idx_count;
-        meshDecleration.indexFormat = xatlas::IndexFormat::UInt32;
-        xatlas::AddMesh(atlas, meshDecleration);
-    }
-
-    xatlas::ChartOptions chartOptions = xatlas::ChartOptions();
-    // chartOptions.fixWinding = true;
-    xatlas::PackOptions packOptions = xatlas::PackOptions();
-    packOptions.texelsPerUnit = precalculationInfo.texelSize;
-    packOptions.bilinear = true;
-    packOptions.padding = 1;
-    xatlas::Generate(atlas, chartOptions, packOptions);
-
-    gltf_scene.lightmap_width = atlas->width;
-    gltf_scene.lightmap_height = atlas->height;
-
-    std::vector<GltfPrimMesh> prim_meshes;
-    std::vector<glm::vec3> positions;
-    std::vector<uint32_t> indices;
-    std::vector<glm::vec3> normals;
-    std::vector<glm::vec2> texcoords0;
-    std::vector<glm::vec4> tangents;
-
-    for (int i = 0; i < gltf_scene.nodes.size(); i++)
-    {
-        GltfPrimMesh mesh = gltf_scene.prim_meshes[gltf_scene.nodes[i].prim_mesh];
-        uint32_t orihinal_vtx_offset = mesh.vtx_offset;
-        mesh.first_idx = indices.size();
-        mesh.vtx_offset = positions.size();
-
-        mesh.idx_count = atlas->meshes[i].indexCount;
-        mesh.vtx_count = atlas->meshes[i].vertexCount;
-
-        gltf_scene.nodes[i].prim_mesh = prim_meshes.size();
-        prim_meshes.push_back(mesh);
-
-        for (int j = 0; j < atlas->meshes[i].vertexCount; j++)
-        {
-            gltf_scene.lightmapUVs.push_back({atlas->meshes[i].vertexArray[j].uv[0],
-                                              atlas->meshes[i].vertexArray[j].uv[1]});
-
-            positions.push_back(gltf_scene.positions[atlas->meshes[i].vertexArray[j].xref +
-                                                     orihinal_vtx_offset]);
-            normals.push_back(gltf_scene.normals[atlas->meshes[i].vertexArray[j].xref +
-                                                 orihinal_vtx_offset]);
-            texcoords0.push_back(gltf_scene.texcoords0[atlas->meshes[i].vertexArray[j].xref +
-                                                       orihinal_vtx_offset]);
-            tangents.push_back(gltf_scene.tangents[atlas->meshes[i].vertexArray[j].xref +
-                                                   orihinal_vtx_offset]);
-        }
-
-        for (int j = 0; j < atlas->meshes[i].indexCount; j++)
-        {
-            indices.push_back(atlas->meshes[i].indexArray[j]);
-        }
-    }
-
-    gltf_scene.prim_meshes.clear();
-    gltf_scene.positions.clear();
-    gltf_scene.indices.clear();
-    gltf_scene.normals.clear();
-    gltf_scene.texcoords0.clear();
-    gltf_scene.tangents.clear();
-
-    gltf_scene.prim_meshes = prim_meshes;
-    gltf_scene.positions = positions;
-    gltf_scene.indices = indices;
-    gltf_scene.normals = normals;
-    gltf_scene.texcoords0 = texcoords0;
-    gltf_scene.tangents = tangents;
-
-    printf("Generated lightmap uvs, %d x %d\n", atlas->width, atlas->height);
-    xatlas::Destroy(atlas);
+    generate_lightmap_uvs(gltf_scene, precalculationInfo.texelSize);
 
     /*
     --
@@ -1389,7 +1268,8 @@ void VulkanEngine::draw_objects(VkCommandBuffer cmd)
                             .alpha_mode == 0)
         {
             auto& mesh = gltf_scene.prim_meshes[gltf_scene.nodes[i].prim_mesh];
-            vkCmdDrawIndexed(cmd, mesh.idx_count, 1, mesh.first_idx, mesh.vtx_offset, i);
+            _engineData.renderGraph->get_recorder()->draw_indexed(
+                cmd, mesh.idx_count, 1, mesh.first_idx, mesh.vtx_offset, i);
         }
     }
 }
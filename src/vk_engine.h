@@ -15,6 +15,11 @@
 
 #undef RAYTRACING
 
+namespace Vrg
+{
+class VulkanRenderDevice;
+} // namespace Vrg
+
 struct DeletionQueue
 {
     std::deque<std::function<void()>> deletors;
@@ -46,6 +51,7 @@ public:
     VulkanRaytracing _vulkanRaytracing;
     VulkanDebugRenderer _vulkanDebugRenderer;
     ShaderManager _shaderManager;
+    Vrg::VulkanRenderDevice* _renderDevice;
 
     DeletionQueue _mainDeletionQueue;
 
@@ -102,6 +108,7 @@ public:
     void draw_objects(VkCommandBuffer cmd);
 
 private:
+    void add_frame_passes(VkCommandBuffer cmd, uint32_t swapchainImageIndex, double deltaTime);
     void init_vulkan();
 
     void init_swapchain();
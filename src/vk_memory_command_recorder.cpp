@@ -0,0 +1,207 @@
+#include "vk_command_recorder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace Vrg;
+
+static const char* recordedCommandNames[] = {
+    "BeginPass",       "EndPass",        "PipelineBarrier", "BindPipeline",
+    "BindDescriptors", "PushConstants",  "BindVertex",      "BindIndex",
+    "ViewportScissor", "BeginRendering", "EndRendering",    "Dispatch",
+    "Draw",            "DrawIndexed",    "TraceRays",       "External"};
+
+RecordedCommand& MemoryCommandRecorder::add_command(RecordedCommandType type, uint32_t offset,
+                                                    uint64_t handle)
+{
+    commandCounts[(int)type]++;
+    commands.push_back({type, {}, offset, handle});
+    return commands.back();
+}
+
+uint32_t MemoryCommandRecorder::add_name(const std::string& name)
+{
+    // Assigning to the strings of the last frame reuses their memory
+    if (nameCount < names.size())
+    {
+        names[nameCount] = name;
+    }
+    else
+    {
+        names.push_back(name);
+    }
+    return nameCount++;
+}
+
+void MemoryCommandRecorder::begin_pass(VkCommandBuffer cmd, const std::string& name)
+{
+    add_command(RecordedCommandType::BEGIN_PASS, add_name(name));
+}
+
+void MemoryCommandRecorder::end_pass(VkCommandBuffer cmd)
+{
+    add_command(RecordedCommandType::END_PASS);
+}
+
+void MemoryCommandRecorder::pipeline_barrier(VkCommandBuffer cmd,
+                                             const VkDependencyInfo& dependencyInfo)
+{
+    auto& command = add_command(RecordedCommandType::PIPELINE_BARRIER, imageBarriers.size());
+    command.args[0] = dependencyInfo.imageMemoryBarrierCount;
+    command.args[1] = dependencyInfo.bufferMemoryBarrierCount;
+    command.args[2] = bufferBarriers.size();
+
+    imageBarriers.insert(imageBarriers.end(), dependencyInfo.pImageMemoryBarriers,
+                         dependencyInfo.pImageMemoryBarriers +
+                             dependencyInfo.imageMemoryBarrierCount);
+    bufferBarriers.insert(bufferBarriers.end(), dependencyInfo.pBufferMemoryBarriers,
+                          dependencyInfo.pBufferMemoryBarriers +
+                              dependencyInfo.bufferMemoryBarrierCount);
+}
+
+void MemoryCommandRecorder::bind_pipeline(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint,
+                                          VkPipeline pipeline)
+{
+    auto& command = add_command(RecordedCommandType::BIND_PIPELINE, 0,
+                                reinterpret_cast<uint64_t>(pipeline));
+    command.args[0] = bindPoint;
+}
+
+void MemoryCommandRecorder::bind_descriptor_sets(VkCommandBuffer cmd,
+                                                 VkPipelineBindPoint bindPoint,
+                                                 VkPipelineLayout layout, uint32_t setCount,
+                                                 const VkDescriptorSet* sets)
+{
+    auto& command = add_command(RecordedCommandType::BIND_DESCRIPTOR_SETS,
+                                descriptorSets.size(), reinterpret_cast<uint64_t>(layout));
+    command.args[0] = bindPoint;
+    command.args[1] = setCount;
+
+    descriptorSets.insert(descriptorSets.end(), sets, sets + setCount);
+}
+
+void MemoryCommandRecorder::push_constants(VkCommandBuffer cmd, VkPipelineLayout layout,
+                                           uint32_t size, const void* data)
+{
+    auto& command = add_command(RecordedCommandType::PUSH_CONSTANTS, pushConstantData.size(),
+                                reinterpret_cast<uint64_t>(layout));
+    command.args[0] = size;
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    pushConstantData.insert(pushConstantData.end(), bytes, bytes + size);
+}
+
+void MemoryCommandRecorder::bind_vertex_buffers(VkCommandBuffer cmd, uint32_t bufferCount,
+                                                const VkBuffer* buffers)
+{
+    auto& command =
+        add_command(RecordedCommandType::BIND_VERTEX_BUFFERS, vertexBuffers.size());
+    command.args[0] = bufferCount;
+
+    vertexBuffers.insert(vertexBuffers.end(), buffers, buffers + bufferCount);
+}
+
+void MemoryCommandRecorder::bind_index_buffer(VkCommandBuffer cmd, VkBuffer buffer)
+{
+    add_command(RecordedCommandType::BIND_INDEX_BUFFER, 0, reinterpret_cast<uint64_t>(buffer));
+}
+
+void MemoryCommandRecorder::set_viewport_scissor(VkCommandBuffer cmd, VkExtent2D extent)
+{
+    auto& command = add_command(RecordedCommandType::SET_VIEWPORT_SCISSOR);
+    command.args[0] = extent.width;
+    command.args[1] = extent.height;
+}
+
+void MemoryCommandRecorder::begin_rendering(VkCommandBuffer cmd,
+                                            const VkRenderingInfo& renderingInfo)
+{
+    auto& command = add_command(RecordedCommandType::BEGIN_RENDERING);
+    command.args[0] = renderingInfo.colorAttachmentCount;
+    command.args[1] = renderingInfo.pDepthAttachment != nullptr;
+    command.args[2] = renderingInfo.renderArea.extent.width;
+    command.args[3] = renderingInfo.renderArea.extent.height;
+}
+
+void MemoryCommandRecorder::end_rendering(VkCommandBuffer cmd)
+{
+    add_command(RecordedCommandType::END_RENDERING);
+}
+
+void MemoryCommandRecorder::dispatch(VkCommandBuffer cmd, uint32_t x, uint32_t y, uint32_t z)
+{
+    auto& command = add_command(RecordedCommandType::DISPATCH);
+    command.args[0] = x;
+    command.args[1] = y;
+    command.args[2] = z;
+}
+
+void MemoryCommandRecorder::draw(VkCommandBuffer cmd, uint32_t vertexCount,
+                                 uint32_t instanceCount, uint32_t firstVertex,
+                                 uint32_t firstInstance)
+{
+    auto& command = add_command(RecordedCommandType::DRAW);
+    command.args[0] = vertexCount;
+    command.args[1] = instanceCount;
+    command.args[2] = firstVertex;
+    command.args[3] = firstInstance;
+}
+
+void MemoryCommandRecorder::draw_indexed(VkCommandBuffer cmd, uint32_t indexCount,
+                                         uint32_t instanceCount, uint32_t firstIndex,
+                                         int32_t vertexOffset, uint32_t firstInstance)
+{
+    auto& command = add_command(RecordedCommandType::DRAW_INDEXED, (uint32_t)vertexOffset);
+    command.args[0] = indexCount;
+    command.args[1] = instanceCount;
+    command.args[2] = firstIndex;
+    command.args[3] = firstInstance;
+}
+
+void MemoryCommandRecorder::trace_rays(VkCommandBuffer cmd, const RaytracingPipeline& pipeline,
+                                       uint32_t width, uint32_t height, uint32_t depth)
+{
+    auto& command =
+        add_command(RecordedCommandType::TRACE_RAYS, 0, pipeline.rgenRegion.deviceAddress);
+    command.args[0] = width;
+    command.args[1] = height;
+    command.args[2] = depth;
+}
+
+void MemoryCommandRecorder::external(VkCommandBuffer cmd, const std::string& name,
+                                     const std::function<void(VkCommandBuffer cmd)>& function)
+{
+    add_command(RecordedCommandType::EXTERNAL, add_name(name));
+}
+
+void MemoryCommandRecorder::clear()
+{
+    commands.clear();
+    imageBarriers.clear();
+    bufferBarriers.clear();
+    descriptorSets.clear();
+    vertexBuffers.clear();
+    pushConstantData.clear();
+    nameCount = 0;
+    memset(commandCounts, 0, sizeof(commandCounts));
+}
+
+uint32_t MemoryCommandRecorder::count(RecordedCommandType type) const
+{
+    return commandCounts[(int)type];
+}
+
+void MemoryCommandRecorder::print_summary() const
+{
+    for (int i = 0; i < (int)RecordedCommandType::COUNT; i++)
+    {
+        printf("%-16s %8u\n", recordedCommandNames[i], commandCounts[i]);
+    }
+    size_t streamSize = commands.size() * sizeof(RecordedCommand) +
+                        imageBarriers.size() * sizeof(VkImageMemoryBarrier2) +
+                        bufferBarriers.size() * sizeof(VkBufferMemoryBarrier2) +
+                        descriptorSets.size() * sizeof(VkDescriptorSet) +
+                        vertexBuffers.size() * sizeof(VkBuffer) + pushConstantData.size();
+    printf("%zu commands, %zu image and %zu buffer barriers, %.1f KB\n", commands.size(),
+           imageBarriers.size(), bufferBarriers.size(), streamSize / 1024.0);
+}
@@ -0,0 +1,243 @@
+#include "vk_null_render_device.h"
+
+using namespace Vrg;
+
+inline static VkDeviceSize get_texel_size(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R32_UINT:
+    case VK_FORMAT_R32_SFLOAT:
+    case VK_FORMAT_D32_SFLOAT:
+        return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R32G32_SFLOAT:
+        return 8;
+    default:
+        return 16;
+    }
+}
+
+template <typename T> T NullRenderDevice::new_handle()
+{
+    return reinterpret_cast<T>(nextHandle++);
+}
+
+CommandRecorder* NullRenderDevice::get_recorder()
+{
+    return &recorder;
+}
+
+AllocatedBuffer NullRenderDevice::create_buffer(size_t size, VkBufferUsageFlags usage,
+                                                VmaMemoryUsage memoryUsage,
+                                                VmaAllocationCreateFlags allocationFlags)
+{
+    AllocatedBuffer buffer = {._buffer = new_handle<VkBuffer>(),
+                              ._allocation = new_handle<VmaAllocation>()};
+    buffer._descriptorBufferInfo = {.buffer = buffer._buffer, .offset = 0, .range = size};
+    return buffer;
+}
+
+AllocatedBuffer NullRenderDevice::create_upload_buffer(
+    const void* data, size_t size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+    VmaAllocationCreateFlags allocationFlags)
+{
+    return create_buffer(size, usage, memoryUsage, allocationFlags);
+}
+
+void NullRenderDevice::upload_buffer(AllocatedBuffer& buffer, size_t offset, const void* data,
+                                     size_t size)
+{
+}
+
+void NullRenderDevice::flush_uploads()
+{
+}
+
+void NullRenderDevice::write_buffer(AllocatedBuffer& buffer, const void* data, size_t size)
+{
+}
+
+AllocatedImage NullRenderDevice::create_image(VkFormat format, VkImageUsageFlags usage,
+                                              VkExtent3D extent, uint32_t mipLevels)
+{
+    return {._image = new_handle<VkImage>(),
+            ._allocation = new_handle<VmaAllocation>(),
+            .mips = mipLevels,
+            .format = format};
+}
+
+void NullRenderDevice::upload_image(AllocatedImage& image, const void* data, size_t size,
+                                    VkExtent3D extent)
+{
+}
+
+void NullRenderDevice::destroy_buffer(AllocatedBuffer& buffer)
+{
+}
+
+void NullRenderDevice::destroy_image(AllocatedImage& image)
+{
+}
+
+void NullRenderDevice::set_object_name(VkImage image, const std::string& name)
+{
+}
+
+VkImage NullRenderDevice::create_unbound_image(VkFormat format, VkImageUsageFlags usage,
+                                               VkExtent3D extent, uint32_t mipLevels,
+                                               VkMemoryRequirements& requirements)
+{
+    // The mip chain is rounded up to the size of the first mip
+    requirements = {.size = get_texel_size(format) * extent.width * extent.height *
+                            extent.depth * mipLevels,
+                    .alignment = 256,
+                    .memoryTypeBits = 1};
+    return new_handle<VkImage>();
+}
+
+void NullRenderDevice::destroy_unbound_image(VkImage image)
+{
+}
+
+VmaAllocation NullRenderDevice::allocate_memory(const VkMemoryRequirements& requirements)
+{
+    return new_handle<VmaAllocation>();
+}
+
+void NullRenderDevice::free_memory(VmaAllocation allocation)
+{
+}
+
+void NullRenderDevice::bind_image_memory(VmaAllocation allocation, VkImage image)
+{
+}
+
+void NullRenderDevice::wait_idle()
+{
+}
+
+VkSampler NullRenderDevice::create_sampler(VkFilter filter)
+{
+    return new_handle<VkSampler>();
+}
+
+VkImageView NullRenderDevice::create_image_view(VkImage image, const ImageView& imageView,
+                                                VkFormat format)
+{
+    imageViewCount++;
+    return new_handle<VkImageView>();
+}
+
+void NullRenderDevice::destroy_image_view(VkImageView imageView)
+{
+}
+
+VkDescriptorSetLayout NullRenderDevice::create_descriptor_set_layout(
+    Slice<VkDescriptorType> descriptorTypes, const std::string& name)
+{
+    return new_handle<VkDescriptorSetLayout>();
+}
+
+VkPipelineLayout NullRenderDevice::create_pipeline_layout(
+    Slice<VkDescriptorSetLayout> setLayouts, Slice<VkPushConstantRange> pushRanges,
+    const std::string& name)
+{
+    return new_handle<VkPipelineLayout>();
+}
+
+VkDescriptorSet NullRenderDevice::create_descriptor_set(VkDescriptorSetLayout layout,
+                                                        Slice<DescriptorWrite> writes,
+                                                        const std::string& name)
+{
+    descriptorSetCount++;
+    return new_handle<VkDescriptorSet>();
+}
+
+void NullRenderDevice::destroy_descriptor_set(VkDescriptorSet descriptorSet)
+{
+}
+
+VkPipeline NullRenderDevice::create_compute_pipeline(const ComputePipeline& computePipeline,
+                                                     Slice<std::string_view> defines,
+                                                     VkPipelineLayout layout)
+{
+    pipelineCount++;
+    return new_handle<VkPipeline>();
+}
+
+VkPipeline NullRenderDevice::create_raster_pipeline(const RasterPipeline& rasterPipeline,
+                                                    const RasterPipelineFormats& formats,
+                                                    VkPipelineLayout layout,
+                                                    const std::string& name)
+{
+    pipelineCount++;
+    return new_handle<VkPipeline>();
+}
+
+void NullRenderDevice::create_raytracing_pipeline(RaytracingPipeline& pipeline,
+                                                  RayPipeline& rayPipeline,
+                                                  VkPipelineLayout layout)
+{
+    pipelineCount++;
+    pipeline.pipeline = new_handle<VkPipeline>();
+    pipeline.rgenRegion.deviceAddress = nextHandle++;
+}
+
+void NullRenderDevice::destroy_pipeline(VkPipeline pipeline)
+{
+}
+
+void NullRenderDevice::destroy_raytracing_pipeline(RaytracingPipeline& pipeline)
+{
+}
+
+void NullRenderDevice::clear_shader_cache()
+{
+}
+
+void NullRenderDevice::reset_timer()
+{
+}
+
+int NullRenderDevice::reserve_timer_slot(const std::string& name)
+{
+    return -1;
+}
+
+void NullRenderDevice::start_timer(VkCommandBuffer cmd, int slot)
+{
+}
+
+void NullRenderDevice::stop_timer(VkCommandBuffer cmd, int slot)
+{
+}
+
+int NullRenderDevice::get_recording_thread_count()
+{
+    return 1;
+}
+
+void NullRenderDevice::reset_recording_threads()
+{
+}
+
+VkCommandBuffer NullRenderDevice::begin_secondary_command_buffer(int thread)
+{
+    return VK_NULL_HANDLE;
+}
+
+void NullRenderDevice::end_secondary_command_buffer(VkCommandBuffer cmd)
+{
+}
+
+void NullRenderDevice::execute_secondary_command_buffers(VkCommandBuffer cmd, uint32_t count,
+                                                         const VkCommandBuffer* commandBuffers)
+{
+}
+
+void NullRenderDevice::destroy()
+{
+}
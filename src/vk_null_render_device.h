@@ -0,0 +1,94 @@
+#pragma once
+
+#include "vk_render_device.h"
+
+namespace Vrg
+{
+// Creates nothing: every object is a distinct fake handle and uploads are dropped. The graph
+// still plans, caches and records everything, into a MemoryCommandRecorder, so a frame can be
+// built and recorded without a GPU (panko_benchmark_recording, test_command_recorder). The
+// transient images need the size of their formats, unknown formats take 16 bytes per texel.
+class NullRenderDevice : public RenderDevice
+{
+public:
+    CommandRecorder* get_recorder() override;
+
+    AllocatedBuffer create_buffer(size_t size, VkBufferUsageFlags usage,
+                                  VmaMemoryUsage memoryUsage,
+                                  VmaAllocationCreateFlags allocationFlags = 0) override;
+    AllocatedBuffer create_upload_buffer(
+        const void* data, size_t size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+        VmaAllocationCreateFlags allocationFlags = 0) override;
+    void upload_buffer(AllocatedBuffer& buffer, size_t offset, const void* data,
+                       size_t size) override;
+    void flush_uploads() override;
+    void write_buffer(AllocatedBuffer& buffer, const void* data, size_t size) override;
+    AllocatedImage create_image(VkFormat format, VkImageUsageFlags usage, VkExtent3D extent,
+                                uint32_t mipLevels = 1) override;
+    void upload_image(AllocatedImage& image, const void* data, size_t size,
+                      VkExtent3D extent) override;
+    void destroy_buffer(AllocatedBuffer& buffer) override;
+    void destroy_image(AllocatedImage& image) override;
+    void set_object_name(VkImage image, const std::string& name) override;
+
+    VkImage create_unbound_image(VkFormat format, VkImageUsageFlags usage, VkExtent3D extent,
+                                 uint32_t mipLevels,
+                                 VkMemoryRequirements& requirements) override;
+    void destroy_unbound_image(VkImage image) override;
+    VmaAllocation allocate_memory(const VkMemoryRequirements& requirements) override;
+    void free_memory(VmaAllocation allocation) override;
+    void bind_image_memory(VmaAllocation allocation, VkImage image) override;
+    void wait_idle() override;
+
+    VkSampler create_sampler(VkFilter filter) override;
+    VkImageView create_image_view(VkImage image, const ImageView& imageView,
+                                  VkFormat format) override;
+    void destroy_image_view(VkImageView imageView) override;
+    VkDescriptorSetLayout create_descriptor_set_layout(Slice<VkDescriptorType> descriptorTypes,
+                                                       const std::string& name) override;
+    VkPipelineLayout create_pipeline_layout(Slice<VkDescriptorSetLayout> setLayouts,
+                                            Slice<VkPushConstantRange> pushRanges,
+                                            const std::string& name) override;
+    VkDescriptorSet create_descriptor_set(VkDescriptorSetLayout layout,
+                                          Slice<DescriptorWrite> writes,
+                                          const std::string& name) override;
+    void destroy_descriptor_set(VkDescriptorSet descriptorSet) override;
+    VkPipeline create_compute_pipeline(const ComputePipeline& computePipeline,
+                                       Slice<std::string_view> defines,
+                                       VkPipelineLayout layout) override;
+    VkPipeline create_raster_pipeline(const RasterPipeline& rasterPipeline,
+                                      const RasterPipelineFormats& formats,
+                                      VkPipelineLayout layout,
+                                      const std::string& name) override;
+    void create_raytracing_pipeline(RaytracingPipeline& pipeline, RayPipeline& rayPipeline,
+                                    VkPipelineLayout layout) override;
+    void destroy_pipeline(VkPipeline pipeline) override;
+    void destroy_raytracing_pipeline(RaytracingPipeline& pipeline) override;
+    void clear_shader_cache() override;
+
+    void reset_timer() override;
+    int reserve_timer_slot(const std::string& name) override;
+    void start_timer(VkCommandBuffer cmd, int slot) override;
+    void stop_timer(VkCommandBuffer cmd, int slot) override;
+
+    int get_recording_thread_count() override;
+    void reset_recording_threads() override;
+    VkCommandBuffer begin_secondary_command_buffer(int thread) override;
+    void end_secondary_command_buffer(VkCommandBuffer cmd) override;
+    void execute_secondary_command_buffers(VkCommandBuffer cmd, uint32_t count,
+                                           const VkCommandBuffer* commandBuffers) override;
+
+    void destroy() override;
+
+    MemoryCommandRecorder recorder;
+    // Objects created so far, pipelines and descriptor sets are only created on cache misses
+    uint32_t pipelineCount = 0;
+    uint32_t descriptorSetCount = 0;
+    uint32_t imageViewCount = 0;
+
+private:
+    template <typename T> T new_handle();
+
+    uint64_t nextHandle = 1;
+};
+} // namespace Vrg
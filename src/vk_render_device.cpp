@@ -0,0 +1,655 @@
+#include "vk_render_device.h"
+
+#include <vk_initializers.h>
+#include <vk_pipeline.h>
+#include <vk_rendergraph.h>
+#include <vk_utils.h>
+
+using namespace Vrg;
+
+VulkanRenderDevice::VulkanRenderDevice(EngineData* _engineData, ShaderManager* _shaderManager)
+    : vulkanRecorder(_engineData, &timer)
+{
+    engineData = _engineData;
+    shaderManager = _shaderManager;
+}
+
+void VulkanRenderDevice::enable_raytracing(VulkanRaytracing* _vulkanRaytracing)
+{
+    vulkanRaytracing = _vulkanRaytracing;
+}
+
+CommandRecorder* VulkanRenderDevice::get_recorder()
+{
+    return &vulkanRecorder;
+}
+
+AllocatedBuffer VulkanRenderDevice::create_buffer(size_t size, VkBufferUsageFlags usage,
+                                                  VmaMemoryUsage memoryUsage,
+                                                  VmaAllocationCreateFlags allocationFlags)
+{
+    return vkutils::create_buffer(engineData->allocator, size, usage, memoryUsage,
+                                  allocationFlags);
+}
+
+AllocatedBuffer VulkanRenderDevice::create_upload_buffer(
+    const void* data, size_t size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+    VmaAllocationCreateFlags allocationFlags)
+{
+    return get_upload_stream().create_buffer(data, size, usage, memoryUsage, allocationFlags);
+}
+
+void VulkanRenderDevice::upload_buffer(AllocatedBuffer& buffer, size_t offset,
+                                       const void* data, size_t size)
+{
+    get_upload_stream().upload(buffer, offset, data, size);
+}
+
+void VulkanRenderDevice::flush_uploads()
+{
+    if (isUploading)
+    {
+        uploadStream.destroy();
+        isUploading = false;
+    }
+}
+
+UploadStream& VulkanRenderDevice::get_upload_stream()
+{
+    // The staging memory is only kept until the uploads are flushed
+    if (!isUploading)
+    {
+        uploadStream.init(engineData);
+        isUploading = true;
+    }
+    return uploadStream;
+}
+
+void VulkanRenderDevice::write_buffer(AllocatedBuffer& buffer, const void* data, size_t size)
+{
+    vkutils::cpu_to_gpu(engineData->allocator, buffer, const_cast<void*>(data), size);
+}
+
+AllocatedImage VulkanRenderDevice::create_image(VkFormat format, VkImageUsageFlags usage,
+                                                VkExtent3D extent, uint32_t mipLevels)
+{
+    return vkutils::create_image(engineData, format, usage, extent, mipLevels);
+}
+
+void VulkanRenderDevice::upload_image(AllocatedImage& image, const void* data, size_t size,
+                                      VkExtent3D extent)
+{
+    AllocatedBuffer stagingBuffer =
+        vkutils::create_buffer(engineData->allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                               VMA_MEMORY_USAGE_CPU_ONLY);
+    write_buffer(stagingBuffer, data, size);
+
+    vkutils::immediate_submit(engineData, [&](VkCommandBuffer cmd) {
+        VkImageSubresourceRange range;
+        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        range.baseMipLevel = 0;
+        range.levelCount = 1;
+        range.baseArrayLayer = 0;
+        range.layerCount = 1;
+
+        VkImageMemoryBarrier imageBarrier_toTransfer = {};
+        imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+
+        imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier_toTransfer.image = image._image;
+        imageBarrier_toTransfer.subresourceRange = range;
+
+        imageBarrier_toTransfer.srcAccessMask = 0;
+        imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        // barrier the image into the transfer-receive layout
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                             &imageBarrier_toTransfer);
+
+        VkBufferImageCopy copyRegion = {};
+        copyRegion.bufferOffset = 0;
+        copyRegion.bufferRowLength = 0;
+        copyRegion.bufferImageHeight = 0;
+
+        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyRegion.imageSubresource.mipLevel = 0;
+        copyRegion.imageSubresource.baseArrayLayer = 0;
+        copyRegion.imageSubresource.layerCount = 1;
+        copyRegion.imageExtent = extent;
+
+        // copy the buffer into the image
+        vkCmdCopyBufferToImage(cmd, stagingBuffer._buffer, image._image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+        VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+
+        imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        // barrier the image into the shader readable layout
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                             0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
+    });
+
+    destroy_buffer(stagingBuffer);
+}
+
+void VulkanRenderDevice::destroy_buffer(AllocatedBuffer& buffer)
+{
+    vmaDestroyBuffer(engineData->allocator, buffer._buffer, buffer._allocation);
+}
+
+void VulkanRenderDevice::destroy_image(AllocatedImage& image)
+{
+    vmaDestroyImage(engineData->allocator, image._image, image._allocation);
+}
+
+void VulkanRenderDevice::set_object_name(VkImage image, const std::string& name)
+{
+    vkutils::setObjectName(engineData->device, image, name);
+}
+
+VkImage VulkanRenderDevice::create_unbound_image(VkFormat format, VkImageUsageFlags usage,
+                                                 VkExtent3D extent, uint32_t mipLevels,
+                                                 VkMemoryRequirements& requirements)
+{
+    VkImageCreateInfo createInfo = vkinit::image_create_info(format, usage, extent, mipLevels);
+    VkImage image;
+    VK_CHECK(vkCreateImage(engineData->device, &createInfo, nullptr, &image));
+    vkGetImageMemoryRequirements(engineData->device, image, &requirements);
+    return image;
+}
+
+void VulkanRenderDevice::destroy_unbound_image(VkImage image)
+{
+    vkDestroyImage(engineData->device, image, nullptr);
+}
+
+VmaAllocation VulkanRenderDevice::allocate_memory(const VkMemoryRequirements& requirements)
+{
+    VmaAllocationCreateInfo allocationInfo = {};
+    allocationInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocationInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VmaAllocation allocation;
+    VK_CHECK(vmaAllocateMemory(engineData->allocator, &requirements, &allocationInfo,
+                               &allocation, nullptr));
+    return allocation;
+}
+
+void VulkanRenderDevice::free_memory(VmaAllocation allocation)
+{
+    vmaFreeMemory(engineData->allocator, allocation);
+}
+
+void VulkanRenderDevice::bind_image_memory(VmaAllocation allocation, VkImage image)
+{
+    VK_CHECK(vmaBindImageMemory2(engineData->allocator, allocation, 0, image, nullptr));
+}
+
+void VulkanRenderDevice::wait_idle()
+{
+    vkDeviceWaitIdle(engineData->device);
+}
+
+VkSampler VulkanRenderDevice::create_sampler(VkFilter filter)
+{
+    VkSamplerCreateInfo samplerInfo =
+        vkinit::sampler_create_info(filter, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 1.0f;
+
+    VkSampler sampler;
+    VK_CHECK(vkCreateSampler(engineData->device, &samplerInfo, nullptr, &sampler));
+    return sampler;
+}
+
+VkImageView VulkanRenderDevice::create_image_view(VkImage image, const ImageView& imageView,
+                                                  VkFormat format)
+{
+    bool isDepth = false;
+    if (format == DEPTH_32_FORMAT)
+    {
+        isDepth = true;
+    }
+
+    VkImageViewCreateInfo imageViewInfo = vkinit::imageview_create_info(
+        format, image, isDepth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
+    imageViewInfo.subresourceRange.baseMipLevel = imageView.baseMipLevel;
+    imageViewInfo.subresourceRange.levelCount = imageView.mipLevelCount;
+
+    VkImageView newImageView;
+    VK_CHECK(vkCreateImageView(engineData->device, &imageViewInfo, nullptr, &newImageView));
+    return newImageView;
+}
+
+void VulkanRenderDevice::destroy_image_view(VkImageView imageView)
+{
+    vkDestroyImageView(engineData->device, imageView, nullptr);
+}
+
+VkDescriptorSetLayout VulkanRenderDevice::create_descriptor_set_layout(
+    Slice<VkDescriptorType> descriptorTypes, const std::string& name)
+{
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+    for (int i = 0; i < descriptorTypes.size(); i++)
+    {
+        layoutBindings.push_back(
+            vkinit::descriptorset_layout_binding(descriptorTypes[i], VK_SHADER_STAGE_ALL, i));
+    }
+
+    VkDescriptorSetLayoutCreateInfo setinfo =
+        vkinit::descriptorset_layout_create_info(layoutBindings.data(), layoutBindings.size());
+    VkDescriptorSetLayout newDescriptorSetLayout;
+
+    VK_CHECK(vkCreateDescriptorSetLayout(engineData->device, &setinfo, nullptr,
+                                         &newDescriptorSetLayout));
+    vkutils::setObjectName(engineData->device, newDescriptorSetLayout, name);
+
+    return newDescriptorSetLayout;
+}
+
+VkPipelineLayout VulkanRenderDevice::create_pipeline_layout(
+    Slice<VkDescriptorSetLayout> setLayouts, Slice<VkPushConstantRange> pushRanges,
+    const std::string& name)
+{
+    VkPipelineLayoutCreateInfo pipeline_layout_info =
+        vkinit::pipeline_layout_create_info(setLayouts.m_data, setLayouts.size());
+
+    if (pushRanges.size() > 0)
+    {
+        pipeline_layout_info.pushConstantRangeCount = pushRanges.size();
+        pipeline_layout_info.pPushConstantRanges = pushRanges.m_data;
+    }
+
+    VkPipelineLayout newLayout;
+    VK_CHECK(vkCreatePipelineLayout(engineData->device, &pipeline_layout_info, nullptr,
+                                    &newLayout));
+    vkutils::setObjectName(engineData->device, newLayout, name);
+
+    return newLayout;
+}
+
+VkDescriptorSet VulkanRenderDevice::create_descriptor_set(VkDescriptorSetLayout layout,
+                                                          Slice<DescriptorWrite> writes,
+                                                          const std::string& name)
+{
+    VkDescriptorSet descriptorSet;
+
+    VkDescriptorSetAllocateInfo allocInfo =
+        vkinit::descriptorset_allocate_info(engineData->descriptorPool, &layout, 1);
+    vkAllocateDescriptorSets(engineData->device, &allocInfo, &descriptorSet);
+
+    for (int i = 0; i < writes.size(); i++)
+    {
+        VkWriteDescriptorSet writeDescriptorSet;
+        if (writes[i].bufferInfo != nullptr)
+        {
+            writeDescriptorSet = vkinit::write_descriptor_buffer(
+                writes[i].type, descriptorSet, writes[i].bufferInfo, i);
+        }
+        else
+        {
+            writeDescriptorSet = vkinit::write_descriptor_image(
+                writes[i].type, descriptorSet, &writes[i].imageInfo, i, 1);
+        }
+        vkUpdateDescriptorSets(engineData->device, 1, &writeDescriptorSet, 0, nullptr);
+    }
+
+    vkutils::setObjectName(engineData->device, descriptorSet, name);
+    return descriptorSet;
+}
+
+void VulkanRenderDevice::destroy_descriptor_set(VkDescriptorSet descriptorSet)
+{
+    vkFreeDescriptorSets(engineData->device, engineData->descriptorPool, 1, &descriptorSet);
+}
+
+VkPipeline VulkanRenderDevice::create_compute_pipeline(const ComputePipeline& computePipeline,
+                                                       Slice<std::string_view> defines,
+                                                       VkPipelineLayout layout)
+{
+    VkShaderModule computeShader;
+    Slice<uint32_t> spirv{};
+    shaderManager->get_spirv(computePipeline.shader, defines, spirv);
+
+    if (!vkutils::load_shader_module(engineData->device, spirv, &computeShader))
+    {
+        assert("Compute Shader Loading Issue");
+    }
+
+    VkPipelineShaderStageCreateInfo stage =
+        vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, computeShader);
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.stage = stage;
+    computePipelineCreateInfo.layout = layout;
+
+    VkPipeline newPipeline;
+    VK_CHECK(vkCreateComputePipelines(engineData->device, VK_NULL_HANDLE, 1,
+                                      &computePipelineCreateInfo, nullptr, &newPipeline));
+
+    vkDestroyShaderModule(engineData->device, computeShader, nullptr);
+
+    return newPipeline;
+}
+
+VkPipeline VulkanRenderDevice::create_raster_pipeline(const RasterPipeline& rasterPipeline,
+                                                      const RasterPipelineFormats& formats,
+                                                      VkPipelineLayout layout,
+                                                      const std::string& name)
+{
+    // dynamic rendering
+    VkPipelineRenderingCreateInfo pipeline_rendering_create_info{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        .colorAttachmentCount = (uint32_t)formats.colorFormats.size(),
+        .pColorAttachmentFormats = formats.colorFormats.m_data,
+        .depthAttachmentFormat = formats.depthFormat};
+
+    // compile shaders
+    VkShaderModule vertexShader;
+    Slice<uint32_t> spirvVertex{};
+    shaderManager->get_spirv(rasterPipeline.vertexShader, {}, spirvVertex);
+
+    if (!vkutils::load_shader_module(engineData->device, spirvVertex, &vertexShader))
+    {
+        assert("Vertex Shader Loading Issue");
+    }
+
+    VkShaderModule fragmentShader;
+    Slice<uint32_t> spirvFragment{};
+    shaderManager->get_spirv(rasterPipeline.fragmentShader, {}, spirvFragment);
+
+    if (!vkutils::load_shader_module(engineData->device, spirvFragment, &fragmentShader))
+    {
+        assert("Fragment Shader Loading Issue");
+    }
+
+    PipelineBuilder pipelineBuilder;
+
+    // VERTEX INFO
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    bindings.reserve(formats.vertexFormats.size());
+    attributes.reserve(formats.vertexFormats.size());
+    {
+        pipelineBuilder._vertexInputInfo = vkinit::vertex_input_state_create_info();
+
+        for (int i = 0; i < formats.vertexFormats.size(); i++)
+        {
+            VkFormat format = formats.vertexFormats[i];
+
+            VkVertexInputBindingDescription vertexBinding = {};
+            vertexBinding.binding = i;
+            if (format == VK_FORMAT_R32G32_SFLOAT)
+            {
+                vertexBinding.stride = sizeof(float) * 2;
+            }
+            else if (format == VK_FORMAT_R32G32B32_SFLOAT)
+            {
+                vertexBinding.stride = sizeof(float) * 3;
+            }
+            else if (format == VK_FORMAT_R32G32B32A32_SFLOAT)
+            {
+                vertexBinding.stride = sizeof(float) * 4;
+            }
+            vertexBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            bindings.push_back(vertexBinding);
+
+            VkVertexInputAttributeDescription vertexAttribute = {};
+            vertexAttribute.binding = i;
+            vertexAttribute.location = i;
+            vertexAttribute.format = format;
+            vertexAttribute.offset = 0;
+
+            attributes.push_back(vertexAttribute);
+        }
+
+        pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
+        pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = attributes.size();
+        pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = bindings.data();
+        pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = bindings.size();
+    }
+
+    // TOPOLOGY
+    {
+        VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+        if (rasterPipeline.inputAssembly == InputAssembly::TRIANGLE)
+        {
+            topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        }
+        else if (rasterPipeline.inputAssembly == InputAssembly::POINT)
+        {
+            topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+        }
+        else if (rasterPipeline.inputAssembly == InputAssembly::LINE)
+        {
+            topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+        }
+        pipelineBuilder._inputAssembly = vkinit::input_assembly_create_info(topology);
+    }
+
+    // RASTERIZER
+    {
+        VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+        if (rasterPipeline.polygonMode == PolygonMode::FILL)
+        {
+            polygonMode = VK_POLYGON_MODE_FILL;
+        }
+        else if (rasterPipeline.polygonMode == PolygonMode::POINT)
+        {
+            polygonMode = VK_POLYGON_MODE_POINT;
+        }
+        else if (rasterPipeline.polygonMode == PolygonMode::LINE)
+        {
+            polygonMode = VK_POLYGON_MODE_LINE;
+        }
+        pipelineBuilder._rasterizer = vkinit::rasterization_state_create_info(polygonMode);
+
+        if (rasterPipeline.cullMode == CullMode::NONE)
+        {
+            pipelineBuilder._rasterizer.cullMode = VK_CULL_MODE_NONE;
+        }
+        else
+        {
+            pipelineBuilder._rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+        }
+
+        if (rasterPipeline.cullMode == CullMode::CLOCK_WISE)
+        {
+            pipelineBuilder._rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        }
+        else
+        {
+            pipelineBuilder._rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        }
+    }
+
+    // CONSERVATIVE RASTERIZATION
+    VkPipelineRasterizationConservativeStateCreateInfoEXT conservativeRasterStateCI{};
+    conservativeRasterStateCI.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT;
+    conservativeRasterStateCI.conservativeRasterizationMode =
+        VK_CONSERVATIVE_RASTERIZATION_MODE_OVERESTIMATE_EXT;
+    conservativeRasterStateCI.extraPrimitiveOverestimationSize = 1.0;
+
+    if (rasterPipeline.enableConservativeRasterization)
+    {
+        pipelineBuilder._rasterizer.pNext = &conservativeRasterStateCI;
+    }
+
+    // MULTISAMPLING
+    {
+        pipelineBuilder._multisampling = vkinit::multisampling_state_create_info();
+    }
+
+    // COLOR BLENDING
+    {
+        pipelineBuilder._colorBlending = vkinit::color_blend_state_create_info(
+            rasterPipeline.blendAttachmentStates.size(),
+            rasterPipeline.blendAttachmentStates.m_data);
+    }
+
+    // DEPTH TEST
+    {
+        pipelineBuilder._depthStencil = vkinit::depth_stencil_create_info(
+            rasterPipeline.depthState.depthTest, rasterPipeline.depthState.depthWrite,
+            rasterPipeline.depthState.compareOp);
+    }
+
+    // SHADER STAGES
+    {
+        pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(
+            VK_SHADER_STAGE_VERTEX_BIT, vertexShader));
+        pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(
+            VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
+    }
+
+    pipelineBuilder._pipelineLayout = layout;
+    VkPipeline newPipeline = pipelineBuilder.build_pipeline(engineData->device, nullptr,
+                                                            &pipeline_rendering_create_info);
+
+    vkDestroyShaderModule(engineData->device, vertexShader, nullptr);
+    vkDestroyShaderModule(engineData->device, fragmentShader, nullptr);
+
+    vkutils::setObjectName(engineData->device, newPipeline, name);
+
+    return newPipeline;
+}
+
+void VulkanRenderDevice::create_raytracing_pipeline(RaytracingPipeline& pipeline,
+                                                    RayPipeline& rayPipeline,
+                                                    VkPipelineLayout layout)
+{
+    Slice<uint32_t> rgenSpirv{};
+    shaderManager->get_spirv(rayPipeline.rgenShader, {}, rgenSpirv);
+
+    Slice<uint32_t> rmissSpirv{};
+    shaderManager->get_spirv(rayPipeline.missShader, {}, rmissSpirv);
+
+    Slice<uint32_t> rchitSpirv{};
+    shaderManager->get_spirv(rayPipeline.hitShader, {}, rchitSpirv);
+
+    vulkanRaytracing->create_new_pipeline(
+        pipeline, layout, rgenSpirv, rmissSpirv, rchitSpirv, rayPipeline.recursionDepth,
+        &rayPipeline.rgenSpecialization, &rayPipeline.missSpecialization,
+        &rayPipeline.hitSpecialization);
+}
+
+void VulkanRenderDevice::destroy_pipeline(VkPipeline pipeline)
+{
+    vkDestroyPipeline(engineData->device, pipeline, nullptr);
+}
+
+void VulkanRenderDevice::destroy_raytracing_pipeline(RaytracingPipeline& pipeline)
+{
+    vulkanRaytracing->destroy_raytracing_pipeline(pipeline);
+}
+
+void VulkanRenderDevice::clear_shader_cache()
+{
+    shaderManager->clear_cache();
+}
+
+void VulkanRenderDevice::reset_timer()
+{
+    timer.reset();
+}
+
+int VulkanRenderDevice::reserve_timer_slot(const std::string& name)
+{
+    return timer.reserve_slot(*engineData, name);
+}
+
+void VulkanRenderDevice::start_timer(VkCommandBuffer cmd, int slot)
+{
+    timer.start_recording(*engineData, cmd, slot);
+}
+
+void VulkanRenderDevice::stop_timer(VkCommandBuffer cmd, int slot)
+{
+    timer.stop_recording(*engineData, cmd, slot);
+}
+
+int VulkanRenderDevice::get_recording_thread_count()
+{
+    return RENDER_GRAPH_RECORDING_THREADS;
+}
+
+void VulkanRenderDevice::reset_recording_threads()
+{
+    if (recordingThreads.empty())
+    {
+        recordingThreads.resize(RENDER_GRAPH_RECORDING_THREADS);
+        for (RecordingThread& recordingThread : recordingThreads)
+        {
+            VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(
+                engineData->graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+            VK_CHECK(vkCreateCommandPool(engineData->device, &commandPoolInfo, nullptr,
+                                         &recordingThread.commandPool));
+        }
+    }
+
+    // The engine waits for the last frame before recording the next one
+    for (RecordingThread& recordingThread : recordingThreads)
+    {
+        VK_CHECK(vkResetCommandPool(engineData->device, recordingThread.commandPool, 0));
+        recordingThread.usedCount = 0;
+    }
+}
+
+VkCommandBuffer VulkanRenderDevice::begin_secondary_command_buffer(int thread)
+{
+    RecordingThread& recordingThread = recordingThreads[thread];
+    if (recordingThread.usedCount == recordingThread.commandBuffers.size())
+    {
+        VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(
+            recordingThread.commandPool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        VkCommandBuffer commandBuffer;
+        VK_CHECK(vkAllocateCommandBuffers(engineData->device, &allocInfo, &commandBuffer));
+        recordingThread.commandBuffers.push_back(commandBuffer);
+    }
+    VkCommandBuffer secondary = recordingThread.commandBuffers[recordingThread.usedCount++];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+    VkCommandBufferBeginInfo beginInfo =
+        vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+
+    return secondary;
+}
+
+void VulkanRenderDevice::end_secondary_command_buffer(VkCommandBuffer cmd)
+{
+    VK_CHECK(vkEndCommandBuffer(cmd));
+}
+
+void VulkanRenderDevice::execute_secondary_command_buffers(
+    VkCommandBuffer cmd, uint32_t count, const VkCommandBuffer* commandBuffers)
+{
+    vkCmdExecuteCommands(cmd, count, commandBuffers);
+}
+
+void VulkanRenderDevice::destroy()
+{
+    flush_uploads();
+
+    // Destroying a pool frees the secondary command buffers allocated from it
+    for (RecordingThread& recordingThread : recordingThreads)
+    {
+        vkDestroyCommandPool(engineData->device, recordingThread.commandPool, nullptr);
+    }
+    recordingThreads.clear();
+}
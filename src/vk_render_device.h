@@ -0,0 +1,216 @@
+#pragma once
+
+#include "memory/slice.h"
+#include "vk_command_recorder.h"
+#include "vk_rendergraph_types.h"
+#include "vk_shader.h"
+#include "vk_upload_stream.h"
+#include <string>
+#include <string_view>
+
+namespace Vrg
+{
+// Vertex, color and depth formats of a raster pipeline, taken from its bindings
+struct RasterPipelineFormats
+{
+    Slice<VkFormat> colorFormats;
+    VkFormat depthFormat;
+    Slice<VkFormat> vertexFormats;
+};
+
+// One binding of a descriptor set, buffers use bufferInfo and images imageInfo
+struct DescriptorWrite
+{
+    VkDescriptorType type;
+    const VkDescriptorBufferInfo* bufferInfo;
+    VkDescriptorImageInfo imageInfo;
+};
+
+// Everything the render graph and the frame modules create on the GPU. The graph only plans
+// and records, so with a device that creates nothing (NullRenderDevice) a frame can be built
+// and recorded without a GPU.
+class RenderDevice
+{
+public:
+    virtual ~RenderDevice() = default;
+
+    // Recorder of the graph until another one is set
+    virtual CommandRecorder* get_recorder() = 0;
+
+    // Resources of the modules. Uploads are copied before these return and are done on the
+    // GPU after flush_uploads.
+    virtual AllocatedBuffer create_buffer(size_t size, VkBufferUsageFlags usage,
+                                          VmaMemoryUsage memoryUsage,
+                                          VmaAllocationCreateFlags allocationFlags = 0) = 0;
+    virtual AllocatedBuffer create_upload_buffer(
+        const void* data, size_t size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+        VmaAllocationCreateFlags allocationFlags = 0) = 0;
+    virtual void upload_buffer(AllocatedBuffer& buffer, size_t offset, const void* data,
+                               size_t size) = 0;
+    virtual void flush_uploads() = 0;
+    // Only for buffers in CPU visible memory
+    virtual void write_buffer(AllocatedBuffer& buffer, const void* data, size_t size) = 0;
+    virtual AllocatedImage create_image(VkFormat format, VkImageUsageFlags usage,
+                                        VkExtent3D extent, uint32_t mipLevels = 1) = 0;
+    // Fills the first mip of a sampled image, which is left shader readable
+    virtual void upload_image(AllocatedImage& image, const void* data, size_t size,
+                              VkExtent3D extent) = 0;
+    virtual void destroy_buffer(AllocatedBuffer& buffer) = 0;
+    virtual void destroy_image(AllocatedImage& image) = 0;
+    virtual void set_object_name(VkImage image, const std::string& name) = 0;
+
+    // Transient images get their memory from the graph once their lifetimes are known
+    virtual VkImage create_unbound_image(VkFormat format, VkImageUsageFlags usage,
+                                         VkExtent3D extent, uint32_t mipLevels,
+                                         VkMemoryRequirements& requirements) = 0;
+    virtual void destroy_unbound_image(VkImage image) = 0;
+    virtual VmaAllocation allocate_memory(const VkMemoryRequirements& requirements) = 0;
+    virtual void free_memory(VmaAllocation allocation) = 0;
+    virtual void bind_image_memory(VmaAllocation allocation, VkImage image) = 0;
+    virtual void wait_idle() = 0;
+
+    // Objects the graph caches
+    virtual VkSampler create_sampler(VkFilter filter) = 0;
+    virtual VkImageView create_image_view(VkImage image, const ImageView& imageView,
+                                          VkFormat format) = 0;
+    virtual void destroy_image_view(VkImageView imageView) = 0;
+    virtual VkDescriptorSetLayout create_descriptor_set_layout(
+        Slice<VkDescriptorType> descriptorTypes, const std::string& name) = 0;
+    virtual VkPipelineLayout create_pipeline_layout(
+        Slice<VkDescriptorSetLayout> setLayouts, Slice<VkPushConstantRange> pushRanges,
+        const std::string& name) = 0;
+    virtual VkDescriptorSet create_descriptor_set(VkDescriptorSetLayout layout,
+                                                  Slice<DescriptorWrite> writes,
+                                                  const std::string& name) = 0;
+    virtual void destroy_descriptor_set(VkDescriptorSet descriptorSet) = 0;
+    virtual VkPipeline create_compute_pipeline(const ComputePipeline& computePipeline,
+                                               Slice<std::string_view> defines,
+                                               VkPipelineLayout layout) = 0;
+    virtual VkPipeline create_raster_pipeline(const RasterPipeline& rasterPipeline,
+                                              const RasterPipelineFormats& formats,
+                                              VkPipelineLayout layout,
+                                              const std::string& name) = 0;
+    virtual void create_raytracing_pipeline(RaytracingPipeline& pipeline,
+                                            RayPipeline& rayPipeline,
+                                            VkPipelineLayout layout) = 0;
+    virtual void destroy_pipeline(VkPipeline pipeline) = 0;
+    virtual void destroy_raytracing_pipeline(RaytracingPipeline& pipeline) = 0;
+    virtual void clear_shader_cache() = 0;
+
+    // Pass timestamps of passes recorded on other threads, see VulkanTimer
+    virtual void reset_timer() = 0;
+    virtual int reserve_timer_slot(const std::string& name) = 0;
+    virtual void start_timer(VkCommandBuffer cmd, int slot) = 0;
+    virtual void stop_timer(VkCommandBuffer cmd, int slot) = 0;
+
+    // Secondary command buffers of the recording threads, 1 thread records everything into
+    // the command buffer of the frame
+    virtual int get_recording_thread_count() = 0;
+    virtual void reset_recording_threads() = 0;
+    virtual VkCommandBuffer begin_secondary_command_buffer(int thread) = 0;
+    virtual void end_secondary_command_buffer(VkCommandBuffer cmd) = 0;
+    virtual void execute_secondary_command_buffers(VkCommandBuffer cmd, uint32_t count,
+                                                   const VkCommandBuffer* commandBuffers) = 0;
+
+    // Frees what the device owns itself, the GPU must be idle
+    virtual void destroy() = 0;
+};
+
+// Creates everything on the Vulkan device of the engine
+class VulkanRenderDevice : public RenderDevice
+{
+public:
+    VulkanRenderDevice(EngineData* _engineData, ShaderManager* _shaderManager);
+    void enable_raytracing(VulkanRaytracing* _vulkanRaytracing);
+
+    CommandRecorder* get_recorder() override;
+
+    AllocatedBuffer create_buffer(size_t size, VkBufferUsageFlags usage,
+                                  VmaMemoryUsage memoryUsage,
+                                  VmaAllocationCreateFlags allocationFlags = 0) override;
+    AllocatedBuffer create_upload_buffer(
+        const void* data, size_t size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+        VmaAllocationCreateFlags allocationFlags = 0) override;
+    void upload_buffer(AllocatedBuffer& buffer, size_t offset, const void* data,
+                       size_t size) override;
+    void flush_uploads() override;
+    void write_buffer(AllocatedBuffer& buffer, const void* data, size_t size) override;
+    AllocatedImage create_image(VkFormat format, VkImageUsageFlags usage, VkExtent3D extent,
+                                uint32_t mipLevels = 1) override;
+    void upload_image(AllocatedImage& image, const void* data, size_t size,
+                      VkExtent3D extent) override;
+    void destroy_buffer(AllocatedBuffer& buffer) override;
+    void destroy_image(AllocatedImage& image) override;
+    void set_object_name(VkImage image, const std::string& name) override;
+
+    VkImage create_unbound_image(VkFormat format, VkImageUsageFlags usage, VkExtent3D extent,
+                                 uint32_t mipLevels,
+                                 VkMemoryRequirements& requirements) override;
+    void destroy_unbound_image(VkImage image) override;
+    VmaAllocation allocate_memory(const VkMemoryRequirements& requirements) override;
+    void free_memory(VmaAllocation allocation) override;
+    void bind_image_memory(VmaAllocation allocation, VkImage image) override;
+    void wait_idle() override;
+
+    VkSampler create_sampler(VkFilter filter) override;
+    VkImageView create_image_view(VkImage image, const ImageView& imageView,
+                                  VkFormat format) override;
+    void destroy_image_view(VkImageView imageView) override;
+    VkDescriptorSetLayout create_descriptor_set_layout(Slice<VkDescriptorType> descriptorTypes,
+                                                       const std::string& name) override;
+    VkPipelineLayout create_pipeline_layout(Slice<VkDescriptorSetLayout> setLayouts,
+                                            Slice<VkPushConstantRange> pushRanges,
+                                            const std::string& name) override;
+    VkDescriptorSet create_descriptor_set(VkDescriptorSetLayout layout,
+                                          Slice<DescriptorWrite> writes,
+                                          const std::string& name) override;
+    void destroy_descriptor_set(VkDescriptorSet descriptorSet) override;
+    VkPipeline create_compute_pipeline(const ComputePipeline& computePipeline,
+                                       Slice<std::string_view> defines,
+                                       VkPipelineLayout layout) override;
+    VkPipeline create_raster_pipeline(const RasterPipeline& rasterPipeline,
+                                      const RasterPipelineFormats& formats,
+                                      VkPipelineLayout layout,
+                                      const std::string& name) override;
+    void create_raytracing_pipeline(RaytracingPipeline& pipeline, RayPipeline& rayPipeline,
+                                    VkPipelineLayout layout) override;
+    void destroy_pipeline(VkPipeline pipeline) override;
+    void destroy_raytracing_pipeline(RaytracingPipeline& pipeline) override;
+    void clear_shader_cache() override;
+
+    void reset_timer() override;
+    int reserve_timer_slot(const std::string& name) override;
+    void start_timer(VkCommandBuffer cmd, int slot) override;
+    void stop_timer(VkCommandBuffer cmd, int slot) override;
+
+    int get_recording_thread_count() override;
+    void reset_recording_threads() override;
+    VkCommandBuffer begin_secondary_command_buffer(int thread) override;
+    void end_secondary_command_buffer(VkCommandBuffer cmd) override;
+    void execute_secondary_command_buffers(VkCommandBuffer cmd, uint32_t count,
+                                           const VkCommandBuffer* commandBuffers) override;
+
+    void destroy() override;
+
+    VulkanTimer timer;
+
+private:
+    // Command pool of a recording thread, reset every frame
+    struct RecordingThread
+    {
+        VkCommandPool commandPool;
+        std::vector<VkCommandBuffer> commandBuffers;
+        uint32_t usedCount;
+    };
+
+    UploadStream& get_upload_stream();
+
+    EngineData* engineData;
+    ShaderManager* shaderManager;
+    VulkanRaytracing* vulkanRaytracing = nullptr;
+    VulkanCommandRecorder vulkanRecorder;
+    UploadStream uploadStream;
+    bool isUploading = false;
+    std::vector<RecordingThread> recordingThreads;
+};
+} // namespace Vrg
@@ -1,58 +1,59 @@
-#include "gltf_scene.hpp"
 #include "vk_cache.h"
-#include "vk_pipeline.h"
 #include "vk_rendergraph_types.h"
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <stdio.h>
+#include <string.h>
 #include <string_view>
-#include <vk_initializers.h>
 #include <vk_rendergraph.h>
-#include <vk_utils.h>
 
 using namespace Vrg;
 
-inline static VkAccessFlags get_access_flags(ResourceAccessType type)
+inline static VkAccessFlags2 get_access_flags(ResourceAccessType type)
 {
     switch (type)
     {
     case ResourceAccessType::COLOR_WRITE:
-        return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        return VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
     case ResourceAccessType::DEPTH_WRITE:
-        return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        return VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     case ResourceAccessType::COMPUTE_WRITE:
-        return VK_ACCESS_SHADER_WRITE_BIT;
+        return VK_ACCESS_2_SHADER_WRITE_BIT;
     case ResourceAccessType::COMPUTE_READ:
-        return VK_ACCESS_SHADER_READ_BIT;
+        return VK_ACCESS_2_SHADER_READ_BIT;
     case ResourceAccessType::FRAGMENT_READ:
-        return VK_ACCESS_SHADER_READ_BIT;
+        return VK_ACCESS_2_SHADER_READ_BIT;
     case ResourceAccessType::RAYTRACING_WRITE:
-        return VK_ACCESS_SHADER_WRITE_BIT;
+        return VK_ACCESS_2_SHADER_WRITE_BIT;
     case ResourceAccessType::RAYTRACING_READ:
-        return VK_ACCESS_SHADER_READ_BIT;
+        return VK_ACCESS_2_SHADER_READ_BIT;
     }
 
-    return 0;
+    return VK_ACCESS_2_NONE;
 }
 
-inline static VkPipelineStageFlags get_stage_flags(ResourceAccessType type)
+inline static VkPipelineStageFlags2 get_stage_flags(ResourceAccessType type)
 {
     switch (type)
     {
     case ResourceAccessType::COLOR_WRITE:
-        return VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        return VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
     case ResourceAccessType::DEPTH_WRITE:
-        return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        return VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT;
     case ResourceAccessType::COMPUTE_WRITE:
-        return VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        return VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
     case ResourceAccessType::COMPUTE_READ:
-        return VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        return VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
     case ResourceAccessType::FRAGMENT_READ:
-        return VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        return VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
     case ResourceAccessType::RAYTRACING_WRITE:
-        return VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+        return VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
     case ResourceAccessType::RAYTRACING_READ:
-        return VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+        return VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
     }
-    return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    return VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT;
 }
 
 inline static VkImageLayout get_image_layout(ResourceAccessType type)
@@ -94,6 +95,68 @@ inline static bool is_image_binding(BindType type)
     return type == BindType::IMAGE_VIEW;
 }
 
+// The graph tells resources apart by their Vulkan handle, bindings of different mips of one
+// image are the same resource
+inline static uint64_t get_resource_key(const Bindable* binding)
+{
+    if (is_image_binding(binding->type))
+    {
+        return reinterpret_cast<uint64_t>(binding->image->_image);
+    }
+    return reinterpret_cast<uint64_t>(binding->buffer->_buffer);
+}
+
+// A pass that loads and stores an image lists the binding in both its reads and its writes.
+// It is bound once, as the storage image of the write.
+inline static bool is_read_modify_write(Pool<Bindable>& bindings, const RenderPass& renderPass,
+                                        Handle<Bindable> bindable)
+{
+    Bindable* binding = bindings.get(bindable);
+    for (const DescriptorBinding& write : renderPass.writes)
+    {
+        if (bindings.get(write.bindable) == binding)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline static bool is_read_by_pass(Pool<Bindable>& bindings, const RenderPass& renderPass,
+                                   Handle<Bindable> bindable)
+{
+    Bindable* binding = bindings.get(bindable);
+    for (const DescriptorBinding& read : renderPass.reads)
+    {
+        if (bindings.get(read.bindable) == binding)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Custom passes place their own barriers and swapchain passes draw the UI, which calls back
+// into the graph. Both are recorded in submission order into the command buffer of execute.
+inline static bool is_recorded_in_order(const RenderPass& renderPass)
+{
+    if (renderPass.pipelineType == PipelineType::CUSTOM)
+    {
+        return true;
+    }
+    if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
+    {
+        for (const auto& colorOutput : renderPass.rasterPipeline.colorOutputs)
+        {
+            if (colorOutput.isSwapChain)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 template <typename T>
 inline static void copy_memory(Slice<T>& slice, FrameAllocator& frameAllocator)
 {
@@ -172,38 +235,26 @@ inline Slice<std::string_view> get_defines(Slice<Define> defines,
     return Slice<std::string_view>(result, defines.size());
 }
 
-RenderGraph::RenderGraph(EngineData* _engineData, ShaderManager* _shaderManager)
+RenderGraph::RenderGraph(RenderDevice* _device)
 {
+    device = _device;
+    recorder = device->get_recorder();
     renderPasses.reserve(128);
-    engineData = _engineData;
-    shaderManager = _shaderManager;
 
     frameAllocator.initialize(1024 * 1024 * 64); // 64mb
 
-    // Create a linear sampler
-    VkSamplerCreateInfo samplerInfo =
-        vkinit::sampler_create_info(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
-    samplerInfo.mipLodBias = 0.0f;
-    samplerInfo.maxAnisotropy = 1.0f;
-    samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 1.0f;
-    VK_CHECK(vkCreateSampler(_engineData->device, &samplerInfo, nullptr,
-                             &samplers[(int)Sampler::LINEAR]));
-
-    // Create a nearest sampler
-    VkSamplerCreateInfo samplerInfo2 =
-        vkinit::sampler_create_info(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
-    samplerInfo2.mipLodBias = 0.0f;
-    samplerInfo2.maxAnisotropy = 1.0f;
-    samplerInfo2.minLod = 0.0f;
-    samplerInfo2.maxLod = 1.0f;
-    VK_CHECK(vkCreateSampler(_engineData->device, &samplerInfo2, nullptr,
-                             &samplers[(int)Sampler::NEAREST]));
+    samplers[(int)Sampler::LINEAR] = device->create_sampler(VK_FILTER_LINEAR);
+    samplers[(int)Sampler::NEAREST] = device->create_sampler(VK_FILTER_NEAREST);
 }
 
-void Vrg::RenderGraph::enable_raytracing(VulkanRaytracing* _vulkanRaytracing)
+void RenderGraph::set_recorder(CommandRecorder* _recorder)
 {
-    vulkanRaytracing = _vulkanRaytracing;
+    recorder = _recorder != nullptr ? _recorder : device->get_recorder();
+}
+
+CommandRecorder* RenderGraph::get_recorder()
+{
+    return recorder;
 }
 
 RenderPass* RenderGraph::add_render_pass(RenderPass renderPass)
@@ -260,6 +311,35 @@ RenderPass* RenderGraph::add_render_pass(RenderPass renderPass)
     return &renderPasses[renderPasses.size() - 1];
 }
 
+void RenderGraph::create_transient_image(AllocatedImage* image, VkFormat format,
+                                         VkImageUsageFlags usageFlags, VkExtent3D extent,
+                                         uint32_t mipLevels, bool isHistory)
+{
+#if RENDER_GRAPH_ALIAS_TRANSIENTS
+    // Never replanned, replanning recreates the images and loses their contents
+    if (isHistory)
+    {
+        *image = device->create_image(format, usageFlags, extent, mipLevels);
+        historyImages.push_back(image);
+        return;
+    }
+
+    TransientImage transient = {
+        .image = image, .usage = usageFlags, .extent = extent, .isHistory = false};
+
+    // The memory is bound by execute, the image only needs a handle until then
+    image->_image = device->create_unbound_image(format, usageFlags, extent, mipLevels,
+                                                 transient.memoryRequirements);
+    image->_allocation = nullptr;
+    image->mips = mipLevels;
+    image->format = format;
+
+    transientImages.push_back(transient);
+#else
+    *image = device->create_image(format, usageFlags, extent, mipLevels);
+#endif
+}
+
 Handle<Bindable> RenderGraph::register_image_view(AllocatedImage* image, ImageView imageView,
                                                   std::string resourceName)
 {
@@ -269,7 +349,7 @@ Handle<Bindable> RenderGraph::register_image_view(AllocatedImage* image, ImageVi
                          .type = BindType::IMAGE_VIEW,
                          .name = resourceName};
 
-    vkutils::setObjectName(engineData->device, image->_image, resourceName);
+    device->set_object_name(image->_image, resourceName);
 
     return bindings.put(std::move(bindable));
 }
@@ -310,6 +390,13 @@ Handle<Bindable> RenderGraph::register_index_buffer(AllocatedBuffer* buffer, VkF
 
 void RenderGraph::insert_barrier(VkCommandBuffer cmd, Handle<Bindable> bindable,
                                  PipelineType pipelineType, bool isWrite, uint32_t mip)
+{
+    queue_barrier(bindable, pipelineType, isWrite, mip);
+    flush_barriers(cmd);
+}
+
+void RenderGraph::queue_barrier(Handle<Bindable> bindable, PipelineType pipelineType,
+                                bool isWrite, uint32_t mip, bool isReadModifyWrite)
 {
     auto binding = bindings.get(bindable);
 
@@ -332,8 +419,8 @@ void RenderGraph::insert_barrier(VkCommandBuffer cmd, Handle<Bindable> bindable,
         }
     }
 
-    VkAccessFlags dstAccess = get_access_flags(ResourceAccessType::NONE);
-    VkPipelineStageFlags dstStage = get_stage_flags(ResourceAccessType::NONE);
+    VkAccessFlags2 dstAccess = get_access_flags(ResourceAccessType::NONE);
+    VkPipelineStageFlags2 dstStage = get_stage_flags(ResourceAccessType::NONE);
     VkImageLayout dstLayout = get_image_layout(ResourceAccessType::NONE);
 
     ResourceAccessType newAccessType;
@@ -370,6 +457,10 @@ void RenderGraph::insert_barrier(VkCommandBuffer cmd, Handle<Bindable> bindable,
     }
 
     dstAccess = get_access_flags(newAccessType);
+    if (isReadModifyWrite)
+    {
+        dstAccess |= VK_ACCESS_2_SHADER_READ_BIT;
+    }
     dstStage = get_stage_flags(newAccessType);
     dstLayout = get_image_layout(newAccessType);
 
@@ -394,11 +485,17 @@ void RenderGraph::insert_barrier(VkCommandBuffer cmd, Handle<Bindable> bindable,
 
     if (condition)
     {
-        VkAccessFlags srcAccess = get_access_flags(prevAccessType);
-        VkPipelineStageFlags srcStage = get_stage_flags(prevAccessType);
+        VkAccessFlags2 srcAccess = get_access_flags(prevAccessType);
+        VkPipelineStageFlags2 srcStage = get_stage_flags(prevAccessType);
 
         if (binding->type == BindType::IMAGE_VIEW)
         {
+            if (is_first_aliased_use(binding->image->_image, mip))
+            {
+                srcStage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+                srcAccess = VK_ACCESS_2_MEMORY_WRITE_BIT;
+            }
+
             // TODO BARRIER VKIMAGESUBRESOURCERANGE FIX
             VkImageAspectFlags aspectFlag = VK_IMAGE_ASPECT_COLOR_BIT;
 
@@ -407,14 +504,31 @@ void RenderGraph::insert_barrier(VkCommandBuffer cmd, Handle<Bindable> bindable,
                 aspectFlag = VK_IMAGE_ASPECT_DEPTH_BIT;
             }
 
-            vkutils::image_barrier(cmd, binding->image->_image, srcLayout, dstLayout,
-                                   {aspectFlag, mip, 1, 0, 1}, srcAccess, dstAccess, srcStage,
-                                   dstStage);
+            queue_image_barrier({.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                                 .srcStageMask = srcStage,
+                                 .srcAccessMask = srcAccess,
+                                 .dstStageMask = dstStage,
+                                 .dstAccessMask = dstAccess,
+                                 .oldLayout = srcLayout,
+                                 .newLayout = dstLayout,
+                                 .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                                 .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                                 .image = binding->image->_image,
+                                 .subresourceRange = {aspectFlag, mip, 1, 0, 1}});
         }
         else
         {
-            vkutils::memory_barrier(cmd, binding->buffer->_buffer, srcAccess, dstAccess,
-                                    srcStage, dstStage);
+            pendingBarriers.queue_buffer_barrier(
+                {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                 .srcStageMask = srcStage,
+                 .srcAccessMask = srcAccess,
+                 .dstStageMask = dstStage,
+                 .dstAccessMask = dstAccess,
+                 .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                 .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                 .buffer = binding->buffer->_buffer,
+                 .offset = 0,
+                 .size = VK_WHOLE_SIZE});
         }
     }
 
@@ -429,24 +543,68 @@ void RenderGraph::insert_barrier(VkCommandBuffer cmd, Handle<Bindable> bindable,
     }
 }
 
+void RenderGraph::queue_image_barrier(VkImageMemoryBarrier2 barrier)
+{
+    pendingBarriers.queue_image_barrier(barrier);
+}
+
+void RenderGraph::flush_barriers(VkCommandBuffer cmd)
+{
+    record_barriers(cmd, plan_barriers());
+}
+
+BarrierRange RenderGraph::plan_barriers()
+{
+    return pendingBarriers.plan(plannedImageBarriers, plannedBufferBarriers);
+}
+
+void RenderGraph::record_barriers(VkCommandBuffer cmd, const BarrierRange& range)
+{
+    if (range.imageCount == 0 && range.bufferCount == 0)
+    {
+        return;
+    }
+
+    VkDependencyInfo dependencyInfo = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = range.bufferCount,
+        .pBufferMemoryBarriers = plannedBufferBarriers.data() + range.bufferOffset,
+        .imageMemoryBarrierCount = range.imageCount,
+        .pImageMemoryBarriers = plannedImageBarriers.data() + range.imageOffset};
+    recorder->pipeline_barrier(cmd, dependencyInfo);
+}
+
+bool RenderGraph::is_first_aliased_use(VkImage image, uint32_t mip)
+{
+    return aliasedImages.count(image) != 0 &&
+           imageBindingAccessType.find({image, mip}) == imageBindingAccessType.end();
+}
+
 void Vrg::RenderGraph::handle_render_pass_barriers(VkCommandBuffer cmd, RenderPass& renderPass)
+{
+    queue_render_pass_barriers(renderPass);
+    flush_barriers(cmd);
+}
+
+void RenderGraph::queue_render_pass_barriers(RenderPass& renderPass)
 {
     // WRITE BARRIERS
     for (int i = 0; i < renderPass.writes.size(); i++)
     {
         auto bindable = renderPass.writes[i].bindable;
         auto binding = bindings.get(bindable);
+        bool isReadModifyWrite = is_read_by_pass(bindings, renderPass, bindable);
 
         if (is_buffer_binding(binding->type))
         {
-            insert_barrier(cmd, bindable, renderPass.pipelineType, true);
+            queue_barrier(bindable, renderPass.pipelineType, true, 0, isReadModifyWrite);
         }
         else if (is_image_binding(binding->type))
         {
             for (uint32_t k = binding->imageView.baseMipLevel;
                  k < binding->imageView.baseMipLevel + binding->imageView.mipLevelCount; k++)
             {
-                insert_barrier(cmd, bindable, renderPass.pipelineType, true, k);
+                queue_barrier(bindable, renderPass.pipelineType, true, k, isReadModifyWrite);
             }
         }
     }
@@ -455,17 +613,21 @@ void Vrg::RenderGraph::handle_render_pass_barriers(VkCommandBuffer cmd, RenderPa
     {
         auto bindable = renderPass.reads[i].bindable;
         auto binding = bindings.get(bindable);
+        if (is_read_modify_write(bindings, renderPass, bindable))
+        {
+            continue;
+        }
 
         if (is_buffer_binding(binding->type))
         {
-            insert_barrier(cmd, bindable, renderPass.pipelineType, false);
+            queue_barrier(bindable, renderPass.pipelineType, false, 0);
         }
         else if (is_image_binding(binding->type))
         {
             for (uint32_t k = binding->imageView.baseMipLevel;
                  k < binding->imageView.baseMipLevel + binding->imageView.mipLevelCount; k++)
             {
-                insert_barrier(cmd, bindable, renderPass.pipelineType, false, k);
+                queue_barrier(bindable, renderPass.pipelineType, false, k);
             }
         }
     }
@@ -474,541 +636,733 @@ void Vrg::RenderGraph::handle_render_pass_barriers(VkCommandBuffer cmd, RenderPa
 void Vrg::RenderGraph::bind_pipeline_and_descriptors(VkCommandBuffer cmd,
                                                      RenderPass& renderPass)
 {
-    VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    VkPipeline pipeline;
+    PreparedPass prepared = {.renderPass = &renderPass};
+    prepare_bindings(renderPass, prepared);
+    record_bindings(cmd, prepared);
+}
 
+void RenderGraph::prepare_bindings(RenderPass& renderPass, PreparedPass& prepared)
+{
     if (renderPass.pipelineType == PipelineType::COMPUTE_TYPE)
     {
-        bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
-        pipeline = get_pipeline(renderPass);
+        prepared.bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+        prepared.pipeline = get_pipeline(renderPass);
     }
     else if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
     {
-        bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        pipeline = get_pipeline(renderPass);
+        prepared.bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        prepared.pipeline = get_pipeline(renderPass);
     }
     else
     {
-        bindPoint = VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR;
-        pipeline = get_raytracing_pipeline(renderPass)->pipeline;
+        prepared.bindPoint = VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR;
+        prepared.raytracingPipeline = get_raytracing_pipeline(renderPass);
+        prepared.pipeline = prepared.raytracingPipeline->pipeline;
     }
 
-    VkDescriptorSet descriptorSet[16];
-
+    prepared.descriptorSetOffset = plannedDescriptorSets.size();
     for (int i = 0; i < renderPass.descriptorSetCount; i++)
     {
-        descriptorSet[i] = get_descriptor_set(renderPass, i);
+        plannedDescriptorSets.push_back(get_descriptor_set(renderPass, i));
     }
-    auto pipelineLayout = get_pipeline_layout(renderPass);
+    prepared.pipelineLayout = get_pipeline_layout(renderPass);
+}
+
+void RenderGraph::record_bindings(VkCommandBuffer cmd, const PreparedPass& prepared)
+{
+    RenderPass& renderPass = *prepared.renderPass;
 
-    vkCmdBindPipeline(cmd, bindPoint, pipeline);
-    vkCmdBindDescriptorSets(cmd, bindPoint, pipelineLayout, 0, renderPass.descriptorSetCount,
-                            descriptorSet, 0, nullptr);
+    recorder->bind_pipeline(cmd, prepared.bindPoint, prepared.pipeline);
+    const VkDescriptorSet* descriptorSets =
+        plannedDescriptorSets.data() + prepared.descriptorSetOffset;
+    recorder->bind_descriptor_sets(cmd, prepared.bindPoint, prepared.pipelineLayout,
+                                   renderPass.descriptorSetCount, descriptorSets);
     if (renderPass.constants.size() > 0)
     {
-        vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_ALL, 0,
-                           renderPass.constants[0].size, renderPass.constants[0].data);
+        recorder->push_constants(cmd, prepared.pipelineLayout, renderPass.constants[0].size,
+                                 renderPass.constants[0].data);
     }
 
     if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
     {
         auto& rasterPipeline = renderPass.rasterPipeline;
-        vkutils::cmd_viewport_scissor(cmd, rasterPipeline.size);
-
-        // TODO: Get rid of std::vectors
-        std::vector<VkDeviceSize> offsets;
-        std::vector<VkBuffer> buffers;
-        offsets.reserve(rasterPipeline.vertexBuffers.size());
-        buffers.reserve(rasterPipeline.vertexBuffers.size());
+        recorder->set_viewport_scissor(cmd, rasterPipeline.size);
 
+        VkBuffer buffers[16];
         for (int i = 0; i < rasterPipeline.vertexBuffers.size(); i++)
         {
-            buffers.push_back(bindings.get(rasterPipeline.vertexBuffers[i])->buffer->_buffer);
-            offsets.push_back(0);
+            buffers[i] = bindings.get(rasterPipeline.vertexBuffers[i])->buffer->_buffer;
         }
 
-        if (buffers.size() > 0)
+        if (rasterPipeline.vertexBuffers.size() > 0)
         {
-            vkCmdBindVertexBuffers(cmd, 0, buffers.size(), buffers.data(), offsets.data());
+            recorder->bind_vertex_buffers(cmd, rasterPipeline.vertexBuffers.size(), buffers);
         }
 
         if (rasterPipeline.indexBuffer.isValid())
         {
-            vkCmdBindIndexBuffer(cmd,
-                                 bindings.get(rasterPipeline.indexBuffer)->buffer->_buffer, 0,
-                                 VK_INDEX_TYPE_UINT32); // TODO: support different index types
+            recorder->bind_index_buffer(
+                cmd, bindings.get(rasterPipeline.indexBuffer)->buffer->_buffer);
         }
     }
 }
 
-void RenderGraph::execute(VkCommandBuffer cmd)
+void RenderGraph::queue_attachment_barriers(RenderPass& renderPass)
 {
-    vkTimer.reset();
+    const auto& rasterPipeline = renderPass.rasterPipeline;
+
+    // TODO BARRIER VKIMAGESUBRESOURCERANGE FIX
+    // Color output barrier
+    for (int i = 0; i < rasterPipeline.colorOutputs.size(); i++)
+    {
+        auto& colorAttachment = rasterPipeline.colorOutputs[i];
+        auto binding = bindings.get(colorAttachment.bindable);
+
+        uint32_t mipLevel = binding->imageView.baseMipLevel;
+        bool isFirstAliasedUse = is_first_aliased_use(binding->image->_image, mipLevel);
+        queue_image_barrier({.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                             .srcStageMask = isFirstAliasedUse
+                                                 ? VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+                                                 : VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+                             .srcAccessMask = isFirstAliasedUse ? VK_ACCESS_2_MEMORY_WRITE_BIT
+                                                                : VK_ACCESS_2_NONE,
+                             .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             .dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                             .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                             .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                             .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                             .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                             .image = binding->image->_image,
+                             .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, mipLevel, 1, 0,
+                                                  1}});
+
+        imageBindingAccessType[{binding->image->_image, mipLevel}] =
+            ResourceAccessType::COLOR_WRITE;
+        bindingImageLayout[{binding->image->_image, mipLevel}] =
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+    // Depth output barrier
+    if (rasterPipeline.depthOutput.bindable.isValid())
+    {
+        auto binding = bindings.get(rasterPipeline.depthOutput.bindable);
+
+        uint32_t mipLevel = binding->imageView.baseMipLevel;
+        VkPipelineStageFlags2 depthStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                                            VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+        bool isFirstAliasedUse = is_first_aliased_use(binding->image->_image, mipLevel);
+        queue_image_barrier({.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                             .srcStageMask = isFirstAliasedUse
+                                                 ? VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+                                                 : depthStages,
+                             .srcAccessMask = isFirstAliasedUse ? VK_ACCESS_2_MEMORY_WRITE_BIT
+                                                                : VK_ACCESS_2_NONE,
+                             .dstStageMask = depthStages,
+                             .dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                             .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                             .newLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                             .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                             .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                             .image = binding->image->_image,
+                             .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, mipLevel, 1, 0,
+                                                  1}});
+
+        imageBindingAccessType[{binding->image->_image, mipLevel}] =
+            ResourceAccessType::DEPTH_WRITE;
+        bindingImageLayout[{binding->image->_image, mipLevel}] =
+            VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    }
+}
+
+void RenderGraph::compile()
+{
+    passInfos.resize(renderPasses.size());
 
     for (int r = 0; r < renderPasses.size(); r++)
     {
         auto& renderPass = renderPasses[r];
+        const auto& rasterPipeline = renderPass.rasterPipeline;
+        bool isRaster = renderPass.pipelineType == PipelineType::RASTER_TYPE;
 
-        if (renderPass.skipExecution)
+        size_t maxAccessCount = renderPass.writes.size() + renderPass.reads.size();
+        if (isRaster)
         {
-            continue;
+            maxAccessCount += rasterPipeline.colorOutputs.size() +
+                              rasterPipeline.vertexBuffers.size() + 2;
         }
+        PassAccess* accesses = frameAllocator.allocate_array<PassAccess>(maxAccessCount);
+        uint32_t accessCount = 0;
+
+        auto add_access = [&](Handle<Bindable> bindable, bool isWrite) {
+            auto binding = bindings.get(bindable);
+            if (binding != nullptr)
+            {
+                accesses[accessCount++] = {get_resource_key(binding), isWrite};
+            }
+        };
 
-        vkTimer.start_recording(*engineData, cmd, renderPass.name);
+        bool keep = !RENDER_GRAPH_CULL_PASSES || renderPass.keepAlive ||
+                    renderPass.skipExecution ||
+                    renderPass.pipelineType == PipelineType::CUSTOM;
 
-        if (renderPass.pipelineType == PipelineType::CUSTOM)
+        for (auto& write : renderPass.writes)
         {
-            renderPass.execute(cmd);
+            add_access(write.bindable, true);
         }
-        else
+        for (auto& read : renderPass.reads)
         {
-            handle_render_pass_barriers(cmd, renderPass);
-            bind_pipeline_and_descriptors(cmd, renderPass);
-
-            if (renderPass.pipelineType == PipelineType::COMPUTE_TYPE)
+            add_access(read.bindable, false);
+        }
+        if (isRaster)
+        {
+            for (auto& colorOutput : rasterPipeline.colorOutputs)
             {
-                vkCmdDispatch(cmd, renderPass.computePipeline.dimX,
-                              renderPass.computePipeline.dimY,
-                              renderPass.computePipeline.dimZ);
+                add_access(colorOutput.bindable, true);
+                keep |= colorOutput.isSwapChain;
             }
-            else if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
+            if (rasterPipeline.depthOutput.bindable.isValid())
             {
-                const auto& rasterPipeline = renderPass.rasterPipeline;
-
-                // TODO: Get rid of std::vectors
-                std::vector<VkRenderingAttachmentInfo> renderingAttachments;
-                renderingAttachments.reserve(rasterPipeline.colorOutputs.size());
-                int colorAttachmentCount = rasterPipeline.colorOutputs.size();
-
-                for (int i = 0; i < colorAttachmentCount; i++)
-                {
-                    auto binding = bindings.get(rasterPipeline.colorOutputs[i].bindable);
-
-                    VkRenderingAttachmentInfo color_attachment_info{
-                        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-                        .imageView = get_image_view(binding->image->_image, binding->imageView,
-                                                    binding->format),
-                        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-                        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-                        .clearValue = rasterPipeline.colorOutputs[i].clearValue};
-                    renderingAttachments.push_back(color_attachment_info);
-                }
-
-                VkRenderingInfo render_info{
-                    .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-                    .renderArea = {0, 0, rasterPipeline.size.width,
-                                   rasterPipeline.size.height},
-                    .layerCount = 1,
-                    .colorAttachmentCount = (uint32_t)colorAttachmentCount,
-                    .pColorAttachments = renderingAttachments.data(),
-                };
-
-                VkRenderingAttachmentInfo depthStencilAttachment{
-                    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-                    .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-                    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-                    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-                    .clearValue = rasterPipeline.depthOutput.clearValue};
-
-                if (rasterPipeline.depthOutput.bindable.isValid())
-                {
-                    auto binding = bindings.get(rasterPipeline.depthOutput.bindable);
-                    depthStencilAttachment.imageView = get_image_view(
-                        binding->image->_image, binding->imageView, binding->format),
-                    render_info.pDepthAttachment = &depthStencilAttachment;
-                }
-
-                // TODO BARRIER VKIMAGESUBRESOURCERANGE FIX
-                // Color output barrier
-                for (int i = 0; i < colorAttachmentCount; i++)
-                {
-                    auto& colorAttachment = rasterPipeline.colorOutputs[0];
-                    auto binding = bindings.get(colorAttachment.bindable);
-
-                    uint32_t mipLevel = binding->imageView.baseMipLevel;
-                    vkutils::image_barrier(
-                        cmd, binding->image->_image, VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                        VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, mipLevel, 1, 0, 1},
-                        0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-
-                    imageBindingAccessType[{binding->image->_image, mipLevel}] =
-                        ResourceAccessType::COLOR_WRITE;
-                    bindingImageLayout[{binding->image->_image, mipLevel}] =
-                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-                }
-                // Depth output barrier
-                if (rasterPipeline.depthOutput.bindable.isValid())
-                {
-                    auto binding = bindings.get(rasterPipeline.depthOutput.bindable);
-
-                    uint32_t mipLevel = binding->imageView.baseMipLevel;
-
-                    vkutils::image_barrier(
-                        cmd, binding->image->_image, VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-                        VkImageSubresourceRange{VK_IMAGE_ASPECT_DEPTH_BIT, mipLevel, 1, 0, 1},
-                        0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
-                            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
-                            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
-
-                    imageBindingAccessType[{binding->image->_image, mipLevel}] =
-                        ResourceAccessType::DEPTH_WRITE;
-                    bindingImageLayout[{binding->image->_image, mipLevel}] =
-                        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-                }
-
-                vkCmdBeginRendering(cmd, &render_info);
-
-                renderPass.execute(cmd);
-
-                vkCmdEndRendering(cmd);
-
-                for (int i = 0; i < colorAttachmentCount; i++)
-                {
-                    auto& colorAttachment = rasterPipeline.colorOutputs[0];
-                    if (colorAttachment.isSwapChain)
-                    {
-                        auto binding = bindings.get(colorAttachment.bindable);
-
-                        vkutils::image_barrier(
-                            cmd, binding->image->_image,
-                            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                            VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
-                            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0,
-                            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-                    }
-                }
+                add_access(rasterPipeline.depthOutput.bindable, true);
             }
-            else if (renderPass.pipelineType == PipelineType::RAYTRACING_TYPE)
+            for (auto& vertexBuffer : rasterPipeline.vertexBuffers)
             {
-                auto raytracingPipeline = get_raytracing_pipeline(renderPass);
-
-                vkCmdTraceRaysKHR(
-                    cmd, &raytracingPipeline->rgenRegion, &raytracingPipeline->missRegion,
-                    &raytracingPipeline->hitRegion, &raytracingPipeline->callRegion,
-                    renderPass.raytracingPipeline.width, renderPass.raytracingPipeline.height,
-                    renderPass.raytracingPipeline.depth);
+                add_access(vertexBuffer, false);
+            }
+            if (rasterPipeline.indexBuffer.isValid())
+            {
+                add_access(rasterPipeline.indexBuffer, false);
             }
         }
-        vkTimer.stop_recording(*engineData, cmd);
+
+        passInfos[r] = {Slice<PassAccess>(accesses, accessCount), keep};
     }
 
-    imageBindingAccessType.clear();
-    bufferBindingAccessType.clear();
-    renderPasses.clear();
-    frameAllocator.reset();
+    graphCompiler.compile(Slice<PassInfo>(passInfos));
 }
 
-void Vrg::RenderGraph::rebuild_pipelines()
+void RenderGraph::execute(VkCommandBuffer cmd)
 {
-    for (auto& it : pipelineCache)
+    device->reset_timer();
+    compile();
+    update_transient_memory();
+
+    // Passes recorded on other threads are timed without the recorder, only the recorder of
+    // the device records in parallel
+    bool isParallel =
+        device->get_recording_thread_count() > 1 && recorder == device->get_recorder();
+    if (isParallel)
     {
-        vkDestroyPipeline(engineData->device, it.second, nullptr);
+        device->reset_recording_threads();
     }
-    pipelineCache.clear();
 
-    for (auto& it : raytracingPipelineCache)
+    size_t segmentStart = 0;
+    for (uint32_t r : graphCompiler.passOrder)
     {
-        vulkanRaytracing->destroy_raytracing_pipeline(it.second);
+        auto& renderPass = renderPasses[r];
+
+        if (renderPass.skipExecution)
+        {
+            continue;
+        }
+
+        if (!is_recorded_in_order(renderPass))
+        {
+            preparedPasses.push_back(prepare_pass(renderPass, isParallel));
+            continue;
+        }
+
+        // The passes after it are planned once it has placed its barriers
+        record_passes(cmd, segmentStart, preparedPasses.size() - segmentStart);
+        record_pass(cmd, prepare_pass(renderPass, false));
+        segmentStart = preparedPasses.size();
     }
-    raytracingPipelineCache.clear();
-    shaderManager->clear_cache();
+    record_passes(cmd, segmentStart, preparedPasses.size() - segmentStart);
+
+    preparedPasses.clear();
+    plannedImageBarriers.clear();
+    plannedBufferBarriers.clear();
+    plannedDescriptorSets.clear();
+    plannedAttachments.clear();
+    imageBindingAccessType.clear();
+    bufferBindingAccessType.clear();
+    renderPasses.clear();
+    frameAllocator.reset();
 }
 
-void Vrg::RenderGraph::destroy_resource(AllocatedImage& image)
+PreparedPass RenderGraph::prepare_pass(RenderPass& renderPass, bool isParallel)
 {
-    for (uint32_t i = 0; i < image.mips; i++)
+    PreparedPass prepared = {
+        .renderPass = &renderPass,
+        .timerSlot = isParallel ? device->reserve_timer_slot(renderPass.name) : -1};
+
+    if (renderPass.pipelineType == PipelineType::CUSTOM)
     {
-        imageBindingAccessType.erase({image._image, i});
-        bindingImageLayout.erase({image._image, i});
-        // TODO: Destroy all image views
-        // TODO: Destroy all descriptor sets
+        return prepared;
     }
 
-    if (image._allocation != nullptr)
+    // Everything the pass waits for in one barrier command
+    queue_render_pass_barriers(renderPass);
+    if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
     {
-        vmaDestroyImage(engineData->allocator, image._image, image._allocation);
+        queue_attachment_barriers(renderPass);
     }
-}
+    prepared.barriers = plan_barriers();
+    prepare_bindings(renderPass, prepared);
 
-void Vrg::RenderGraph::destroy_resource(AllocatedBuffer& buffer)
-{
-    // TODO: Destroy all descriptor sets
-    bufferBindingAccessType.erase(buffer._buffer);
-    vmaDestroyBuffer(engineData->allocator, buffer._buffer, buffer._allocation);
+    if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
+    {
+        const auto& rasterPipeline = renderPass.rasterPipeline;
+
+        prepared.attachmentOffset = plannedAttachments.size();
+        for (int i = 0; i < rasterPipeline.colorOutputs.size(); i++)
+        {
+            auto binding = bindings.get(rasterPipeline.colorOutputs[i].bindable);
+
+            VkRenderingAttachmentInfo color_attachment_info{
+                .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                .imageView = get_image_view(binding->image->_image, binding->imageView,
+                                            binding->format),
+                .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue = rasterPipeline.colorOutputs[i].clearValue};
+            plannedAttachments.push_back(color_attachment_info);
+        }
+
+        if (rasterPipeline.depthOutput.bindable.isValid())
+        {
+            auto binding = bindings.get(rasterPipeline.depthOutput.bindable);
+            prepared.depthView =
+                get_image_view(binding->image->_image, binding->imageView, binding->format);
+        }
+
+        for (int i = 0; i < rasterPipeline.colorOutputs.size(); i++)
+        {
+            auto& colorAttachment = rasterPipeline.colorOutputs[i];
+            if (colorAttachment.isSwapChain)
+            {
+                auto binding = bindings.get(colorAttachment.bindable);
+
+                queue_image_barrier(
+                    {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                     .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                     .srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                     .dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+                     .dstAccessMask = VK_ACCESS_2_NONE,
+                     .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                     .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                     .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                     .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                     .image = binding->image->_image,
+                     .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}});
+            }
+        }
+        prepared.presentBarriers = plan_barriers();
+    }
+
+    return prepared;
 }
 
-VkPipeline RenderGraph::get_pipeline(RenderPass& renderPass)
+void RenderGraph::record_pass(VkCommandBuffer cmd, const PreparedPass& prepared)
 {
-    auto pipelineHash = get_pipeline_hash(renderPass);
-    if (pipelineCache.find(pipelineHash) != pipelineCache.end())
+    auto& renderPass = *prepared.renderPass;
+
+    if (prepared.timerSlot >= 0)
     {
-        return pipelineCache[pipelineHash];
+        device->start_timer(cmd, prepared.timerSlot);
+    }
+    else
+    {
+        recorder->begin_pass(cmd, renderPass.name);
     }
 
-    if (renderPass.pipelineType == PipelineType::COMPUTE_TYPE)
+    if (renderPass.pipelineType == PipelineType::CUSTOM)
     {
-        VkShaderModule computeShader;
-        Slice<uint32_t> spirv{};
-        shaderManager->get_spirv(renderPass.computePipeline.shader,
-                                 get_defines(renderPass.defines, frameAllocator), spirv);
+        recorder->external(cmd, renderPass.name, renderPass.execute);
+    }
+    else
+    {
+        record_barriers(cmd, prepared.barriers);
+        record_bindings(cmd, prepared);
 
-        if (!vkutils::load_shader_module(engineData->device, spirv, &computeShader))
+        if (renderPass.pipelineType == PipelineType::COMPUTE_TYPE)
         {
-            assert("Compute Shader Loading Issue");
+            recorder->dispatch(cmd, renderPass.computePipeline.dimX,
+                               renderPass.computePipeline.dimY,
+                               renderPass.computePipeline.dimZ);
         }
+        else if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
+        {
+            const auto& rasterPipeline = renderPass.rasterPipeline;
+
+            VkRenderingInfo render_info{
+                .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+                .renderArea = {0, 0, rasterPipeline.size.width, rasterPipeline.size.height},
+                .layerCount = 1,
+                .colorAttachmentCount = (uint32_t)rasterPipeline.colorOutputs.size(),
+                .pColorAttachments = plannedAttachments.data() + prepared.attachmentOffset,
+            };
+
+            VkRenderingAttachmentInfo depthStencilAttachment{
+                .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                .imageView = prepared.depthView,
+                .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue = rasterPipeline.depthOutput.clearValue};
+
+            if (rasterPipeline.depthOutput.bindable.isValid())
+            {
+                render_info.pDepthAttachment = &depthStencilAttachment;
+            }
 
-        VkPipelineShaderStageCreateInfo stage = vkinit::pipeline_shader_stage_create_info(
-            VK_SHADER_STAGE_COMPUTE_BIT, computeShader);
-
-        VkComputePipelineCreateInfo computePipelineCreateInfo = {};
-        computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        computePipelineCreateInfo.stage = stage;
-        computePipelineCreateInfo.layout = get_pipeline_layout(renderPass);
+            recorder->begin_rendering(cmd, render_info);
 
-        VkPipeline computePipeline;
+            renderPass.execute(cmd);
 
-        VK_CHECK(vkCreateComputePipelines(engineData->device, VK_NULL_HANDLE, 1,
-                                          &computePipelineCreateInfo, nullptr,
-                                          &computePipeline));
-        pipelineCache[pipelineHash] = computePipeline;
+            recorder->end_rendering(cmd);
 
-        vkDestroyShaderModule(engineData->device, computeShader, nullptr);
+            record_barriers(cmd, prepared.presentBarriers);
+        }
+        else if (renderPass.pipelineType == PipelineType::RAYTRACING_TYPE)
+        {
+            recorder->trace_rays(cmd, *prepared.raytracingPipeline,
+                                 renderPass.raytracingPipeline.width,
+                                 renderPass.raytracingPipeline.height,
+                                 renderPass.raytracingPipeline.depth);
+        }
+    }
 
-        return computePipeline;
+    if (prepared.timerSlot >= 0)
+    {
+        device->stop_timer(cmd, prepared.timerSlot);
     }
-    else if (renderPass.pipelineType == PipelineType::RASTER_TYPE)
+    else
     {
-        // dynamic rendering
-        std::vector<VkFormat> colorAttachments;
-        colorAttachments.reserve(renderPass.rasterPipeline.colorOutputs.size());
+        recorder->end_pass(cmd);
+    }
+}
 
-        for (int i = 0; i < renderPass.rasterPipeline.colorOutputs.size(); i++)
+void RenderGraph::record_passes(VkCommandBuffer cmd, size_t first, size_t count)
+{
+    int runCount = std::min<size_t>(count, device->get_recording_thread_count());
+    if (recorder != device->get_recorder() || runCount < 2)
+    {
+        for (size_t i = first; i < first + count; i++)
         {
-            colorAttachments.push_back(
-                bindings.get(renderPass.rasterPipeline.colorOutputs[i].bindable)->format);
+            record_pass(cmd, preparedPasses[i]);
         }
+        return;
+    }
 
-        VkFormat depthFormat = VK_FORMAT_UNDEFINED;
-
-        if (renderPass.rasterPipeline.depthOutput.bindable.isValid())
+    // Split by position on purpose, not along the dependencies of graphCompiler. The
+    // secondaries execute in submission order, so a pass waiting for one in an earlier run is
+    // covered by the barriers planned in that order. Nearly every pass of the frame depends
+    // on the gbuffer, so independent chains would leave most threads without work.
+    secondaryCommandBuffers.resize(runCount);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(RENDER_GRAPH_RECORDING_THREADS)
+    for (int run = 0; run < runCount; run++)
+    {
+#ifdef _OPENMP
+        VkCommandBuffer secondary =
+            device->begin_secondary_command_buffer(omp_get_thread_num());
+#else
+        VkCommandBuffer secondary = device->begin_secondary_command_buffer(0);
+#endif
+
+        size_t runEnd = first + count * (run + 1) / runCount;
+        for (size_t i = first + count * run / runCount; i < runEnd; i++)
         {
-            depthFormat = bindings.get(renderPass.rasterPipeline.depthOutput.bindable)->format;
+            record_pass(secondary, preparedPasses[i]);
         }
 
-        VkPipelineRenderingCreateInfo pipeline_rendering_create_info{
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-            .colorAttachmentCount = (uint32_t)renderPass.rasterPipeline.colorOutputs.size(),
-            .pColorAttachmentFormats = colorAttachments.data(),
-            .depthAttachmentFormat = depthFormat};
+        device->end_secondary_command_buffer(secondary);
+        secondaryCommandBuffers[run] = secondary;
+    }
 
-        // compile shaders
-        VkShaderModule vertexShader;
-        Slice<uint32_t> spirvVertex{};
-        shaderManager->get_spirv(renderPass.rasterPipeline.vertexShader, {}, spirvVertex);
+    device->execute_secondary_command_buffers(cmd, runCount, secondaryCommandBuffers.data());
+}
 
-        if (!vkutils::load_shader_module(engineData->device, spirvVertex, &vertexShader))
+void RenderGraph::update_transient_memory()
+{
+    if (transientImages.empty())
+    {
+        return;
+    }
+
+    transientResources.resize(transientImages.size());
+    for (int i = 0; i < transientImages.size(); i++)
+    {
+        TransientImage& transient = transientImages[i];
+        ResourceLifetime lifetime =
+            graphCompiler.get_lifetime(reinterpret_cast<uint64_t>(transient.image->_image));
+        if (lifetime.isHistory && !transient.isHistory)
         {
-            assert("Vertex Shader Loading Issue");
+            // Shares memory until the plan changes, which loses what it held
+            printf("A transient image is read before it is written, it should be created as "
+                   "history\n");
+            transient.isHistory = true;
         }
 
-        VkShaderModule fragmentShader;
-        Slice<uint32_t> spirvFragment{};
-        shaderManager->get_spirv(renderPass.rasterPipeline.fragmentShader, {}, spirvFragment);
-
-        if (!vkutils::load_shader_module(engineData->device, spirvFragment, &fragmentShader))
+        // Images the frame does not use get the first pass, they only need to be bound
+        uint32_t first = 0;
+        uint32_t last = 0;
+        if (transient.isHistory)
         {
-            assert("Fragment Shader Loading Issue");
+            last = UINT32_MAX;
         }
-
-        PipelineBuilder pipelineBuilder;
-
-        // VERTEX INFO
-        std::vector<VkVertexInputBindingDescription> bindings;
-        std::vector<VkVertexInputAttributeDescription> attributes;
-        bindings.reserve(renderPass.rasterPipeline.vertexBuffers.size());
-        attributes.reserve(renderPass.rasterPipeline.vertexBuffers.size());
+        else if (lifetime.first != UINT32_MAX)
         {
-            pipelineBuilder._vertexInputInfo = vkinit::vertex_input_state_create_info();
+            first = lifetime.first;
+            last = lifetime.last;
+        }
 
-            for (int i = 0; i < renderPass.rasterPipeline.vertexBuffers.size(); i++)
-            {
-                VkFormat format =
-                    this->bindings.get(renderPass.rasterPipeline.vertexBuffers[i])->format;
-
-                VkVertexInputBindingDescription vertexBinding = {};
-                vertexBinding.binding = i;
-                if (format == VK_FORMAT_R32G32_SFLOAT)
-                {
-                    vertexBinding.stride = sizeof(float) * 2;
-                }
-                else if (format == VK_FORMAT_R32G32B32_SFLOAT)
-                {
-                    vertexBinding.stride = sizeof(float) * 3;
-                }
-                else if (format == VK_FORMAT_R32G32B32A32_SFLOAT)
-                {
-                    vertexBinding.stride = sizeof(float) * 4;
-                }
-                vertexBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-                bindings.push_back(vertexBinding);
-
-                VkVertexInputAttributeDescription vertexAttribute = {};
-                vertexAttribute.binding = i;
-                vertexAttribute.location = i;
-                vertexAttribute.format = format;
-                vertexAttribute.offset = 0;
-
-                attributes.push_back(vertexAttribute);
-            }
+        const VkMemoryRequirements& requirements = transient.memoryRequirements;
+        transientResources[i] = {requirements.size, requirements.alignment,
+                                 requirements.memoryTypeBits, first, last};
+    }
 
-            pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
-            pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount =
-                attributes.size();
-            pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = bindings.data();
-            pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = bindings.size();
-        }
+    aliasingPlanner.plan(Slice<TransientResource>(transientResources));
 
-        // TOPOLOGY
+    bool isPlanChanged = aliasingPlanner.placements != transientPlacements ||
+                         aliasingPlanner.blocks.size() != transientBlocks.size();
+    for (int b = 0; !isPlanChanged && b < transientBlocks.size(); b++)
+    {
+        isPlanChanged = aliasingPlanner.blocks[b].size != transientBlocks[b].size ||
+                        aliasingPlanner.blocks[b].memoryTypeBits !=
+                            transientBlocks[b].memoryTypeBits;
+    }
+
+    if (isPlanChanged)
+    {
+        // Images that were bound before are recreated, an image can not be bound twice
+        if (!transientMemory.empty())
         {
-            VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
-            if (renderPass.rasterPipeline.inputAssembly == InputAssembly::TRIANGLE)
+            device->wait_idle();
+
+            for (TransientImage& transient : transientImages)
             {
-                topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+                release_image_caches(transient.image->_image, transient.image->mips);
+                device->destroy_unbound_image(transient.image->_image);
             }
-            else if (renderPass.rasterPipeline.inputAssembly == InputAssembly::POINT)
+            for (TransientImage& transient : transientImages)
             {
-                topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+                transient.image->_image = device->create_unbound_image(
+                    transient.image->format, transient.usage, transient.extent,
+                    transient.image->mips, transient.memoryRequirements);
             }
-            else if (renderPass.rasterPipeline.inputAssembly == InputAssembly::LINE)
+            for (VmaAllocation allocation : transientMemory)
             {
-                topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+                device->free_memory(allocation);
             }
-            pipelineBuilder._inputAssembly = vkinit::input_assembly_create_info(topology);
         }
 
-        // RASTERIZER
+        transientMemory.resize(aliasingPlanner.blocks.size());
+        for (int b = 0; b < aliasingPlanner.blocks.size(); b++)
         {
-            VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
-            if (renderPass.rasterPipeline.polygonMode == PolygonMode::FILL)
-            {
-                polygonMode = VK_POLYGON_MODE_FILL;
-            }
-            else if (renderPass.rasterPipeline.polygonMode == PolygonMode::POINT)
-            {
-                polygonMode = VK_POLYGON_MODE_POINT;
-            }
-            else if (renderPass.rasterPipeline.polygonMode == PolygonMode::LINE)
-            {
-                polygonMode = VK_POLYGON_MODE_LINE;
-            }
-            pipelineBuilder._rasterizer = vkinit::rasterization_state_create_info(polygonMode);
+            const TransientBlock& block = aliasingPlanner.blocks[b];
+            transientMemory[b] =
+                device->allocate_memory({block.size, block.alignment, block.memoryTypeBits});
+        }
 
-            if (renderPass.rasterPipeline.cullMode == CullMode::NONE)
-            {
-                pipelineBuilder._rasterizer.cullMode = VK_CULL_MODE_NONE;
-            }
-            else
+        aliasedImages.clear();
+        for (int i = 0; i < transientImages.size(); i++)
+        {
+            uint32_t block = aliasingPlanner.placements[i];
+            VkImage image = transientImages[i].image->_image;
+            device->bind_image_memory(transientMemory[block], image);
+            if (aliasingPlanner.blocks[block].resourceCount > 1)
             {
-                pipelineBuilder._rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+                aliasedImages.insert(image);
             }
+        }
 
-            if (renderPass.rasterPipeline.cullMode == CullMode::CLOCK_WISE)
-            {
-                pipelineBuilder._rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-            }
-            else
+        transientPlacements = aliasingPlanner.placements;
+        transientBlocks = aliasingPlanner.blocks;
+        aliasingPlanner.print_report();
+    }
+
+    // Aliased images hold whatever used their memory last, every frame starts them over
+    for (TransientImage& transient : transientImages)
+    {
+        if (aliasedImages.count(transient.image->_image) != 0)
+        {
+            for (uint32_t i = 0; i < transient.image->mips; i++)
             {
-                pipelineBuilder._rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+                bindingImageLayout.erase({transient.image->_image, i});
             }
         }
+    }
+}
 
-        // CONSERVATIVE RASTERIZATION
-        VkPipelineRasterizationConservativeStateCreateInfoEXT conservativeRasterStateCI{};
-        conservativeRasterStateCI.sType =
-            VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT;
-        conservativeRasterStateCI.conservativeRasterizationMode =
-            VK_CONSERVATIVE_RASTERIZATION_MODE_OVERESTIMATE_EXT;
-        conservativeRasterStateCI.extraPrimitiveOverestimationSize = 1.0;
-
-        if (renderPass.rasterPipeline.enableConservativeRasterization)
+void RenderGraph::release_image_caches(VkImage image, uint32_t mips)
+{
+    for (auto it = imageViewCache.begin(); it != imageViewCache.end();)
+    {
+        if (it->first.image == image)
         {
-            pipelineBuilder._rasterizer.pNext = &conservativeRasterStateCI;
+            device->destroy_image_view(it->second);
+            it = imageViewCache.erase(it);
         }
-
-        // MULTISAMPLING
+        else
         {
-            pipelineBuilder._multisampling = vkinit::multisampling_state_create_info();
+            it++;
         }
+    }
 
-        // COLOR BLENDING
+    for (auto it = descriptorSetCache.begin(); it != descriptorSetCache.end();)
+    {
+        bool usesImage = false;
+        for (const DescriptorSet& descriptorSet : it->first.descriptorSets)
         {
-            pipelineBuilder._colorBlending = vkinit::color_blend_state_create_info(
-                renderPass.rasterPipeline.blendAttachmentStates.size(),
-                renderPass.rasterPipeline.blendAttachmentStates.m_data);
+            usesImage |= descriptorSet.image == image;
         }
 
-        // DEPTH TEST
+        if (usesImage)
         {
-            pipelineBuilder._depthStencil = vkinit::depth_stencil_create_info(
-                renderPass.rasterPipeline.depthState.depthTest,
-                renderPass.rasterPipeline.depthState.depthWrite,
-                renderPass.rasterPipeline.depthState.compareOp);
+            device->destroy_descriptor_set(it->second);
+            it = descriptorSetCache.erase(it);
         }
-
-        // SHADER STAGES
+        else
         {
-            pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(
-                VK_SHADER_STAGE_VERTEX_BIT, vertexShader));
-            pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(
-                VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
+            it++;
         }
+    }
 
-        pipelineBuilder._pipelineLayout = get_pipeline_layout(renderPass);
-        VkPipeline newPipeline = pipelineBuilder.build_pipeline(
-            engineData->device, nullptr, &pipeline_rendering_create_info);
-        pipelineCache[pipelineHash] = newPipeline;
+    for (uint32_t i = 0; i < mips; i++)
+    {
+        imageBindingAccessType.erase({image, i});
+        bindingImageLayout.erase({image, i});
+    }
+}
 
-        vkDestroyShaderModule(engineData->device, vertexShader, nullptr);
-        vkDestroyShaderModule(engineData->device, fragmentShader, nullptr);
+void Vrg::RenderGraph::rebuild_pipelines()
+{
+    for (auto& it : pipelineCache)
+    {
+        device->destroy_pipeline(it.second);
+    }
+    pipelineCache.clear();
 
-        vkutils::setObjectName(engineData->device, newPipeline,
-                               renderPass.name + " - Pipeline");
+    for (auto& it : raytracingPipelineCache)
+    {
+        device->destroy_raytracing_pipeline(it.second);
+    }
+    raytracingPipelineCache.clear();
+    device->clear_shader_cache();
+}
 
-        return newPipeline;
+void Vrg::RenderGraph::destroy_resource(AllocatedImage& image)
+{
+    for (uint32_t i = 0; i < image.mips; i++)
+    {
+        imageBindingAccessType.erase({image._image, i});
+        bindingImageLayout.erase({image._image, i});
+        // TODO: Destroy all image views
+        // TODO: Destroy all descriptor sets
+    }
+
+    if (image._allocation != nullptr)
+    {
+        device->destroy_image(image);
     }
 }
 
-RaytracingPipeline* Vrg::RenderGraph::get_raytracing_pipeline(RenderPass& renderPass)
+void Vrg::RenderGraph::destroy_resource(AllocatedBuffer& buffer)
 {
-    if (raytracingPipelineCache.find(renderPass.name) != raytracingPipelineCache.end())
+    // TODO: Destroy all descriptor sets
+    bufferBindingAccessType.erase(buffer._buffer);
+    device->destroy_buffer(buffer);
+}
+
+void Vrg::RenderGraph::destroy()
+{
+    for (TransientImage& transient : transientImages)
     {
-        return &raytracingPipelineCache[renderPass.name];
+        release_image_caches(transient.image->_image, transient.image->mips);
+        device->destroy_unbound_image(transient.image->_image);
+        transient.image->_image = VK_NULL_HANDLE;
     }
-    RaytracingPipeline pipeline;
-    RayPipeline rayPipeline = renderPass.raytracingPipeline;
+    for (VmaAllocation allocation : transientMemory)
+    {
+        device->free_memory(allocation);
+    }
+    transientImages.clear();
+    transientMemory.clear();
+    transientPlacements.clear();
+    transientBlocks.clear();
+    aliasedImages.clear();
+    for (AllocatedImage* image : historyImages)
+    {
+        release_image_caches(image->_image, image->mips);
+        device->destroy_image(*image);
+        image->_image = VK_NULL_HANDLE;
+    }
+    historyImages.clear();
+    secondaryCommandBuffers.clear();
+}
+
+VkPipeline RenderGraph::get_pipeline(RenderPass& renderPass)
+{
+    auto pipelineHash = get_pipeline_hash(renderPass);
+    if (pipelineCache.find(pipelineHash) != pipelineCache.end())
+    {
+        return pipelineCache[pipelineHash];
+    }
+
+    VkPipeline newPipeline;
+    if (renderPass.pipelineType == PipelineType::COMPUTE_TYPE)
+    {
+        newPipeline = device->create_compute_pipeline(
+            renderPass.computePipeline, get_defines(renderPass.defines, frameAllocator),
+            get_pipeline_layout(renderPass));
+    }
+    else
+    {
+        const auto& rasterPipeline = renderPass.rasterPipeline;
 
-    Slice<uint32_t> rgenSpirv{};
-    shaderManager->get_spirv(rayPipeline.rgenShader, {}, rgenSpirv);
+        // dynamic rendering
+        VkFormat* colorFormats =
+            frameAllocator.allocate_array<VkFormat>(rasterPipeline.colorOutputs.size());
+        for (int i = 0; i < rasterPipeline.colorOutputs.size(); i++)
+        {
+            colorFormats[i] = bindings.get(rasterPipeline.colorOutputs[i].bindable)->format;
+        }
 
-    Slice<uint32_t> rmissSpirv{};
-    shaderManager->get_spirv(rayPipeline.missShader, {}, rmissSpirv);
+        VkFormat* vertexFormats =
+            frameAllocator.allocate_array<VkFormat>(rasterPipeline.vertexBuffers.size());
+        for (int i = 0; i < rasterPipeline.vertexBuffers.size(); i++)
+        {
+            vertexFormats[i] = bindings.get(rasterPipeline.vertexBuffers[i])->format;
+        }
 
-    Slice<uint32_t> rchitSpirv{};
-    shaderManager->get_spirv(rayPipeline.hitShader, {}, rchitSpirv);
+        RasterPipelineFormats formats = {
+            .colorFormats = Slice<VkFormat>(colorFormats, rasterPipeline.colorOutputs.size()),
+            .depthFormat = VK_FORMAT_UNDEFINED,
+            .vertexFormats =
+                Slice<VkFormat>(vertexFormats, rasterPipeline.vertexBuffers.size())};
+        if (rasterPipeline.depthOutput.bindable.isValid())
+        {
+            formats.depthFormat = bindings.get(rasterPipeline.depthOutput.bindable)->format;
+        }
 
-    vulkanRaytracing->create_new_pipeline(
-        pipeline, get_pipeline_layout(renderPass), rgenSpirv, rmissSpirv, rchitSpirv,
-        rayPipeline.recursionDepth, &rayPipeline.rgenSpecialization,
-        &rayPipeline.missSpecialization, &rayPipeline.hitSpecialization);
+        newPipeline = device->create_raster_pipeline(rasterPipeline, formats,
+                                                     get_pipeline_layout(renderPass),
+                                                     renderPass.name + " - Pipeline");
+    }
+
+    pipelineCache[pipelineHash] = newPipeline;
+    return newPipeline;
+}
+
+RaytracingPipeline* Vrg::RenderGraph::get_raytracing_pipeline(RenderPass& renderPass)
+{
+    if (raytracingPipelineCache.find(renderPass.name) != raytracingPipelineCache.end())
+    {
+        return &raytracingPipelineCache[renderPass.name];
+    }
+    RaytracingPipeline pipeline;
+    device->create_raytracing_pipeline(pipeline, renderPass.raytracingPipeline,
+                                       get_pipeline_layout(renderPass));
 
     raytracingPipelineCache[renderPass.name] = pipeline;
     return &raytracingPipelineCache[renderPass.name];
@@ -1040,23 +1394,11 @@ VkPipelineLayout RenderGraph::get_pipeline_layout(RenderPass& renderPass)
         return pipelineLayoutCache[cache1];
     }
 
-    VkPipelineLayoutCreateInfo pipeline_layout_info = vkinit::pipeline_layout_create_info(
-        descriptorSetLayouts.data(), descriptorSetLayouts.size());
-
-    if (pushRanges.size() > 0)
-    {
-        pipeline_layout_info.pushConstantRangeCount = pushRanges.size();
-        pipeline_layout_info.pPushConstantRanges = pushRanges.data();
-    }
-
-    VkPipelineLayout newLayout;
-    VK_CHECK(vkCreatePipelineLayout(engineData->device, &pipeline_layout_info, nullptr,
-                                    &newLayout));
+    VkPipelineLayout newLayout = device->create_pipeline_layout(
+        Slice<VkDescriptorSetLayout>(descriptorSetLayouts),
+        Slice<VkPushConstantRange>(pushRanges), renderPass.name + " - Pipeline Layout");
     pipelineLayoutCache[cache1] = newLayout;
 
-    vkutils::setObjectName(engineData->device, newLayout,
-                           renderPass.name + " - Pipeline Layout");
-
     return newLayout;
 }
 
@@ -1075,7 +1417,9 @@ VkDescriptorSet RenderGraph::get_descriptor_set(RenderPass& renderPass, int set)
     auto prepare = [&](const Slice<DescriptorBinding>& bindings, bool isWrite) {
         for (int i = 0; i < bindings.size(); i++)
         {
-            if (bindings[i].set_index != set)
+            if (bindings[i].set_index != set ||
+                (!isWrite && is_read_modify_write(this->bindings, renderPass,
+                                                  bindings[i].bindable)))
             {
                 continue;
             }
@@ -1122,53 +1466,32 @@ VkDescriptorSet RenderGraph::get_descriptor_set(RenderPass& renderPass, int set)
         return descriptorSetCache[cache1];
     }
 
-    VkDescriptorSetLayout descriptorSetLayout = get_descriptor_set_layout(renderPass, set);
-    VkDescriptorSet descriptorSet;
-
-    VkDescriptorSetAllocateInfo allocInfo = vkinit::descriptorset_allocate_info(
-        engineData->descriptorPool, &descriptorSetLayout, 1);
-    vkAllocateDescriptorSets(engineData->device, &allocInfo, &descriptorSet);
-
-    descriptorSetCache[cache1] = descriptorSet;
-
     // TODO: Update allocations
+    std::vector<DescriptorWrite> writes(descriptorSets.size());
     for (int i = 0; i < descriptorSets.size(); i++)
     {
-        VkWriteDescriptorSet writeDescriptorSet;
-        VkDescriptorImageInfo imageInfo;
-
+        writes[i] = {.type = descriptorSets[i].type};
         if (descriptorSets[i].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ||
             descriptorSets[i].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
         {
-            writeDescriptorSet = vkinit::write_descriptor_buffer(
-                descriptorSets[i].type, descriptorSet,
-                &descriptorSets[i].buffer->_descriptorBufferInfo, i);
+            writes[i].bufferInfo = &descriptorSets[i].buffer->_descriptorBufferInfo;
         }
-        else if (descriptorSets[i].type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)
-        {
-            imageInfo = {.sampler = samplers[(int)descriptorSets[i].imageView.sampler],
-                         .imageView = get_image_view(descriptorSets[i].image,
-                                                     descriptorSets[i].imageView,
-                                                     descriptorSets[i].format),
-                         .imageLayout = descriptorSets[i].imageLayout};
-            writeDescriptorSet = vkinit::write_descriptor_image(
-                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, descriptorSet, &imageInfo, i, 1);
-        }
-        else if (descriptorSets[i].type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+        else
         {
-            imageInfo = {.sampler = samplers[(int)descriptorSets[i].imageView.sampler],
-                         .imageView = get_image_view(descriptorSets[i].image,
-                                                     descriptorSets[i].imageView,
-                                                     descriptorSets[i].format),
-                         .imageLayout = descriptorSets[i].imageLayout};
-            writeDescriptorSet = vkinit::write_descriptor_image(
-                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptorSet, &imageInfo, i, 1);
+            writes[i].imageInfo = {
+                .sampler = samplers[(int)descriptorSets[i].imageView.sampler],
+                .imageView = get_image_view(descriptorSets[i].image,
+                                            descriptorSets[i].imageView,
+                                            descriptorSets[i].format),
+                .imageLayout = descriptorSets[i].imageLayout};
         }
-        vkUpdateDescriptorSets(engineData->device, 1, &writeDescriptorSet, 0, nullptr);
     }
 
-    vkutils::setObjectName(engineData->device, descriptorSet,
-                           renderPass.name + " - DescriptorSet" + std::to_string(set));
+    VkDescriptorSet descriptorSet = device->create_descriptor_set(
+        get_descriptor_set_layout(renderPass, set), Slice<DescriptorWrite>(writes),
+        renderPass.name + " - DescriptorSet" + std::to_string(set));
+    descriptorSetCache[cache1] = descriptorSet;
+
     return descriptorSet;
 }
 
@@ -1182,14 +1505,14 @@ VkDescriptorSetLayout RenderGraph::get_descriptor_set_layout(RenderPass& renderP
         }
     }
 
-    int bindingCounter = 0;
-    std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
     std::vector<VkDescriptorType> bindingDescriptorTypes;
 
     auto prepare = [&](const Slice<DescriptorBinding>& bindings, bool isWrite) {
         for (int i = 0; i < bindings.size(); i++)
         {
-            if (bindings[i].set_index != set)
+            if (bindings[i].set_index != set ||
+                (!isWrite && is_read_modify_write(this->bindings, renderPass,
+                                                  bindings[i].bindable)))
             {
                 continue;
             }
@@ -1199,20 +1522,12 @@ VkDescriptorSetLayout RenderGraph::get_descriptor_set_layout(RenderPass& renderP
             switch (binding->type)
             {
             case BindType::UNIFORM:
-                layoutBindings.push_back(vkinit::descriptorset_layout_binding(
-                    VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL, bindingCounter));
                 bindingDescriptorTypes.push_back(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
                 break;
             case BindType::STORAGE:
-                layoutBindings.push_back(vkinit::descriptorset_layout_binding(
-                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_ALL, bindingCounter));
                 bindingDescriptorTypes.push_back(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
                 break;
             case BindType::IMAGE_VIEW:
-                layoutBindings.push_back(vkinit::descriptorset_layout_binding(
-                    isWrite ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
-                            : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    VK_SHADER_STAGE_ALL, bindingCounter));
                 bindingDescriptorTypes.push_back(
                     isWrite ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
                             : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
@@ -1220,8 +1535,6 @@ VkDescriptorSetLayout RenderGraph::get_descriptor_set_layout(RenderPass& renderP
             default:
                 break;
             }
-
-            bindingCounter++;
         }
     };
 
@@ -1234,16 +1547,10 @@ VkDescriptorSetLayout RenderGraph::get_descriptor_set_layout(RenderPass& renderP
     {
         return descriptorSetLayoutCache[cache1];
     }
-    VkDescriptorSetLayoutCreateInfo setinfo =
-        vkinit::descriptorset_layout_create_info(layoutBindings.data(), layoutBindings.size());
-    VkDescriptorSetLayout newDescriptorSetLayout;
-
-    VK_CHECK(vkCreateDescriptorSetLayout(engineData->device, &setinfo, nullptr,
-                                         &newDescriptorSetLayout));
-
+    VkDescriptorSetLayout newDescriptorSetLayout = device->create_descriptor_set_layout(
+        Slice<VkDescriptorType>(bindingDescriptorTypes),
+        renderPass.name + " - DescriptorSetLayout" + std::to_string(set));
     descriptorSetLayoutCache[cache1] = newDescriptorSetLayout;
-    vkutils::setObjectName(engineData->device, newDescriptorSetLayout,
-                           renderPass.name + " - DescriptorSetLayout" + std::to_string(set));
 
     return newDescriptorSetLayout;
 }
@@ -1258,23 +1565,10 @@ VkImageView Vrg::RenderGraph::get_image_view(VkImage image, ImageView& imageView
         return imageViewCache[cache1];
     }
 
-    bool isDepth = false;
-    if (format == DEPTH_32_FORMAT)
-    {
-        isDepth = true;
-    }
-
-    VkImageViewCreateInfo imageViewInfo = vkinit::imageview_create_info(
-        format, image, isDepth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
-    imageViewInfo.subresourceRange.baseMipLevel = imageView.baseMipLevel;
-    imageViewInfo.subresourceRange.levelCount = imageView.mipLevelCount;
-    VkImageView newImageView;
-
-    VK_CHECK(vkCreateImageView(engineData->device, &imageViewInfo, nullptr, &newImageView));
+    VkImageView newImageView = device->create_image_view(image, imageView, format);
     imageViewCache[cache1] = newImageView;
 
     return newImageView;
-    // vkutils::setObjectName(engineData->device, newImageView, );
 }
 
 VkImageLayout Vrg::RenderGraph::get_current_image_layout(VkImage image, uint32_t mip)
@@ -2,26 +2,69 @@
 
 #include "memory/frame_allocator.h"
 #include "vk_cache.h"
+#include "vk_command_recorder.h"
 #include "vk_raytracing.h"
+#include "vk_rendergraph_aliasing.h"
+#include "vk_rendergraph_barriers.h"
+#include "vk_rendergraph_compiler.h"
 #include "vk_rendergraph_types.h"
-#include "vk_shader.h"
-#include "vk_timer.h"
+#include "vk_render_device.h"
 #include <functional>
 #include <initializer_list>
 #include <string>
-#include <vcruntime.h>
+#include <unordered_set>
 #include <vector>
 
 #include "memory/handle_pool.h"
 
+// Passes whose outputs are never read are left out of the frame (see GraphCompiler)
+#define RENDER_GRAPH_CULL_PASSES 1
+// Transient images share memory when their lifetimes in the frame do not overlap, otherwise
+// each gets its own allocation
+#define RENDER_GRAPH_ALIAS_TRANSIENTS 1
+// Threads recording the passes between custom and swapchain passes into secondary command
+// buffers, 1 records everything into the command buffer given to execute
+#ifdef _OPENMP
+#define RENDER_GRAPH_RECORDING_THREADS 4
+#else
+#define RENDER_GRAPH_RECORDING_THREADS 1
+#endif
+
 namespace Vrg
 {
+// Everything a pass records, looked up before recording so the pass can be recorded on any
+// thread. Offsets index the planned arrays of the graph.
+struct PreparedPass
+{
+    RenderPass* renderPass;
+    int timerSlot; // -1 times the pass through the recorder
+    BarrierRange barriers;
+    BarrierRange presentBarriers;
+    VkPipelineBindPoint bindPoint;
+    VkPipeline pipeline;
+    RaytracingPipeline* raytracingPipeline;
+    VkPipelineLayout pipelineLayout;
+    uint32_t descriptorSetOffset;
+    uint32_t attachmentOffset;
+    VkImageView depthView;
+};
+
 class RenderGraph
 {
 public:
-    RenderGraph(EngineData* _engineData, ShaderManager* _shaderManager);
-    void enable_raytracing(VulkanRaytracing* _vulkanRaytracing);
+    // Everything the graph creates goes through the device
+    RenderGraph(RenderDevice* _device);
+    // Commands are recorded with the given recorder until it is reset with nullptr, which
+    // goes back to the recorder of the device
+    void set_recorder(CommandRecorder* _recorder);
+    CommandRecorder* get_recorder();
     RenderPass* add_render_pass(RenderPass renderPass);
+    // Creates an image whose memory is placed by execute among the other transient images
+    // that are not in use at the same time. History images are read by the next frame before
+    // it writes them, they get memory of their own right away.
+    void create_transient_image(AllocatedImage* image, VkFormat format,
+                                VkImageUsageFlags usageFlags, VkExtent3D extent,
+                                uint32_t mipLevels = 1, bool isHistory = false);
     Handle<Bindable> register_image_view(AllocatedImage* image, ImageView imageView,
                                          std::string resourceName);
     Handle<Bindable> register_storage_buffer(AllocatedBuffer* buffer,
@@ -35,6 +78,7 @@ public:
     Handle<Bindable> get_resource(
         std::string resourceName); // TODO: Implement if needed. Right now, not needed.
 
+    // Both record their barriers with a single vkCmdPipelineBarrier2
     void insert_barrier(VkCommandBuffer cmd, Handle<Bindable> bindable,
                         PipelineType pipelineType, bool isWrite, uint32_t mip = 0);
     void handle_render_pass_barriers(VkCommandBuffer cmd, RenderPass& renderPass);
@@ -43,13 +87,17 @@ public:
     VkImageLayout get_current_image_layout(VkImage image, uint32_t mip);
     void inform_current_image_layout(VkImage image, uint32_t mip, VkImageLayout layout);
 
+    // Builds the pass DAG of the frame from the declared reads and writes and culls the
+    // passes nothing depends on, execute compiles the graph itself
+    void compile();
     void execute(VkCommandBuffer cmd);
     void rebuild_pipelines();
 
     void destroy_resource(AllocatedImage& image);
     void destroy_resource(AllocatedBuffer& buffer);
+    // Frees what the graph owns itself, the device must be idle
+    void destroy();
 
-    VulkanTimer vkTimer;
     Pool<Bindable> bindings;
 
 private:
@@ -60,14 +108,61 @@ private:
     VkDescriptorSet get_descriptor_set(RenderPass& renderPass, int set);
     VkDescriptorSetLayout get_descriptor_set_layout(RenderPass& renderPass, int set);
 
+    // Barriers are queued per resource and recorded together by flush_barriers. A write of a
+    // pass that also loads the resource makes the earlier writes visible to the loads too.
+    void queue_barrier(Handle<Bindable> bindable, PipelineType pipelineType, bool isWrite,
+                       uint32_t mip, bool isReadModifyWrite = false);
+    void queue_image_barrier(VkImageMemoryBarrier2 barrier);
+    void queue_render_pass_barriers(RenderPass& renderPass);
+    void queue_attachment_barriers(RenderPass& renderPass);
+    void flush_barriers(VkCommandBuffer cmd);
+    // Moves the queued barriers into the planned ones
+    BarrierRange plan_barriers();
+    void record_barriers(VkCommandBuffer cmd, const BarrierRange& range);
+    // Whatever used the memory of an aliased image before may still be running
+    bool is_first_aliased_use(VkImage image, uint32_t mip);
+
+    // Plans the transient memory with the lifetimes of the compiled frame, the transient
+    // images are recreated when the plan changes
+    void update_transient_memory();
+    // Destroys the cached image views and descriptor sets of an image and forgets its state
+    void release_image_caches(VkImage image, uint32_t mips);
+
+    // Passes are prepared in submission order, which plans their barriers, and recorded
+    // afterwards. Passes prepared one after another are recorded on several threads.
+    PreparedPass prepare_pass(RenderPass& renderPass, bool isParallel);
+    void prepare_bindings(RenderPass& renderPass, PreparedPass& prepared);
+    void record_pass(VkCommandBuffer cmd, const PreparedPass& prepared);
+    void record_bindings(VkCommandBuffer cmd, const PreparedPass& prepared);
+    void record_passes(VkCommandBuffer cmd, size_t first, size_t count);
+
     //
-    EngineData* engineData;
-    ShaderManager* shaderManager;
-    VulkanRaytracing* vulkanRaytracing;
+    RenderDevice* device;
+    CommandRecorder* recorder;
     FrameAllocator frameAllocator;
 
     // render passes
     std::vector<RenderPass> renderPasses;
+    GraphCompiler graphCompiler;
+    std::vector<PassInfo> passInfos;
+
+    // transient images
+    std::vector<TransientImage> transientImages;
+    std::vector<TransientResource> transientResources;
+    AliasingPlanner aliasingPlanner;
+    std::vector<uint32_t> transientPlacements;
+    std::vector<TransientBlock> transientBlocks;
+    std::vector<VmaAllocation> transientMemory;
+    std::vector<AllocatedImage*> historyImages;
+    std::unordered_set<VkImage> aliasedImages;
+
+    // recording
+    std::vector<PreparedPass> preparedPasses;
+    std::vector<VkImageMemoryBarrier2> plannedImageBarriers;
+    std::vector<VkBufferMemoryBarrier2> plannedBufferBarriers;
+    std::vector<VkDescriptorSet> plannedDescriptorSets;
+    std::vector<VkRenderingAttachmentInfo> plannedAttachments;
+    std::vector<VkCommandBuffer> secondaryCommandBuffers;
 
     // bindings
     uint32_t bindingCount = 0;
@@ -75,6 +170,7 @@ private:
     std::unordered_map<ImageMipCache, ResourceAccessType, ImageMipCache_hash>
         imageBindingAccessType;
     std::unordered_map<ImageMipCache, VkImageLayout, ImageMipCache_hash> bindingImageLayout;
+    BarrierBatch pendingBarriers;
 
     // caches
     std::unordered_map<size_t, VkPipeline> pipelineCache;
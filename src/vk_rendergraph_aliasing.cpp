@@ -0,0 +1,100 @@
+#include "vk_rendergraph_aliasing.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+using namespace Vrg;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+void AliasingPlanner::plan(Slice<TransientResource> resources)
+{
+    placements.assign(resources.size(), 0);
+    blocks.clear();
+    blockLastUse.clear();
+    unaliasedSize = 0;
+    aliasedSize = 0;
+
+    // By first use, the larger resources of a pass first so they pick the blocks
+    order.resize(resources.size());
+    for (uint32_t i = 0; i < resources.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        if (resources[a].first != resources[b].first)
+        {
+            return resources[a].first < resources[b].first;
+        }
+        if (resources[a].size != resources[b].size)
+        {
+            return resources[a].size > resources[b].size;
+        }
+        return a < b;
+    });
+
+    for (uint32_t i : order)
+    {
+        const TransientResource& resource = resources[i];
+        unaliasedSize += align_up(resource.size, resource.alignment);
+
+        int bestFit = -1;
+        int largest = -1;
+        for (int b = 0; b < blocks.size(); b++)
+        {
+            if (blockLastUse[b] >= resource.first ||
+                (blocks[b].memoryTypeBits & resource.memoryTypeBits) == 0)
+            {
+                continue;
+            }
+            if (blocks[b].size >= resource.size &&
+                (bestFit == -1 || blocks[b].size < blocks[bestFit].size))
+            {
+                bestFit = b;
+            }
+            if (largest == -1 || blocks[b].size > blocks[largest].size)
+            {
+                largest = b;
+            }
+        }
+
+        int block = bestFit != -1 ? bestFit : largest;
+        if (block == -1)
+        {
+            block = blocks.size();
+            blocks.push_back({0, 1, resource.memoryTypeBits, 0});
+            blockLastUse.push_back(0);
+        }
+
+        TransientBlock& target = blocks[block];
+        target.alignment = std::max(target.alignment, resource.alignment);
+        target.size = align_up(std::max(target.size, resource.size), target.alignment);
+        target.memoryTypeBits &= resource.memoryTypeBits;
+        target.resourceCount++;
+        blockLastUse[block] = resource.last;
+        placements[i] = block;
+    }
+
+    for (const TransientBlock& block : blocks)
+    {
+        aliasedSize += block.size;
+    }
+}
+
+void AliasingPlanner::print_report() const
+{
+    uint32_t sharedBlockCount = 0;
+    for (const TransientBlock& block : blocks)
+    {
+        sharedBlockCount += block.resourceCount > 1;
+    }
+
+    printf("Transient resources: %zu in %zu blocks (%u shared), %.1f MB instead of %.1f MB, "
+           "%.1f MB saved\n",
+           placements.size(), blocks.size(), sharedBlockCount,
+           aliasedSize / (1024.0 * 1024.0), unaliasedSize / (1024.0 * 1024.0),
+           (unaliasedSize - aliasedSize) / (1024.0 * 1024.0));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "memory/slice.h"
+#include <stdint.h>
+#include <vector>
+
+namespace Vrg
+{
+// Memory requirements of a transient resource and the positions in the compiled pass order
+// of its first and last use
+struct TransientResource
+{
+    uint64_t size;
+    uint64_t alignment;
+    uint32_t memoryTypeBits;
+    uint32_t first;
+    uint32_t last;
+};
+
+// One memory allocation shared by resources whose lifetimes do not overlap, all of them are
+// bound at its start
+struct TransientBlock
+{
+    uint64_t size;
+    uint64_t alignment;
+    uint32_t memoryTypeBits;
+    uint32_t resourceCount;
+};
+
+// Packs transient resources into shared memory blocks, without touching Vulkan. The
+// lifetimes form an interval graph, which is coloured greedily in the order the intervals
+// start: a resource takes a block that is free by its first pass and has a common memory
+// type, the smallest one that is large enough, or else the largest one which then grows.
+// Every colour is a block.
+class AliasingPlanner
+{
+public:
+    void plan(Slice<TransientResource> resources);
+    // Transient memory with and without aliasing
+    void print_report() const;
+
+    // Block of every resource, in the order they were passed in
+    std::vector<uint32_t> placements;
+    std::vector<TransientBlock> blocks;
+    uint64_t unaliasedSize = 0;
+    uint64_t aliasedSize = 0;
+
+private:
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> blockLastUse;
+};
+} // namespace Vrg
@@ -0,0 +1,78 @@
+#include "vk_rendergraph_barriers.h"
+
+using namespace Vrg;
+
+inline static bool is_same_transition(const VkImageMemoryBarrier2& a,
+                                      const VkImageMemoryBarrier2& b)
+{
+    return a.image == b.image && a.oldLayout == b.oldLayout && a.newLayout == b.newLayout &&
+           a.srcStageMask == b.srcStageMask && a.srcAccessMask == b.srcAccessMask &&
+           a.dstStageMask == b.dstStageMask && a.dstAccessMask == b.dstAccessMask &&
+           a.subresourceRange.aspectMask == b.subresourceRange.aspectMask;
+}
+
+void BarrierBatch::queue_image_barrier(const VkImageMemoryBarrier2& barrier)
+{
+    for (auto& pending : imageBarriers)
+    {
+        if (pending.image == barrier.image &&
+            pending.subresourceRange.baseMipLevel == barrier.subresourceRange.baseMipLevel)
+        {
+            pending.newLayout = barrier.newLayout;
+            pending.dstStageMask |= barrier.dstStageMask;
+            pending.dstAccessMask |= barrier.dstAccessMask;
+            return;
+        }
+    }
+
+    imageBarriers.push_back(barrier);
+}
+
+void BarrierBatch::queue_buffer_barrier(const VkBufferMemoryBarrier2& barrier)
+{
+    for (auto& pending : bufferBarriers)
+    {
+        if (pending.buffer == barrier.buffer)
+        {
+            pending.dstStageMask |= barrier.dstStageMask;
+            pending.dstAccessMask |= barrier.dstAccessMask;
+            return;
+        }
+    }
+
+    bufferBarriers.push_back(barrier);
+}
+
+BarrierRange BarrierBatch::plan(std::vector<VkImageMemoryBarrier2>& plannedImageBarriers,
+                                std::vector<VkBufferMemoryBarrier2>& plannedBufferBarriers)
+{
+    uint32_t imageBarrierCount = 0;
+    for (uint32_t i = 0; i < imageBarriers.size(); i++)
+    {
+        VkImageMemoryBarrier2 barrier = imageBarriers[i];
+        if (imageBarrierCount > 0)
+        {
+            auto& previous = imageBarriers[imageBarrierCount - 1];
+            auto& range = previous.subresourceRange;
+            if (is_same_transition(previous, barrier) &&
+                range.baseMipLevel + range.levelCount == barrier.subresourceRange.baseMipLevel)
+            {
+                range.levelCount++;
+                continue;
+            }
+        }
+        imageBarriers[imageBarrierCount++] = barrier;
+    }
+
+    BarrierRange range = {(uint32_t)plannedImageBarriers.size(), imageBarrierCount,
+                          (uint32_t)plannedBufferBarriers.size(),
+                          (uint32_t)bufferBarriers.size()};
+    plannedImageBarriers.insert(plannedImageBarriers.end(), imageBarriers.begin(),
+                                imageBarriers.begin() + imageBarrierCount);
+    plannedBufferBarriers.insert(plannedBufferBarriers.end(), bufferBarriers.begin(),
+                                 bufferBarriers.end());
+
+    imageBarriers.clear();
+    bufferBarriers.clear();
+    return range;
+}
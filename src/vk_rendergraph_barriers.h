@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Vrg
+{
+// Barriers planned for a pass, ranges of the planned barrier arrays of the graph
+struct BarrierRange
+{
+    uint32_t imageOffset;
+    uint32_t imageCount;
+    uint32_t bufferOffset;
+    uint32_t bufferCount;
+};
+
+// Barriers of the resources of a pass, recorded together with one vkCmdPipelineBarrier2.
+// Only needs the Vulkan headers, no device.
+class BarrierBatch
+{
+public:
+    // A subresource used twice by a pass gets one transition into the layout of its last use,
+    // two transitions of it in one barrier command would not be ordered
+    void queue_image_barrier(const VkImageMemoryBarrier2& barrier);
+    // A buffer used twice by a pass waits for both uses with one barrier
+    void queue_buffer_barrier(const VkBufferMemoryBarrier2& barrier);
+    // Moves the queued barriers to the end of the planned arrays. Neighbouring mips with the
+    // same transition become one subresource range.
+    BarrierRange plan(std::vector<VkImageMemoryBarrier2>& plannedImageBarriers,
+                      std::vector<VkBufferMemoryBarrier2>& plannedBufferBarriers);
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers;
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+};
+} // namespace Vrg
@@ -0,0 +1,165 @@
+#include "vk_rendergraph_compiler.h"
+
+#include <algorithm>
+
+using namespace Vrg;
+
+uint32_t GraphCompiler::resource_index(uint64_t resource)
+{
+    auto it = resourceIndices.find(resource);
+    if (it != resourceIndices.end())
+    {
+        return it->second;
+    }
+
+    uint32_t index = resourceIndices.size();
+    resourceIndices[resource] = index;
+    if (resources.size() <= index)
+    {
+        resources.emplace_back();
+    }
+    ResourceState& state = resources[index];
+    state.isHistory = false;
+    state.isNeeded = false;
+    state.lastWriter = -1;
+    state.firstUse = UINT32_MAX;
+    state.lastUse = 0;
+    state.readers.clear();
+    return index;
+}
+
+void GraphCompiler::compile(Slice<PassInfo> passes)
+{
+    resourceIndices.clear();
+    passOrder.clear();
+    dependencyOffsets.clear();
+    dependencies.clear();
+    kept.assign(passes.size(), 0);
+
+    // Resources read before any earlier pass wrote them. A pass that reads and writes the same
+    // resource reads it first.
+    for (int p = 0; p < passes.size(); p++)
+    {
+        for (const PassAccess& access : passes[p].accesses)
+        {
+            ResourceState& state = resources[resource_index(access.resource)];
+            state.isHistory |= !access.isWrite && state.lastWriter == -1;
+        }
+        for (const PassAccess& access : passes[p].accesses)
+        {
+            if (access.isWrite)
+            {
+                resources[resourceIndices[access.resource]].lastWriter = p;
+            }
+        }
+    }
+
+    // Liveness from the last pass backwards. Writes may be partial, so a later kept writer
+    // needs the earlier writes just like a reader does.
+    for (int p = passes.size() - 1; p >= 0; p--)
+    {
+        bool hasOutputs = false;
+        bool isLive = passes[p].keep;
+        for (const PassAccess& access : passes[p].accesses)
+        {
+            if (access.isWrite)
+            {
+                const ResourceState& state = resources[resourceIndices[access.resource]];
+                hasOutputs = true;
+                isLive |= state.isHistory || state.isNeeded;
+            }
+        }
+
+        if (!isLive && hasOutputs)
+        {
+            continue;
+        }
+        kept[p] = 1;
+        for (const PassAccess& access : passes[p].accesses)
+        {
+            resources[resourceIndices[access.resource]].isNeeded = true;
+        }
+    }
+
+    for (ResourceState& state : resources)
+    {
+        state.lastWriter = -1;
+        state.readers.clear();
+    }
+
+    // Dependencies between the kept passes
+    for (int p = 0; p < passes.size(); p++)
+    {
+        if (!kept[p])
+        {
+            continue;
+        }
+        uint32_t position = passOrder.size();
+        passOrder.push_back(p);
+        dependencyOffsets.push_back(dependencies.size());
+        size_t first = dependencies.size();
+
+        for (const PassAccess& access : passes[p].accesses)
+        {
+            ResourceState& state = resources[resourceIndices[access.resource]];
+            state.firstUse = std::min(state.firstUse, position);
+            state.lastUse = position;
+            if (state.lastWriter >= 0 && state.lastWriter != (int)position)
+            {
+                dependencies.push_back(state.lastWriter);
+            }
+            if (access.isWrite)
+            {
+                for (uint32_t reader : state.readers)
+                {
+                    if (reader != position)
+                    {
+                        dependencies.push_back(reader);
+                    }
+                }
+            }
+        }
+        // Updated after all accesses, so a pass reading and writing a resource does not wait
+        // for itself
+        for (const PassAccess& access : passes[p].accesses)
+        {
+            ResourceState& state = resources[resourceIndices[access.resource]];
+            if (access.isWrite)
+            {
+                state.lastWriter = position;
+                state.readers.clear();
+            }
+        }
+        for (const PassAccess& access : passes[p].accesses)
+        {
+            ResourceState& state = resources[resourceIndices[access.resource]];
+            if (!access.isWrite && state.lastWriter != (int)position)
+            {
+                state.readers.push_back(position);
+            }
+        }
+
+        std::sort(dependencies.begin() + first, dependencies.end());
+        dependencies.erase(std::unique(dependencies.begin() + first, dependencies.end()),
+                           dependencies.end());
+    }
+    dependencyOffsets.push_back(dependencies.size());
+
+    culledPassCount = passes.size() - passOrder.size();
+}
+
+ResourceLifetime GraphCompiler::get_lifetime(uint64_t resource) const
+{
+    auto it = resourceIndices.find(resource);
+    if (it == resourceIndices.end())
+    {
+        return {UINT32_MAX, 0, false};
+    }
+
+    const ResourceState& state = resources[it->second];
+    if (state.isHistory && state.firstUse != UINT32_MAX)
+    {
+        return {0, (uint32_t)passOrder.size() - 1, true};
+    }
+    return {state.firstUse, state.lastUse, state.isHistory};
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "memory/slice.h"
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace Vrg
+{
+// Resource read or written by a pass. Resources are told apart by their key (the VkImage or
+// VkBuffer handle), so bindings of different mips of one image are the same resource.
+struct PassAccess
+{
+    uint64_t resource;
+    bool isWrite;
+};
+
+struct PassInfo
+{
+    Slice<PassAccess> accesses;
+    // Passes with side effects the graph can not see (custom passes, swapchain writes)
+    bool keep;
+};
+
+// Positions in passOrder of the first and last kept pass using a resource. History resources
+// are read before they are written, so they live through the whole frame. Resources no kept
+// pass uses have first > last.
+struct ResourceLifetime
+{
+    uint32_t first;
+    uint32_t last;
+    bool isHistory;
+};
+
+// Builds the pass DAG of a frame from the declared accesses, without touching Vulkan.
+// A pass is culled when it writes something and no kept pass after it reads or writes any of
+// its outputs. Outputs of resources that are read before they are written in the frame are
+// history for the next frame and keep their passes. Passes without declared outputs are kept,
+// the graph can not tell what they do.
+class GraphCompiler
+{
+public:
+    void compile(Slice<PassInfo> passes);
+    ResourceLifetime get_lifetime(uint64_t resource) const;
+
+    // Kept passes in submission order, as indices of the compiled passes
+    std::vector<uint32_t> passOrder;
+    // Kept passes passOrder[i] has to wait for (read after write, write after read and write
+    // after write), positions in passOrder from dependencies[dependencyOffsets[i]] up to the
+    // offset of i + 1
+    std::vector<uint32_t> dependencyOffsets;
+    std::vector<uint32_t> dependencies;
+    uint32_t culledPassCount = 0;
+
+private:
+    struct ResourceState
+    {
+        bool isHistory;
+        bool isNeeded;
+        int lastWriter;
+        uint32_t firstUse;
+        uint32_t lastUse;
+        std::vector<uint32_t> readers; // kept passes reading it since its last write
+    };
+
+    uint32_t resource_index(uint64_t resource);
+
+    std::unordered_map<uint64_t, uint32_t> resourceIndices;
+    std::vector<ResourceState> resources;
+    std::vector<char> kept;
+};
+} // namespace Vrg
@@ -188,13 +188,21 @@ struct RenderPass
     RasterPipeline rasterPipeline = {};   // type 1
     RayPipeline raytracingPipeline = {};  // type 2
     Slice<DescriptorBinding> writes;
+    // A binding that is in the writes too is loaded and stored through one storage image
     Slice<DescriptorBinding> reads;
     Slice<Define> defines;
     Slice<PushConstant> constants;
     Slice<DescriptorSetBinding> extraDescriptorSets;
     uint32_t descriptorSetCount;
+    // Raster passes may be recorded on another thread, where execute must only record into
+    // the command buffer it gets. Custom passes and passes writing the swapchain are recorded
+    // on the thread calling RenderGraph::execute and may call back into the graph.
     std::function<void(VkCommandBuffer cmd)> execute;
     bool skipExecution = false;
+    // Kept by RenderGraph::compile even if nothing reads what it writes. Custom passes are
+    // always kept, their reads and writes are only used to order them and they place their
+    // own barriers.
+    bool keepAlive = false;
 };
 
 struct MemoryPass
@@ -213,4 +221,13 @@ struct DescriptorSet
     VkImageLayout imageLayout;
     VkFormat format;
 };
+
+struct TransientImage
+{
+    AllocatedImage* image;
+    VkImageUsageFlags usage;
+    VkExtent3D extent;
+    VkMemoryRequirements memoryRequirements;
+    bool isHistory;
+};
 } // namespace Vrg
\ No newline at end of file
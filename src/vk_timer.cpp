@@ -3,18 +3,32 @@
 
 void VulkanTimer::start_recording(EngineData& engineData, VkCommandBuffer cmd,
                                   std::string name)
+{
+    start_recording(engineData, cmd, reserve_slot(engineData, name));
+}
+
+void VulkanTimer::stop_recording(EngineData& engineData, VkCommandBuffer cmd)
+{
+    stop_recording(engineData, cmd, count - 1);
+}
+
+int VulkanTimer::reserve_slot(EngineData& engineData, std::string name)
 {
     vkResetQueryPool(engineData.device, engineData.queryPool, count * 2, 2);
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, engineData.queryPool,
-                        count * 2);
     names[count] = name;
+    return count++;
 }
 
-void VulkanTimer::stop_recording(EngineData& engineData, VkCommandBuffer cmd)
+void VulkanTimer::start_recording(EngineData& engineData, VkCommandBuffer cmd, int slot)
+{
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, engineData.queryPool,
+                        slot * 2);
+}
+
+void VulkanTimer::stop_recording(EngineData& engineData, VkCommandBuffer cmd, int slot)
 {
     vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, engineData.queryPool,
-                        count * 2 + 1);
-    count++;
+                        slot * 2 + 1);
 }
 
 void VulkanTimer::get_results(EngineData& engineData)
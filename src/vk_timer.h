@@ -8,6 +8,11 @@ class VulkanTimer
 public:
     void start_recording(EngineData& engineData, VkCommandBuffer cmd, std::string name);
     void stop_recording(EngineData& engineData, VkCommandBuffer cmd);
+    // For passes recorded on several threads, the slots are taken in submission order before
+    // and the timestamps written by any thread
+    int reserve_slot(EngineData& engineData, std::string name);
+    void start_recording(EngineData& engineData, VkCommandBuffer cmd, int slot);
+    void stop_recording(EngineData& engineData, VkCommandBuffer cmd, int slot);
     void get_results(EngineData& engineData);
     void reset();
     uint64_t times[512];
@@ -12,6 +12,7 @@ const VkFormat DEPTH_32_FORMAT = VK_FORMAT_D32_SFLOAT;
 namespace Vrg
 {
 class RenderGraph;
+class RenderDevice;
 struct Bindable;
 } // namespace Vrg
 
@@ -62,6 +63,7 @@ struct EngineData
     VkQueryPool queryPool;
 
     Vrg::RenderGraph* renderGraph;
+    Vrg::RenderDevice* renderDevice;
 };
 
 struct SceneData
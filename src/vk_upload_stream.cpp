@@ -0,0 +1,146 @@
+#include "vk_upload_stream.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vk_initializers.h>
+#include <vk_utils.h>
+
+void UploadStream::init(EngineData* engineData)
+{
+    _engineData = engineData;
+    _current = 0;
+
+    for (Chunk& chunk : _chunks)
+    {
+        chunk.staging = vkutils::create_buffer(
+            engineData->allocator, UPLOAD_STREAM_CHUNK_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VMA_MEMORY_USAGE_CPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+        VmaAllocationInfo allocationInfo;
+        vmaGetAllocationInfo(engineData->allocator, chunk.staging._allocation, &allocationInfo);
+        chunk.mapped = (uint8_t*)allocationInfo.pMappedData;
+
+        VkCommandPoolCreateInfo poolInfo =
+            vkinit::command_pool_create_info(engineData->graphicsQueueFamily);
+        VK_CHECK(vkCreateCommandPool(engineData->device, &poolInfo, nullptr,
+                                     &chunk.commandPool));
+        VkCommandBufferAllocateInfo cmdAllocInfo =
+            vkinit::command_buffer_allocate_info(chunk.commandPool, 1);
+        VK_CHECK(vkAllocateCommandBuffers(engineData->device, &cmdAllocInfo, &chunk.cmd));
+
+        VkFenceCreateInfo fenceInfo = vkinit::fence_create_info();
+        VK_CHECK(vkCreateFence(engineData->device, &fenceInfo, nullptr, &chunk.fence));
+
+        chunk.used = 0;
+        chunk.recording = false;
+        chunk.submitted = false;
+    }
+}
+
+void UploadStream::destroy()
+{
+    flush();
+
+    for (Chunk& chunk : _chunks)
+    {
+        vkDestroyFence(_engineData->device, chunk.fence, nullptr);
+        vkDestroyCommandPool(_engineData->device, chunk.commandPool, nullptr);
+        vmaDestroyBuffer(_engineData->allocator, chunk.staging._buffer,
+                         chunk.staging._allocation);
+    }
+    _engineData = nullptr;
+}
+
+AllocatedBuffer UploadStream::create_buffer(const void* data, size_t size,
+                                            VkBufferUsageFlags usage,
+                                            VmaMemoryUsage memoryUsage,
+                                            VmaAllocationCreateFlags allocationFlags)
+{
+    AllocatedBuffer buffer = vkutils::create_buffer(_engineData->allocator, size,
+                                                    usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                    memoryUsage, allocationFlags);
+    upload(buffer, 0, data, size);
+    return buffer;
+}
+
+void UploadStream::upload(AllocatedBuffer& buffer, size_t offset, const void* data,
+                          size_t size)
+{
+    const uint8_t* source = (const uint8_t*)data;
+    while (size > 0)
+    {
+        Chunk& chunk = current_chunk();
+        size_t copySize = std::min(size, (size_t)UPLOAD_STREAM_CHUNK_SIZE - chunk.used);
+        memcpy(chunk.mapped + chunk.used, source, copySize);
+
+        VkBufferCopy copy;
+        copy.srcOffset = chunk.used;
+        copy.dstOffset = offset;
+        copy.size = copySize;
+        vkCmdCopyBuffer(chunk.cmd, chunk.staging._buffer, buffer._buffer, 1, &copy);
+
+        chunk.used += copySize;
+        source += copySize;
+        offset += copySize;
+        size -= copySize;
+
+        if (chunk.used == UPLOAD_STREAM_CHUNK_SIZE)
+        {
+            submit(chunk);
+            _current = (_current + 1) % UPLOAD_STREAM_CHUNK_COUNT;
+        }
+    }
+}
+
+void UploadStream::flush()
+{
+    Chunk& chunk = _chunks[_current];
+    if (chunk.recording)
+    {
+        submit(chunk);
+        _current = (_current + 1) % UPLOAD_STREAM_CHUNK_COUNT;
+    }
+
+    for (Chunk& pending : _chunks)
+    {
+        if (pending.submitted)
+        {
+            vkWaitForFences(_engineData->device, 1, &pending.fence, true, UINT64_MAX);
+            vkResetFences(_engineData->device, 1, &pending.fence);
+            pending.submitted = false;
+        }
+    }
+}
+
+UploadStream::Chunk& UploadStream::current_chunk()
+{
+    Chunk& chunk = _chunks[_current];
+    if (chunk.recording)
+    {
+        return chunk;
+    }
+
+    // The staging memory is reused once the copies that read it are done
+    if (chunk.submitted)
+    {
+        vkWaitForFences(_engineData->device, 1, &chunk.fence, true, UINT64_MAX);
+        vkResetFences(_engineData->device, 1, &chunk.fence);
+        chunk.submitted = false;
+    }
+    vkResetCommandPool(_engineData->device, chunk.commandPool, 0);
+
+    VkCommandBufferBeginInfo beginInfo =
+        vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    VK_CHECK(vkBeginCommandBuffer(chunk.cmd, &beginInfo));
+    chunk.used = 0;
+    chunk.recording = true;
+    return chunk;
+}
+
+void UploadStream::submit(Chunk& chunk)
+{
+    VK_CHECK(vkEndCommandBuffer(chunk.cmd));
+    VkSubmitInfo submitInfo = vkinit::submit_info(&chunk.cmd);
+    VK_CHECK(vkQueueSubmit(_engineData->graphicsQueue, 1, &submitInfo, chunk.fence));
+    chunk.recording = false;
+    chunk.submitted = true;
+}
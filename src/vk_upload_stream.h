@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vk_types.h>
+
+#define UPLOAD_STREAM_CHUNK_SIZE (4 * 1024 * 1024)
+#define UPLOAD_STREAM_CHUNK_COUNT 3
+
+// Uploads buffers through a ring of small, persistently mapped staging buffers instead of one
+// staging buffer as large as the data. A chunk is submitted as soon as it is full, so filling
+// the next chunk (and faulting in the pages of a mapped file) overlaps with the GPU copies.
+class UploadStream
+{
+public:
+    void init(EngineData* engineData);
+    // Waits for the queued copies and frees the staging memory
+    void destroy();
+
+    // The data is copied to staging memory before these return, so it can be released
+    // right away. The GPU copy is only guaranteed to be done after flush.
+    AllocatedBuffer create_buffer(const void* data, size_t size, VkBufferUsageFlags usage,
+                                  VmaMemoryUsage memoryUsage,
+                                  VmaAllocationCreateFlags allocationFlags = 0);
+    void upload(AllocatedBuffer& buffer, size_t offset, const void* data, size_t size);
+
+    // Submits the partially filled chunk and waits until every copy finished
+    void flush();
+
+private:
+    struct Chunk
+    {
+        AllocatedBuffer staging;
+        uint8_t* mapped;
+        VkCommandPool commandPool;
+        VkCommandBuffer cmd;
+        VkFence fence;
+        size_t used;
+        bool recording;
+        bool submitted;
+    };
+
+    // Chunk with free space that is recording, waits for its previous copies if needed
+    Chunk& current_chunk();
+    void submit(Chunk& chunk);
+
+    EngineData* _engineData = nullptr;
+    Chunk _chunks[UPLOAD_STREAM_CHUNK_COUNT];
+    int _current = 0;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdio.h>
+
+// Checks of the tests. A failed check prints itself and the test returns the number of
+// failed checks from main, so ctest reports it.
+inline int testFailures = 0;
+
+#define CHECK(condition)                                                                    \
+    do                                                                                      \
+    {                                                                                       \
+        if (!(condition))                                                                   \
+        {                                                                                   \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);            \
+            testFailures++;                                                                 \
+        }                                                                                   \
+    } while (0)
+
+#define RUN_TEST(test)                                                                      \
+    do                                                                                      \
+    {                                                                                       \
+        int failuresBefore = testFailures;                                                  \
+        test();                                                                             \
+        printf("%s %s\n", testFailures == failuresBefore ? "PASS" : "FAIL", #test);         \
+    } while (0)
@@ -0,0 +1,261 @@
+#include "test.h"
+#include <vk_null_render_device.h>
+#include <vk_rendergraph.h>
+
+#include <string>
+#include <vector>
+
+using namespace Vrg;
+
+#define TEST_FORMAT_COLOR VK_FORMAT_R8G8B8A8_UNORM
+#define TEST_FORMAT_HDR VK_FORMAT_R16G16B16A16_SFLOAT
+
+// A small deferred frame on a NullRenderDevice: a gbuffer raster pass, a compute pass nobody
+// reads, lighting and blur compute passes and a present pass into a swapchain stand-in.
+// RenderGraph::execute records it into the MemoryCommandRecorder of the device.
+class TestFrame
+{
+public:
+    TestFrame() : graph(&device)
+    {
+        VkExtent3D extent = {64, 64, 1};
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        graph.create_transient_image(&gbufferImage, TEST_FORMAT_COLOR,
+                                     VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | usage, extent);
+        graph.create_transient_image(&depthImage, VK_FORMAT_D32_SFLOAT,
+                                     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                         VK_IMAGE_USAGE_SAMPLED_BIT,
+                                     extent);
+        graph.create_transient_image(&unusedImage, TEST_FORMAT_HDR, usage, extent);
+        graph.create_transient_image(&lightingImage, TEST_FORMAT_HDR, usage, extent);
+        graph.create_transient_image(&blurImage, TEST_FORMAT_HDR, usage, extent);
+        swapchainImage = device.create_image(TEST_FORMAT_COLOR,
+                                             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, extent);
+        statsBuffer = device.create_buffer(256, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                           VMA_MEMORY_USAGE_GPU_ONLY);
+
+        ImageView view = {.sampler = Sampler::NEAREST, .baseMipLevel = 0, .mipLevelCount = 1};
+        gbuffer = graph.register_image_view(&gbufferImage, view, "GBuffer");
+        depth = graph.register_image_view(&depthImage, view, "Depth");
+        unused = graph.register_image_view(&unusedImage, view, "Unused");
+        lighting = graph.register_image_view(&lightingImage, view, "Lighting");
+        blur = graph.register_image_view(&blurImage, view, "Blur");
+        swapchain = graph.register_image_view(&swapchainImage, view, "Swapchain");
+        stats = graph.register_storage_buffer(&statsBuffer, "Stats");
+    }
+
+    ~TestFrame()
+    {
+        graph.destroy();
+    }
+
+    void record()
+    {
+        VkClearValue clearValue = {};
+        auto draw = [this](VkCommandBuffer cmd) {
+            graph.get_recorder()->draw(cmd, 3, 1, 0, 0);
+        };
+
+        graph.add_render_pass({.name = "GBuffer",
+                               .pipelineType = PipelineType::RASTER_TYPE,
+                               .rasterPipeline = {.vertexShader = "gbuffer.vert",
+                                                  .fragmentShader = "gbuffer.frag",
+                                                  .size = {64, 64},
+                                                  .colorOutputs = {{gbuffer, clearValue}},
+                                                  .depthOutput = {depth, clearValue}},
+                               .execute = draw});
+        graph.add_render_pass({.name = "Unused",
+                               .pipelineType = PipelineType::COMPUTE_TYPE,
+                               .computePipeline = {"unused.comp", 8, 8, 1},
+                               .writes = {{0, unused}},
+                               .reads = {{0, gbuffer}}});
+        graph.add_render_pass({.name = "Lighting",
+                               .pipelineType = PipelineType::COMPUTE_TYPE,
+                               .computePipeline = {"lighting.comp", 8, 8, 1},
+                               .writes = {{0, lighting}, {0, stats}},
+                               .reads = {{0, gbuffer}, {0, depth}}});
+        graph.add_render_pass({.name = "Blur",
+                               .pipelineType = PipelineType::COMPUTE_TYPE,
+                               .computePipeline = {"blur.comp", 8, 8, 1},
+                               .writes = {{0, blur}},
+                               .reads = {{0, lighting}}});
+        graph.add_render_pass(
+            {.name = "Present",
+             .pipelineType = PipelineType::RASTER_TYPE,
+             .rasterPipeline = {.vertexShader = "fullscreen.vert",
+                                .fragmentShader = "present.frag",
+                                .size = {64, 64},
+                                .depthState = {false, false, VK_COMPARE_OP_NEVER},
+                                .colorOutputs = {{swapchain, clearValue, true}}},
+             .reads = {{0, blur}, {0, stats}},
+             .execute = draw});
+
+        graph.execute(VK_NULL_HANDLE);
+    }
+
+    NullRenderDevice device;
+    RenderGraph graph;
+
+    AllocatedImage gbufferImage, depthImage, unusedImage, lightingImage, blurImage;
+    AllocatedImage swapchainImage;
+    AllocatedBuffer statsBuffer;
+    Handle<Bindable> gbuffer, depth, unused, lighting, blur, swapchain, stats;
+};
+
+static std::vector<RecordedCommandType> command_types(const MemoryCommandRecorder& recorder)
+{
+    std::vector<RecordedCommandType> types;
+    for (const RecordedCommand& command : recorder.commands)
+    {
+        types.push_back(command.type);
+    }
+    return types;
+}
+
+static std::vector<const RecordedCommand*> barrier_commands(
+    const MemoryCommandRecorder& recorder)
+{
+    std::vector<const RecordedCommand*> barriers;
+    for (const RecordedCommand& command : recorder.commands)
+    {
+        if (command.type == RecordedCommandType::PIPELINE_BARRIER)
+        {
+            barriers.push_back(&command);
+        }
+    }
+    return barriers;
+}
+
+static void test_records_kept_passes()
+{
+    TestFrame frame;
+    frame.record();
+    const MemoryCommandRecorder& recorder = frame.device.recorder;
+
+    std::vector<std::string> passNames;
+    for (const RecordedCommand& command : recorder.commands)
+    {
+        if (command.type == RecordedCommandType::BEGIN_PASS)
+        {
+            passNames.push_back(recorder.names[command.offset]);
+        }
+    }
+    CHECK(passNames == std::vector<std::string>({"GBuffer", "Lighting", "Blur", "Present"}));
+
+    using T = RecordedCommandType;
+    std::vector<RecordedCommandType> expected = {
+        // GBuffer
+        T::BEGIN_PASS, T::PIPELINE_BARRIER, T::BIND_PIPELINE, T::BIND_DESCRIPTOR_SETS,
+        T::SET_VIEWPORT_SCISSOR, T::BEGIN_RENDERING, T::DRAW, T::END_RENDERING, T::END_PASS,
+        // Lighting and Blur
+        T::BEGIN_PASS, T::PIPELINE_BARRIER, T::BIND_PIPELINE, T::BIND_DESCRIPTOR_SETS,
+        T::DISPATCH, T::END_PASS, T::BEGIN_PASS, T::PIPELINE_BARRIER, T::BIND_PIPELINE,
+        T::BIND_DESCRIPTOR_SETS, T::DISPATCH, T::END_PASS,
+        // Present, with the transition to the present layout after rendering
+        T::BEGIN_PASS, T::PIPELINE_BARRIER, T::BIND_PIPELINE, T::BIND_DESCRIPTOR_SETS,
+        T::SET_VIEWPORT_SCISSOR, T::BEGIN_RENDERING, T::DRAW, T::END_RENDERING,
+        T::PIPELINE_BARRIER, T::END_PASS};
+    CHECK(command_types(recorder) == expected);
+
+    // GBuffer has a depth attachment, Present only the swapchain
+    for (const RecordedCommand& command : recorder.commands)
+    {
+        if (command.type == RecordedCommandType::BEGIN_RENDERING)
+        {
+            CHECK(command.args[0] == 1 && command.args[2] == 64 && command.args[3] == 64);
+        }
+    }
+    CHECK(recorder.commands[5].args[1] == 1);
+    CHECK(recorder.commands[26].args[1] == 0);
+}
+
+static void test_batches_barriers_per_pass()
+{
+    TestFrame frame;
+    frame.record();
+    const MemoryCommandRecorder& recorder = frame.device.recorder;
+
+    // One barrier command per pass: GBuffer clears both attachments, Lighting waits for them
+    // and starts its outputs, Blur waits for Lighting, Present waits for Blur and Stats
+    std::vector<const RecordedCommand*> barriers = barrier_commands(recorder);
+    CHECK(barriers.size() == 5);
+    std::vector<uint32_t> imageCounts;
+    std::vector<uint32_t> bufferCounts;
+    for (const RecordedCommand* command : barriers)
+    {
+        imageCounts.push_back(command->args[0]);
+        bufferCounts.push_back(command->args[1]);
+    }
+    CHECK(imageCounts == std::vector<uint32_t>({2, 3, 2, 2, 1}));
+    CHECK(bufferCounts == std::vector<uint32_t>({0, 0, 0, 1, 0}));
+
+    // Lighting reads the depth attachment through its depth aspect
+    const VkImageMemoryBarrier2* lightingBarriers =
+        recorder.imageBarriers.data() + barriers[1]->offset;
+    bool isDepthRead = false;
+    for (uint32_t i = 0; i < barriers[1]->args[0]; i++)
+    {
+        if (lightingBarriers[i].image == frame.depthImage._image)
+        {
+            isDepthRead =
+                lightingBarriers[i].oldLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL &&
+                lightingBarriers[i].newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL &&
+                lightingBarriers[i].subresourceRange.aspectMask == VK_IMAGE_ASPECT_DEPTH_BIT;
+        }
+    }
+    CHECK(isDepthRead);
+
+    // The stats buffer written by a compute shader is read by the fragment shader of Present
+    CHECK(recorder.bufferBarriers.size() == 1);
+    CHECK(recorder.bufferBarriers[0].buffer == frame.statsBuffer._buffer);
+    CHECK(recorder.bufferBarriers[0].srcStageMask == VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    CHECK(recorder.bufferBarriers[0].dstStageMask == VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+
+    // The swapchain is handed to presentation once Present is done
+    const VkImageMemoryBarrier2& present = recorder.imageBarriers[barriers[4]->offset];
+    CHECK(present.image == frame.swapchainImage._image);
+    CHECK(present.oldLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    CHECK(present.newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+}
+
+static void test_culls_unread_passes()
+{
+    TestFrame frame;
+    frame.record();
+
+    // Unused is neither recorded nor given a pipeline or descriptor set
+    CHECK(frame.device.pipelineCount == 4);
+    CHECK(frame.device.descriptorSetCount == 3);
+    for (const VkImageMemoryBarrier2& barrier : frame.device.recorder.imageBarriers)
+    {
+        CHECK(barrier.image != frame.unusedImage._image);
+    }
+}
+
+static void test_records_frames_again()
+{
+    TestFrame frame;
+    frame.record();
+    std::vector<RecordedCommandType> firstFrame = command_types(frame.device.recorder);
+    uint32_t pipelineCount = frame.device.pipelineCount;
+    uint32_t descriptorSetCount = frame.device.descriptorSetCount;
+    uint32_t imageViewCount = frame.device.imageViewCount;
+
+    // The second frame finds everything in the caches of the graph and keeps the memory plan
+    frame.device.recorder.clear();
+    frame.record();
+
+    CHECK(command_types(frame.device.recorder) == firstFrame);
+    CHECK(frame.device.pipelineCount == pipelineCount);
+    CHECK(frame.device.descriptorSetCount == descriptorSetCount);
+    CHECK(frame.device.imageViewCount == imageViewCount);
+}
+
+int main()
+{
+    RUN_TEST(test_records_kept_passes);
+    RUN_TEST(test_batches_barriers_per_pass);
+    RUN_TEST(test_culls_unread_passes);
+    RUN_TEST(test_records_frames_again);
+    return testFailures;
+}
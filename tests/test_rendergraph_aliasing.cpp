@@ -0,0 +1,87 @@
+#include "test.h"
+#include <vk_rendergraph_aliasing.h>
+
+#include <vector>
+
+using namespace Vrg;
+
+// RenderGraph::update_transient_memory gives history images the whole frame and beyond
+static const uint32_t HISTORY_FIRST_USE = 0;
+static const uint32_t HISTORY_LAST_USE = UINT32_MAX;
+
+static TransientResource resource(uint64_t size, uint32_t first, uint32_t last,
+                                  uint32_t memoryTypeBits = 0x3)
+{
+    return {size, 256, memoryTypeBits, first, last};
+}
+
+static void test_disjoint_lifetimes_share_a_block()
+{
+    std::vector<TransientResource> resources = {
+        resource(1024, 0, 1),
+        resource(4096, 2, 3),
+        resource(2048, 4, 4),
+    };
+    AliasingPlanner planner;
+    planner.plan(Slice(resources));
+
+    CHECK(planner.blocks.size() == 1);
+    CHECK(planner.placements == std::vector<uint32_t>({0, 0, 0}));
+    CHECK(planner.blocks[0].resourceCount == 3);
+    // The block grows to the largest of them
+    CHECK(planner.blocks[0].size == 4096);
+    CHECK(planner.unaliasedSize == 1024 + 4096 + 2048);
+    CHECK(planner.aliasedSize == 4096);
+}
+
+static void test_overlapping_lifetimes_get_separate_blocks()
+{
+    std::vector<TransientResource> resources = {
+        resource(1024, 0, 2),
+        resource(1024, 1, 3),
+        // Starts in the last pass of the first one, both are in use during it
+        resource(1024, 2, 2),
+        // Disjoint, but no common memory type
+        resource(1024, 4, 4, 0x4),
+    };
+    AliasingPlanner planner;
+    planner.plan(Slice(resources));
+
+    CHECK(planner.blocks.size() == 4);
+    CHECK(planner.placements[0] != planner.placements[1]);
+    CHECK(planner.placements[0] != planner.placements[2]);
+    CHECK(planner.placements[1] != planner.placements[2]);
+    CHECK(planner.placements[3] != planner.placements[0]);
+    CHECK(planner.aliasedSize == planner.unaliasedSize);
+}
+
+static void test_history_is_never_aliased()
+{
+    std::vector<TransientResource> resources = {
+        resource(1024, 0, 0),
+        resource(1024, HISTORY_FIRST_USE, HISTORY_LAST_USE),
+        resource(1024, 1, 1),
+        resource(1024, 2, 2),
+        resource(2048, HISTORY_FIRST_USE, HISTORY_LAST_USE),
+    };
+    AliasingPlanner planner;
+    planner.plan(Slice(resources));
+
+    uint32_t history = planner.placements[1];
+    uint32_t largerHistory = planner.placements[4];
+    CHECK(planner.blocks[history].resourceCount == 1);
+    CHECK(planner.blocks[largerHistory].resourceCount == 1);
+    CHECK(history != largerHistory);
+    // The others still share their block
+    CHECK(planner.placements[0] == planner.placements[2]);
+    CHECK(planner.placements[0] == planner.placements[3]);
+    CHECK(planner.blocks.size() == 3);
+}
+
+int main()
+{
+    RUN_TEST(test_disjoint_lifetimes_share_a_block);
+    RUN_TEST(test_overlapping_lifetimes_get_separate_blocks);
+    RUN_TEST(test_history_is_never_aliased);
+    return testFailures;
+}
@@ -0,0 +1,147 @@
+#include "test.h"
+#include <vk_rendergraph_barriers.h>
+
+#include <vector>
+
+using namespace Vrg;
+
+static VkImage test_image(uintptr_t id)
+{
+    return (VkImage)id;
+}
+
+static VkBuffer test_buffer(uintptr_t id)
+{
+    return (VkBuffer)id;
+}
+
+static VkImageMemoryBarrier2 image_barrier(
+    VkImage image, uint32_t mip, VkImageLayout newLayout,
+    VkAccessFlags2 dstAccess = VK_ACCESS_2_SHADER_READ_BIT)
+{
+    return {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+            .dstAccessMask = dstAccess,
+            .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .newLayout = newLayout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 1, 0, 1}};
+}
+
+static VkBufferMemoryBarrier2 buffer_barrier(VkBuffer buffer, VkPipelineStageFlags2 dstStage,
+                                             VkAccessFlags2 dstAccess)
+{
+    return {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT,
+            .dstStageMask = dstStage,
+            .dstAccessMask = dstAccess,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE};
+}
+
+static void test_merges_neighbouring_mips()
+{
+    BarrierBatch batch;
+    std::vector<VkImageMemoryBarrier2> plannedImages;
+    std::vector<VkBufferMemoryBarrier2> plannedBuffers;
+
+    // Mips 0-2 of image 1 become one range, mip 4 is not next to them
+    for (uint32_t mip : {0, 1, 2, 4})
+    {
+        batch.queue_image_barrier(
+            image_barrier(test_image(1), mip, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+    }
+    // Same mip as image 1, another image
+    batch.queue_image_barrier(
+        image_barrier(test_image(2), 3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+    // Next to mip 3 of image 2 but into another layout
+    batch.queue_image_barrier(image_barrier(test_image(2), 4, VK_IMAGE_LAYOUT_GENERAL));
+    BarrierRange range = batch.plan(plannedImages, plannedBuffers);
+
+    CHECK(range.imageOffset == 0 && range.imageCount == 4);
+    CHECK(range.bufferCount == 0);
+    CHECK(plannedImages.size() == 4);
+    CHECK(plannedImages[0].image == test_image(1));
+    CHECK(plannedImages[0].subresourceRange.baseMipLevel == 0);
+    CHECK(plannedImages[0].subresourceRange.levelCount == 3);
+    CHECK(plannedImages[1].subresourceRange.baseMipLevel == 4);
+    CHECK(plannedImages[1].subresourceRange.levelCount == 1);
+    CHECK(plannedImages[2].image == test_image(2));
+    CHECK(plannedImages[2].subresourceRange.levelCount == 1);
+    CHECK(plannedImages[3].newLayout == VK_IMAGE_LAYOUT_GENERAL);
+    CHECK(batch.imageBarriers.empty() && batch.bufferBarriers.empty());
+}
+
+static void test_merges_repeated_uses()
+{
+    BarrierBatch batch;
+    std::vector<VkImageMemoryBarrier2> plannedImages;
+    std::vector<VkBufferMemoryBarrier2> plannedBuffers;
+
+    // A subresource used twice ends in the layout of its last use and waits for both
+    batch.queue_image_barrier(image_barrier(test_image(1), 0,
+                                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                            VK_ACCESS_2_SHADER_READ_BIT));
+    batch.queue_image_barrier(image_barrier(test_image(1), 0, VK_IMAGE_LAYOUT_GENERAL,
+                                            VK_ACCESS_2_SHADER_WRITE_BIT));
+    batch.queue_buffer_barrier(buffer_barrier(
+        test_buffer(1), VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT));
+    batch.queue_buffer_barrier(buffer_barrier(test_buffer(1),
+                                              VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                                              VK_ACCESS_2_SHADER_READ_BIT));
+    batch.queue_buffer_barrier(buffer_barrier(
+        test_buffer(2), VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT));
+    BarrierRange range = batch.plan(plannedImages, plannedBuffers);
+
+    CHECK(range.imageCount == 1);
+    CHECK(plannedImages[0].newLayout == VK_IMAGE_LAYOUT_GENERAL);
+    CHECK(plannedImages[0].dstAccessMask ==
+          (VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT));
+    CHECK(range.bufferOffset == 0 && range.bufferCount == 2);
+    CHECK(plannedBuffers[0].buffer == test_buffer(1));
+    CHECK(plannedBuffers[0].dstStageMask == (VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT |
+                                             VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT));
+    CHECK(plannedBuffers[1].buffer == test_buffer(2));
+}
+
+static void test_plans_passes_one_after_another()
+{
+    BarrierBatch batch;
+    std::vector<VkImageMemoryBarrier2> plannedImages;
+    std::vector<VkBufferMemoryBarrier2> plannedBuffers;
+
+    batch.queue_image_barrier(image_barrier(test_image(1), 0, VK_IMAGE_LAYOUT_GENERAL));
+    batch.queue_buffer_barrier(buffer_barrier(
+        test_buffer(1), VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT));
+    BarrierRange first = batch.plan(plannedImages, plannedBuffers);
+
+    BarrierRange empty = batch.plan(plannedImages, plannedBuffers);
+
+    batch.queue_image_barrier(image_barrier(test_image(2), 0, VK_IMAGE_LAYOUT_GENERAL));
+    batch.queue_image_barrier(image_barrier(test_image(3), 0, VK_IMAGE_LAYOUT_GENERAL));
+    BarrierRange second = batch.plan(plannedImages, plannedBuffers);
+
+    CHECK(first.imageOffset == 0 && first.imageCount == 1);
+    CHECK(first.bufferOffset == 0 && first.bufferCount == 1);
+    CHECK(empty.imageCount == 0 && empty.bufferCount == 0);
+    CHECK(second.imageOffset == 1 && second.imageCount == 2);
+    CHECK(second.bufferOffset == 1 && second.bufferCount == 0);
+    CHECK(plannedImages.size() == 3 && plannedBuffers.size() == 1);
+    CHECK(plannedImages[second.imageOffset].image == test_image(2));
+}
+
+int main()
+{
+    RUN_TEST(test_merges_neighbouring_mips);
+    RUN_TEST(test_merges_repeated_uses);
+    RUN_TEST(test_plans_passes_one_after_another);
+    return testFailures;
+}
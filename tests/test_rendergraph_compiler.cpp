@@ -0,0 +1,133 @@
+#include "test.h"
+#include <vk_rendergraph_compiler.h>
+
+#include <vector>
+
+using namespace Vrg;
+
+// A frame of passes and their accesses, the compiler sees them through slices
+struct TestGraph
+{
+    void add_pass(std::vector<PassAccess> accesses, bool keep = false)
+    {
+        passAccesses.push_back(accesses);
+        passKeeps.push_back(keep);
+    }
+
+    void compile()
+    {
+        passes.clear();
+        for (size_t i = 0; i < passAccesses.size(); i++)
+        {
+            passes.push_back({Slice(passAccesses[i]), passKeeps[i]});
+        }
+        compiler.compile(Slice(passes));
+    }
+
+    // Kept passes passOrder[position] waits for, as positions in passOrder
+    std::vector<uint32_t> dependencies(uint32_t position) const
+    {
+        return std::vector<uint32_t>(
+            compiler.dependencies.begin() + compiler.dependencyOffsets[position],
+            compiler.dependencies.begin() + compiler.dependencyOffsets[position + 1]);
+    }
+
+    std::vector<std::vector<PassAccess>> passAccesses;
+    std::vector<bool> passKeeps;
+    std::vector<PassInfo> passes;
+    GraphCompiler compiler;
+};
+
+static PassAccess read(uint64_t resource)
+{
+    return {resource, false};
+}
+
+static PassAccess write(uint64_t resource)
+{
+    return {resource, true};
+}
+
+static void test_culls_unused_passes()
+{
+    TestGraph graph;
+    graph.add_pass({write(1)});                // 0: nothing reads 1
+    graph.add_pass({write(2)});                // 1: read by the kept pass 4
+    graph.add_pass({write(3)});                // 2: only read by the culled pass 3
+    graph.add_pass({read(3), write(4)});       // 3: nothing reads 4
+    graph.add_pass({read(2), write(5)}, true); // 4: side effects
+    graph.add_pass({read(5)});                 // 5: no outputs, kept
+    graph.compile();
+
+    CHECK(graph.compiler.culledPassCount == 3);
+    CHECK(graph.compiler.passOrder == std::vector<uint32_t>({1, 4, 5}));
+
+    ResourceLifetime unused = graph.compiler.get_lifetime(4);
+    CHECK(unused.first > unused.last);
+    ResourceLifetime used = graph.compiler.get_lifetime(2);
+    CHECK(used.first == 0 && used.last == 1 && !used.isHistory);
+}
+
+static void test_keeps_history()
+{
+    TestGraph graph;
+    graph.add_pass({read(1), write(2)}); // 0: reads last frame's 1
+    graph.add_pass({read(2), write(1)}); // 1: writes 1 for the next frame only
+    graph.add_pass({read(2)}, true);     // 2
+    graph.add_pass({write(3)});          // 3: 3 is not history, nothing reads it
+    graph.compile();
+
+    CHECK(graph.compiler.passOrder == std::vector<uint32_t>({0, 1, 2}));
+
+    ResourceLifetime history = graph.compiler.get_lifetime(1);
+    CHECK(history.isHistory);
+    CHECK(history.first == 0 && history.last == 2);
+    ResourceLifetime current = graph.compiler.get_lifetime(2);
+    CHECK(!current.isHistory);
+    CHECK(current.first == 0 && current.last == 2);
+    CHECK(!graph.compiler.get_lifetime(3).isHistory);
+}
+
+static void test_read_modify_write_is_history()
+{
+    TestGraph graph;
+    graph.add_pass({write(1)});                    // 0
+    graph.add_pass({read(1), read(2), write(2)});  // 1: blends into the 2 of the last frame
+    graph.add_pass({read(1), write(3), write(4)}); // 2: writes 3 and 4 over, nothing reads
+    graph.compile();
+
+    // Nothing reads 2 in the frame, it is kept for the next one
+    CHECK(graph.compiler.passOrder == std::vector<uint32_t>({0, 1}));
+    ResourceLifetime blended = graph.compiler.get_lifetime(2);
+    CHECK(blended.isHistory);
+    CHECK(blended.first == 0 && blended.last == 1);
+}
+
+static void test_dependency_edges()
+{
+    TestGraph graph;
+    graph.add_pass({write(1)});                        // 0
+    graph.add_pass({read(1), write(2)});               // 1: read after write on 0
+    graph.add_pass({read(1), write(3)});               // 2: read after write on 0
+    graph.add_pass({write(1)});                        // 3: waits for the reads of 1 and 2
+    graph.add_pass({read(1), read(2), read(3)}, true); // 4
+    graph.add_pass({read(4), write(4)}, true);         // 5: reads and writes 4 itself
+    graph.compile();
+
+    CHECK(graph.compiler.culledPassCount == 0);
+    CHECK(graph.dependencies(0).empty());
+    CHECK(graph.dependencies(1) == std::vector<uint32_t>({0}));
+    CHECK(graph.dependencies(2) == std::vector<uint32_t>({0}));
+    CHECK(graph.dependencies(3) == std::vector<uint32_t>({0, 1, 2}));
+    CHECK(graph.dependencies(4) == std::vector<uint32_t>({1, 2, 3}));
+    CHECK(graph.dependencies(5).empty());
+}
+
+int main()
+{
+    RUN_TEST(test_culls_unused_passes);
+    RUN_TEST(test_keeps_history);
+    RUN_TEST(test_read_modify_write_is_history);
+    RUN_TEST(test_dependency_edges);
+    return testFailures;
+}
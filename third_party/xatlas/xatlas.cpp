@@ -3131,7 +3131,7 @@ public:
 	{
 		m_threadIndex = 0;
 		// Max with current task scheduler usage is 1 per thread + 1 deep nesting, but allow for some slop.
-		m_maxGroups = std::thread::hardware_concurrency() * 4;
+		m_maxGroups = max(2u, std::thread::hardware_concurrency()) * 4;
 		m_groups = XA_ALLOC_ARRAY(MemTag::Default, TaskGroup, m_maxGroups);
 		for (uint32_t i = 0; i < m_maxGroups; i++) {
 			new (&m_groups[i]) TaskGroup();
@@ -3168,7 +3168,7 @@ public:
 
 	uint32_t threadCount() const
 	{
-		return max(1u, std::thread::hardware_concurrency()); // Including the main thread.
+		return max(2u, std::thread::hardware_concurrency()); // Including the main thread. At least one worker is always created.
 	}
 
 	// userData is passed to Task::func as groupUserData.
@@ -3424,7 +3424,7 @@ public:
 	ThreadLocal()
 	{
 #if XA_MULTITHREADED
-		const uint32_t n = std::thread::hardware_concurrency();
+		const uint32_t n = max(2u, std::thread::hardware_concurrency()); // Match TaskScheduler::threadCount
 #else
 		const uint32_t n = 1;
 #endif
@@ -3436,7 +3436,7 @@ public:
 	~ThreadLocal()
 	{
 #if XA_MULTITHREADED
-		const uint32_t n = std::thread::hardware_concurrency();
+		const uint32_t n = max(2u, std::thread::hardware_concurrency()); // Match TaskScheduler::threadCount
 #else
 		const uint32_t n = 1;
 #endif